@@ -0,0 +1,1598 @@
+/* kasama_bench.c
+ *
+ * ------------------------------------------------------------
+ *
+ * Headless micro-benchmarks for the hot paths of kasama_emulator.c. The
+ * client is compiled into this file (with its main() disabled), so every
+ * benchmark drives the exact static functions the client uses. Nothing here
+ * needs a compositor or a display: the protocol benchmark forks the mock
+ * compositor from kasama_mock_compositor.c and talks to it over a real
+ * socket.
+ *
+ * Compile / run (example):
+ *   gcc -std=c11 -O2 -o kasama_bench kasama_bench.c
+ *   ./kasama_bench pixels
+ *
+ * Each benchmark is a subcommand; run without arguments for the list.
+ *
+ * kasama_replay.c includes this file with KASAMA_BENCH_NO_MAIN defined, for
+ * its stream generators and mock compositor helpers.
+ */
+
+#define KASAMA_NO_MAIN
+#include "kasama_emulator.c"
+#define KASAMA_MOCK_NO_MAIN
+#include "kasama_mock_compositor.c"
+
+#include <signal.h>
+#include <stdarg.h>
+#include <sys/syscall.h>
+
+/* Minimum wall time spent on each measurement */
+#define BENCH_MIN_NS 200000000ULL
+
+typedef struct bench_size_t bench_size_t;
+
+struct bench_size_t {
+  const char *name;
+  uint32_t width;
+  uint32_t height;
+};
+
+static const bench_size_t bench_sizes[] = {
+  {"640x480", 640, 480},
+  {"1080p", 1920, 1080},
+  {"4k", 3840, 2160},
+  {"5k", 5120, 2880},
+};
+
+/* Keep the compiler from discarding stores nothing reads */
+static void bench_clobber(void *p) {
+  __asm__ volatile("" : : "r"(p) : "memory");
+}
+
+static int bench_compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* p-th percentile (0-100) of n samples; sorts them in place */
+static double bench_percentile_us(uint64_t *samples, uint64_t n, uint32_t p) {
+  qsort(samples, n, sizeof(*samples), bench_compare_u64);
+  return (double)samples[(n - 1) * p / 100] / 1e3;
+}
+
+/* ------------------- Pixel kernels --------------------------------------- */
+
+typedef enum bench_pixel_op_t {
+  BENCH_CLEAR,        // renderer_clear of the whole frame (streaming stores)
+  BENCH_FILL,         // the same clear through the cached fill kernel
+  BENCH_RECT,         // clipped rect covering the middle of the frame
+  BENCH_BLEND,        // alpha-blended rect of the same size
+} bench_pixel_op_t;
+
+static const char *bench_pixel_op_names[] = {"clear", "fill", "rect", "blend"};
+
+/* Clip a rect to dst_w x dst_h; returns false if nothing is left */
+static bool bench_rect_clip(uint64_t dst_w, uint64_t dst_h,
+                            uint64_t *rect_x, uint64_t *rect_y,
+                            uint64_t *rect_w, uint64_t *rect_h) {
+  if (*rect_x >= dst_w || *rect_y >= dst_h || *rect_w == 0 || *rect_h == 0)
+    return false;
+  if (*rect_w > dst_w - *rect_x)
+    *rect_w = dst_w - *rect_x;
+  if (*rect_h > dst_h - *rect_y)
+    *rect_h = dst_h - *rect_y;
+  return true;
+}
+
+/* Draw a filled rectangle in the framebuffer
+ * - dst_stride: row pitch in pixels
+ * The rect is clipped to dst_w x dst_h; the clipped part is added to damage.
+ */
+static void bench_draw_rect(uint32_t *dst, uint64_t dst_w,
+                            uint64_t dst_h, uint32_t dst_stride,
+                            uint64_t rect_x, uint64_t rect_y,
+                            uint64_t rect_w, uint64_t rect_h,
+                            uint32_t color_rgb, damage_t *damage) {
+  if (!bench_rect_clip(dst_w, dst_h, &rect_x, &rect_y, &rect_w, &rect_h))
+    return;
+
+  for (uint64_t y = rect_y; y < rect_y + rect_h; y++)
+    pixel_kernels->fill(dst + y * dst_stride + rect_x, rect_w, color_rgb);
+
+  damage_add(damage, (rect_t){.x = (uint32_t)rect_x, .y = (uint32_t)rect_y,
+                              .w = (uint32_t)rect_w, .h = (uint32_t)rect_h});
+}
+
+/* Blend a translucent rectangle over the framebuffer; alpha is the top byte
+ * of color_argb. Same clipping and damage rules as bench_draw_rect. */
+static void bench_blend_rect(uint32_t *dst, uint64_t dst_w,
+                             uint64_t dst_h, uint32_t dst_stride,
+                             uint64_t rect_x, uint64_t rect_y,
+                             uint64_t rect_w, uint64_t rect_h,
+                             uint32_t color_argb, damage_t *damage) {
+  if (!bench_rect_clip(dst_w, dst_h, &rect_x, &rect_y, &rect_w, &rect_h))
+    return;
+
+  for (uint64_t y = rect_y; y < rect_y + rect_h; y++)
+    pixel_kernels->blend(dst + y * dst_stride + rect_x, rect_w, color_argb);
+
+  damage_add(damage, (rect_t){.x = (uint32_t)rect_x, .y = (uint32_t)rect_y,
+                              .w = (uint32_t)rect_w, .h = (uint32_t)rect_h});
+}
+
+/* Run one op repeatedly for BENCH_MIN_NS and return GB/s of pixels written */
+static double bench_pixel_op(bench_pixel_op_t op, uint32_t *pixels, uint32_t width, uint32_t height) {
+  damage_t damage = {0};
+  uint64_t rect_x = width / 8, rect_y = height / 8;
+  uint64_t rect_w = width - width / 4, rect_h = height - height / 4;
+  uint64_t bytes_per_op = op == BENCH_CLEAR || op == BENCH_FILL
+                            ? (uint64_t)width * height * sizeof(*pixels)
+                            : rect_w * rect_h * sizeof(*pixels);
+
+  uint64_t iterations = 0, start = monotonic_ns(), elapsed;
+  do {
+    switch (op) {
+    case BENCH_CLEAR:
+      renderer_clear(pixels, width, height, 0x00202020, &damage);
+      break;
+    case BENCH_FILL:
+      pixel_kernels->fill(pixels, (uint64_t)width * height, 0x00202020);
+      break;
+    case BENCH_RECT:
+      bench_draw_rect(pixels, width, height, width, rect_x, rect_y, rect_w, rect_h,
+                      0x000000ff, &damage);
+      break;
+    case BENCH_BLEND:
+      bench_blend_rect(pixels, width, height, width, rect_x, rect_y, rect_w, rect_h,
+                       0x80ff0000, &damage);
+      break;
+    }
+    bench_clobber(pixels);
+    damage_reset(&damage);
+    iterations++;
+    elapsed = monotonic_ns() - start;
+  } while (elapsed < BENCH_MIN_NS);
+
+  return (double)(bytes_per_op * iterations) / (double)elapsed; // bytes/ns == GB/s
+}
+
+/* GB/s per kernel set, per op, per window size */
+static int bench_pixels(void) {
+  pixel_kernels_init();
+  const pixel_kernels_t *selected = pixel_kernels;
+
+  printf("%-8s %-6s", "kernels", "op");
+  for (uint64_t s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++)
+    printf(" %10s", bench_sizes[s].name);
+  printf("   (GB/s)\n");
+
+  for (uint32_t k = 0; k < pixel_kernels_available_len; k++) {
+    pixel_kernels = pixel_kernels_available[k];
+    for (uint32_t op = 0; op < sizeof(bench_pixel_op_names) / sizeof(bench_pixel_op_names[0]); op++) {
+      printf("%-8s %-6s", pixel_kernels->name, bench_pixel_op_names[op]);
+      for (uint64_t s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+        uint32_t width = bench_sizes[s].width, height = bench_sizes[s].height;
+        uint32_t *pixels = aligned_alloc(64, (uint64_t)width * height * sizeof(*pixels));
+        if (!pixels)
+          return 1;
+        memset(pixels, 0, (uint64_t)width * height * sizeof(*pixels)); // fault pages in
+        printf(" %10.2f", bench_pixel_op(op, pixels, width, height));
+        fflush(stdout);
+        free(pixels);
+      }
+      printf("\n");
+    }
+  }
+
+  pixel_kernels = selected;
+  printf("selected: %s\n", selected->name);
+  return 0;
+}
+
+/* ------------------- Text rendering -------------------------------------- */
+
+/* Small deterministic PRNG so every run draws the same screens */
+static uint32_t bench_rand_state = 0x9e3779b9;
+
+static uint32_t bench_rand(void) {
+  bench_rand_state ^= bench_rand_state << 13;
+  bench_rand_state ^= bench_rand_state >> 17;
+  bench_rand_state ^= bench_rand_state << 5;
+  return bench_rand_state;
+}
+
+/* Fill a cols x rows screen with source-code-like text: indented lines of
+ * words, some short, some blank. `colored` gives every word its own color,
+ * like syntax-highlighted compiler output. */
+static void bench_fill_screen(text_cell_t *cells, uint32_t cols, uint32_t rows, bool colored) {
+  static const uint32_t palette[] = {0xd0d0d0, 0x5fafff, 0xffaf5f, 0x87d787, 0xd75f87, 0xafafff};
+  const uint32_t fg = 0xd0d0d0, bg = 0x101010;
+
+  for (uint32_t row = 0; row < rows; row++) {
+    text_cell_t *line = cells + (uint64_t)row * cols;
+    uint32_t len = bench_rand() % 8 == 0 ? 0 : bench_rand() % cols;
+    uint32_t col = 0, color = fg;
+    for (uint32_t indent = (bench_rand() % 4) * 2; col < indent && col < len; col++)
+      line[col] = (text_cell_t){.codepoint = ' ', .fg = fg, .bg = bg};
+    while (col < len) {
+      if (colored)
+        color = palette[bench_rand() % (sizeof(palette) / sizeof(palette[0]))];
+      for (uint32_t word = 1 + bench_rand() % 9; word > 0 && col < len; word--, col++)
+        line[col] = (text_cell_t){.codepoint = 0x21 + bench_rand() % 94, .fg = color, .bg = bg};
+      if (col < len)
+        line[col++] = (text_cell_t){.codepoint = ' ', .fg = fg, .bg = bg};
+    }
+    for (; col < cols; col++)
+      line[col] = (text_cell_t){.codepoint = ' ', .fg = fg, .bg = bg};
+  }
+}
+
+/* Put a screen of cells on the terminal's grid */
+static void bench_term_load(term_t *term, const text_cell_t *cells) {
+  for (uint32_t y = 0; y < term->rows; y++) {
+    uint32_t row = term_ring_row(term, y);
+    term_cell_t *line = term_row_cells(term, row);
+    for (uint32_t x = 0; x < term->cols; x++) {
+      const text_cell_t *cell = &cells[(uint64_t)y * term->cols + x];
+      line[x] = (term_cell_t){.codepoint = cell->codepoint, .style = term_style_intern(&term->styles,
+                              (term_style_t){.fg = cell->fg, .bg = cell->bg, .flags = cell->style})};
+    }
+    term->ring_len[row] = term->cols;
+  }
+  term_mark_all(term);
+}
+
+/* Full-screen redraws per second, i.e. `cat` of a large file where every
+ * frame shows a screenful of new text */
+static int bench_text(void) {
+  pixel_kernels_init();
+
+  font_t font;
+  glyph_atlas_t atlas;
+  char *font_path = getenv("KASAMA_FONT");
+  if (font_path ? font_load_psf(&font, font_path) : font_load_embedded(&font)) {
+    fprintf(stderr, "can't load font %s: %s\n", font_path ? font_path : "(embedded)", strerror(errno));
+    return 1;
+  }
+  if (glyph_atlas_init(&atlas, &font) == -1)
+    return 1;
+  printf("font: %s, %ux%u cells\n", font_path ? font_path : "embedded 8x8", font.width, font.height);
+  printf("%-8s %-8s %8s %10s %10s\n", "size", "colors", "grid", "fps", "Mcells/s");
+
+  for (uint64_t s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+    uint32_t width = bench_sizes[s].width, height = bench_sizes[s].height;
+    uint32_t cols = width / atlas.cell_w, rows = height / atlas.cell_h;
+    uint32_t *pixels = aligned_alloc(64, (uint64_t)width * height * sizeof(*pixels));
+    text_cell_t *screens[4];
+    for (uint32_t i = 0; i < 4; i++)
+      screens[i] = malloc(sizeof(text_cell_t) * cols * rows);
+    if (!pixels || !screens[0] || !screens[1] || !screens[2] || !screens[3])
+      return 1;
+    memset(pixels, 0, (uint64_t)width * height * sizeof(*pixels));
+
+    for (uint32_t colored = 0; colored < 2; colored++) {
+      for (uint32_t i = 0; i < 4; i++)
+        bench_fill_screen(screens[i], cols, rows, colored);
+
+      damage_t damage = {0};
+      uint64_t frames = 0, start = monotonic_ns(), elapsed;
+      do {
+        const text_cell_t *screen = screens[frames % 4];
+        for (uint32_t row = 0; row < rows; row++)
+          text_draw_row(&atlas, pixels, width, height, width, 0, (uint64_t)row * atlas.cell_h,
+                        screen + (uint64_t)row * cols, cols, &damage);
+        bench_clobber(pixels);
+        damage_reset(&damage);
+        frames++;
+        elapsed = monotonic_ns() - start;
+      } while (elapsed < BENCH_MIN_NS);
+
+      double fps = (double)frames * 1e9 / (double)elapsed;
+      char grid[32];
+      snprintf(grid, sizeof(grid), "%ux%u", cols, rows);
+      printf("%-8s %-8s %8s %10.0f %10.1f\n", bench_sizes[s].name, colored ? "per-word" : "uniform",
+             grid, fps, fps * cols * rows / 1e6);
+    }
+
+    for (uint32_t i = 0; i < 4; i++)
+      free(screens[i]);
+    free(pixels);
+  }
+
+  printf("atlas: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " flushes\n",
+         atlas.stats.hits, atlas.stats.misses, atlas.stats.flushes);
+  glyph_atlas_free(&atlas);
+  font_free(&font);
+  return 0;
+}
+
+/* ------------------- Entities -------------------------------------------- */
+
+#define BENCH_ENTITY_FRAMES 200U
+#define BENCH_ENTITY_BUDGET_NS 16000000ULL /* a 60 Hz frame, with a little to spare */
+
+typedef enum bench_entity_stage_t {
+  BENCH_UPDATE,       // integrate positions
+  BENCH_CULL_BIN,     // cull against the window and bin into tiles
+  BENCH_DRAW,         // tiled draw of the visible rects
+  BENCH_DRAW_DIRECT,  // the same rects drawn straight, in entity order
+  BENCH_STAGES,
+} bench_entity_stage_t;
+
+static const char *bench_entity_stage_names[] = {"update", "cull+bin", "draw", "direct"};
+
+/* Fill every visible rect across the whole frame in entity order, the way
+ * the renderer drew before tiling; the comparison point for the tiled draw. */
+static void bench_draw_direct(entity_store_t *store, uint32_t *pixels, uint32_t background) {
+  pixel_kernels->fill(pixels, (uint64_t)store->view_w * store->view_h, background);
+  for (uint64_t k = 0; k < store->visible_len; k++) {
+    entity_rect_t r = store->rects[k];
+    for (uint32_t y = r.y0; y < r.y1; y++)
+      entity_fill_span(pixels + (uint64_t)y * store->view_w + r.x0, (uint32_t)(r.x1 - r.x0), r.color);
+  }
+}
+
+/* `count` square entities of 2-8 pixels at random in a world of twice the
+ * window's width and height, so about a quarter of them are visible */
+static int bench_entities_spawn(entity_store_t *store, uint64_t count, uint32_t width, uint32_t height) {
+  if (entity_store_init(store, count, 2.0f * (float)width, 2.0f * (float)height) == -1)
+    return -1;
+  uint32_t seed = 1;
+  for (uint64_t i = 0; i < count; i++) {
+    // xorshift: deterministic, and cheap enough not to matter
+    uint32_t r[5];
+    for (uint32_t k = 0; k < 5; k++) {
+      seed ^= seed << 13;
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      r[k] = seed;
+    }
+    uint32_t side = 2 + r[2] % 7;
+    entity_store_add(store, (float)(r[0] % (2 * width - side)), (float)(r[1] % (2 * height - side)),
+                     (float)(r[3] % 400) - 200.0f, (float)(r[4] % 400) - 200.0f, side, side,
+                     r[2] & 0xffffff);
+  }
+  return 0;
+}
+
+/* 1M entities of 2-8 pixels in a world four times the window's area, so
+ * about a quarter are visible. Per stage p50/p99 over BENCH_ENTITY_FRAMES
+ * frames, with a 16.7 ms frame as the budget. 10k and 100k are expected to
+ * fit it; 1M is reported but not expected to (see the README). */
+static int bench_entities(void) {
+  pixel_kernels_init();
+  entity_kernels_init();
+  static const uint64_t counts[] = {10000, 100000, 1000000};
+  const bench_size_t *size = &bench_sizes[1]; // 1080p
+  uint32_t width = size->width, height = size->height;
+  uint32_t *pixels = aligned_alloc(64, sizeof(*pixels) * width * height);
+  uint64_t *samples[BENCH_STAGES];
+  for (uint32_t s = 0; s < BENCH_STAGES; s++)
+    samples[s] = malloc(sizeof(*samples[s]) * BENCH_ENTITY_FRAMES);
+  if (!pixels || !samples[BENCH_STAGES - 1]) {
+    perror("alloc");
+    return 1;
+  }
+
+  printf("kernels: %s, window %s, %ux%u px tiles\n", entity_kernels->name, size->name,
+         ENTITY_TILE_SIZE, ENTITY_TILE_SIZE);
+  printf("%10s %10s", "entities", "visible");
+  for (uint32_t s = 0; s < BENCH_STAGES; s++)
+    printf(" %9s p50 %5s p99", bench_entity_stage_names[s], "");
+  printf(" %10s %7s\n", "frame p99", "16ms");
+
+  for (uint32_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    entity_store_t store;
+    if (bench_entities_spawn(&store, counts[c], width, height) == -1) {
+      perror("entity_store_init");
+      return 1;
+    }
+
+    uint64_t frame[BENCH_ENTITY_FRAMES];
+    damage_t damage = {0};
+    for (uint32_t f = 0; f < BENCH_ENTITY_FRAMES; f++) {
+      uint64_t t0 = monotonic_ns();
+      entity_store_update(&store, 1.0f / 60.0f);
+      uint64_t t1 = monotonic_ns();
+      if (entity_store_bin(&store, width, height) == -1) {
+        perror("entity_store_bin");
+        return 1;
+      }
+      uint64_t t2 = monotonic_ns();
+      damage_reset(&damage);
+      entity_store_draw(&store, pixels, 0xffffff, false, &damage);
+      uint64_t t3 = monotonic_ns();
+      bench_clobber(pixels);
+      bench_draw_direct(&store, pixels, 0xffffff);
+      uint64_t t4 = monotonic_ns();
+      bench_clobber(pixels);
+
+      samples[BENCH_UPDATE][f] = t1 - t0;
+      samples[BENCH_CULL_BIN][f] = t2 - t1;
+      samples[BENCH_DRAW][f] = t3 - t2;
+      samples[BENCH_DRAW_DIRECT][f] = t4 - t3;
+      frame[f] = t3 - t0;
+    }
+
+    printf("%10" PRIu64 " %10" PRIu64, counts[c], store.visible_len);
+    for (uint32_t s = 0; s < BENCH_STAGES; s++)
+      printf(" %11.2fms %9.2fms", bench_percentile_us(samples[s], BENCH_ENTITY_FRAMES, 50) / 1e3,
+             bench_percentile_us(samples[s], BENCH_ENTITY_FRAMES, 99) / 1e3);
+    double frame_p99 = bench_percentile_us(frame, BENCH_ENTITY_FRAMES, 99);
+    printf(" %8.2fms %7s\n", frame_p99 / 1e3, frame_p99 * 1e3 <= BENCH_ENTITY_BUDGET_NS ? "ok" : "MISSED");
+    entity_store_free(&store);
+  }
+
+  for (uint32_t s = 0; s < BENCH_STAGES; s++)
+    free(samples[s]);
+  free(pixels);
+  return 0;
+}
+
+/* ------------------- Render threads -------------------------------------- */
+
+#define BENCH_THREAD_FRAMES 100U
+
+typedef enum bench_phase_t {
+  BENCH_PHASE_CLEAR,     // the whole frame, in row bands
+  BENCH_PHASE_TEXT,      // every row of a full screen of text
+  BENCH_PHASE_ENTITIES,  // 1M entities, binned once, a job per tile row
+  BENCH_PHASES,
+} bench_phase_t;
+
+static const char *bench_phase_names[] = {"clear", "text", "entities"};
+
+/* FNV-1a over the frame, to check that every thread count draws the same */
+static uint64_t bench_frame_hash(const uint32_t *pixels, uint64_t count) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (uint64_t i = 0; i < count; i++)
+    hash = (hash ^ pixels[i]) * 0x100000001b3ULL;
+  return hash;
+}
+
+/* The phases of a parallel 4K frame with 1..N render threads, N the online
+ * CPUs or KASAMA_RENDER_THREADS. p50/p99 per phase over BENCH_THREAD_FRAMES
+ * frames and the p50 speedup over one thread. */
+static int bench_threads(void) {
+  pixel_kernels_init();
+  entity_kernels_init();
+  const bench_size_t *size = &bench_sizes[2]; // 4k
+  uint32_t width = size->width, height = size->height;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t max_threads = cpus > 0 ? (uint32_t)cpus : 1;
+  char *threads_env = getenv("KASAMA_RENDER_THREADS");
+  if (threads_env && strtoul(threads_env, NULL, 10) > 0)
+    max_threads = (uint32_t)strtoul(threads_env, NULL, 10);
+  max_threads = max_threads < RENDER_POOL_MAX_THREADS ? max_threads : RENDER_POOL_MAX_THREADS;
+
+  font_t font;
+  glyph_atlas_t atlas;
+  term_t term;
+  entity_store_t entities;
+  uint32_t *pixels = aligned_alloc(64, sizeof(*pixels) * width * height);
+  uint64_t *samples[BENCH_PHASES];
+  for (uint32_t p = 0; p < BENCH_PHASES; p++)
+    samples[p] = malloc(sizeof(*samples[p]) * BENCH_THREAD_FRAMES);
+  if (!pixels || !samples[BENCH_PHASES - 1] || font_load_embedded(&font) == -1 ||
+      glyph_atlas_init(&atlas, &font) == -1 ||
+      term_init(&term, width / atlas.cell_w, height / atlas.cell_h) == -1 ||
+      bench_entities_spawn(&entities, 1000000, width, height) == -1 ||
+      entity_store_bin(&entities, width, height) == -1) {
+    perror("setup");
+    return 1;
+  }
+  text_cell_t *screen = malloc(sizeof(*screen) * term.cols * term.rows);
+  if (!screen) {
+    perror("setup");
+    return 1;
+  }
+  bench_fill_screen(screen, term.cols, term.rows, true);
+  bench_term_load(&term, screen);
+  free(screen);
+  state_t clear_only = {.width = width, .height = height};
+
+  printf("window %s, %ux%u text grid, %" PRIu64 " of 1000000 entities visible, %ld CPUs\n",
+         size->name, term.cols, term.rows, entities.visible_len, cpus);
+  printf("%7s", "threads");
+  for (uint32_t p = 0; p < BENCH_PHASES; p++)
+    printf(" %8s p50 %5s p99 speedup", bench_phase_names[p], "");
+  printf(" %12s %s\n", "steals/frame", "pixels");
+
+  double base[BENCH_PHASES];
+  uint64_t base_hash = 0;
+  for (uint32_t threads = 1; threads <= max_threads; threads++) {
+    render_tiles_t tiles;
+    if (render_tiles_init(&tiles, threads) == -1) {
+      perror("render_tiles_init");
+      return 1;
+    }
+    damage_t damage = {0};
+    for (uint32_t f = 0; f < BENCH_THREAD_FRAMES; f++) {
+      uint64_t t0 = monotonic_ns();
+      render_tiles_draw(&tiles, &clear_only, pixels, TERM_DEFAULT_BG, true, &damage);
+      uint64_t t1 = monotonic_ns();
+      if (render_tiles_draw_text(&tiles, &term, &atlas, true, &damage) == -1) {
+        perror("render_tiles_draw_text");
+        return 1;
+      }
+      uint64_t t2 = monotonic_ns();
+      if (render_tiles_draw_entities(&tiles, &entities, false, &damage) == -1) {
+        perror("render_tiles_draw_entities");
+        return 1;
+      }
+      uint64_t t3 = monotonic_ns();
+      bench_clobber(pixels);
+      damage_reset(&damage);
+      samples[BENCH_PHASE_CLEAR][f] = t1 - t0;
+      samples[BENCH_PHASE_TEXT][f] = t2 - t1;
+      samples[BENCH_PHASE_ENTITIES][f] = t3 - t2;
+    }
+
+    uint64_t hash = bench_frame_hash(pixels, (uint64_t)width * height);
+    base_hash = threads == 1 ? hash : base_hash;
+    printf("%7u", threads);
+    for (uint32_t p = 0; p < BENCH_PHASES; p++) {
+      double p50 = bench_percentile_us(samples[p], BENCH_THREAD_FRAMES, 50);
+      base[p] = threads == 1 ? p50 : base[p];
+      printf(" %10.2fms %7.2fms %6.2fx", p50 / 1e3,
+             bench_percentile_us(samples[p], BENCH_THREAD_FRAMES, 99) / 1e3, base[p] / p50);
+    }
+    printf(" %12.1f %s\n", (double)atomic_load(&tiles.pool.steals) / BENCH_THREAD_FRAMES,
+           hash == base_hash ? "same" : "DIFFER");
+    render_tiles_free(&tiles);
+  }
+
+  for (uint32_t p = 0; p < BENCH_PHASES; p++)
+    free(samples[p]);
+  free(pixels);
+  entity_store_free(&entities);
+  term_free(&term);
+  glyph_atlas_free(&atlas);
+  font_free(&font);
+  return 0;
+}
+
+/* ------------------- Protocol -------------------------------------------- */
+
+#define BENCH_STARTUPS 20U
+#define BENCH_ROUNDTRIPS 1000U
+#define BENCH_ENTITIES 256U
+
+/* Run the mock compositor in a child process on $XDG_RUNTIME_DIR/name.
+ * The socket is listening before this returns, so clients can connect
+ * straight away. Returns the child's pid, or -1. */
+static pid_t bench_mock_spawn(const char *name, const mock_config_t *config) {
+  int listen_fd = mock_listen(name);
+  if (listen_fd == -1)
+    return -1;
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0)
+    _exit(mock_run(listen_fd, config, false) == -1 ? 1 : 0);
+  close(listen_fd);
+  return pid;
+}
+
+/* Point WAYLAND_DISPLAY at a socket name private to this process, for the
+ * mock to listen on. */
+static void bench_mock_display(char *name, size_t name_len) {
+  log_enabled = false;
+  if (!getenv("XDG_RUNTIME_DIR"))
+    setenv("XDG_RUNTIME_DIR", "/tmp", 1);
+  snprintf(name, name_len, "kasama-bench-%d", (int)getpid());
+  setenv("WAYLAND_DISPLAY", name, 1);
+}
+
+static void bench_mock_unlink(const char *name) {
+  char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  snprintf(path, sizeof(path), "%s/%s", getenv("XDG_RUNTIME_DIR"), name);
+  unlink(path);
+}
+
+/* Connect and get a configured window in one go, without kasama's font
+ * loading in between. */
+static int bench_client_startup(wayland_conn_t *conn, state_t *state) {
+  if (client_startup_begin(conn, state) == -1)
+    return -1;
+  return client_startup_finish(conn, state);
+}
+
+/* Send wl_display.sync and dispatch events until its callback is done. */
+static int bench_roundtrip(wayland_conn_t *conn, state_t *state) {
+  state->sync_callback = wayland_wl_display_sync(conn);
+  if (!state->sync_callback)
+    return -1;
+  while (state->sync_callback) {
+    if (swapchain_wait_event(conn, state) == -1)
+      return -1;
+  }
+  return 0;
+}
+
+/* Start a client and wait for its first frame to be done, like kasama
+ * showing its first frame. */
+static int bench_client_first_frame(wayland_conn_t *conn, state_t *state) {
+  if (bench_client_startup(conn, state) == -1)
+    return -1;
+  frame_mark_dirty(state);
+  frame_maybe_render(conn, state);
+  while (state->frame.callback) {
+    if (swapchain_wait_event(conn, state) == -1)
+      return -1;
+  }
+  return 0;
+}
+
+/* Startup latency, wl_display.sync round trips and paced frame throughput
+ * against the mock, with the vsync unlimited and at 60 Hz */
+static int bench_protocol(void) {
+  pixel_kernels_init();
+  char name[64];
+  bench_mock_display(name, sizeof(name));
+
+  static const struct {
+    const char *name;
+    uint64_t vsync_ns;
+  } modes[] = {
+    {"unlimited", 0},
+    {"60hz", 1000000000ULL / 60},
+  };
+
+  static wayland_conn_t conn;
+  static uint64_t samples[BENCH_ROUNDTRIPS];
+  static uint64_t phases[3][BENCH_STARTUPS]; // globals, configure, first frame
+  entity_store_t entities;
+
+  printf("%-10s %12s %12s %12s %12s %10s %12s %12s\n", "vsync", "startup p50", "startup p99",
+         "sync p50", "sync p99", "fps", "bytes/frame", "syscalls/fr");
+  for (uint32_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+    mock_config_t config = {.vsync_ns = modes[m].vsync_ns, .width = 800, .height = 600};
+    pid_t mock = bench_mock_spawn(name, &config);
+    if (mock == -1) {
+      fprintf(stderr, "can't start the mock compositor: %s\n", strerror(errno));
+      return 1;
+    }
+
+    // connect to first frame done; the socket and every object are fresh each time
+    uint32_t startups = modes[m].vsync_ns ? BENCH_STARTUPS / 2 : BENCH_STARTUPS;
+    state_t state;
+    for (uint32_t i = 0; i < startups; i++) {
+      state = (state_t){.width = config.width, .height = config.height, .redraw_all = true};
+      uint64_t start = monotonic_ns();
+      if (bench_client_first_frame(&conn, &state) == -1) {
+        fprintf(stderr, "startup: %s\n", strerror(errno));
+        kill(mock, SIGTERM);
+        return 1;
+      }
+      samples[i] = monotonic_ns() - start;
+      phases[0][i] = state.startup.globals_ns;
+      phases[1][i] = state.startup.configure_ns;
+      phases[2][i] = state.startup.first_frame_ns;
+      if (i + 1 < startups)
+        client_shutdown(&conn, &state);
+    }
+    double startup_p50 = bench_percentile_us(samples, startups, 50);
+    double startup_p99 = bench_percentile_us(samples, startups, 99);
+    uint32_t startup_waits = state.startup.waits;
+
+    // request round trips on the last connection
+    for (uint32_t i = 0; i < BENCH_ROUNDTRIPS; i++) {
+      uint64_t start = monotonic_ns();
+      if (bench_roundtrip(&conn, &state) == -1)
+        return 1;
+      samples[i] = monotonic_ns() - start;
+    }
+    double sync_p50 = bench_percentile_us(samples, BENCH_ROUNDTRIPS, 50);
+    double sync_p99 = bench_percentile_us(samples, BENCH_ROUNDTRIPS, 99);
+
+    // steady state: every entity moves each frame, and each frame waits for
+    // its callback like the event loop does
+    if (entity_store_init(&entities, BENCH_ENTITIES, (float)config.width, (float)config.height) == -1)
+      return 1;
+    for (uint32_t i = 0; i < BENCH_ENTITIES; i++)
+      entity_store_add(&entities, (float)(i * 37 % (config.width - ENTITY_SIZE)),
+                       (float)(i * 53 % (config.height - ENTITY_SIZE)), 60.0f, 0.0f,
+                       ENTITY_SIZE, ENTITY_SIZE, 0x0000ff);
+    state.entities = &entities;
+    wayland_conn_stats_t before = conn.stats;
+    uint64_t frames = 0, start = monotonic_ns(), elapsed;
+    uint64_t min_ns = modes[m].vsync_ns ? 5 * BENCH_MIN_NS : BENCH_MIN_NS;
+    do {
+      entity_store_update(&entities, 1.0f / 60.0f); // a pixel per frame
+      frame_mark_dirty(&state);
+      frame_maybe_render(&conn, &state);
+      while (state.frame.callback) {
+        if (swapchain_wait_event(&conn, &state) == -1)
+          return 1;
+      }
+      frames++;
+      elapsed = monotonic_ns() - start;
+    } while (elapsed < min_ns);
+
+    printf("%-10s %10.0fus %10.0fus %10.1fus %10.1fus %10.0f %12.0f %12.1f\n", modes[m].name,
+           startup_p50, startup_p99, sync_p50, sync_p99, (double)frames * 1e9 / (double)elapsed,
+           (double)(conn.stats.bytes_sent - before.bytes_sent) / (double)frames,
+           (double)(conn.stats.syscalls - before.syscalls) / (double)frames);
+    printf("%-10s startup p50: globals %.0fus, configure %.0fus, first frame %.0fus, %u waits\n", "",
+           bench_percentile_us(phases[0], startups, 50), bench_percentile_us(phases[1], startups, 50),
+           bench_percentile_us(phases[2], startups, 50), startup_waits);
+
+    client_shutdown(&conn, &state);
+    entity_store_free(&entities);
+    kill(mock, SIGTERM);
+    waitpid(mock, NULL, 0);
+  }
+
+  bench_mock_unlink(name);
+  return 0;
+}
+
+/* ------------------- Wire ------------------------------------------------ */
+
+#define BENCH_WIRE_REQUESTS 1000000U
+#define BENCH_WIRE_BATCH 64U /* requests per flush, about a frame's worth */
+
+#ifdef KASAMA_LIBWAYLAND
+#define BENCH_WIRE_TRANSPORT "libwayland-client"
+#else
+#define BENCH_WIRE_TRANSPORT "wire engine"
+#endif
+
+/* Every syscall either transport makes on the Wayland socket. These take
+ * the place of libc's wrappers for the whole process, and so for
+ * libwayland-client too, whose own counters we can't see; conn->stats
+ * counts only the wire engine's. Only a -DKASAMA_BENCH_WIRE build replaces
+ * them, so the other benchmarks (and kasama_replay) keep libc's. The socket
+ * is the AF_UNIX socket last connected; calls on other fds aren't counted. */
+static uint64_t bench_wire_syscalls;
+
+#ifdef KASAMA_BENCH_WIRE
+static int bench_wire_fd = -1;
+
+int connect(int fd, const struct sockaddr *addr, socklen_t len) {
+  int ret = (int)syscall(SYS_connect, fd, addr, len);
+  if (ret == 0 && addr->sa_family == AF_UNIX)
+    bench_wire_fd = fd;
+  return ret;
+}
+
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags) {
+  bench_wire_syscalls += fd == bench_wire_fd;
+  return syscall(SYS_sendmsg, fd, msg, flags);
+}
+
+ssize_t recvmsg(int fd, struct msghdr *msg, int flags) {
+  bench_wire_syscalls += fd == bench_wire_fd;
+  return syscall(SYS_recvmsg, fd, msg, flags);
+}
+
+/* Through ppoll: not every architecture has SYS_poll (aarch64 doesn't).
+ * The fds are looked at after the call, as glibc declares them write-only. */
+int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+  struct timespec ts = {.tv_sec = timeout / 1000, .tv_nsec = (long)(timeout % 1000) * 1000000};
+  int ret = (int)syscall(SYS_ppoll, fds, nfds, timeout < 0 ? NULL : &ts, NULL, (size_t)0);
+  for (nfds_t i = 0; i < nfds; i++) {
+    if (fds[i].fd == bench_wire_fd) {
+      bench_wire_syscalls++;
+      break;
+    }
+  }
+  return ret;
+}
+
+/* The variadic argument is only read for commands that take one: an int,
+ * or a pointer for the lock and owner commands. */
+int fcntl(int fd, int cmd, ...) {
+  long arg = 0;
+  va_list args;
+  va_start(args, cmd);
+  switch (cmd) {
+  case F_GETFD:
+  case F_GETFL:
+  case F_GETOWN:
+  case F_GETSIG:
+  case F_GETLEASE:
+  case F_GETPIPE_SZ:
+  case F_GET_SEALS:
+    break;
+  case F_GETLK:
+  case F_SETLK:
+  case F_SETLKW:
+  case F_OFD_GETLK:
+  case F_OFD_SETLK:
+  case F_OFD_SETLKW:
+  case F_GETOWN_EX:
+  case F_SETOWN_EX:
+    arg = (long)va_arg(args, void *);
+    break;
+  default:
+    arg = va_arg(args, int);
+    break;
+  }
+  va_end(args);
+  bench_wire_syscalls += fd == bench_wire_fd;
+  return (int)syscall(SYS_fcntl, fd, cmd, arg);
+}
+
+int close(int fd) {
+  if (fd == bench_wire_fd) {
+    bench_wire_syscalls++;
+    bench_wire_fd = -1;
+  }
+  return (int)syscall(SYS_close, fd);
+}
+#endif
+
+/* Size in KiB of the file mapped into this process whose path contains
+ * `name`, or 0 if none is. */
+static uint64_t bench_wire_mapped_kib(const char *name) {
+  FILE *maps = fopen("/proc/self/maps", "r");
+  if (!maps)
+    return 0;
+  char line[512];
+  uint64_t kib = 0;
+  while (!kib && fgets(line, sizeof(line), maps)) {
+    char *path = strchr(line, '/');
+    if (!path || !strstr(path, name))
+      continue;
+    path[strcspn(path, "\n")] = 0;
+    struct stat st;
+    if (stat(path, &st) == 0)
+      kib = (uint64_t)st.st_size / 1024;
+  }
+  fclose(maps);
+  return kib;
+}
+
+/* Let the compositor catch up with a flush the socket couldn't take whole */
+static int bench_wire_flush(wayland_conn_t *conn) {
+  if (wayland_conn_flush(conn) == -1)
+    return -1;
+  while (conn->out_blocked) {
+    struct pollfd pfd = {.fd = conn->fd, .events = POLLOUT};
+    if (poll(&pfd, 1, -1) == -1 || wayland_conn_flush(conn) == -1)
+      return -1;
+  }
+  return 0;
+}
+
+/* The transport this binary was built with, against the mock: startup,
+ * wl_display.sync round trips, request throughput (wl_surface.damage_buffer
+ * in batches, each flushed), syscalls per unpaced frame, and what the
+ * transport adds to the binary. Build with -DKASAMA_BENCH_WIRE, once plain
+ * and once with -DKASAMA_LIBWAYLAND, and compare the two runs. */
+static int bench_wire(void) {
+#ifndef KASAMA_BENCH_WIRE
+  fprintf(stderr, "the wire benchmark counts syscalls; build it with -DKASAMA_BENCH_WIRE\n");
+  return 1;
+#endif
+  pixel_kernels_init();
+  char name[64];
+  bench_mock_display(name, sizeof(name));
+
+  mock_config_t config = {.vsync_ns = 0, .width = 800, .height = 600};
+  pid_t mock = bench_mock_spawn(name, &config);
+  if (mock == -1) {
+    fprintf(stderr, "can't start the mock compositor: %s\n", strerror(errno));
+    return 1;
+  }
+
+  static wayland_conn_t conn;
+  static uint64_t samples[BENCH_ROUNDTRIPS];
+  state_t state;
+  uint64_t syscalls = bench_wire_syscalls;
+  for (uint32_t i = 0; i < BENCH_STARTUPS; i++) {
+    state = (state_t){.width = config.width, .height = config.height, .redraw_all = true};
+    uint64_t start = monotonic_ns();
+    if (bench_client_first_frame(&conn, &state) == -1) {
+      fprintf(stderr, "startup: %s\n", strerror(errno));
+      kill(mock, SIGTERM);
+      return 1;
+    }
+    samples[i] = monotonic_ns() - start;
+    if (i + 1 < BENCH_STARTUPS)
+      client_shutdown(&conn, &state);
+  }
+  printf("transport: %s\n", BENCH_WIRE_TRANSPORT);
+  printf("startup to first frame: p50 %.0fus p99 %.0fus, %.0f syscalls\n",
+         bench_percentile_us(samples, BENCH_STARTUPS, 50), bench_percentile_us(samples, BENCH_STARTUPS, 99),
+         (double)(bench_wire_syscalls - syscalls) / BENCH_STARTUPS);
+
+  syscalls = bench_wire_syscalls;
+  for (uint32_t i = 0; i < BENCH_ROUNDTRIPS; i++) {
+    uint64_t start = monotonic_ns();
+    if (bench_roundtrip(&conn, &state) == -1)
+      return 1;
+    samples[i] = monotonic_ns() - start;
+  }
+  printf("sync round trip: p50 %.1fus p99 %.1fus, %.1f syscalls\n",
+         bench_percentile_us(samples, BENCH_ROUNDTRIPS, 50), bench_percentile_us(samples, BENCH_ROUNDTRIPS, 99),
+         (double)(bench_wire_syscalls - syscalls) / BENCH_ROUNDTRIPS);
+
+  // one round trip at the end, so every request counted was also read
+  syscalls = bench_wire_syscalls;
+  uint64_t start = monotonic_ns();
+  for (uint32_t i = 0; i < BENCH_WIRE_REQUESTS; i++) {
+    wayland_wl_surface_damage_buffer(&conn, state.wl_surface, i % config.width, i % config.height, 1, 1);
+    if ((i + 1) % BENCH_WIRE_BATCH == 0 && bench_wire_flush(&conn) == -1) {
+      fprintf(stderr, "flush: %s\n", strerror(errno));
+      return 1;
+    }
+  }
+  if (bench_roundtrip(&conn, &state) == -1)
+    return 1;
+  uint64_t elapsed = monotonic_ns() - start;
+  printf("requests: %.2fM msgs/s, %.3f syscalls per %u\n", (double)BENCH_WIRE_REQUESTS * 1e3 / (double)elapsed,
+         (double)(bench_wire_syscalls - syscalls) * BENCH_WIRE_BATCH / BENCH_WIRE_REQUESTS, BENCH_WIRE_BATCH);
+
+  // full redraws, each waiting for its frame callback like the event loop
+  syscalls = bench_wire_syscalls;
+  uint64_t frames = 0;
+  start = monotonic_ns();
+  do {
+    state.redraw_all = true;
+    frame_mark_dirty(&state);
+    frame_maybe_render(&conn, &state);
+    while (state.frame.callback) {
+      if (swapchain_wait_event(&conn, &state) == -1)
+        return 1;
+    }
+    frames++;
+    elapsed = monotonic_ns() - start;
+  } while (elapsed < BENCH_MIN_NS);
+  printf("frames: %.0f fps, %.1f syscalls per frame\n", (double)frames * 1e9 / (double)elapsed,
+         (double)(bench_wire_syscalls - syscalls) / (double)frames);
+
+  struct stat exe;
+  if (stat("/proc/self/exe", &exe) == 0)
+    printf("binary: %" PRIu64 " KiB executable, %" PRIu64 " KiB libwayland-client\n",
+           (uint64_t)exe.st_size / 1024, bench_wire_mapped_kib("libwayland-client"));
+
+  client_shutdown(&conn, &state);
+  kill(mock, SIGTERM);
+  waitpid(mock, NULL, 0);
+  bench_mock_unlink(name);
+  return 0;
+}
+
+/* ------------------- Oversized events ------------------------------------ */
+
+/* A compositor that breaks the protocol's 4096-byte message limit, with the
+ * big event wrapping the end of the receive ring (see -o in the mock): once
+ * just past the limit, once past the ring itself. The connection must fail
+ * with a protocol error, not overrun the receive scratch buffer or wait for
+ * bytes that can never fit. */
+static int bench_oversize(void) {
+  static const uint32_t sizes[] = {8192, 65532};
+  char name[64];
+  bench_mock_display(name, sizeof(name));
+
+  int failed = 0;
+  for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    mock_config_t config = {.vsync_ns = 0, .width = 800, .height = 600, .oversize = sizes[i]};
+    pid_t mock = bench_mock_spawn(name, &config);
+    if (mock == -1) {
+      fprintf(stderr, "can't start the mock compositor: %s\n", strerror(errno));
+      return 1;
+    }
+
+    static wayland_conn_t conn;
+    state_t state = {.width = config.width, .height = config.height, .redraw_all = true};
+    int ret = bench_client_first_frame(&conn, &state);
+    if (ret == 0)
+      ret = bench_roundtrip(&conn, &state);
+    int error = ret == -1 ? errno : 0;
+#ifdef KASAMA_LIBWAYLAND
+    bool ok = error != 0; // libwayland picks its own errno
+#else
+    bool ok = error == EPROTO;
+#endif
+    printf("%5u-byte event: %-36s %s\n", sizes[i], error ? strerror(error) : "accepted",
+           ok ? "ok" : "FAIL");
+    failed |= !ok;
+
+    client_shutdown(&conn, &state);
+    kill(mock, SIGTERM);
+    waitpid(mock, NULL, 0);
+  }
+
+  bench_mock_unlink(name);
+  return failed;
+}
+
+/* ------------------- Resize ---------------------------------------------- */
+
+#define BENCH_RESIZE_FRAMES 2000U
+
+/* An interactive resize against the mock: every frame is answered with a
+ * new window size, sweeping from 400x300 to 1200x900 and back, 8 px per
+ * frame. Reports the time from a configure to the frame presented at the
+ * new size, and what each resize cost in mappings, pool growth and fds. */
+static int bench_resize(void) {
+  pixel_kernels_init();
+  char name[64];
+  bench_mock_display(name, sizeof(name));
+
+  mock_config_t config = {.vsync_ns = 0, .width = 800, .height = 600, .drag_px = 8};
+  pid_t mock = bench_mock_spawn(name, &config);
+  if (mock == -1) {
+    fprintf(stderr, "can't start the mock compositor: %s\n", strerror(errno));
+    return 1;
+  }
+
+  static wayland_conn_t conn;
+  static uint64_t samples[BENCH_RESIZE_FRAMES];
+  state_t state = {.width = config.width, .height = config.height, .redraw_all = true};
+  if (bench_client_first_frame(&conn, &state) == -1) {
+    fprintf(stderr, "startup: %s\n", strerror(errno));
+    kill(mock, SIGTERM);
+    return 1;
+  }
+
+  // the first frame's release came with a configure, so every render below
+  // rebuilds the swapchain
+  shm_pool_stats_t pool_before = state.pool.stats;
+  wayland_conn_stats_t conn_before = conn.stats;
+  uint64_t resizes_before = state.swapchain.stats.resizes;
+  uint64_t start = monotonic_ns();
+  for (uint32_t i = 0; i < BENCH_RESIZE_FRAMES; i++) {
+    uint64_t frame_start = monotonic_ns();
+    frame_maybe_render(&conn, &state);
+    while (state.frame.callback) {
+      if (swapchain_wait_event(&conn, &state) == -1)
+        return 1;
+    }
+    samples[i] = monotonic_ns() - frame_start;
+  }
+  uint64_t elapsed = monotonic_ns() - start;
+
+  uint64_t resizes = state.swapchain.stats.resizes - resizes_before;
+  shm_pool_stats_t *pool = &state.pool.stats;
+  printf("frames %u, resizes %" PRIu64 ", %.0f frames/s\n", BENCH_RESIZE_FRAMES, resizes,
+         (double)BENCH_RESIZE_FRAMES * 1e9 / (double)elapsed);
+  printf("configure to frame: p50 %.1fus p99 %.1fus\n", bench_percentile_us(samples, BENCH_RESIZE_FRAMES, 50),
+         bench_percentile_us(samples, BENCH_RESIZE_FRAMES, 99));
+  printf("pool: %s pages, %u KiB mapped, %u KiB peak in use, %" PRIu64 " grows\n",
+         state.pool.hugetlb ? "huge" : "normal", state.pool.size / 1024, pool->used_max / 1024,
+         pool->grows - pool_before.grows);
+  printf("per resize: %.3f mmap/mremap, %.3f fds sent, %.2f buffers allocated, %.0f bytes sent\n",
+         (double)(pool->maps - pool_before.maps) / (double)resizes,
+         (double)(conn.stats.fds_sent - conn_before.fds_sent) / (double)resizes,
+         (double)(pool->allocs - pool_before.allocs) / (double)resizes,
+         (double)(conn.stats.bytes_sent - conn_before.bytes_sent) / (double)resizes);
+
+  client_shutdown(&conn, &state);
+  kill(mock, SIGTERM);
+  waitpid(mock, NULL, 0);
+  bench_mock_unlink(name);
+  return 0;
+}
+
+/* ------------------- Input ----------------------------------------------- */
+
+#define BENCH_INPUT_REPORTS 1000000U /* a 1000 Hz mouse for ~17 minutes */
+
+/* Append one event to the connection's receive ring as if it had been read
+ * from the socket */
+static void bench_input_put(wayland_conn_t *conn, uint32_t object_id, uint16_t opcode,
+                            const uint32_t *args, uint32_t args_len) {
+  uint32_t size = wayland_header_size + args_len * 4;
+  uint32_t msg[2 + 4] = {object_id, size << 16 | opcode};
+  memcpy(msg + 2, args, args_len * 4);
+  memcpy(conn->in + conn->in_head + conn->in_len, msg, size);
+  conn->in_len += size;
+}
+
+/* Decode, merge and apply a 1000 Hz mouse's motion (one motion and frame
+ * per report, a click every 100 reports) through the real event handlers,
+ * with 1 report per loop turn (every event applied on its own) and with 16
+ * (a 60 Hz loop). Reports ns per event and how many pointer updates, i.e.
+ * frame_mark_dirty calls, the stream cost. */
+static int bench_input(void) {
+#ifdef KASAMA_LIBWAYLAND
+  // events are put straight into the wire engine's receive ring
+  fprintf(stderr, "input: needs the wire engine; build without -DKASAMA_LIBWAYLAND\n");
+  return 1;
+#endif
+  static const uint32_t turns[] = {1, 16};
+  font_t font;
+  glyph_atlas_t atlas;
+  term_t term;
+  static wayland_conn_t conn;
+  if (font_load_embedded(&font) == -1 || glyph_atlas_init(&atlas, &font) == -1 ||
+      term_init(&term, 1920 / atlas.cell_w, 1080 / atlas.cell_h) == -1 ||
+      wayland_conn_init(&conn, -1) == -1) {
+    perror("setup");
+    return 1;
+  }
+  uint32_t wl_pointer = wayland_object_new(&conn, &wayland_wl_pointer_vtable);
+
+  printf("%-14s %10s %10s %10s %10s %10s %8s\n", "reports/turn", "ns/event", "events", "merged",
+         "drains", "updates", "buttons");
+  for (uint32_t t = 0; t < sizeof(turns) / sizeof(turns[0]); t++) {
+    state_t state = {.width = 1920, .height = 1080, .atlas = &atlas, .term = &term};
+    state.input.seat_version = 5;
+    state.input.pty_fd = -1;
+    uint32_t x = 0, y = 0;
+
+    uint64_t start = monotonic_ns();
+    for (uint32_t report = 0; report < BENCH_INPUT_REPORTS; report++) {
+      x = (x + 3 * 256) % (1920 * 256); // 24.8 fixed point, 3 px per report
+      y = (y + 2 * 256) % (1080 * 256);
+      uint32_t motion[] = {report, x, y};
+      bench_input_put(&conn, wl_pointer, wayland_wl_pointer_motion_event, motion, 3);
+      bench_input_put(&conn, wl_pointer, wayland_wl_pointer_frame_event, NULL, 0);
+      if (report % 100 == 99) {
+        uint32_t press[] = {report, report, INPUT_BTN_LEFT, wayland_wl_pointer_button_state_pressed};
+        uint32_t release[] = {report, report, INPUT_BTN_LEFT, wayland_wl_pointer_button_state_released};
+        bench_input_put(&conn, wl_pointer, wayland_wl_pointer_button_event, press, 4);
+        bench_input_put(&conn, wl_pointer, wayland_wl_pointer_frame_event, NULL, 0);
+        bench_input_put(&conn, wl_pointer, wayland_wl_pointer_button_event, release, 4);
+        bench_input_put(&conn, wl_pointer, wayland_wl_pointer_frame_event, NULL, 0);
+      }
+      if ((report + 1) % turns[t] == 0) {
+        if (wayland_conn_dispatch(&conn, &state) == -1) {
+          perror("wayland_conn_dispatch");
+          return 1;
+        }
+        input_drain(&state);
+        if (term.dirty)
+          term_draw_end(&term, 0, 0); // as if rendered
+      }
+    }
+    uint64_t elapsed = monotonic_ns() - start;
+
+    input_stats_t *s = &state.input.stats;
+    printf("%-14u %10.1f %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %8s\n", turns[t],
+           (double)elapsed / (double)s->events, s->events, s->merged, s->drains, s->updates,
+           state.pointer_button_state == 0 ? "ok" : "STUCK");
+  }
+
+  wayland_conn_free(&conn);
+  term_free(&term);
+  glyph_atlas_free(&atlas);
+  font_free(&font);
+  return 0;
+}
+
+/* ------------------- Parser ---------------------------------------------- */
+
+#define BENCH_PARSER_BYTES (16U << 20)  /* size of each generated stream */
+#define BENCH_PARSER_READ 4096U         /* bytes per term_feed, one PTY read */
+
+typedef struct bench_stream_t bench_stream_t;
+
+struct bench_stream_t {
+  char *data;
+  uint64_t len, cap;
+};
+
+static void bench_stream_printf(bench_stream_t *stream, const char *format, ...)
+  __attribute__((format(printf, 2, 3)));
+
+static void bench_stream_printf(bench_stream_t *stream, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(stream->data + stream->len, stream->cap - stream->len, format, args);
+  va_end(args);
+  if (n > 0 && stream->len + (uint64_t)n < stream->cap)
+    stream->len += (uint64_t)n;
+  else
+    stream->len = stream->cap; // full; the caller stops
+}
+
+/* A word of 1-9 random letters, digits and punctuation */
+static void bench_stream_word(bench_stream_t *stream) {
+  char word[10];
+  uint32_t len = 1 + bench_rand() % 9;
+  for (uint32_t i = 0; i < len; i++)
+    word[i] = (char)(0x21 + bench_rand() % 94);
+  word[len] = 0;
+  bench_stream_printf(stream, "%s", word);
+}
+
+/* Lines as a PTY delivers them (CR LF) from programs that print:
+ *   ascii     logs: a timestamp and a line of plain words
+ *   compiler  gcc diagnostics with their SGR colors and erase-line codes
+ *   utf8      prose in Latin accents, Cyrillic, CJK and emoji, 1-4 byte
+ *             sequences mixed with ASCII spaces and punctuation
+ *   tui       a full-screen program redrawing fields: cursor addressing,
+ *             colors and erase-line around short pieces of text
+ *   storm     a scroll storm: `seq`-style short lines broken up by lines
+ *             two to four screens wide that wrap, as from `cat` of a log
+ *             with long records */
+static void bench_stream_fill(bench_stream_t *stream, const char *kind, uint32_t cols, uint32_t rows) {
+  static const char *utf8_words[] = {"naïve", "café", "Straße", "привет", "мир", "日本語", "漢字",
+                                     "한국어", "😀", "🚀✨", "λ→∞", "emoji", "text"};
+  stream->len = 0;
+  for (uint64_t line = 0; stream->len + 512 < stream->cap; line++) {
+    if (strcmp(kind, "ascii") == 0) {
+      bench_stream_printf(stream, "2026-10-16T12:%02" PRIu64 ":%02" PRIu64 ".%03u INFO ",
+                          line / 60 % 60, line % 60, bench_rand() % 1000);
+      for (uint32_t words = 4 + bench_rand() % 16; words > 0; words--) {
+        bench_stream_word(stream);
+        bench_stream_printf(stream, " ");
+      }
+      bench_stream_printf(stream, "\r\n");
+    } else if (strcmp(kind, "compiler") == 0) {
+      bench_stream_printf(stream, "\x1b[01m\x1b[Ksrc/file%u.c:%u:%u:\x1b[m\x1b[K \x1b[01;%s\x1b[K%s\x1b[m\x1b[K ",
+                          bench_rand() % 100, bench_rand() % 5000, bench_rand() % 80,
+                          line % 3 ? "35m" : "31m", line % 3 ? "warning:" : "error:");
+      for (uint32_t words = 3 + bench_rand() % 8; words > 0; words--) {
+        bench_stream_word(stream);
+        bench_stream_printf(stream, " ");
+      }
+      bench_stream_printf(stream, "[\x1b[01;35m\x1b[K-Wunused\x1b[m\x1b[K]\r\n");
+      bench_stream_printf(stream, "  %4u | ", bench_rand() % 5000);
+      for (uint32_t words = 2 + bench_rand() % 8; words > 0; words--) {
+        bench_stream_word(stream);
+        bench_stream_printf(stream, " ");
+      }
+      bench_stream_printf(stream, "\r\n       | \x1b[01;32m\x1b[K^~~~~\x1b[m\x1b[K\r\n");
+    } else if (strcmp(kind, "utf8") == 0) {
+      for (uint32_t words = 4 + bench_rand() % 12; words > 0; words--)
+        bench_stream_printf(stream, "%s%s", utf8_words[bench_rand() % (sizeof(utf8_words) / sizeof(utf8_words[0]))],
+                            bench_rand() % 6 ? " " : ", ");
+      bench_stream_printf(stream, "\r\n");
+    } else if (strcmp(kind, "storm") == 0) {
+      if (line % 16 == 15) {
+        uint64_t end = stream->len + cols * (2 + bench_rand() % 3);
+        while (stream->len < end && stream->len + 512 < stream->cap) {
+          bench_stream_word(stream);
+          bench_stream_printf(stream, " ");
+        }
+      } else {
+        bench_stream_printf(stream, "%" PRIu64, line);
+      }
+      bench_stream_printf(stream, "\r\n");
+    } else { // tui
+      bench_stream_printf(stream, "\x1b[%u;%uH\x1b[1;3%um", 1 + bench_rand() % rows, 1 + bench_rand() % (cols - 20),
+                          bench_rand() % 8);
+      for (uint32_t words = 1 + bench_rand() % 3; words > 0; words--) {
+        bench_stream_word(stream);
+        bench_stream_printf(stream, " ");
+      }
+      bench_stream_printf(stream, "\x1b[0m\x1b[K");
+    }
+  }
+}
+
+/* What a stream left on the grid, to check every kernel set agrees */
+static uint64_t bench_term_hash(term_t *term) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (uint32_t y = 0; y < term->rows; y++) {
+    const term_cell_t *row = term_row_cells(term, term_ring_row(term, y));
+    for (uint32_t x = 0; x < term->cols; x++)
+      hash = (hash ^ row[x].codepoint ^ (uint64_t)term->styles.styles[row[x].style].fg << 32) * 0x100000001b3;
+  }
+  return (hash ^ term->cursor_x ^ (uint64_t)term->cursor_y << 32) * 0x100000001b3;
+}
+
+/* Parser throughput in MB/s per kernel set, on streams shaped like common
+ * program output, fed in PTY-read-sized pieces into a 1080p grid (240x67
+ * with 8x16 cells) */
+static int bench_parser(void) {
+  static const char *kinds[] = {"ascii", "compiler", "utf8", "tui", "storm"};
+  const uint32_t cols = 240, rows = 67;
+  term_scan_kernels_init();
+  const term_scan_kernels_t *selected = term_scan_kernels;
+
+  bench_stream_t stream = {.data = malloc(BENCH_PARSER_BYTES), .cap = BENCH_PARSER_BYTES};
+  const uint32_t kernels = term_scan_kernels_available_len;
+  term_t terms[sizeof(term_scan_kernels_available) / sizeof(term_scan_kernels_available[0])];
+  if (!stream.data) {
+    perror("setup");
+    return 1;
+  }
+
+  printf("%-10s", "stream");
+  for (uint32_t k = 0; k < kernels; k++)
+    printf(" %10s", term_scan_kernels_available[k]->name);
+  printf("   (MB/s)\n");
+
+  for (uint32_t s = 0; s < sizeof(kinds) / sizeof(kinds[0]); s++) {
+    bench_stream_fill(&stream, kinds[s], cols, rows);
+    const uint8_t *data = (const uint8_t *)stream.data;
+    uint64_t bytes = 0, elapsed[sizeof(terms) / sizeof(terms[0])] = {0}, least = 0;
+    bool agree = true;
+
+    for (uint32_t k = 0; k < kernels; k++) {
+      if (term_init(&terms[k], cols, rows) == -1) {
+        perror("term_init");
+        return 1;
+      }
+    }
+
+    // one pass per kernel set in turn, so drift in the machine's speed lands
+    // on all of them alike instead of on whichever runs last
+    while (least < BENCH_MIN_NS) {
+      for (uint32_t k = 0; k < kernels; k++) {
+        term_scan_kernels = term_scan_kernels_available[k];
+        uint64_t start = monotonic_ns();
+        for (uint64_t at = 0; at < stream.len; at += BENCH_PARSER_READ) {
+          uint64_t n = stream.len - at < BENCH_PARSER_READ ? stream.len - at : BENCH_PARSER_READ;
+          term_feed(&terms[k], data + at, n);
+        }
+        elapsed[k] += monotonic_ns() - start;
+      }
+      if (bytes == 0) { // the first pass decides the grid
+        for (uint32_t k = 1; k < kernels; k++)
+          agree &= bench_term_hash(&terms[k]) == bench_term_hash(&terms[0]);
+      }
+      bytes += stream.len;
+      least = elapsed[0];
+      for (uint32_t k = 1; k < kernels; k++)
+        least = elapsed[k] < least ? elapsed[k] : least;
+    }
+
+    printf("%-10s", kinds[s]);
+    for (uint32_t k = 0; k < kernels; k++) {
+      printf(" %10.0f", (double)bytes * 1e3 / (double)elapsed[k]);
+      term_free(&terms[k]);
+    }
+    printf("   %s\n", agree ? "grids agree" : "GRIDS DIFFER");
+  }
+
+  term_scan_kernels = selected;
+  free(stream.data);
+  return 0;
+}
+
+#define BENCH_SCROLL_LINES 10000000U
+#define BENCH_SCROLL_FRAMES 3000U    /* frames of each paced run */
+
+/* `seq 1 10000000` through the parser and renderer of a 1080p terminal
+ * against the mock (vsync unlimited), turn by turn like the event loop.
+ * Unpaced, a turn parses PTY reads for up to PTY_READ_BUDGET_NS and then
+ * draws a frame; paced, a turn gets a fixed number of lines, like a
+ * program printing at a steady rate. Each is run with scrolls redrawing
+ * every row and with the last frame's pixels shifted; every shifted run's
+ * frame is compared with a full redraw of the same grid (untimed), and a
+ * mismatch fails the benchmark. Unpaced turns scroll more than a screen,
+ * which always redraws, so only the paced runs exercise the shift. */
+static int bench_scroll(void) {
+  pixel_kernels_init();
+  term_scan_kernels_init();
+  char name[64];
+  bench_mock_display(name, sizeof(name));
+
+  bench_stream_t stream = {.cap = 96U << 20}; // seq through a PTY: "\r\n" endings
+  stream.data = malloc(stream.cap);
+  if (!stream.data) {
+    perror("setup");
+    return 1;
+  }
+  for (uint32_t i = 1; i <= BENCH_SCROLL_LINES; i++)
+    stream.len += (uint64_t)sprintf(stream.data + stream.len, "%u\r\n", i);
+  const uint8_t *data = (const uint8_t *)stream.data;
+
+  mock_config_t config = {.vsync_ns = 0, .width = 1920, .height = 1080};
+  pid_t mock = bench_mock_spawn(name, &config);
+  if (mock == -1) {
+    fprintf(stderr, "can't start the mock compositor: %s\n", strerror(errno));
+    return 1;
+  }
+
+  static wayland_conn_t conn;
+  static uint64_t samples[BENCH_SCROLL_LINES / 1000];
+  font_t font;
+  glyph_atlas_t atlas;
+  uint32_t *reference = malloc((size_t)config.width * config.height * sizeof(uint32_t));
+  if (!reference || font_load_embedded(&font) == -1 || glyph_atlas_init(&atlas, &font) == -1) {
+    perror("setup");
+    return 1;
+  }
+
+  printf("seq 1 %u (%.1f MB), %ux%u window, %ux%u cells\n", BENCH_SCROLL_LINES, (double)stream.len / 1e6,
+         config.width, config.height, config.width / atlas.cell_w, config.height / atlas.cell_h);
+  printf("%-12s %-7s %8s %8s %10s %8s %8s %12s %12s\n", "lines/frame", "scroll", "seconds", "MB/s", "lines/s",
+         "frames", "shifted", "render p50", "render p99");
+  static const uint32_t paces[] = {0, 1, 8, 32}; // 0: as fast as it parses
+  for (uint32_t p = 0; p < sizeof(paces) / sizeof(paces[0]); p++) {
+    for (uint32_t shift = 0; shift < 2; shift++) {
+      render_scroll_enabled = shift;
+      term_t term;
+      state_t state = {.width = config.width, .height = config.height, .redraw_all = true};
+      if (term_init(&term, config.width / atlas.cell_w, config.height / atlas.cell_h) == -1) {
+        perror("term_init");
+        return 1;
+      }
+      state.atlas = &atlas;
+      state.term = &term;
+      if (bench_client_first_frame(&conn, &state) == -1) {
+        fprintf(stderr, "startup: %s\n", strerror(errno));
+        kill(mock, SIGTERM);
+        return 1;
+      }
+
+      uint64_t frames = 0, lines = 0, at = 0, verify_ns = 0, start = monotonic_ns();
+      uint64_t renders_before = state.frame.renders, scrolls_before = state.frame.scrolls;
+      while (at < stream.len && (!paces[p] || frames < BENCH_SCROLL_FRAMES)) {
+        uint64_t turn = monotonic_ns();
+        if (paces[p]) {
+          uint64_t end = at;
+          for (uint32_t line = 0; line < paces[p] && end < stream.len; line++, lines++)
+            end = (uint64_t)((const uint8_t *)memchr(data + end, '\n', stream.len - end) - data) + 1;
+          term_feed(&term, data + at, end - at);
+          at = end;
+        }
+        while (!paces[p] && at < stream.len && monotonic_ns() - turn < PTY_READ_BUDGET_NS) {
+          uint64_t n = stream.len - at < BENCH_PARSER_READ ? stream.len - at : BENCH_PARSER_READ;
+          term_feed(&term, data + at, n);
+          at += n;
+        }
+        frame_mark_dirty(&state);
+        uint64_t render = monotonic_ns(), rendered = state.frame.renders;
+        frame_maybe_render(&conn, &state);
+        if (frames < sizeof(samples) / sizeof(samples[0]))
+          samples[frames] = monotonic_ns() - render;
+        frames++;
+
+        // the presented frame must be what a full redraw of the grid gives;
+        // rendering left no row dirty, so this only repaints `reference`
+        if (shift && state.frame.renders > rendered) {
+          uint64_t verify = monotonic_ns();
+          damage_t scratch = {0};
+          const uint32_t *front = swapchain_pixels(&state, state.swapchain.front);
+          renderer_clear(reference, config.width, config.height, TERM_DEFAULT_BG, &scratch);
+          term_draw(&term, &atlas, reference, config.width, config.height, true, &scratch);
+          for (uint32_t y = 0; y < config.height; y++) {
+            size_t row = (size_t)y * config.width;
+            if (memcmp(front + row, reference + row, config.width * sizeof(uint32_t)) != 0) {
+              fprintf(stderr, "frame %" PRIu64 " of %u lines/frame differs from a full redraw at y=%u\n",
+                      frames, paces[p], y);
+              kill(mock, SIGTERM);
+              return 1;
+            }
+          }
+          verify_ns += monotonic_ns() - verify;
+        }
+
+        while (state.frame.callback) {
+          if (swapchain_wait_event(&conn, &state) == -1)
+            return 1;
+        }
+      }
+      uint64_t elapsed = monotonic_ns() - start - verify_ns;
+      uint64_t measured = frames < sizeof(samples) / sizeof(samples[0]) ? frames : sizeof(samples) / sizeof(samples[0]);
+      lines = paces[p] ? lines : BENCH_SCROLL_LINES;
+
+      char pace[16] = "unpaced";
+      if (paces[p])
+        snprintf(pace, sizeof(pace), "%u", paces[p]);
+      printf("%-12s %-7s %8.2f %8.1f %10.0f %8" PRIu64 " %8" PRIu64 " %10.0fus %10.0fus\n", pace,
+             shift ? "shift" : "redraw", (double)elapsed / 1e9, (double)at * 1e3 / (double)elapsed,
+             (double)lines * 1e9 / (double)elapsed,
+             state.frame.renders - renders_before, state.frame.scrolls - scrolls_before,
+             bench_percentile_us(samples, measured, 50), bench_percentile_us(samples, measured, 99));
+      if (!paces[p] && shift)
+        printf("%-12s %.0f lines/frame, more than the %u rows on screen: every frame redraws, "
+               "shifted or not\n", "", (double)lines / (double)frames, term.rows);
+      client_shutdown(&conn, &state);
+      term_free(&term);
+    }
+  }
+  printf("every shifted frame matched a full redraw\n");
+  render_scroll_enabled = true;
+
+  kill(mock, SIGTERM);
+  waitpid(mock, NULL, 0);
+  bench_mock_unlink(name);
+  glyph_atlas_free(&atlas);
+  font_free(&font);
+  free(reference);
+  free(stream.data);
+  return 0;
+}
+
+/* Scrollback: colored compiler output fed until 1M rows have scrolled off a
+ * 240x67 grid, with the history off, at its defaults, and asked to keep
+ * all 1M rows in the default memory budget. Reports parser throughput,
+ * what is held in memory and on disk, and how fast the kept rows decode
+ * when the view is scrolled through them. */
+static int bench_scrollback(void) {
+  typedef struct {
+    const char *name;
+    uint32_t lines;
+    uint64_t budget;
+  } config_t;
+  static const config_t configs[] = {
+    {"off", 0, TERM_HISTORY_BUDGET},
+    {"default", TERM_HISTORY_LINES, TERM_HISTORY_BUDGET},
+    {"1M rows", 1000000, TERM_HISTORY_BUDGET},
+  };
+  const uint32_t cols = 240, rows = 67;
+  const uint64_t target = 1000000;
+  term_scan_kernels_init();
+
+  bench_stream_t stream = {.data = malloc(BENCH_PARSER_BYTES), .cap = BENCH_PARSER_BYTES};
+  if (!stream.data) {
+    perror("setup");
+    return 1;
+  }
+  bench_stream_fill(&stream, "compiler", cols, rows);
+  const uint8_t *data = (const uint8_t *)stream.data;
+
+  printf("%ux%u grid, %u ring rows, %" PRIu64 " rows scrolled off\n", cols, rows, rows + TERM_HOT_LINES, target);
+  printf("%-8s %8s %9s %9s %10s %10s %10s %12s\n", "history", "MB/s", "rows kept", "bytes/row",
+         "memory KiB", "spilled KiB", "styles", "read ns/row");
+  for (uint32_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+    term_t term;
+    if (term_init(&term, cols, rows) == -1) {
+      perror("term_init");
+      return 1;
+    }
+    term_set_scrollback(&term, configs[c].lines, configs[c].budget);
+    term_history_t *h = &term.history;
+
+    uint64_t bytes = 0, start = monotonic_ns();
+    while (h->rows_added + term.hot_len < target && (configs[c].lines || bytes < stream.len * 8)) {
+      for (uint64_t at = 0; at < stream.len; at += BENCH_PARSER_READ) {
+        uint64_t n = stream.len - at < BENCH_PARSER_READ ? stream.len - at : BENCH_PARSER_READ;
+        term_feed(&term, data + at, n);
+      }
+      bytes += stream.len;
+    }
+    uint64_t elapsed = monotonic_ns() - start;
+
+    uint64_t memory = (uint64_t)term.ring_rows * cols * sizeof(*term.ring) + h->memory +
+                      (uint64_t)h->offsets_cap * sizeof(*h->offsets) +
+                      (uint64_t)term.styles.cap * sizeof(*term.styles.styles);
+    start = monotonic_ns();
+    for (uint32_t i = 0; i < h->len; i++) {
+      term_history_get(h, i, term.view_buf, cols);
+      bench_clobber(term.view_buf);
+    }
+    double read_ns = h->len ? (double)(monotonic_ns() - start) / h->len : 0.0;
+
+    printf("%-8s %8.0f %9u %9.1f %10" PRIu64 " %11" PRIu64 " %10u %12.0f\n", configs[c].name,
+           (double)bytes * 1e3 / (double)elapsed, h->len + term.hot_len,
+           h->rows_added ? (double)h->bytes_encoded / h->rows_added : 0.0, memory >> 10, h->spilled >> 10,
+           term.styles.len, read_ns);
+    term_free(&term);
+  }
+  free(stream.data);
+  return 0;
+}
+
+/* ------------------- Main ------------------------------------------------- */
+
+typedef struct bench_command_t bench_command_t;
+
+struct bench_command_t {
+  const char *name;
+  const char *help;
+  int (*run)(void);
+};
+
+static const bench_command_t bench_commands[] = {
+  {"pixels", "fill/rect/blend kernels, GB/s per kernel set and window size", bench_pixels},
+  {"text", "full-screen text redraws per second (KASAMA_FONT=file.psf to pick a font)", bench_text},
+  {"entities", "1M-entity update, cull, tile binning and draw, ms per stage", bench_entities},
+  {"threads", "4K clear, text and entity phases with 1..N render threads, ms and speedup", bench_threads},
+  {"protocol", "startup latency, round trips and frame throughput against the mock compositor", bench_protocol},
+  {"wire", "the transport built in (-DKASAMA_LIBWAYLAND or not): startup, msgs/s, syscalls, size; needs -DKASAMA_BENCH_WIRE", bench_wire},
+  {"oversize", "events over the protocol's size limit from the mock must end the connection", bench_oversize},
+  {"resize", "interactive window resize against the mock: latency, mappings and fds per resize", bench_resize},
+  {"input", "1000 Hz pointer stream through decode, merge and drain, per event and batched", bench_input},
+  {"parser", "VT parser MB/s per scan kernel set on log, compiler, UTF-8, TUI and scroll-storm output", bench_parser},
+  {"scroll", "seq 1 10000000 through parser and renderer, scrolls redrawn vs shifted", bench_scroll},
+  {"scrollback", "1M rows of scrollback: MB/s, bytes per row, memory, spill and read-back", bench_scrollback},
+};
+
+#ifndef KASAMA_BENCH_NO_MAIN
+int main(int argc, char **argv) {
+  uint64_t commands_len = sizeof(bench_commands) / sizeof(bench_commands[0]);
+  for (uint64_t i = 0; argc == 2 && i < commands_len; i++) {
+    if (strcmp(argv[1], bench_commands[i].name) == 0)
+      return bench_commands[i].run();
+  }
+
+  fprintf(stderr, "usage: %s <benchmark>\n", argv[0]);
+  for (uint64_t i = 0; i < commands_len; i++)
+    fprintf(stderr, "  %-10s %s\n", bench_commands[i].name, bench_commands[i].help);
+  return 2;
+}
+#endif
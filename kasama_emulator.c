@@ -8,11 +8,17 @@
  *    according to the comments and the Wayland protocol semantics.
  *  - Keep your implementation portable: avoid non-portable behavior unless
  *    the function explicitly requires POSIX (sockets, mmap, etc.).
- *  - Use helper buffer read/write functions provided in this file when
- *    marshaling or unmarshaling Wayland messages.
+ *  - Marshal and unmarshal Wayland messages with the stubs generated into
+ *    kasama_protocol.h from the XML in protocol/ (see protocol/generate.py).
  *
  * Compile / run (example):
- *   gcc -std=c11 -D_POSIX_C_SOURCE=200112L -o wayland_assignment wayland_assignment.c
+ *   gcc -std=c11 -O2 -o kasama kasama_emulator.c
+ *   gcc -std=c11 -O2 -DKASAMA_TRACE -o kasama kasama_emulator.c  # protocol trace ring
+ *   gcc -std=c11 -O2 -DKASAMA_LIBWAYLAND -o kasama kasama_emulator.c \
+ *       $(pkg-config --cflags --libs wayland-client)              # libwayland transport
+ *
+ * Headless benchmarks of the hot paths live in kasama_bench.c, which compiles
+ * this file with -DKASAMA_NO_MAIN semantics (see the top of that file).
  *
  * Note: This is a teaching skeleton; it intentionally omits many details
  * of a production Wayland client (error handling, dynamic object registry
@@ -20,9 +26,10 @@
  * the missing parts as part of a CS assignment toward a terminal emulator.
  */
 
-#define _POSIX_C_SOURCE 200112L
+#define _POSIX_C_SOURCE 200809L
+#define _XOPEN_SOURCE 700 // posix_openpt and friends
+#define _GNU_SOURCE       // memfd_create, mremap, file sealing
 
-#include <wayland-client.h> // add -lwayland-client to compilation command
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -33,47 +40,56 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+/* Opcodes, message sizes and marshaling stubs, generated from protocol/ */
+#ifdef KASAMA_LIBWAYLAND
+#include <wayland-client-core.h>
+#define KASAMA_PROTOCOL_WL_INTERFACES
+#endif
+#include "kasama_protocol.h"
+
 static bool log_enabled = true;
 
 // standard log macro
-#define LOG(msg, ...)
-  do {
-    if (log_enabled)
-      fprintf(stderr, msg, __VA_ARGS__);
+#define LOG(msg, ...)                       \
+  do {                                      \
+    if (log_enabled)                        \
+      fprintf(stderr, msg, __VA_ARGS__);    \
   } while (0)
 
 static const uint32_t wayland_display_object_id = 1;
-static const uint16_t wayland_wl_registry_event_global = 0;
-static const uint16_t wayland_shm_pool_event_format = 0;
-static const uint16_t wayland_wl_buffer_event_release = 0;
-static const uint16_t wayland_xdg_wm_base_event_ping = 0;
-static const uint16_t wayland_xdg_toplevel_event_configure = 0;
-static const uint16_t wayland_xdg_toplevel_event_close = 1;
-static const uint16_t wayland_xdg_surface_event_configure = 0;
-static const uint16_t wayland_wl_display_get_registry_opcode = 1;
-static const uint16_t wayland_wl_registry_bind_opcode = 0;
-static const uint16_t wayland_wl_compositor_create_surface_opcode = 0;
-static const uint16_t wayland_xdg_wm_base_pong_opcode = 3;
-static const uint16_t wayland_xdg_surface_ack_configure_opcode = 4;
-static const uint16_t wayland_wl_shm_create_pool_opcode = 0;
-static const uint16_t wayland_xdg_wm_base_get_xdg_surface_opcode = 2;
-static const uint16_t wayland_wl_shm_pool_create_buffer_opcode = 0;
-static const uint16_t wayland_wl_surface_attach_opcode = 1;
-static const uint16_t wayland_xdg_surface_get_toplevel_opcode = 1;
-static const uint16_t wayland_wl_surface_commit_opcode = 6;
-static const uint16_t wayland_wl_display_error_event = 0;
-static const uint32_t wayland_format_xrgb8888 = 1;
 static const uint32_t wayland_header_size = 8;
 static const uint32_t color_channels = 4;
 
 /* Helpful constants for this assignment */
-#define OLD_IDS_CAP 256U
+#define SWAPCHAIN_MIN 2U     /* buffers created up front */
+#define SWAPCHAIN_MAX 4U     /* the shm pool is sized for this many */
+#define SWAPCHAIN_RETIRED_MAX 8U /* old-size buffers the compositor still holds */
+#define SHM_POOL_MAX_BLOCKS 32U  /* free extents the pool allocator tracks */
+#define SHM_POOL_ALIGN 64U       /* buffer offsets and sizes, one cache line */
+#define DAMAGE_MAX_RECTS 16U /* past this, rects are merged into bounding boxes */
+#define ENTITY_SIZE 16U      /* side of the demo's square entities, in pixels */
+#define INPUT_QUEUE_CAP 256U /* input events decoded between two drains */
+#define INPUT_FRAME_CAP 32U  /* pointer events in one wl_pointer.frame */
+#define INPUT_LATENCY_CAP 4096U /* latest input-to-photon samples kept */
+#define FRAME_TIMES_CAP 4096U   /* latest render_frame times kept */
 #define WAYLAND_SOCKET_ENV "WAYLAND_DISPLAY"
 #define DEFAULT_WAYLAND_SOCKET "wayland-0"
 #define roundup_4(n) (((n)+3) & -4)
@@ -82,45 +98,246 @@ static const uint32_t color_channels = 4;
 
 /* Forward type declarations copied from the original source */
 typedef enum state_state_t state_state_t;
-typedef struct entity_t entity_t;
+typedef struct entity_store_t entity_store_t;
 typedef struct state_t state_t;
+typedef struct rect_t rect_t;
+typedef struct damage_t damage_t;
+typedef struct swapchain_t swapchain_t;
+typedef struct swapchain_buffer_t swapchain_buffer_t;
+typedef struct swapchain_stats_t swapchain_stats_t;
+typedef struct swapchain_retired_t swapchain_retired_t;
+typedef struct shm_block_t shm_block_t;
+typedef struct shm_pool_stats_t shm_pool_stats_t;
+typedef struct shm_pool_t shm_pool_t;
+typedef struct frame_scheduler_t frame_scheduler_t;
+typedef struct startup_stats_t startup_stats_t;
+typedef struct input_event_t input_event_t;
+typedef struct input_stats_t input_stats_t;
+typedef struct input_t input_t;
+typedef enum input_kind_t input_kind_t;
+typedef struct glyph_atlas_t glyph_atlas_t;
+typedef struct term_t term_t;
+typedef struct render_tiles_t render_tiles_t;
+
+enum state_state_t {
+  STATE_NONE,
+  STATE_SURFACE_ACKED_CONFIGURE,
+  STATE_SURFACE_ATTACHED,
+  STATE_CLOSED,
+};
+
+/* Pixel rectangle in buffer coordinates */
+struct rect_t {
+  uint32_t x, y, w, h;
+};
+
+/* Set of changed rectangles. Overlapping rects are merged as they are added,
+ * so the list stays short and never double-counts pixels. */
+struct damage_t {
+  rect_t rects[DAMAGE_MAX_RECTS];
+  uint32_t len;
+};
+
+/* A byte range of the shm pool */
+struct shm_block_t {
+  uint32_t offset;
+  uint32_t size;
+};
+
+struct shm_pool_stats_t {
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t grows;              // wl_shm_pool.resize requests
+  uint64_t maps;               // mmap and mremap calls, the initial one included
+  uint32_t used;               // bytes handed out right now
+  uint32_t used_max;
+};
+
+/* The one wl_shm_pool all buffers are carved from: a sealed memfd, mapped
+ * once and grown in place. */
+struct shm_pool_t {
+  int fd;
+  uint8_t *data;
+  uint32_t size;               // bytes mapped, and the size the compositor knows
+  uint32_t page;               // growth granularity: the page or hugepage size
+  bool hugetlb;                // MFD_HUGETLB backing
+  uint32_t wl_shm_pool;        // 0 until announced with wl_shm.create_pool
+  shm_block_t free[SHM_POOL_MAX_BLOCKS]; // sorted by offset, never adjacent
+  uint32_t free_len;
+  shm_pool_stats_t stats;
+};
+
+/* One wl_buffer of the swapchain, a frame-sized block of the shm pool. It is
+ * busy from the commit that presents it until the compositor's release. */
+struct swapchain_buffer_t {
+  uint32_t wl_buffer;
+  shm_block_t block;
+  bool busy;
+  uint64_t presented_seq;      // frame number it was last presented in
+  damage_t damage;             // drawn into this buffer for the frame in progress
+  damage_t missed;             // presented in other buffers since this one was drawn
+};
+
+/* How often, and for how long, the renderer had to wait for a free buffer.
+ * Frequent waits with the chain at SWAPCHAIN_MAX mean the compositor holds
+ * more buffers than we can give it. */
+struct swapchain_stats_t {
+  uint64_t acquires;
+  uint64_t waits;
+  uint64_t wait_ns_total;
+  uint64_t wait_ns_max;
+  uint64_t grows;
+  uint64_t resizes;            // swapchains rebuilt for a new window size
+};
+
+/* A buffer of an old window size that was busy when the chain was rebuilt.
+ * Its block goes back to the pool once the compositor releases it. */
+struct swapchain_retired_t {
+  uint32_t wl_buffer;
+  shm_block_t block;
+};
+
+struct swapchain_t {
+  swapchain_buffer_t buffers[SWAPCHAIN_MAX];
+  uint32_t len;
+  uint32_t width, height;      // size of every buffer in `buffers`
+  swapchain_retired_t retired[SWAPCHAIN_RETIRED_MAX];
+  uint32_t retired_len;
+  int front;                   // slot presented last, -1 before the first frame
+  uint64_t present_seq;
+  swapchain_stats_t stats;
+};
+
+/* Paces rendering to the compositor's frame callbacks. Changes only mark the
+ * frame dirty; a render happens once the previous frame's callback is done,
+ * so everything that changed in between is folded into that one render. */
+struct frame_scheduler_t {
+  uint32_t callback;           // outstanding wl_surface.frame, 0 if none
+  bool dirty;                  // a change is waiting to be rendered
+  bool deferred_counted;       // this wait on `callback` is already in `deferred`
+  uint64_t dirty_since_ns;     // arrival of the oldest unrendered change
+  uint64_t idle_since_ns;      // start of the current idle stretch, 0 if busy
+  uint32_t last_done_ms;       // compositor timestamp of the last callback
+  uint32_t refresh_ms;         // shortest callback interval seen so far
+
+  uint64_t updates;            // frame_mark_dirty calls
+  uint64_t renders;            // frames presented
+  uint64_t deferred;           // callbacks that held back a dirty frame
+  uint64_t skipped;            // refreshes with no callback between two frames
+  uint64_t latency_ns_total;   // change arrival to present
+  uint64_t latency_ns_max;
+  uint64_t idle_ns_total;      // nothing dirty and no callback outstanding
+  uint64_t scrolls;            // frames that shifted the last one's pixels for a scroll
+  uint64_t scrolled_rows;      // text rows shifted, rather than redrawn, by those
+  uint32_t render_us[FRAME_TIMES_CAP]; // render_frame times of presented frames, ring
+  uint64_t render_len;         // samples ever taken
+};
+
+/* Where the time from connect to the first frame on screen went. Times are
+ * offsets from start_ns, 0 until reached. */
+struct startup_stats_t {
+  uint64_t start_ns;           // client_startup_begin, before connecting
+  uint64_t globals_ns;         // registry done, every global bound
+  uint64_t configure_ns;       // first xdg_surface.configure handled
+  uint64_t first_frame_ns;     // callback of the first frame done
+  uint32_t waits;              // times startup blocked on the socket
+};
+
+enum input_kind_t {
+  INPUT_ENTER,                 // pointer entered the surface at (x, y)
+  INPUT_LEAVE,
+  INPUT_MOTION,                // pointer at (x, y); consecutive ones are merged
+  INPUT_BUTTON,                // code: evdev button (BTN_LEFT...)
+  INPUT_KEY,                   // code: evdev key
+  INPUT_MODIFIERS,             // code: depressed | latched | locked xkb mods
+};
 
-/* Basic entity used for rendering examples in this assignment */
-struct entity_t {
-  float x, y;
+/* One decoded wl_pointer or wl_keyboard event */
+struct input_event_t {
+  input_kind_t kind;
+  bool pressed;                // INPUT_BUTTON and INPUT_KEY
+  uint32_t code;
+  uint32_t time_ms;            // compositor timestamp, 0 for events without
+                               // one; a merged motion keeps the earliest
+  double x, y;                 // surface-local, from 24.8 fixed point
+};
+
+struct input_stats_t {
+  uint64_t events;             // wl_pointer and wl_keyboard events decoded
+  uint64_t merged;             // motions folded into the one after them
+  uint64_t pointer_frames;     // wl_pointer.frame, or single events before v5
+  uint64_t drains;             // batches applied to the client state
+  uint64_t updates;            // drains that changed what is on screen
+  uint64_t keys;               // key presses written to the PTY
+  uint64_t keys_dropped;       // ... or not: no mapping, or the PTY was full
+};
+
+/* Input pipeline: events are decoded as they are dispatched, grouped by
+ * wl_pointer.frame and queued in arrival order; input_drain applies the
+ * queue once per loop turn. Each visible change carries the compositor
+ * timestamp of the oldest event behind it through the render that shows it
+ * to the frame callback of that render, which closes an input-to-photon
+ * latency sample (both ends are on the compositor's clock). A key press
+ * becomes such a change when the PTY answers it with output. */
+struct input_t {
+  uint32_t seat_version;
+  uint32_t wl_pointer;         // 0 without the pointer capability
+  uint32_t wl_keyboard;        // 0 without the keyboard capability
+  uint32_t modifiers;           // xkb depressed | latched | locked
+  int pty_fd;                  // key presses are written here, -1 if none
+
+  input_event_t frame[INPUT_FRAME_CAP]; // since the last wl_pointer.frame
+  uint32_t frame_len;
+  input_event_t queue[INPUT_QUEUE_CAP]; // complete frames and keys, in order
+  uint32_t queue_len;
+
+  bool unechoed;               // keys written, no PTY output read since
+  uint32_t unechoed_ms;
+  bool unrendered;             // a drain changed the screen, not yet rendered
+  uint32_t unrendered_ms;      // oldest event behind that change
+  bool unpresented;            // rendered, frame callback not yet done
+  uint32_t unpresented_ms;
+  uint32_t latency_ms[INPUT_LATENCY_CAP]; // ring, oldest overwritten
+  uint64_t latency_len;        // samples ever taken
+
+  input_stats_t stats;
 };
 
 /* Simplified client state structure. Expand as you implement functions. */
 struct state_t {
   uint32_t wl_registry;
+  uint32_t wl_compositor;
   uint32_t wl_shm;
-  uint32_t wl_shm_pool;
-
-  uint32_t old_wl_buffers[OLD_IDS_CAP];
-  uint32_t old_wl_buffers_len;
-  uint32_t old_wl_callbacks[OLD_IDS_CAP];
-  uint32_t old_wl_callbacks_len;
 
   uint32_t xdg_wm_base;
   uint32_t xdg_surface;
   uint32_t xdg_toplevel;
 
   uint32_t wl_surface;
-  uint32_t wl_buffer;
   uint32_t wl_seat;
+  uint32_t configure_width;    // from the last xdg_toplevel.configure, 0 if
+  uint32_t configure_height;   // the compositor leaves the size to us
+  uint32_t sync_callback;      // outstanding wl_display.sync, 0 once done
+  frame_scheduler_t frame;
+  startup_stats_t startup;
+  swapchain_t swapchain;       // wl_buffers carved from the one shm pool
+  shm_pool_t pool;
 
-  uint32_t width;
-  uint32_t height;
-  uint32_t shm_pool_size;
-  int shm_fd;
-  volatile uint8_t *shm_pool_data;
+  uint32_t width;              // window size; the swapchain follows it on the
+  uint32_t height;             // next render
+
+  double pointer_x;            // surface-local, valid while pointer_inside
+  double pointer_y;
+  bool pointer_inside;
+  uint32_t pointer_button_state; // bit n: button BTN_LEFT + n is down
+  input_t input;
 
-  float pointer_x;
-  float pointer_y;
-  uint32_t pointer_button_state;
+  entity_store_t *entities;    // NULL unless running the entity demo
+  bool redraw_all;             // background must be repainted, e.g. first frame
 
-  entity_t *entities;
-  uint64_t entities_len;
+  glyph_atlas_t *atlas;
+  term_t *term;                // NULL when running the entity demo
+  render_tiles_t *tiles;       // NULL: frames are drawn on the main thread
 
   state_state_t state;
 };
@@ -133,7 +350,7 @@ struct state_t {
  *
  * Hint: Wayland uses 24.8 fixed format: upper 24 bits integer, lower 8 bits fraction.
  */
-static inline double wayland_fixed_to_double(uint32_t f) {
+static inline double wayland_fixed_to_double(int32_t f) {
   // This method came from wayland-util.h docs
   (void)f; // ignores compiler errors if not using variable
   union { // use a union since we're mutating and storing the object at the same memory locations
@@ -145,26 +362,6 @@ static inline double wayland_fixed_to_double(uint32_t f) {
   return u.d - (3LL << 43);
 }
 
-/* Check/set helpers for tracking old ids */
-static bool is_old_id(uint32_t *old_ids, uint32_t id) {
-  /* Return true if id is present in old_ids */
-  (void)old_ids; (void)id;
-
-  for (uint32_t i = 0; i < OLD_IDS_CAP; i++) {
-    if (old_ids[i] == id)
-      return true;
-  }
-  return false;
-}
-
-static void store_old_id(uint32_t *old_ids, uint32_t *old_ids_len, uint32_t id) {
-  /* Add id into array, if room; avoid duplicates */
-  (void)old_ids; (void)old_ids_len; (void)id;
-  uint32_t newLen = (*old_ids_len + 1) & OLD_IDS_CAP;
-  olds_ids[newLen] = id;
-  *old_ids_len = newLen;
-}
-
 /* Connect to the Wayland socket defined by WAYLAND_DISPLAY env var or default.
  * - Returns an open fd on success, or -1 on failure with errno set.
  *
@@ -176,395 +373,7505 @@ static void store_old_id(uint32_t *old_ids, uint32_t *old_ids_len, uint32_t id)
  *    locations. Keep implementation simple: use getenv(WAYLAND_SOCKET_ENV)
  *    and connect to a UNIX domain socket with that name.
  */
-static int wayland_display_connect() {
-  /*: implement connection logic */
-  char *xdg_runtime_dir = getenv("XDG_RUNTIME_DIR");
-  if (xdg_runtime_dir=NULL) {
-    return EINVAL;
-  }
+#ifndef KASAMA_LIBWAYLAND
+static int wayland_display_connect(void) {
+  char *wayland_display = getenv(WAYLAND_SOCKET_ENV);
+  if (wayland_display == NULL || *wayland_display == '\0')
+    wayland_display = DEFAULT_WAYLAND_SOCKET;
+  uint64_t wayland_display_len = strlen(wayland_display);
 
-  uint64_t xdg_runtime_dir_len = strlen(xdg_runtime_dir);
-  
   struct sockaddr_un addr = {.sun_family = AF_UNIX};
-  assert(xdg_runtIme_dir_len <= cstring_len(addr.sun_path));
-  uint64_t socket_path_len  = 0;
-
-  memcpy(addr.sun_path, xdg_runtime_dir, xdg_runtime_dir_len);
-  socket_path_len += xdg_runtime_dir_len;
+  uint64_t socket_path_len = 0;
 
-  addr.sun_path[socket_path_len++] = '/';
-
-  char *wayland_display = getenv("WAYLAND_DISPLAY");
-  uint64_t wayland_display_len = strlen(wayland_display);
-  memcyp(addr.sun_path + socket_path_len, wayland_display, wayland_display_len);
-
-  socket_path_len += wayland_display_len;
+  if (wayland_display[0] != '/') { // relative to the runtime dir, like libwayland
+    char *xdg_runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (xdg_runtime_dir == NULL) {
+      errno = ENOENT;
+      return -1;
+    }
+    uint64_t xdg_runtime_dir_len = strlen(xdg_runtime_dir);
+    if (xdg_runtime_dir_len + 1 >= sizeof(addr.sun_path)) {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+    memcpy(addr.sun_path, xdg_runtime_dir, xdg_runtime_dir_len);
+    socket_path_len += xdg_runtime_dir_len;
+    addr.sun_path[socket_path_len++] = '/';
+  }
 
-  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (socket_path_len + wayland_display_len >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memcpy(addr.sun_path + socket_path_len, wayland_display, wayland_display_len);
 
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
   if (fd == -1)
-      exit(errno);
-
-  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))==-1)
-      exit(errno);
+    return -1;
 
-  return -1;
-}
-
-/* Buffer write helpers for message marshaling. These functions append to a
- * character buffer while maintaining size and capacity. Use
- * these helpers to prepare Wayland messages to write to the socket.
- */
-
-static void buf_write_u32(char *buf, uint64_t *buf_size, uint64_t buf_cap, uint32_t x) {
-  /* write a 32-bit little-endian value into buf, update buf_size. */
-  (void)buf; (void)buf_size; (void)buf_cap; (void)x;
-  assert(*buf_size + sizeof(x) <= buf_cap); // first general check
-  assert(((size_t)buf + *buf_size) % sizeof(x) == 0); // checks if exactly enough room
-  *(uint32_t *)(buf + *buf_size) = x;
-  *buf_size += sizeof(x);
-}
-
-static void buf_write_u16(char *buf, uint64_t *buf_size, uint64_t buf_cap, uint16_t x) {
-  /* write a 16-bit little-endian value into buf, update buf_size. */
-  (void)buf; (void)buf_size; (void)buf_cap; (void)x;
-  assert(*buf_size + sizeof(x) <= buf_cap);
-  assert(((size_t)buf + *buf_size) % sizeof(x) == 0);
-  *(uint16_t *)(buf + *buf_size) = x;
-  *buf_size += sizeof(x);
-}
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
 
-static void buf_write_string(char *buf, uint64_t *buf_size, uint64_t buf_cap,
-                             char *src, uint32_t src_len) {
-  /* Write a null-terminated string with 4-byte padding as Wayland expects. */
-  (void)buf; (void)buf_size; (void)buf_cap; (void)src; (void)src_len;
-  assert(*buf_size + src_len <= buf_cap);
-  
-  buf_write_u32(buf, buf_size, buf_cap, src_len);
-  memcpy(buf + *buf_size, src, roudnup_4(src_len);
-  *buf_size += roundup_4(src_len);
+  return fd;
 }
+#endif
 
-/* Buffer read helpers: advance the buffer pointer and parse values. These are
- * small convenience functions to unpack incoming messages. Make sure to check
- * bounds (buf_size) before reading bytes.
+/* Buffer read helpers: advance the buffer pointer and parse values. Only the
+ * message header is read this way; arguments are decoded by the generated
+ * _unpack() functions. Make sure to check bounds (buf_size) before reading.
  */
 static uint32_t buf_read_u32(char **buf, uint64_t *buf_size) {
-  (void)buf; (void)buf_size;
   /* read 4 bytes as little-endian u32, advance *buf by 4, decrement *buf_size */
   assert(*buf_size >= sizeof(uint32_t));
   assert((size_t)*buf % sizeof(uint32_t) == 0);
 
   uint32_t res = *(uint32_t *)(*buf);
   *buf += sizeof(res);
-  *buf_size = sizeof(res);
+  *buf_size -= sizeof(res);
   return res;
 }
 
 static uint16_t buf_read_u16(char **buf, uint64_t *buf_size) {
-  (void)buf; (void)buf_size;
   /* Read 2 bytes as little-endian u16, advance *buf by 2, decrement *buf_size */
   assert(*buf_size >= sizeof(uint16_t));
   assert((size_t)*buf % sizeof(uint16_t) == 0);
   
   uint16_t res = *(uint16_t *)(*buf);
   *buf += sizeof(res);
-  *buf_size = sizeof(res);
+  *buf_size -= sizeof(res);
   return res;
 }
 
-static void buf_read_n(char **buf, uint64_t *buf_size, char *dst, uint64_t n) {
-  (void)buf; (void)buf_size; (void)dst; (void)n;
-  /* Copy n bytes from *buf into dst and advance pointer. */
-  assert(*buf_size >= n);
-  // copy n bytes from src to dst
-  memcpy(dst, *buf, n);
-  *buf += n;
-  *buf_size -= n;
+/* ------------------- Tracing -------------------------------------------- */
+
+/* Protocol tracing, compiled in with -DKASAMA_TRACE. Every request queued and
+ * every event dispatched appends one fixed-size binary record to a ring that
+ * is allocated up front: no formatting, no allocation and no syscall beyond
+ * the clock read, so a traced build keeps the timing of an untraced one. Once
+ * the ring is full the oldest records are overwritten.
+ *
+ * trace_dump() writes the ring to a file, on SIGUSR1 and at exit when
+ * KASAMA_TRACE_FILE is set. kasama_trace.c decodes the file into
+ * WAYLAND_DEBUG-style text and per-message latency histograms.
+ */
+#define TRACE_RING_LEN 65536U      /* records, power of two */
+#define TRACE_MAGIC "KASTRACE"
+#define TRACE_VERSION 1U
+
+typedef enum trace_direction_t trace_direction_t;
+typedef struct trace_record_t trace_record_t;
+typedef struct trace_file_header_t trace_file_header_t;
+
+enum trace_direction_t {
+  TRACE_REQUEST,
+  TRACE_EVENT,
+};
+
+struct trace_record_t {
+  uint64_t ns;                 // CLOCK_MONOTONIC when queued or dispatched
+  uint32_t object_id;
+  uint32_t arg;                // first argument word (often a new_id), 0 if none
+  uint32_t handler_ns;         // events: time spent in the handler
+  uint16_t opcode;
+  uint16_t size;               // bytes on the wire, header included
+  uint8_t direction;           // trace_direction_t
+  uint8_t interface;           // wayland_interface_t of object_id
+  uint8_t reserved[6];
+};
+
+/* A dump is this header followed by `records` records, oldest first */
+struct trace_file_header_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t records;
+  uint64_t dropped;            // overwritten before the dump
+};
+
+static uint64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
 }
 
-/* ---------------- Wayland message helper stubs (marshalling helpers) -------- */
+static int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
 
-/* The following are simplified stubs that mirror the original file's function
- * signatures. For the assignment, implement them to send the appropriate
- * Wayland requests to create pools, buffers, surfaces, and to bind registry
- * interfaces. The comments give the expected purpose and parameters.
+/* Percentiles (0-100) of the samples kept in a ring of `cap` entries that
+ * has had `taken` samples written to it, oldest overwritten.
+ * - Returns false if there are no samples yet.
  */
+static bool sample_ring_percentiles(const uint32_t *ring, uint64_t taken, uint32_t cap,
+                                    const uint32_t *p, uint32_t *out, uint32_t n) {
+  static uint32_t sorted[INPUT_LATENCY_CAP > FRAME_TIMES_CAP ? INPUT_LATENCY_CAP : FRAME_TIMES_CAP];
+  uint64_t len = taken < cap ? taken : cap;
+  if (len == 0)
+    return false;
+  memcpy(sorted, ring, sizeof(*sorted) * len);
+  qsort(sorted, len, sizeof(*sorted), compare_u32);
+  for (uint32_t i = 0; i < n; i++)
+    out[i] = sorted[(len - 1) * p[i] / 100];
+  return true;
+}
 
-/* Example: obtain the wl_registry object by asking the display for 'get_registry' */
-static uint32_t wayland_wl_display_get_registry(int fd) {
-  /* Build and send a wl_display.get_registry request over fd.
-   * Return an object id assigned locally for the registry, or 0 on failure.
-   *
-   * Hints:
-   *  - You will need to marshal the message into a buffer using buf_write_*.
-   *  - Wayland messages use 4-byte alignment for total length and padding.
-   */
+#ifdef KASAMA_TRACE
+static trace_record_t trace_ring[TRACE_RING_LEN];
+static uint64_t trace_head;    // records ever written
+
+static trace_record_t *trace_record(trace_direction_t direction, uint8_t interface, uint32_t object_id,
+                                    uint16_t opcode, uint16_t size, uint32_t arg) {
+  trace_record_t *record = &trace_ring[trace_head++ & (TRACE_RING_LEN - 1)];
+  *record = (trace_record_t){.ns = monotonic_ns(), .object_id = object_id, .arg = arg,
+                             .opcode = opcode, .size = size, .direction = (uint8_t)direction,
+                             .interface = interface};
+  return record;
+}
+
+/* Write the ring to `path`, oldest record first.
+ * - Returns 0, or -1 with errno set.
+ */
+static int trace_dump(const char *path) {
+  uint64_t head = trace_head;
+  uint64_t records = head < TRACE_RING_LEN ? head : TRACE_RING_LEN;
+  trace_file_header_t header = {.magic = TRACE_MAGIC, .version = TRACE_VERSION,
+                                .record_size = sizeof(trace_record_t),
+                                .records = records, .dropped = head - records};
 
-  (void)fd;
-  uint64_t msg_size = 0;
-  char msg[128] = "";
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1)
+    return -1;
+  // the ring wraps at most once: [first, end) then [0, head)
+  uint64_t first = (head - records) & (TRACE_RING_LEN - 1);
+  uint64_t first_len = records < TRACE_RING_LEN - first ? records : TRACE_RING_LEN - first;
+  struct iovec iov[3] = {
+    {.iov_base = &header, .iov_len = sizeof(header)},
+    {.iov_base = trace_ring + first, .iov_len = first_len * sizeof(trace_record_t)},
+    {.iov_base = trace_ring, .iov_len = (records - first_len) * sizeof(trace_record_t)},
+  };
+  uint64_t total = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
 
-  buf_write_u32(msg, &msg_size, sizeof(msg), wayland_display_object_id);
-  buf_write_u16(msg, &msg_size, sizeof(msg), wayland_wl_display_get_registry_opcode);
+  ssize_t n = writev(fd, iov, 3);
+  int err = n == -1 ? errno : EIO;
+  close(fd);
+  if (n != (ssize_t)total) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
 
-  uint16_t msg_announced_size = wayland_header_size + sizeof(wayland_current_id);
-  assert(roundup_4(msg_announced_size) == msg_announced_size);
-  wayland_current_id++;
+static uint32_t trace_first_word(const char *payload, uint64_t payload_len) {
+  uint32_t word = 0;
+  if (payload_len >= sizeof(word))
+    memcpy(&word, payload, sizeof(word));
+  return word;
+}
 
-  buf_write_u16(msg, &msg_size, sizeof(msg), wayland_current_id);
+/* Bracket an event handler; the record's handler_ns covers what's between */
+#define TRACE_EVENT_BEGIN(record, interface, object_id, opcode, size, payload, payload_len) \
+  trace_record_t *record = trace_record(TRACE_EVENT, interface, object_id, opcode, size, \
+                                        trace_first_word(payload, payload_len))
+#define TRACE_EVENT_END(record) \
+  (record->handler_ns = (uint32_t)(monotonic_ns() - record->ns))
+#else
+static int trace_dump(const char *path) {
+  (void)path;
+  errno = ENOTSUP;
+  return -1;
+}
 
-  if((int64_t)msg_size != send(fd, msg, msg_size, MSG_DONTWAIT))
-    exit(errno);
+#define TRACE_EVENT_BEGIN(record, interface, object_id, opcode, size, payload, payload_len) ((void)0)
+#define TRACE_EVENT_END(record) ((void)0)
+#endif
 
-  return wayland_current_id;
+/* Where a dump goes: $KASAMA_TRACE_FILE, or kasama-<pid>.trace in the
+ * working directory. */
+static const char *trace_path(void) {
+  static char path[64];
+  const char *env = getenv("KASAMA_TRACE_FILE");
+  if (env)
+    return env;
+  snprintf(path, sizeof(path), "kasama-%d.trace", (int)getpid());
+  return path;
 }
 
-static uint32_t wayland_wl_registry_bind(int fd, uint32_t registry, uint32_t name,
-                                         char *interface, uint32_t interface_len, uint32_t version) {
-  /* Send wl_registry.bind to bind an advertised global. Return local object id. */
-  (void)fd; (void)registry; (void)name; (void)interface; (void)interface_len; (void)version;
-  uint64_t msg_size = 0;
-  char msg[512] = "";
-  buf_write_u32(msg, &msg_size, sizeof(msg), registry);
-  buf_write_u16(msg, &msg_size, sizeof(msg), wayland_wl_display_get_registry_opcode);
-  
-  uint16_t msg_announced_size = wayland_header_size + sizeof(name) + sizeof(interface_len) + roundup_4(inferface_len) + sizeof(version) + sizeof(wayland_current_id);
-  assert(roundup_4(msg_announced_size) == msg_announced_size);
-  
-  buf_write_u16(msg, &msg_size, sizeof(msg), msg_annoucned_size);
+/* ---------------- Outgoing request queue -------------------------------- */
 
-  buf_write_u32(msg, &msg_size, sizeof(msg), name);
-  buf_write_string(msg, &msg_size, sizeof(msg), interface, interface_len);
-  buf_write_u32(msg, &msg_size, sizeof(msg), version);
+/* Requests are not written to the socket one at a time. Every marshalling
+ * helper below appends its message to the connection's outgoing ring with the
+ * generated _pack() stubs, and file descriptors travelling with a request are
+ * queued next to it. wayland_conn_flush() then hands everything to the kernel
+ * with a single sendmsg(). The event loop flushes once at the end of each
+ * iteration; a helper that finds the ring full flushes early.
+ *
+ * Why pass fds at all? Pixel buffers are shared, not copied: the client sends
+ * the compositor a file descriptor for a shared memory region (wl_shm) as
+ * SCM_RIGHTS ancillary data, and both sides mmap the same memory.
+ */
+#define WAYLAND_OUT_CAP 4096U     /* ring size, power of two and multiple of 4 */
+#define WAYLAND_MAX_FDS_OUT 28U   /* same per-sendmsg limit libwayland uses */
+#define WAYLAND_MSG_SCRATCH 512U  /* largest request we ever marshal */
+#define WAYLAND_IN_CAP 16384U     /* receive ring, power of two */
+#define WAYLAND_MAX_MSG_SIZE 4096U /* protocol limit for a single message */
+#define WAYLAND_MAX_FDS_IN 32U    /* power of two */
 
-  wayland_current_id++;
-  buf_write_u32(msg, &msg_size, sizeof(msg), wayland_current_id);
+typedef struct wayland_conn_stats_t wayland_conn_stats_t;
+typedef struct wayland_conn_t wayland_conn_t;
+typedef struct wayland_object_t wayland_object_t;
+typedef struct wayland_vtable_t wayland_vtable_t;
+typedef enum wayland_interface_t wayland_interface_t;
 
-  assert(msg_size == roundup_4(msg_size));
-  
-  if((int64_t)msg_size != send(fd, msg, msg_size, 0))
-    exit(errno);
+/* Interfaces the client knows how to speak. Stored per object so handlers
+ * can check what an id refers to without a string compare. */
+enum wayland_interface_t {
+  WAYLAND_INTERFACE_NONE,
+  WAYLAND_WL_DISPLAY,
+  WAYLAND_WL_REGISTRY,
+  WAYLAND_WL_CALLBACK,
+  WAYLAND_WL_COMPOSITOR,
+  WAYLAND_WL_SHM,
+  WAYLAND_WL_SHM_POOL,
+  WAYLAND_WL_BUFFER,
+  WAYLAND_WL_SURFACE,
+  WAYLAND_WL_SEAT,
+  WAYLAND_WL_POINTER,
+  WAYLAND_WL_KEYBOARD,
+  WAYLAND_XDG_WM_BASE,
+  WAYLAND_XDG_SURFACE,
+  WAYLAND_XDG_TOPLEVEL,
+};
 
-  return wayland_current_id;
-}
+/* Event handler: payload points just past the message header, in place in
+ * the receive ring. */
+typedef void (*wayland_event_handler_t)(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                        char *payload, uint64_t payload_len);
 
-/* Create a shm pool object associated with a file descriptor backing shared memory */
-static uint32_t wayland_wl_shm_create_pool(int fd, state_t *state) {
-  (void)fd; (void)state;
-  /*  create a wl_shm_pool object (marshal create_pool request) */
-
-  assert(state->shm_pool_size > 0);
-
-  uint64_t msg_size = 0;
-  char msg[128] = "";
-  buf_write_u32(msg, &msg_size, sizeof(msg), state->wl_shm);
-  buf_write_u16(msg, &msg_size, sizeof(msg), wayland_wl_shm_create_pool_opcode);
-  uint16_t msg_announced_size = wayland_header_size + sizeof(wayland_current_id) + sizeof(shm_pool_size);
-
-  assert(msg_announced_size == roundup_4(msg_announced_size));
-  buf_write_u16(msg, &msg_size, sizeof(msg), msg_announced_size);
-
-  wayland_current_id++;
-  buf_write_u32(msg, &msg_size, sizeof(msg), wayland_current_id);
-  buf_write_u32(msg, &msg_size, sizeof(msg), state->shm_pool_size);
-
-  assert(msg_size == roundup_4(msg));
-  /* The following will be macros to assist in sending the wayland file descriptor as ancillary data.
-   * Why? In this case, we want to share pixel buffers for rendering. 
-   * Rather than copy large amounts of pixel data between client and compositor, 
-   * a file descriptor for a shared memory region (created by wl_shm) is passed.
-   * Then, both client and compositor can mmap the FD and access to the same memory region.
-   *
-   * Consequence: No memory copying, greater performance.
-   */
-  char buf[CMSG_SPACE(sizeof(state->shm_fd))] = ""; // create ancillary buffer for new FD
+/* Per-interface dispatch table, indexed by event opcode. NULL entries are
+ * events we accept and ignore. */
+struct wayland_vtable_t {
+  const char *name;
+  wayland_interface_t interface;
+  uint16_t event_count;
+  const wayland_event_handler_t *events;
+  const uint8_t *event_fds;       // fds each event carries, NULL if none do
+};
 
-  struct iovec io = {.iov_base = msg, .iov_len = msg_size}; // memory region, starting address & size of memory
-  struct msghdr socket_msg = {
-    .msg_iov = &io,
-    .msg_iovlen = 1,
-    .msg_control = control,
-    .msg_controllen = sizeof(control),
-  };
-  
-  struct cmsghdr *cmdhr = CMSG_FIRSTHDR($socket_msg);
-  cmdhr->cmdhr_level = SOL_SOCKET;
-  cmdhr->cmdhr_type = SCM_RIGHTS;
-  cmdhr->cmdhr_len = CMSG_LEN(sizeof(state->shm_fd));
+/* One slot of the client object table. The slot index is the object id. */
+struct wayland_object_t {
+  const wayland_vtable_t *vtable; // NULL while the slot is on the free list
+  uint8_t interface;              // wayland_interface_t
+  bool zombie;                    // destroyed, waiting for wl_display.delete_id
+  uint32_t data;                  // per-object payload, e.g. a swapchain slot
+  uint32_t next_free;             // free list link, 0 terminates
+#ifdef KASAMA_LIBWAYLAND
+  struct wl_proxy *proxy;         // libwayland's side of the object
+#endif
+};
 
-  *((int *)CMSG_DATA(cmdhr)) = state->shm_fd;
-  socket_msg.msg_controllen = CMSG_SPACE(sizeof(state->shm_fd));
+/* Counters for tuning the write path. A "frame" runs from one presented
+ * frame to the next (frame_maybe_render closes it with
+ * wayland_conn_stats_frame()); syscalls are every sendmsg, poll and close
+ * issued by the queue. */
+struct wayland_conn_stats_t {
+  uint64_t flushes;            // flushes that had bytes to send
+  uint64_t sendmsg_calls;      // including ones that hit EAGAIN
+  uint64_t bytes_sent;
+  uint64_t fds_sent;
+  uint64_t eagain;             // times the kernel pushed back
+  uint64_t syscalls;           // total syscalls issued by the queue
+  uint64_t last_flush_bytes;
+  uint64_t max_flush_bytes;
 
-  if(sendmsg(fd, &socket_msg, 0) == -1)
-    exit(errno);
+  uint64_t recvmsg_calls;      // including ones that hit EAGAIN
+  uint64_t bytes_received;
+  uint64_t fds_received;
+  uint64_t messages_dispatched;
+  uint64_t max_messages_per_read;
 
-  LOG("-> wl_shm@%u.create_pool: wl_shm_pool=%u\n", state->wl_shm, wayland_current_id);
-  return wayland_current_id;
-}
+  uint64_t frames;
+  uint64_t frame_syscalls;     // syscalls since the last frame mark
+  uint64_t last_frame_syscalls;
+  uint64_t max_frame_syscalls;
+};
 
-/* Create a buffer from the shm pool */
-static uint32_t wayland_wl_shm_pool_create_buffer(int fd, state_t *state) {
-  (void)fd; (void)state;
-  /* allocate and create a wl_buffer using wl_shm_pool.create_buffer */
-  assert(state->shm_pool_size > 0);
+struct wayland_conn_t {
+  int fd;
+  int error;                   // sticky errno once the connection is broken
+  bool out_blocked;            // socket full; wait for POLLOUT before flushing
 
-  uint64_t msg_size = 0;
-  char msg[128] = "";
-  buf_write_u32(msg, &msg_size, sizeof(msg), state->wl_shm);
-  buf_write_u16(msg, &msg_size, sizeof(msg), wayland_wl_shm_pool_create_buffer_opcode);
-  uint16_t msg_announced_size = wayland_header_size + sizeof(wayland_current_id) + sizeof(uint32_t) * 5;
-  
-  assert(roundup_4(msg_announced_size) == msg_announced_size);
-  buf_write_u16(msg, &msg_size, sizeof(msg), msg_announced_size);
-  wayland_current_id++;
-  buf_write_u32(msg, &msg_size, sizeof(msg), wayland_current_id);
-  uint32_t offset = 0;
-  buf_write_u32(msg, &msg_size, sizeof(msg), offset);
-  buf_write_u32(msg, &msg_size, sizeof(msg), state->w);
-  buf_write_u32(msg, &msg_size, sizeof(msg), state->h);
-  buf_write_u32(msg, &msg_size, sizeof(msg), state->stride); 
-
-  uint32_t format = wayland_format_xrgb8888;
-  buf_write_u32(msg, &msg_size, sizeof(msg), format);
-  
-  if((int64_t)msg_size != send(fd, msg, msg_size, 0))
-    exit(errno);
+  _Alignas(uint32_t) char out[WAYLAND_OUT_CAP];
+  uint32_t out_head;           // offset of the first unsent byte
+  uint32_t out_len;            // queued bytes starting at out_head
 
-  LOG("-> wl_shm_pool@%u.create.buffer: wl_buffer=%u\n", state->wl_shm_pool, wayland_current_id);
+  _Alignas(uint32_t) char scratch[WAYLAND_MSG_SCRATCH];
+  bool msg_in_scratch;         // message straddles the end of the ring
 
-  return wayland_current_id;
-}
+  int out_fds[WAYLAND_MAX_FDS_OUT]; // owned dups, closed once sent
+  uint32_t out_fds_len;
 
-static void wayland_wl_buffer_destroy(int fd, uint32_t wl_buffer) {
-  (void)fd; (void)wl_buffer;
-  /* TODO: send wl_buffer.destroy for the given object id */
-}
+  /* Receive side: bytes land in `in` straight from recvmsg() and complete
+   * messages are dispatched from there. Only a message that wraps around the
+   * end of the ring is copied, into in_scratch, so it can be read linearly. */
+  _Alignas(uint32_t) char in[WAYLAND_IN_CAP];
+  uint32_t in_head;            // offset of the first undispatched byte
+  uint32_t in_len;             // received bytes starting at in_head
+  _Alignas(uint32_t) char in_scratch[WAYLAND_MAX_MSG_SIZE];
 
-static void wayland_wl_surface_attach(int fd, uint32_t wl_surface, uint32_t wl_buffer) {
-  (void)fd; (void)wl_surface; (void)wl_buffer;
-  /* TODO: send wl_surface.attach with buffer and commit if needed */
-}
+  int in_fds[WAYLAND_MAX_FDS_IN]; // received fds waiting for their event
+  uint32_t in_fds_head;
+  uint32_t in_fds_len;
+
+  /* Client object table: dense, indexed by object id, so dispatch is a
+   * single array load. Ids released by wl_display.delete_id go on a free list
+   * and are handed out again before the table grows. */
+  wayland_object_t *objects;
+  uint32_t objects_len;        // ids [0, objects_len) have been handed out
+  uint32_t objects_cap;
+  uint32_t objects_free;       // head of the free list, 0 if empty
+
+#ifdef KASAMA_LIBWAYLAND
+  struct wl_display *display;
+  state_t *dispatch_state;     // for the dispatcher, during wayland_conn_dispatch
+#endif
+  wayland_conn_stats_t stats;
+};
 
-static uint32_t wayland_wl_surface_frame(int fd, uint32_t wl_surface) {
-  (void)fd; (void)wl_surface;
-  /* TODO: request a callback for next frame (wl_surface.frame) */
+/* The transport. The client reaches the socket only through these, so it
+ * runs unchanged on either of two implementations picked at compile time:
+ *  - the wire engine in this file (the default): requests packed straight
+ *    into the outgoing ring and sent with one sendmsg() per flush, events
+ *    dispatched in place from the receive ring, no dependencies
+ *  - libwayland-client, with -DKASAMA_LIBWAYLAND (see "libwayland-client
+ *    transport"), kept to measure the engine against
+ */
+static int wayland_conn_connect(wayland_conn_t *conn);
+static void wayland_conn_free(wayland_conn_t *conn);
+static int wayland_conn_flush(wayland_conn_t *conn);
+static int wayland_conn_queue_fd(wayland_conn_t *conn, int fd);
+static uint32_t *wayland_msg_begin(wayland_conn_t *conn, uint32_t size);
+static void wayland_msg_end(wayland_conn_t *conn, uint32_t *msg, uint32_t size);
+static int64_t wayland_conn_read(wayland_conn_t *conn);
+static int64_t wayland_conn_dispatch(wayland_conn_t *conn, state_t *state);
+static int wayland_conn_take_fd(wayland_conn_t *conn);
+#ifdef KASAMA_LIBWAYLAND
+static void wayland_conn_drop_proxy(wayland_conn_t *conn, uint32_t id);
+#endif
+
+static uint32_t wayland_object_new(wayland_conn_t *conn, const wayland_vtable_t *vtable);
+
+/* Dispatch tables, defined with their handlers in the event handling section */
+static const wayland_vtable_t wayland_wl_display_vtable;
+static const wayland_vtable_t wayland_wl_registry_vtable;
+static const wayland_vtable_t wayland_wl_callback_vtable;
+static const wayland_vtable_t wayland_wl_shm_pool_vtable;
+static const wayland_vtable_t wayland_wl_buffer_vtable;
+static const wayland_vtable_t wayland_xdg_toplevel_vtable;
+static const wayland_vtable_t wayland_wl_compositor_vtable;
+static const wayland_vtable_t wayland_wl_shm_vtable;
+static const wayland_vtable_t wayland_wl_surface_vtable;
+static const wayland_vtable_t wayland_wl_seat_vtable;
+static const wayland_vtable_t wayland_wl_pointer_vtable;
+static const wayland_vtable_t wayland_wl_keyboard_vtable;
+static const wayland_vtable_t wayland_xdg_wm_base_vtable;
+static const wayland_vtable_t wayland_xdg_surface_vtable;
+
+/* Set up a connection around an already connected socket.
+ * - Returns 0, or -1 with errno set if the object table can't be allocated.
+ */
+static int wayland_conn_init(wayland_conn_t *conn, int fd) {
+  memset(conn, 0, sizeof(*conn));
+  conn->fd = fd;
+  conn->objects_len = wayland_display_object_id; // id 0 is the null object
+
+  if (wayland_object_new(conn, &wayland_wl_display_vtable) != wayland_display_object_id)
+    return -1;
   return 0;
 }
 
-static uint32_t wayland_xdg_surface_get_toplevel(int fd, state_t *state) {
-  (void)fd; (void)state;
-  /* TODO: send xdg_surface.get_toplevel and return assigned object id */
+#ifndef KASAMA_LIBWAYLAND
+/* Connect to the compositor: the socket, then the connection around it.
+ * - Returns 0, or -1 with errno set.
+ */
+static int wayland_conn_connect(wayland_conn_t *conn) {
+  int fd = wayland_display_connect();
+  if (fd == -1)
+    return -1;
+  if (wayland_conn_init(conn, fd) == -1) {
+    close(fd);
+    return -1;
+  }
   return 0;
 }
 
-static void wayland_wl_surface_commit(int fd, state_t *state) {
-  (void)fd; (void)state;
-  /* TODO: send wl_surface.commit; this applies attached buffers */
+/* Close the socket and every fd still queued in either direction. */
+static void wayland_conn_free(wayland_conn_t *conn) {
+  for (uint32_t i = 0; i < conn->out_fds_len; i++)
+    close(conn->out_fds[i]);
+  for (uint32_t i = 0; i < conn->in_fds_len; i++)
+    close(conn->in_fds[(conn->in_fds_head + i) & (WAYLAND_MAX_FDS_IN - 1)]);
+  if (conn->fd != -1)
+    close(conn->fd);
+  free(conn->objects);
+  memset(conn, 0, sizeof(*conn));
+  conn->fd = -1;
 }
+#endif
 
-static void wayland_wl_surface_damage_buffer(int fd, uint32_t wl_surface,
-                                             uint32_t x, uint32_t y,
-                                             uint32_t w, uint32_t h) {
-  (void)fd; (void)wl_surface; (void)x; (void)y; (void)w; (void)h;
-  /* TODO: send wl_surface.damage_buffer with rectangle extents */
+static void wayland_conn_count_syscall(wayland_conn_t *conn) {
+  conn->stats.syscalls++;
+  conn->stats.frame_syscalls++;
 }
 
-static uint32_t wayland_wl_seat_get_pointer(int fd, uint32_t wl_seat) {
-  (void)fd; (void)wl_seat;
-  /* TODO: request a pointer object from wl_seat */
-  return 0;
+/* Close the frame bracket: roll the per-frame syscall count into the stats. */
+static void wayland_conn_stats_frame(wayland_conn_t *conn) {
+  wayland_conn_stats_t *s = &conn->stats;
+  s->frames++;
+  s->last_frame_syscalls = s->frame_syscalls;
+  if (s->frame_syscalls > s->max_frame_syscalls)
+    s->max_frame_syscalls = s->frame_syscalls;
+  s->frame_syscalls = 0;
 }
 
-/* ------------------- Simple renderer helpers ------------------------------ */
+static void wayland_conn_stats_log(wayland_conn_t *conn) {
+  wayland_conn_stats_t *s = &conn->stats;
+  LOG("wire: flushes=%" PRIu64 " sendmsg=%" PRIu64 " eagain=%" PRIu64 " bytes_sent=%" PRIu64
+      " bytes_received=%" PRIu64 " messages=%" PRIu64 " syscalls=%" PRIu64 "\n",
+      s->flushes, s->sendmsg_calls, s->eagain, s->bytes_sent, s->bytes_received, s->messages_dispatched,
+      s->syscalls);
+  LOG("wire frames: frames=%" PRIu64 " syscalls last=%" PRIu64 " max=%" PRIu64 " avg=%.1f\n", s->frames,
+      s->last_frame_syscalls, s->max_frame_syscalls,
+      s->frames ? (double)s->syscalls / (double)s->frames : 0.0);
+}
 
-/* Clear a region of pixels in the shm buffer. Pixels are 32-bit ARGB or similar. */
-static void renderer_clear(volatile uint32_t *pixels, uint64_t size, uint32_t color_rgb) {
-  (void)pixels; (void)size; (void)color_rgb;
-  /* Clear `size` pixels to color_rgb. Handle volatile pointers. */
+#ifndef KASAMA_LIBWAYLAND
+/* Send as much of the ring as the socket accepts, in one sendmsg() unless the
+ * kernel only takes part of it. All queued fds ride on the first call, which
+ * always precedes (or carries) the bytes of the requests that use them.
+ * - Returns 0 when everything was sent or the socket is full (out_blocked is
+ *   then set and the rest stays queued), -1 with errno on a broken connection.
+ */
+static int wayland_conn_flush(wayland_conn_t *conn) {
+  if (conn->error) {
+    errno = conn->error;
+    return -1;
+  }
+  if (conn->out_len == 0)
+    return 0;
 
-  for (uint64_t i = 0; i < size; i++)
-    pixels[i] = color_rgb;
-}
+  conn->stats.flushes++;
+  uint64_t flushed = 0;
+
+  while (conn->out_len > 0) {
+    struct iovec iov[2];
+    int iovcnt = 1;
+    uint32_t first = WAYLAND_OUT_CAP - conn->out_head;
+    if (first > conn->out_len)
+      first = conn->out_len;
+    iov[0] = (struct iovec){.iov_base = conn->out + conn->out_head, .iov_len = first};
+    if (first < conn->out_len) {
+      iov[1] = (struct iovec){.iov_base = conn->out, .iov_len = conn->out_len - first};
+      iovcnt = 2;
+    }
 
-/* Draw a filled rectangle in the framebuffer */
-static void renderer_draw_rect(volatile uint32_t *dst, uint64_t dst_w,
-                               uint64_t dst_h, uint32_t dst_stride,
-                               uint64_t rect_x, uint64_t rect_y,
-                               uint64_t rect_w, uint64_t rect_h,
-                               uint32_t color_rgb) {
-  (void)dst; (void)dst_w; (void)dst_h; (void)dst_stride;
-  (void)rect_x; (void)rect_y; (void)rect_w; (void)rect_h; (void)color_rgb;
-  /* implement safe rectangle drawing with bounds checks. */
+    union { // keeps the control buffer aligned for struct cmsghdr
+      char buf[CMSG_SPACE(sizeof(int) * WAYLAND_MAX_FDS_OUT)];
+      struct cmsghdr align;
+    } control;
+    struct msghdr socket_msg = {.msg_iov = iov, .msg_iovlen = iovcnt};
 
-  uint64_t dst_len = window_w * window_h;
+    if (conn->out_fds_len > 0) {
+      uint64_t fds_size = sizeof(int) * conn->out_fds_len;
+      memset(control.buf, 0, sizeof(control.buf));
+      socket_msg.msg_control = control.buf;
+      socket_msg.msg_controllen = CMSG_SPACE(fds_size);
 
-  for(uint64_t src.y = 0; src.y < rec_h; src.y++){
-    for(uint64_t src.x = 0; src.x < rect_w; src.x++) {
-      uint64_t x = dst_x + src_x;
-      uint64_t y = dst_y + src_y;
+      struct cmsghdr *cmsg = CMSG_FIRSTHDR(&socket_msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(fds_size);
+      memcpy(CMSG_DATA(cmsg), conn->out_fds, fds_size);
+    }
+
+    ssize_t sent = sendmsg(conn->fd, &socket_msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    conn->stats.sendmsg_calls++;
+    wayland_conn_count_syscall(conn);
 
-      if (x >= window_w || y >= window_h)
+    if (sent == -1) {
+      if (errno == EINTR)
         continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        conn->stats.eagain++;
+        conn->out_blocked = true;
+        break;
+      }
+      conn->error = errno;
+      return -1;
+    }
 
-      uint64_t pos = window_w * y + x;
+    // the kernel now holds its own references to the fds we sent
+    for (uint32_t i = 0; i < conn->out_fds_len; i++) {
+      close(conn->out_fds[i]);
+      wayland_conn_count_syscall(conn);
     }
+    conn->stats.fds_sent += conn->out_fds_len;
+    conn->out_fds_len = 0;
+
+    conn->out_head = (conn->out_head + (uint32_t)sent) & (WAYLAND_OUT_CAP - 1);
+    conn->out_len -= (uint32_t)sent;
+    flushed += (uint64_t)sent;
   }
+
+  if (conn->out_len == 0) {
+    conn->out_head = 0; // keep the common case contiguous
+    conn->out_blocked = false;
+  }
+
+  conn->stats.bytes_sent += flushed;
+  conn->stats.last_flush_bytes = flushed;
+  if (flushed > conn->stats.max_flush_bytes)
+    conn->stats.max_flush_bytes = flushed;
+  return 0;
 }
 
-/* Compose a full frame by drawing the entities and other UI elements */
-static void render_frame(int fd, state_t *state) {
-  (void)fd; (void)state;
-  /* TODO: call renderer_clear and renderer_draw_rect to populate the shm buffer,
-   * then attach the buffer to the surface and commit. This drives on-screen pixels.
-   */
+/* Backpressure: block until the compositor has drained the socket enough for
+ * us to make progress. Only used when the ring itself is full. */
+static int wayland_conn_wait_writable(wayland_conn_t *conn) {
+  struct pollfd pfd = {.fd = conn->fd, .events = POLLOUT};
+  for (;;) {
+    int ret = poll(&pfd, 1, -1);
+    wayland_conn_count_syscall(conn);
+    if (ret == -1 && errno == EINTR)
+      continue;
+    if (ret == -1) {
+      conn->error = errno;
+      return -1;
+    }
+    if (pfd.revents & (POLLERR | POLLHUP)) {
+      conn->error = EPIPE;
+      return -1;
+    }
+    conn->out_blocked = false;
+    return 0;
+  }
 }
 
-/* ------------------- Event handling ------------------------------------- */
+/* Make room for `size` more bytes in the ring, flushing (and waiting on the
+ * socket if it is full) as needed. Returns 0, or -1 on a broken connection. */
+static int wayland_conn_reserve(wayland_conn_t *conn, uint32_t size) {
+  assert(size <= WAYLAND_OUT_CAP);
+  while (WAYLAND_OUT_CAP - conn->out_len < size) {
+    if (conn->out_blocked && wayland_conn_wait_writable(conn) == -1)
+      return -1;
+    if (wayland_conn_flush(conn) == -1)
+      return -1;
+  }
+  return 0;
+}
 
-/* Parse and handle an incoming Wayland message
- * - fd: connection to the Wayland socket
- * - state: our client state
- * - msg: pointer to received message buffer (will be advanced)
- * - msg_len: remaining length in buffer
- *
- * This function should:
- *  - Read sender_id, object_id, opcode, and dispatch to proper handlers.
- *  - Update state fields based on registry announcements (globals), seat
- *    capabilities (pointer/keyboard), pointer events (motion/button), and
- *    other relevant protocol events.
+/* Queue a file descriptor to be sent as SCM_RIGHTS with the next flush. The
+ * queue keeps its own dup, so the caller still owns (and may close) fd.
+ * - Returns 0, or -1 with errno set. */
+static int wayland_conn_queue_fd(wayland_conn_t *conn, int fd) {
+  if (conn->out_fds_len == WAYLAND_MAX_FDS_OUT) {
+    // the fds must leave with bytes; anything queued so far will do
+    if (wayland_conn_flush(conn) == -1)
+      return -1;
+    if (conn->out_fds_len == WAYLAND_MAX_FDS_OUT) {
+      if (wayland_conn_wait_writable(conn) == -1 || wayland_conn_flush(conn) == -1)
+        return -1;
+    }
+  }
+
+  int dup_fd = dup(fd);
+  wayland_conn_count_syscall(conn);
+  if (dup_fd == -1)
+    return -1;
+  conn->out_fds[conn->out_fds_len++] = dup_fd;
+  return 0;
+}
+
+/* Start a request of `size` bytes, header included. Returns a buffer for one
+ * of the generated _pack() functions in kasama_protocol.h to fill: the ring
+ * itself, or the scratch buffer if the message would wrap around its end.
+ * Pass it to wayland_msg_end() once filled. With a constant size (every
+ * request without a string or array) the checks here fold away.
+ * - Returns NULL if the connection is broken.
  */
-static void wayland_handle_message(int fd, state_t *state, char **msg, uint64_t *msg_len) {
-  (void)fd; (void)state; (void)msg; (void)msg_len;
-  /* TODO: implement message parsing and dispatch based on object IDs/opcodes. */
+static uint32_t *wayland_msg_begin(wayland_conn_t *conn, uint32_t size) {
+  assert(size >= wayland_header_size && size % 4 == 0 && size <= WAYLAND_MSG_SCRATCH);
+
+  if (wayland_conn_reserve(conn, size) == -1)
+    return NULL;
+
+  uint32_t tail = (conn->out_head + conn->out_len) & (WAYLAND_OUT_CAP - 1);
+  conn->msg_in_scratch = tail + size > WAYLAND_OUT_CAP;
+  if (conn->msg_in_scratch)
+    return (uint32_t *)conn->scratch; // copied into both ends of the ring by wayland_msg_end
+  return (uint32_t *)(conn->out + tail);
 }
 
-/* ------------------- Main (program flow) --------------------------------- */
+/* Commit a request started with wayland_msg_begin() to the ring. */
+static void wayland_msg_end(wayland_conn_t *conn, uint32_t *msg, uint32_t size) {
+  if (conn->msg_in_scratch) {
+    uint32_t tail = (conn->out_head + conn->out_len) & (WAYLAND_OUT_CAP - 1);
+    uint32_t first = WAYLAND_OUT_CAP - tail;
+    memcpy(conn->out + tail, msg, first);
+    memcpy(conn->out, (char *)msg + first, size - first);
+    conn->msg_in_scratch = false;
+  }
+  conn->out_len += size;
 
-/* The main routine should:
- *  - Connect to the Wayland display
- *  - Get the registry and bind to relevant globals (wl_shm, wl_seat, xdg_wm_base)
- *  - Create a shm pool and a buffer for the initial window size
- *  - Create an xdg_surface and xdg_toplevel, set up event callbacks
- *  - Enter an event loop: read socket data, call wayland_handle_message, and
- *    schedule frame callbacks and commits using render_frame.
- *
- * For the assignment, implement progressively:
- *  1) Connection + registry bind
- *  2) Create shm pool + buffer, attach to surface, commit (see render_frame)
- *  3) Implement a basic renderer to draw background and moving entities
- *  4) Implement pointer event handling to update pointer position and click state
+#ifdef KASAMA_TRACE
+  trace_record(TRACE_REQUEST, conn->objects[msg[0]].interface, msg[0], (uint16_t)msg[1],
+               (uint16_t)size, size > wayland_header_size ? msg[2] : 0);
+#endif
+}
+#endif
+
+/* ---------------- Object table ------------------------------------------- */
+
+/* Allocate a client object id for an interface: the most recently freed id
+ * if there is one, else the next id past the end of the table.
+ * - Returns the id, or 0 if the table can't grow.
  */
-int main(void) {
-  /* TODO: implement program bootstrap steps described above. */
-  struct wl_display *display = wl_display_connect(NULL);
-  if (!display) {
-    fprintf(stderr, "No display\n");
-    return 1;
+static uint32_t wayland_object_new(wayland_conn_t *conn, const wayland_vtable_t *vtable) {
+  uint32_t id = conn->objects_free;
+  if (id != 0) {
+    conn->objects_free = conn->objects[id].next_free;
+  } else {
+    if (conn->objects_len >= conn->objects_cap) {
+      uint32_t new_cap = conn->objects_cap ? conn->objects_cap * 2 : 64;
+      wayland_object_t *objects = realloc(conn->objects, sizeof(*objects) * new_cap);
+      if (!objects)
+        return 0;
+      memset(objects + conn->objects_cap, 0, sizeof(*objects) * (new_cap - conn->objects_cap));
+      conn->objects = objects;
+      conn->objects_cap = new_cap;
+    }
+    id = conn->objects_len++;
   }
 
-  fprintf(stderr, "Connection established\n");
-  struct wl_registry = wl_display_get_registry(display);
-  
-  return 0;
+  wayland_object_t *object = &conn->objects[id];
+  object->vtable = vtable;
+  object->interface = (uint8_t)vtable->interface;
+  object->zombie = false;
+  object->data = 0;
+  object->next_free = 0;
+  return id;
+}
+
+/* The object was destroyed (by a destructor request, or by the compositor for
+ * one-shot objects like wl_callback). Events still in flight for it are
+ * dropped; the id stays reserved until wl_display.delete_id. */
+static void wayland_object_destroy(wayland_conn_t *conn, uint32_t id) {
+  assert(id < conn->objects_len && conn->objects[id].vtable);
+  conn->objects[id].zombie = true;
+#ifdef KASAMA_LIBWAYLAND
+  wayland_conn_drop_proxy(conn, id); // libwayland takes care of delete_id
+#endif
+}
+
+/* wl_display.delete_id: the compositor is done with the id, recycle it. */
+static void wayland_object_release(wayland_conn_t *conn, uint32_t id) {
+  if (id <= wayland_display_object_id || id >= conn->objects_len || !conn->objects[id].vtable)
+    return;
+  wayland_object_t *object = &conn->objects[id];
+  object->vtable = NULL;
+  object->interface = WAYLAND_INTERFACE_NONE;
+  object->zombie = false;
+  object->next_free = conn->objects_free;
+  conn->objects_free = id;
+}
+
+/* ---------------- Wayland message helper stubs (marshalling helpers) -------- */
+
+/* The following helpers mirror the original file's function signatures, with
+ * the socket fd replaced by the connection whose ring they append to. Nothing
+ * reaches the compositor until the next wayland_conn_flush(). Helpers that
+ * allocate an object return its id, or 0 if the connection is broken.
+ */
+
+/* Example: obtain the wl_registry object by asking the display for 'get_registry' */
+static uint32_t wayland_wl_display_get_registry(wayland_conn_t *conn) {
+  /* Queue a wl_display.get_registry request.
+   * Return an object id assigned locally for the registry, or 0 on failure.
+   */
+  uint32_t wl_registry = wayland_object_new(conn, &wayland_wl_registry_vtable);
+  uint32_t *msg = wl_registry ? wayland_msg_begin(conn, wayland_wl_display_get_registry_size) : NULL;
+  if (!msg)
+    return 0;
+
+  wayland_wl_display_get_registry_pack(msg, wayland_display_object_id, wl_registry);
+  wayland_msg_end(conn, msg, wayland_wl_display_get_registry_size);
+  return wl_registry;
+}
+
+/* Queue wl_display.sync. The compositor answers with wl_callback.done once it
+ * has handled every request sent before it, which makes it a round trip. */
+static uint32_t wayland_wl_display_sync(wayland_conn_t *conn) {
+  uint32_t wl_callback = wayland_object_new(conn, &wayland_wl_callback_vtable);
+  uint32_t *msg = wl_callback ? wayland_msg_begin(conn, wayland_wl_display_sync_size) : NULL;
+  if (!msg)
+    return 0;
+
+  wayland_wl_display_sync_pack(msg, wayland_display_object_id, wl_callback);
+  wayland_msg_end(conn, msg, wayland_wl_display_sync_size);
+  return wl_callback;
+}
+
+static uint32_t wayland_wl_registry_bind(wayland_conn_t *conn, uint32_t registry, uint32_t name,
+                                         const char *interface, uint32_t interface_len, uint32_t version,
+                                         const wayland_vtable_t *vtable) {
+  /* Queue wl_registry.bind to bind an advertised global. Return local object id.
+   * interface_len excludes the terminator, e.g. cstring_len("wl_shm"); vtable
+   * is the dispatch table for the new object's events. */
+  uint32_t size = wayland_wl_registry_bind_size(interface_len);
+  uint32_t id = wayland_object_new(conn, vtable);
+  uint32_t *msg = id ? wayland_msg_begin(conn, size) : NULL;
+  if (!msg)
+    return 0;
+
+  wayland_wl_registry_bind_pack(msg, size, registry, name, interface, interface_len, version, id);
+  wayland_msg_end(conn, msg, size);
+  return id;
+}
+
+/* Create a shm pool object associated with a file descriptor backing shared memory */
+static uint32_t wayland_wl_shm_create_pool(wayland_conn_t *conn, uint32_t wl_shm, int fd, uint32_t size) {
+  /* create a wl_shm_pool object (marshal create_pool request). The fd argument
+   * has no bytes on the wire; it travels in the fd queue. */
+  assert(size > 0 && size <= INT32_MAX);
+
+  // queued first: fds may reach the compositor ahead of their request, not after it
+  if (wayland_conn_queue_fd(conn, fd) == -1)
+    return 0;
+  uint32_t wl_shm_pool = wayland_object_new(conn, &wayland_wl_shm_pool_vtable);
+  uint32_t *msg = wl_shm_pool ? wayland_msg_begin(conn, wayland_wl_shm_create_pool_size) : NULL;
+  if (!msg)
+    return 0;
+
+  wayland_wl_shm_create_pool_pack(msg, wl_shm, wl_shm_pool, (int32_t)size);
+  wayland_msg_end(conn, msg, wayland_wl_shm_create_pool_size);
+  return wl_shm_pool;
+}
+
+/* Let the compositor map more of the pool's fd. Pools only ever grow. */
+static void wayland_wl_shm_pool_resize(wayland_conn_t *conn, uint32_t wl_shm_pool, uint32_t size) {
+  assert(size > 0 && size <= INT32_MAX);
+  uint32_t *msg = wayland_msg_begin(conn, wayland_wl_shm_pool_resize_size);
+  if (!msg)
+    return;
+  wayland_wl_shm_pool_resize_pack(msg, wl_shm_pool, (int32_t)size);
+  wayland_msg_end(conn, msg, wayland_wl_shm_pool_resize_size);
+}
+
+/* Create a width x height xrgb8888 buffer `offset` bytes into the pool */
+static uint32_t wayland_wl_shm_pool_create_buffer(wayland_conn_t *conn, uint32_t wl_shm_pool, uint32_t offset,
+                                                  uint32_t width, uint32_t height) {
+  /* allocate and create a wl_buffer using wl_shm_pool.create_buffer */
+  uint32_t wl_buffer = wayland_object_new(conn, &wayland_wl_buffer_vtable);
+  uint32_t *msg = wl_buffer ? wayland_msg_begin(conn, wayland_wl_shm_pool_create_buffer_size) : NULL;
+  if (!msg)
+    return 0;
+
+  wayland_wl_shm_pool_create_buffer_pack(msg, wl_shm_pool, wl_buffer, (int32_t)offset,
+                                         (int32_t)width, (int32_t)height,
+                                         (int32_t)(width * color_channels),
+                                         wayland_wl_shm_format_xrgb8888);
+  wayland_msg_end(conn, msg, wayland_wl_shm_pool_create_buffer_size);
+  return wl_buffer;
+}
+
+static void wayland_wl_buffer_destroy(wayland_conn_t *conn, uint32_t wl_buffer) {
+  /* queue wl_buffer.destroy for the given object id */
+  uint32_t *msg = wayland_msg_begin(conn, wayland_wl_buffer_destroy_size);
+  if (!msg)
+    return;
+  wayland_wl_buffer_destroy_pack(msg, wl_buffer);
+  wayland_msg_end(conn, msg, wayland_wl_buffer_destroy_size);
+  wayland_object_destroy(conn, wl_buffer);
+}
+
+static void wayland_wl_surface_attach(wayland_conn_t *conn, uint32_t wl_surface, uint32_t wl_buffer) {
+  /* queue wl_surface.attach; the buffer is applied by the next commit */
+  uint32_t *msg = wayland_msg_begin(conn, wayland_wl_surface_attach_size);
+  if (!msg)
+    return;
+  wayland_wl_surface_attach_pack(msg, wl_surface, wl_buffer, 0, 0);
+  wayland_msg_end(conn, msg, wayland_wl_surface_attach_size);
+}
+
+static uint32_t wayland_wl_surface_frame(wayland_conn_t *conn, uint32_t wl_surface) {
+  /* request a callback for the next frame; like attach, it takes effect on
+   * the next commit, and wl_callback.done fires when it is a good time to
+   * draw again */
+  uint32_t wl_callback = wayland_object_new(conn, &wayland_wl_callback_vtable);
+  uint32_t *msg = wl_callback ? wayland_msg_begin(conn, wayland_wl_surface_frame_size) : NULL;
+  if (!msg)
+    return 0;
+
+  wayland_wl_surface_frame_pack(msg, wl_surface, wl_callback);
+  wayland_msg_end(conn, msg, wayland_wl_surface_frame_size);
+  return wl_callback;
+}
+
+static uint32_t wayland_wl_compositor_create_surface(wayland_conn_t *conn, state_t *state) {
+  /* queue wl_compositor.create_surface and return the new wl_surface id */
+  uint32_t wl_surface = wayland_object_new(conn, &wayland_wl_surface_vtable);
+  uint32_t *msg = wl_surface ? wayland_msg_begin(conn, wayland_wl_compositor_create_surface_size) : NULL;
+  if (!msg)
+    return 0;
+
+  wayland_wl_compositor_create_surface_pack(msg, state->wl_compositor, wl_surface);
+  wayland_msg_end(conn, msg, wayland_wl_compositor_create_surface_size);
+  return wl_surface;
+}
+
+static uint32_t wayland_xdg_wm_base_get_xdg_surface(wayland_conn_t *conn, state_t *state) {
+  /* queue xdg_wm_base.get_xdg_surface for state->wl_surface */
+  uint32_t xdg_surface = wayland_object_new(conn, &wayland_xdg_surface_vtable);
+  uint32_t *msg = xdg_surface ? wayland_msg_begin(conn, wayland_xdg_wm_base_get_xdg_surface_size) : NULL;
+  if (!msg)
+    return 0;
+
+  wayland_xdg_wm_base_get_xdg_surface_pack(msg, state->xdg_wm_base, xdg_surface, state->wl_surface);
+  wayland_msg_end(conn, msg, wayland_xdg_wm_base_get_xdg_surface_size);
+  return xdg_surface;
+}
+
+static uint32_t wayland_xdg_surface_get_toplevel(wayland_conn_t *conn, state_t *state) {
+  /* queue xdg_surface.get_toplevel and return the new xdg_toplevel id */
+  uint32_t xdg_toplevel = wayland_object_new(conn, &wayland_xdg_toplevel_vtable);
+  uint32_t *msg = xdg_toplevel ? wayland_msg_begin(conn, wayland_xdg_surface_get_toplevel_size) : NULL;
+  if (!msg)
+    return 0;
+
+  wayland_xdg_surface_get_toplevel_pack(msg, state->xdg_surface, xdg_toplevel);
+  wayland_msg_end(conn, msg, wayland_xdg_surface_get_toplevel_size);
+  return xdg_toplevel;
+}
+
+static void wayland_wl_surface_commit(wayland_conn_t *conn, state_t *state) {
+  /* queue wl_surface.commit; this applies attached buffers */
+  uint32_t *msg = wayland_msg_begin(conn, wayland_wl_surface_commit_size);
+  if (!msg)
+    return;
+  wayland_wl_surface_commit_pack(msg, state->wl_surface);
+  wayland_msg_end(conn, msg, wayland_wl_surface_commit_size);
+}
+
+static void wayland_wl_surface_damage_buffer(wayland_conn_t *conn, uint32_t wl_surface,
+                                             uint32_t x, uint32_t y,
+                                             uint32_t w, uint32_t h) {
+  /* queue wl_surface.damage_buffer with rectangle extents in buffer pixels */
+  uint32_t *msg = wayland_msg_begin(conn, wayland_wl_surface_damage_buffer_size);
+  if (!msg)
+    return;
+  wayland_wl_surface_damage_buffer_pack(msg, wl_surface, (int32_t)x, (int32_t)y, (int32_t)w, (int32_t)h);
+  wayland_msg_end(conn, msg, wayland_wl_surface_damage_buffer_size);
+}
+
+static void wayland_xdg_wm_base_pong(wayland_conn_t *conn, uint32_t xdg_wm_base, uint32_t serial) {
+  /* answer xdg_wm_base.ping so the compositor doesn't flag us as unresponsive */
+  uint32_t *msg = wayland_msg_begin(conn, wayland_xdg_wm_base_pong_size);
+  if (!msg)
+    return;
+  wayland_xdg_wm_base_pong_pack(msg, xdg_wm_base, serial);
+  wayland_msg_end(conn, msg, wayland_xdg_wm_base_pong_size);
+}
+
+static void wayland_xdg_surface_ack_configure(wayland_conn_t *conn, uint32_t xdg_surface, uint32_t serial) {
+  /* acknowledge an xdg_surface.configure before the next commit */
+  uint32_t *msg = wayland_msg_begin(conn, wayland_xdg_surface_ack_configure_size);
+  if (!msg)
+    return;
+  wayland_xdg_surface_ack_configure_pack(msg, xdg_surface, serial);
+  wayland_msg_end(conn, msg, wayland_xdg_surface_ack_configure_size);
+}
+
+static uint32_t wayland_wl_seat_get_pointer(wayland_conn_t *conn, uint32_t wl_seat) {
+  /* queue wl_seat.get_pointer and return the new wl_pointer id */
+  uint32_t wl_pointer = wayland_object_new(conn, &wayland_wl_pointer_vtable);
+  uint32_t *msg = wl_pointer ? wayland_msg_begin(conn, wayland_wl_seat_get_pointer_size) : NULL;
+  if (!msg)
+    return 0;
+  wayland_wl_seat_get_pointer_pack(msg, wl_seat, wl_pointer);
+  wayland_msg_end(conn, msg, wayland_wl_seat_get_pointer_size);
+  return wl_pointer;
+}
+
+static uint32_t wayland_wl_seat_get_keyboard(wayland_conn_t *conn, uint32_t wl_seat) {
+  /* queue wl_seat.get_keyboard and return the new wl_keyboard id */
+  uint32_t wl_keyboard = wayland_object_new(conn, &wayland_wl_keyboard_vtable);
+  uint32_t *msg = wl_keyboard ? wayland_msg_begin(conn, wayland_wl_seat_get_keyboard_size) : NULL;
+  if (!msg)
+    return 0;
+  wayland_wl_seat_get_keyboard_pack(msg, wl_seat, wl_keyboard);
+  wayland_msg_end(conn, msg, wayland_wl_seat_get_keyboard_size);
+  return wl_keyboard;
+}
+
+static void wayland_wl_pointer_release(wayland_conn_t *conn, uint32_t wl_pointer) {
+  /* queue wl_pointer.release (a destructor, since version 3) */
+  uint32_t *msg = wayland_msg_begin(conn, wayland_wl_pointer_release_size);
+  if (!msg)
+    return;
+  wayland_wl_pointer_release_pack(msg, wl_pointer);
+  wayland_msg_end(conn, msg, wayland_wl_pointer_release_size);
+  wayland_object_destroy(conn, wl_pointer);
+}
+
+static void wayland_wl_keyboard_release(wayland_conn_t *conn, uint32_t wl_keyboard) {
+  /* queue wl_keyboard.release (a destructor, since version 3) */
+  uint32_t *msg = wayland_msg_begin(conn, wayland_wl_keyboard_release_size);
+  if (!msg)
+    return;
+  wayland_wl_keyboard_release_pack(msg, wl_keyboard);
+  wayland_msg_end(conn, msg, wayland_wl_keyboard_release_size);
+  wayland_object_destroy(conn, wl_keyboard);
+}
+
+/* ------------------- Damage tracking ------------------------------------- */
+
+static uint64_t rect_area(rect_t r) {
+  return (uint64_t)r.w * r.h;
+}
+
+static rect_t rect_union(rect_t a, rect_t b) {
+  uint32_t x0 = a.x < b.x ? a.x : b.x;
+  uint32_t y0 = a.y < b.y ? a.y : b.y;
+  uint32_t x1 = a.x + a.w > b.x + b.w ? a.x + a.w : b.x + b.w;
+  uint32_t y1 = a.y + a.h > b.y + b.h ? a.y + a.h : b.y + b.h;
+  return (rect_t){.x = x0, .y = y0, .w = x1 - x0, .h = y1 - y0};
+}
+
+/* Clip r to a width x height buffer; may return an empty rect */
+static rect_t rect_clip(rect_t r, uint32_t width, uint32_t height) {
+  if (r.x >= width || r.y >= height)
+    return (rect_t){0};
+  if (r.w > width - r.x)
+    r.w = width - r.x;
+  if (r.h > height - r.y)
+    r.h = height - r.y;
+  return r;
+}
+
+/* True if merging a and b loses nothing: they overlap, or they share an edge
+ * and line up so that their union is exactly a rectangle. */
+static bool rect_mergeable(rect_t a, rect_t b) {
+  bool overlap_x = a.x < b.x + b.w && b.x < a.x + a.w;
+  bool overlap_y = a.y < b.y + b.h && b.y < a.y + a.h;
+  if (overlap_x && overlap_y)
+    return true;
+  bool stacked = a.x == b.x && a.w == b.w && (a.y + a.h == b.y || b.y + b.h == a.y);
+  bool side_by_side = a.y == b.y && a.h == b.h && (a.x + a.w == b.x || b.x + b.w == a.x);
+  return stacked || side_by_side;
+}
+
+/* Add a rect, folding in every rect it overlaps. When the list is full the
+ * rect is merged with whichever entry grows the least. */
+static void damage_add(damage_t *damage, rect_t r) {
+  if (r.w == 0 || r.h == 0)
+    return;
+
+  for (uint32_t i = 0; i < damage->len;) {
+    if (rect_mergeable(damage->rects[i], r)) {
+      // the union may now reach rects we already passed, so start over
+      r = rect_union(damage->rects[i], r);
+      damage->rects[i] = damage->rects[--damage->len];
+      i = 0;
+      continue;
+    }
+    i++;
+  }
+
+  if (damage->len == DAMAGE_MAX_RECTS) {
+    uint32_t best = 0;
+    uint64_t best_growth = UINT64_MAX;
+    for (uint32_t i = 0; i < damage->len; i++) {
+      uint64_t growth = rect_area(rect_union(damage->rects[i], r)) - rect_area(damage->rects[i]);
+      if (growth < best_growth) {
+        best = i;
+        best_growth = growth;
+      }
+    }
+    r = rect_union(damage->rects[best], r);
+    damage->rects[best] = damage->rects[--damage->len];
+    damage_add(damage, r);
+    return;
+  }
+
+  damage->rects[damage->len++] = r;
+}
+
+static void damage_add_all(damage_t *dst, const damage_t *src) {
+  for (uint32_t i = 0; i < src->len; i++)
+    damage_add(dst, src->rects[i]);
+}
+
+static void damage_reset(damage_t *damage) {
+  damage->len = 0;
+}
+
+/* ------------------- Shared memory pool ---------------------------------- */
+
+/* Every wl_buffer lives in one wl_shm_pool, backed by a memfd that is mapped
+ * once. Buffers of any size are carved out of it with a first-fit free list,
+ * so a window resize only destroys and creates wl_buffers: no new file, no
+ * fd passing, no mmap. When nothing fits, the pool grows geometrically with
+ * ftruncate, mremap and wl_shm_pool.resize, which the compositor handles
+ * without a round trip.
+ *
+ * The protocol has no way to shrink a pool, so neither do we, and the memfd
+ * is sealed with F_SEAL_SHRINK: a compositor mapping our fd can rely on the
+ * file never being truncated under it (which would SIGBUS it), while growing
+ * stays allowed.
+ *
+ * With KASAMA_HUGEPAGES=1 the memfd asks for hugetlb pages (they must be
+ * reserved in /proc/sys/vm/nr_hugepages) and falls back to normal pages if
+ * there are none. Either way the mapping is madvise'd for transparent
+ * hugepages, which take effect where shmem THP is enabled.
+ */
+
+#define SHM_HUGEPAGE_SIZE (2U << 20)
+
+static uint32_t shm_round_up(uint32_t n, uint32_t align) {
+  return (n + align - 1) & ~(align - 1);
+}
+
+/* Return [offset, offset + size) to the free list, merging with neighbours */
+static void shm_pool_insert_free(shm_pool_t *pool, uint32_t offset, uint32_t size) {
+  uint32_t i = 0;
+  while (i < pool->free_len && pool->free[i].offset < offset)
+    i++;
+
+  bool merge_prev = i > 0 && pool->free[i - 1].offset + pool->free[i - 1].size == offset;
+  bool merge_next = i < pool->free_len && offset + size == pool->free[i].offset;
+  if (merge_prev && merge_next) {
+    pool->free[i - 1].size += size + pool->free[i].size;
+    memmove(&pool->free[i], &pool->free[i + 1], sizeof(pool->free[0]) * (pool->free_len - i - 1));
+    pool->free_len--;
+  } else if (merge_prev) {
+    pool->free[i - 1].size += size;
+  } else if (merge_next) {
+    pool->free[i].offset = offset;
+    pool->free[i].size += size;
+  } else {
+    // extents are bounded by live buffers + 1, far below the table size
+    assert(pool->free_len < SHM_POOL_MAX_BLOCKS);
+    memmove(&pool->free[i + 1], &pool->free[i], sizeof(pool->free[0]) * (pool->free_len - i));
+    pool->free[i] = (shm_block_t){.offset = offset, .size = size};
+    pool->free_len++;
+  }
+}
+
+/* Create a sealed memfd of `size` bytes (rounded up to the page size) and
+ * map it. Returns 0, or -1 with errno set. */
+static int shm_pool_map(shm_pool_t *pool, uint32_t size, bool hugetlb) {
+  memset(pool, 0, sizeof(*pool));
+  pool->hugetlb = hugetlb;
+  pool->page = hugetlb ? SHM_HUGEPAGE_SIZE : (uint32_t)sysconf(_SC_PAGESIZE);
+  size = shm_round_up(size, pool->page);
+
+  pool->fd = memfd_create("kasama-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING | (hugetlb ? MFD_HUGETLB : 0));
+  if (pool->fd == -1)
+    return -1;
+  void *data = MAP_FAILED;
+  if (ftruncate(pool->fd, size) == 0 &&
+      fcntl(pool->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) == 0)
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, pool->fd, 0);
+  if (data == MAP_FAILED) {
+    int err = errno;
+    close(pool->fd);
+    pool->fd = -1;
+    errno = err;
+    return -1;
+  }
+
+  if (!hugetlb)
+    madvise(data, size, MADV_HUGEPAGE); // best effort
+  pool->data = data;
+  pool->size = size;
+  pool->stats.maps++;
+  shm_pool_insert_free(pool, 0, size);
+  return 0;
+}
+
+/* Back the pool with at least `size` bytes. It isn't announced to the
+ * compositor yet; see wayland_wl_shm_create_pool.
+ * - Returns 0, or -1 with errno set.
+ */
+static int shm_pool_init(shm_pool_t *pool, uint32_t size) {
+  const char *hugepages = getenv("KASAMA_HUGEPAGES");
+  if (hugepages && strcmp(hugepages, "1") == 0 && shm_pool_map(pool, size, true) == 0)
+    return 0;
+  return shm_pool_map(pool, size, false);
+}
+
+/* Grow the pool to at least `size` bytes, doubling at a time: enlarge the
+ * file, remap it (possibly moving it; buffers hold offsets, not pointers)
+ * and tell the compositor. Returns 0, or -1 with errno set. */
+static int shm_pool_grow(wayland_conn_t *conn, shm_pool_t *pool, uint32_t size) {
+  uint64_t new_size = pool->size;
+  while (new_size < size)
+    new_size *= 2;
+  new_size = shm_round_up((uint32_t)(new_size < INT32_MAX ? new_size : INT32_MAX), pool->page);
+  if (new_size < size || new_size > INT32_MAX) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  if (ftruncate(pool->fd, (off_t)new_size) == -1)
+    return -1;
+  void *data = mremap(pool->data, pool->size, new_size, MREMAP_MAYMOVE);
+  if (data == MAP_FAILED)
+    return -1;
+  if (!pool->hugetlb)
+    madvise(data, new_size, MADV_HUGEPAGE);
+
+  shm_pool_insert_free(pool, pool->size, (uint32_t)new_size - pool->size);
+  pool->data = data;
+  pool->size = (uint32_t)new_size;
+  pool->stats.maps++;
+  pool->stats.grows++;
+  if (pool->wl_shm_pool)
+    wayland_wl_shm_pool_resize(conn, pool->wl_shm_pool, pool->size);
+  return 0;
+}
+
+/* Hand out `size` bytes, growing the pool if no free extent is big enough.
+ * - Returns the block (size rounded up to SHM_POOL_ALIGN), or one with
+ *   size 0 and errno set on failure.
+ */
+static shm_block_t shm_pool_alloc(wayland_conn_t *conn, shm_pool_t *pool, uint32_t size) {
+  size = shm_round_up(size, SHM_POOL_ALIGN);
+  for (;;) {
+    for (uint32_t i = 0; i < pool->free_len; i++) {
+      shm_block_t *extent = &pool->free[i];
+      if (extent->size < size)
+        continue;
+
+      shm_block_t block = {.offset = extent->offset, .size = size};
+      extent->offset += size;
+      extent->size -= size;
+      if (extent->size == 0) {
+        memmove(extent, extent + 1, sizeof(*extent) * (pool->free_len - i - 1));
+        pool->free_len--;
+      }
+      pool->stats.allocs++;
+      pool->stats.used += size;
+      if (pool->stats.used > pool->stats.used_max)
+        pool->stats.used_max = pool->stats.used;
+      return block;
+    }
+
+    // a free extent at the end of the pool counts toward what is needed
+    uint32_t tail = 0;
+    if (pool->free_len) {
+      shm_block_t last = pool->free[pool->free_len - 1];
+      tail = last.offset + last.size == pool->size ? last.size : 0;
+    }
+    if ((uint64_t)pool->size + size - tail > INT32_MAX) {
+      errno = ENOMEM;
+      return (shm_block_t){0};
+    }
+    if (shm_pool_grow(conn, pool, pool->size + size - tail) == -1)
+      return (shm_block_t){0};
+  }
+}
+
+static void shm_pool_free(shm_pool_t *pool, shm_block_t block) {
+  assert(block.size && block.offset + block.size <= pool->size);
+  pool->stats.frees++;
+  pool->stats.used -= block.size;
+  shm_pool_insert_free(pool, block.offset, block.size);
+}
+
+static void shm_pool_destroy(shm_pool_t *pool) {
+  if (pool->data)
+    munmap(pool->data, pool->size);
+  if (pool->fd != -1)
+    close(pool->fd);
+  memset(pool, 0, sizeof(*pool));
+  pool->fd = -1;
+}
+
+/* ------------------- Swapchain ------------------------------------------- */
+
+/* Up to SWAPCHAIN_MAX frame-sized buffers, each a block of the shm pool.
+ * SWAPCHAIN_MIN wl_buffers are created up front; when the compositor holds
+ * all of them the chain grows by one instead of stalling, and only at
+ * SWAPCHAIN_MAX does the renderer wait for a wl_buffer.release.
+ *
+ * Buffers are never redrawn from scratch. Each one remembers the damage that
+ * was presented while it sat out (`missed`); when it is picked again those
+ * regions are copied over from the front buffer, and only the new frame's
+ * damage is drawn and sent to the compositor.
+ *
+ * A new window size rebuilds the chain on the next render, so a burst of
+ * configures during an interactive resize costs one rebuild per frame. Free
+ * buffers go straight back to the pool; busy ones are retired and returned
+ * when the compositor releases them.
+ */
+
+/* Largest frame in bytes: SWAPCHAIN_MAX of them must fit the pool, which
+ * can't pass INT32_MAX, at either page size */
+#define SWAPCHAIN_FRAME_MAX (INT32_MAX / SWAPCHAIN_MAX / SHM_HUGEPAGE_SIZE * SHM_HUGEPAGE_SIZE)
+
+static uint64_t swapchain_frame_size(state_t *state) {
+  return (uint64_t)state->width * state->height * color_channels;
+}
+
+/* Shrink a window size the compositor asked for until its frame fits
+ * SWAPCHAIN_FRAME_MAX: the width to what one row may take, then the height */
+static void swapchain_clamp_size(uint32_t *width, uint32_t *height) {
+  if ((uint64_t)*width * color_channels > SWAPCHAIN_FRAME_MAX)
+    *width = SWAPCHAIN_FRAME_MAX / color_channels;
+  uint64_t row = (uint64_t)*width * color_channels;
+  if (row * *height > SWAPCHAIN_FRAME_MAX)
+    *height = (uint32_t)(SWAPCHAIN_FRAME_MAX / row);
+}
+
+/* Add one wl_buffer of the chain's size, allocated from the pool.
+ * - Returns the slot index, or -1 if the chain is full or the connection or
+ *   the pool broke.
+ */
+static int swapchain_grow(wayland_conn_t *conn, state_t *state) {
+  swapchain_t *chain = &state->swapchain;
+  if (chain->len == SWAPCHAIN_MAX)
+    return -1;
+
+  shm_block_t block = shm_pool_alloc(conn, &state->pool, chain->width * chain->height * color_channels);
+  if (!block.size) {
+    if (!conn->error)
+      conn->error = errno;
+    return -1;
+  }
+  uint32_t wl_buffer = wayland_wl_shm_pool_create_buffer(conn, state->pool.wl_shm_pool, block.offset,
+                                                         chain->width, chain->height);
+  if (!wl_buffer)
+    return -1;
+  uint32_t slot = chain->len;
+  conn->objects[wl_buffer].data = slot; // lets the release handler find the slot
+
+  chain->buffers[slot] = (swapchain_buffer_t){.wl_buffer = wl_buffer, .block = block};
+  damage_add(&chain->buffers[slot].missed, (rect_t){.w = chain->width, .h = chain->height});
+  chain->len++;
+  return (int)slot;
+}
+
+/* Create SWAPCHAIN_MIN buffers of the current window size. The pool must
+ * already be announced. Returns 0, or -1 on a broken connection. */
+static int swapchain_fill(wayland_conn_t *conn, state_t *state) {
+  swapchain_t *chain = &state->swapchain;
+  chain->width = state->width;
+  chain->height = state->height;
+  chain->front = -1;
+  for (uint32_t i = 0; i < SWAPCHAIN_MIN; i++) {
+    if (swapchain_grow(conn, state) == -1)
+      return -1;
+  }
+  return 0;
+}
+
+static int swapchain_init(wayland_conn_t *conn, state_t *state) {
+  memset(&state->swapchain, 0, sizeof(state->swapchain));
+  return swapchain_fill(conn, state);
+}
+
+/* wl_buffer.release for a retired buffer: destroy it and reclaim its block */
+static void swapchain_retired_release(wayland_conn_t *conn, state_t *state, uint32_t wl_buffer) {
+  swapchain_t *chain = &state->swapchain;
+  for (uint32_t i = 0; i < chain->retired_len; i++) {
+    if (chain->retired[i].wl_buffer != wl_buffer)
+      continue;
+    wayland_wl_buffer_destroy(conn, wl_buffer);
+    shm_pool_free(&state->pool, chain->retired[i].block);
+    chain->retired[i] = chain->retired[--chain->retired_len];
+    return;
+  }
+}
+
+/* Pick the free buffer that was presented longest ago, or -1 if all are busy */
+static int swapchain_oldest_free(swapchain_t *chain) {
+  int best = -1;
+  for (uint32_t i = 0; i < chain->len; i++) {
+    if (chain->buffers[i].busy)
+      continue;
+    if (best == -1 || chain->buffers[i].presented_seq < chain->buffers[best].presented_seq)
+      best = (int)i;
+  }
+  return best;
+}
+
+/* Block until the compositor sends something, then dispatch it. Our own
+ * queued commit is flushed first, or the release we wait for may never come. */
+static int swapchain_wait_event(wayland_conn_t *conn, state_t *state) {
+  if (wayland_conn_flush(conn) == -1)
+    return -1;
+
+  struct pollfd pfd = {.fd = conn->fd, .events = POLLIN};
+  int ret;
+  do {
+    ret = poll(&pfd, 1, -1);
+    wayland_conn_count_syscall(conn);
+  } while (ret == -1 && errno == EINTR);
+  if (ret == -1)
+    return -1;
+
+  if (wayland_conn_read(conn) == -1)
+    return -1;
+  return wayland_conn_dispatch(conn, state) == -1 ? -1 : 0;
+}
+
+/* Rebuild the chain for the window's current size. The old buffers'
+ * contents are useless at the new size, so the next frame is drawn in full.
+ * - Returns 0, or -1 on a broken connection.
+ */
+static int swapchain_resize(wayland_conn_t *conn, state_t *state) {
+  swapchain_t *chain = &state->swapchain;
+  if (swapchain_frame_size(state) > SWAPCHAIN_FRAME_MAX) {
+    if (!conn->error)
+      conn->error = EOVERFLOW;
+    return -1;
+  }
+  for (uint32_t i = 0; i < chain->len; i++) {
+    swapchain_buffer_t *buffer = &chain->buffers[i];
+    if (!buffer->busy) {
+      wayland_wl_buffer_destroy(conn, buffer->wl_buffer);
+      shm_pool_free(&state->pool, buffer->block);
+      continue;
+    }
+    while (chain->retired_len == SWAPCHAIN_RETIRED_MAX) {
+      // the compositor sits on old buffers; wait for one back
+      if (swapchain_wait_event(conn, state) == -1)
+        return -1;
+    }
+    conn->objects[buffer->wl_buffer].data = UINT32_MAX; // see the release handler
+    chain->retired[chain->retired_len++] = (swapchain_retired_t){buffer->wl_buffer, buffer->block};
+  }
+
+  chain->len = 0;
+  chain->stats.resizes++;
+  state->redraw_all = true;
+  return swapchain_fill(conn, state);
+}
+
+/* Hand the renderer a buffer the compositor is not reading from: the oldest
+ * free one, a new one if all are busy and the chain can grow, or else the
+ * first one released.
+ * - Returns the slot index, or -1 on a broken connection.
+ */
+static int swapchain_acquire(wayland_conn_t *conn, state_t *state) {
+  swapchain_t *chain = &state->swapchain;
+  chain->stats.acquires++;
+
+  int slot = swapchain_oldest_free(chain);
+  if (slot != -1)
+    return slot;
+
+  slot = swapchain_grow(conn, state);
+  if (slot != -1) {
+    chain->stats.grows++;
+    return slot;
+  }
+  if (conn->error)
+    return -1;
+
+  uint64_t start = monotonic_ns();
+  while ((slot = swapchain_oldest_free(chain)) == -1) {
+    if (swapchain_wait_event(conn, state) == -1)
+      return -1;
+  }
+  uint64_t waited = monotonic_ns() - start;
+
+  chain->stats.waits++;
+  chain->stats.wait_ns_total += waited;
+  if (waited > chain->stats.wait_ns_max)
+    chain->stats.wait_ns_max = waited;
+  return slot;
+}
+
+/* Pixels of a swapchain slot */
+static uint32_t *swapchain_pixels(state_t *state, int slot) {
+  return (uint32_t *)(state->pool.data + state->swapchain.buffers[slot].block.offset);
+}
+
+/* Attach a slot, send its merged damage clipped to the buffer and commit. The damage becomes
+ * missed damage for every other buffer. The slot stays busy until
+ * wl_buffer.release. */
+static void swapchain_present(wayland_conn_t *conn, state_t *state, int slot) {
+  swapchain_t *chain = &state->swapchain;
+  swapchain_buffer_t *buffer = &chain->buffers[slot];
+
+  wayland_wl_surface_attach(conn, state->wl_surface, buffer->wl_buffer);
+  for (uint32_t i = 0; i < buffer->damage.len; i++) {
+    // rects come from window-sized drawing; send only what lies on the buffer
+    rect_t r = rect_clip(buffer->damage.rects[i], chain->width, chain->height);
+    if (r.w && r.h)
+      wayland_wl_surface_damage_buffer(conn, state->wl_surface, r.x, r.y, r.w, r.h);
+  }
+  wayland_wl_surface_commit(conn, state);
+
+  for (uint32_t i = 0; i < chain->len; i++) {
+    if (i != (uint32_t)slot)
+      damage_add_all(&chain->buffers[i].missed, &buffer->damage);
+  }
+  damage_reset(&buffer->damage);
+
+  buffer->busy = true;
+  buffer->presented_seq = ++chain->present_seq;
+  chain->front = slot;
+}
+
+/* ------------------- Pixel kernels --------------------------------------- */
+
+/* Span kernels the renderer is built on. Each operates on `count` contiguous
+ * pixels; the rect helpers below do the clipping and walk the rows. The best
+ * implementation for the CPU is picked once at startup with cpuid (through
+ * __builtin_cpu_supports), falling back to portable scalar loops.
+ *
+ * Pixels are plain (non-volatile) memory: the compositor only reads a buffer
+ * after our commit, and the sendmsg() carrying it orders the stores.
+ */
+
+typedef struct pixel_kernels_t pixel_kernels_t;
+
+struct pixel_kernels_t {
+  const char *name;
+  void (*fill)(uint32_t *dst, uint64_t count, uint32_t color);
+  // same as fill but with non-temporal stores, for spans too big for cache
+  void (*fill_stream)(uint32_t *dst, uint64_t count, uint32_t color);
+  // src-over blend of one ARGB color (alpha in the top byte) onto dst
+  void (*blend)(uint32_t *dst, uint64_t count, uint32_t color_argb);
+  // `cells` adjacent cell_w x cell_h glyphs; cell i uses the cell_h row
+  // masks at row_masks + slots[i] * cell_h, where a set bit (bit 31 leftmost)
+  // takes fg[i] and a clear bit bg[i]
+  void (*glyph_cells)(uint32_t *dst, uint64_t dst_stride, const uint32_t *row_masks,
+                      const uint32_t *slots, const uint32_t *fg, const uint32_t *bg,
+                      uint64_t cells, uint32_t cell_w, uint32_t cell_h);
+};
+
+/* Clears at least this large bypass the cache: the compositor, not us, will
+ * read those pixels next. */
+#define PIXEL_STREAM_THRESHOLD (1U << 20)
+
+/* x / 255 for x in [0, 255 * 255], exact */
+static inline uint32_t pixel_div255(uint32_t x) {
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+static void pixel_fill_scalar(uint32_t *dst, uint64_t count, uint32_t color) {
+  for (uint64_t i = 0; i < count; i++)
+    dst[i] = color;
+}
+
+static void pixel_blend_scalar(uint32_t *dst, uint64_t count, uint32_t color_argb) {
+  uint32_t a = color_argb >> 24, ia = 255 - a;
+  for (uint64_t i = 0; i < count; i++) {
+    uint32_t d = dst[i], res = 0;
+    for (uint32_t shift = 0; shift < 32; shift += 8) {
+      uint32_t s = (color_argb >> shift) & 0xff, t = (d >> shift) & 0xff;
+      res |= pixel_div255(s * a + t * ia) << shift;
+    }
+    dst[i] = res;
+  }
+}
+
+/* Expands four pixels at a time through a 16-entry table of fg/bg patterns
+ * that is rebuilt only when the colors change, so runs of cells with the same
+ * attributes cost one table copy per four pixels. */
+static void pixel_glyph_cells_scalar(uint32_t *dst, uint64_t dst_stride, const uint32_t *row_masks,
+                                     const uint32_t *slots, const uint32_t *fg, const uint32_t *bg,
+                                     uint64_t cells, uint32_t cell_w, uint32_t cell_h) {
+  uint32_t lut[16][4];
+  uint32_t lut_fg = 0, lut_bg = 0;
+  bool lut_valid = false;
+
+  for (uint64_t i = 0; i < cells; i++, dst += cell_w) {
+    if (!lut_valid || fg[i] != lut_fg || bg[i] != lut_bg) {
+      for (uint32_t bits = 0; bits < 16; bits++) {
+        for (uint32_t px = 0; px < 4; px++)
+          lut[bits][px] = (bits >> (3 - px)) & 1 ? fg[i] : bg[i];
+      }
+      lut_fg = fg[i];
+      lut_bg = bg[i];
+      lut_valid = true;
+    }
+
+    const uint32_t *masks = row_masks + (uint64_t)slots[i] * cell_h;
+    uint32_t *out = dst;
+    for (uint32_t row = 0; row < cell_h; row++, out += dst_stride) {
+      uint32_t mask = masks[row], px = 0;
+      for (; px + 4 <= cell_w; px += 4, mask <<= 4)
+        memcpy(out + px, lut[mask >> 28], sizeof(lut[0]));
+      for (; px < cell_w; px++, mask <<= 1)
+        out[px] = mask >> 31 ? fg[i] : bg[i];
+    }
+  }
+}
+
+static const pixel_kernels_t pixel_kernels_scalar = {
+  .name = "scalar",
+  .fill = pixel_fill_scalar,
+  .fill_stream = pixel_fill_scalar,
+  .blend = pixel_blend_scalar,
+  .glyph_cells = pixel_glyph_cells_scalar,
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/* The blend kernels widen pixels to 16-bit lanes: per channel
+ *   dst = div255(src * a + dst * (255 - a))
+ * with src * a precomputed once per call. */
+
+__attribute__((target("sse2")))
+static void pixel_fill_sse2(uint32_t *dst, uint64_t count, uint32_t color) {
+  __m128i v = _mm_set1_epi32((int)color);
+  uint64_t i = 0;
+  for (; i + 4 <= count; i += 4)
+    _mm_storeu_si128((__m128i *)(dst + i), v);
+  for (; i < count; i++)
+    dst[i] = color;
+}
+
+__attribute__((target("sse2")))
+static void pixel_fill_stream_sse2(uint32_t *dst, uint64_t count, uint32_t color) {
+  uint64_t i = 0;
+  for (; i < count && ((uintptr_t)(dst + i) & 15); i++)
+    dst[i] = color;
+  __m128i v = _mm_set1_epi32((int)color);
+  for (; i + 4 <= count; i += 4)
+    _mm_stream_si128((__m128i *)(dst + i), v);
+  for (; i < count; i++)
+    dst[i] = color;
+  _mm_sfence();
+}
+
+__attribute__((target("sse2")))
+static inline __m128i pixel_div255_epi16_sse2(__m128i x) {
+  x = _mm_add_epi16(x, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static void pixel_blend_sse2(uint32_t *dst, uint64_t count, uint32_t color_argb) {
+  uint32_t a = color_argb >> 24;
+  __m128i zero = _mm_setzero_si128();
+  __m128i src_a = _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_set1_epi32((int)color_argb), zero),
+                                  _mm_set1_epi16((short)a));
+  __m128i ia = _mm_set1_epi16((short)(255 - a));
+  uint64_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i d = _mm_loadu_si128((__m128i *)(dst + i));
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia), src_a);
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia), src_a);
+    lo = pixel_div255_epi16_sse2(lo);
+    hi = pixel_div255_epi16_sse2(hi);
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+  }
+  pixel_blend_scalar(dst + i, count - i, color_argb);
+}
+
+__attribute__((target("avx2")))
+static void pixel_fill_avx2(uint32_t *dst, uint64_t count, uint32_t color) {
+  __m256i v = _mm256_set1_epi32((int)color);
+  uint64_t i = 0;
+  for (; i + 8 <= count; i += 8)
+    _mm256_storeu_si256((__m256i *)(dst + i), v);
+  for (; i < count; i++)
+    dst[i] = color;
+}
+
+__attribute__((target("avx2")))
+static void pixel_fill_stream_avx2(uint32_t *dst, uint64_t count, uint32_t color) {
+  uint64_t i = 0;
+  for (; i < count && ((uintptr_t)(dst + i) & 31); i++)
+    dst[i] = color;
+  __m256i v = _mm256_set1_epi32((int)color);
+  for (; i + 8 <= count; i += 8)
+    _mm256_stream_si256((__m256i *)(dst + i), v);
+  for (; i < count; i++)
+    dst[i] = color;
+  _mm_sfence();
+}
+
+__attribute__((target("avx2")))
+static inline __m256i pixel_div255_epi16_avx2(__m256i x) {
+  x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static void pixel_blend_avx2(uint32_t *dst, uint64_t count, uint32_t color_argb) {
+  uint32_t a = color_argb >> 24;
+  __m256i zero = _mm256_setzero_si256();
+  __m256i src_a = _mm256_mullo_epi16(_mm256_unpacklo_epi8(_mm256_set1_epi32((int)color_argb), zero),
+                                     _mm256_set1_epi16((short)a));
+  __m256i ia = _mm256_set1_epi16((short)(255 - a));
+  uint64_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    // unpack/pack work within 128-bit lanes, so pixel order is preserved
+    __m256i d = _mm256_loadu_si256((__m256i *)(dst + i));
+    __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), ia), src_a);
+    __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), ia), src_a);
+    lo = pixel_div255_epi16_avx2(lo);
+    hi = pixel_div255_epi16_avx2(hi);
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_packus_epi16(lo, hi));
+  }
+  pixel_blend_scalar(dst + i, count - i, color_argb);
+}
+
+__attribute__((target("avx512f")))
+static void pixel_fill_avx512(uint32_t *dst, uint64_t count, uint32_t color) {
+  __m512i v = _mm512_set1_epi32((int)color);
+  uint64_t i = 0;
+  for (; i + 16 <= count; i += 16)
+    _mm512_storeu_si512((void *)(dst + i), v);
+  if (i < count) // masked store covers the tail
+    _mm512_mask_storeu_epi32(dst + i, (__mmask16)((1U << (count - i)) - 1), v);
+}
+
+__attribute__((target("avx512f")))
+static void pixel_fill_stream_avx512(uint32_t *dst, uint64_t count, uint32_t color) {
+  uint64_t i = 0;
+  for (; i < count && ((uintptr_t)(dst + i) & 63); i++)
+    dst[i] = color;
+  __m512i v = _mm512_set1_epi32((int)color);
+  for (; i + 16 <= count; i += 16)
+    _mm512_stream_si512((void *)(dst + i), v);
+  for (; i < count; i++)
+    dst[i] = color;
+  _mm_sfence();
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i pixel_div255_epi16_avx512(__m512i x) {
+  x = _mm512_add_epi16(x, _mm512_set1_epi16(128));
+  return _mm512_srli_epi16(_mm512_add_epi16(x, _mm512_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void pixel_blend_avx512(uint32_t *dst, uint64_t count, uint32_t color_argb) {
+  uint32_t a = color_argb >> 24;
+  __m512i zero = _mm512_setzero_si512();
+  __m512i src_a = _mm512_mullo_epi16(_mm512_unpacklo_epi8(_mm512_set1_epi32((int)color_argb), zero),
+                                     _mm512_set1_epi16((short)a));
+  __m512i ia = _mm512_set1_epi16((short)(255 - a));
+  uint64_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m512i d = _mm512_loadu_si512((void *)(dst + i));
+    __m512i lo = _mm512_add_epi16(_mm512_mullo_epi16(_mm512_unpacklo_epi8(d, zero), ia), src_a);
+    __m512i hi = _mm512_add_epi16(_mm512_mullo_epi16(_mm512_unpackhi_epi8(d, zero), ia), src_a);
+    lo = pixel_div255_epi16_avx512(lo);
+    hi = pixel_div255_epi16_avx512(hi);
+    _mm512_storeu_si512((void *)(dst + i), _mm512_packus_epi16(lo, hi));
+  }
+  pixel_blend_scalar(dst + i, count - i, color_argb);
+}
+
+/* The SIMD glyph kernels broadcast each row mask, isolate one bit per lane
+ * and select fg or bg with the resulting lane mask; there is no table to
+ * rebuild, so per-cell colors cost nothing extra. Walking a cell's rows
+ * rather than a row's cells keeps the masks of one glyph in a single line. */
+
+__attribute__((target("sse2")))
+static void pixel_glyph_cells_sse2(uint32_t *dst, uint64_t dst_stride, const uint32_t *row_masks,
+                                   const uint32_t *slots, const uint32_t *fg, const uint32_t *bg,
+                                   uint64_t cells, uint32_t cell_w, uint32_t cell_h) {
+  const __m128i bits = _mm_set_epi32(1 << 28, 1 << 29, 1 << 30, (int)(1U << 31));
+  for (uint64_t i = 0; i < cells; i++, dst += cell_w) {
+    __m128i vfg = _mm_set1_epi32((int)fg[i]), vbg = _mm_set1_epi32((int)bg[i]);
+    const uint32_t *masks = row_masks + (uint64_t)slots[i] * cell_h;
+    uint32_t *out = dst;
+    for (uint32_t row = 0; row < cell_h; row++, out += dst_stride) {
+      uint32_t mask = masks[row], px = 0;
+      for (; px + 4 <= cell_w; px += 4, mask <<= 4) {
+        __m128i sel = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32((int)mask), bits), bits);
+        _mm_storeu_si128((__m128i *)(out + px),
+                         _mm_or_si128(_mm_and_si128(sel, vfg), _mm_andnot_si128(sel, vbg)));
+      }
+      for (; px < cell_w; px++, mask <<= 1)
+        out[px] = mask >> 31 ? fg[i] : bg[i];
+    }
+  }
+}
+
+__attribute__((target("avx2")))
+static void pixel_glyph_cells_avx2(uint32_t *dst, uint64_t dst_stride, const uint32_t *row_masks,
+                                   const uint32_t *slots, const uint32_t *fg, const uint32_t *bg,
+                                   uint64_t cells, uint32_t cell_w, uint32_t cell_h) {
+  const __m256i bits = _mm256_set_epi32(1 << 24, 1 << 25, 1 << 26, 1 << 27,
+                                        1 << 28, 1 << 29, 1 << 30, (int)(1U << 31));
+  for (uint64_t i = 0; i < cells; i++, dst += cell_w) {
+    __m256i vfg = _mm256_set1_epi32((int)fg[i]), vbg = _mm256_set1_epi32((int)bg[i]);
+    const uint32_t *masks = row_masks + (uint64_t)slots[i] * cell_h;
+    uint32_t *out = dst;
+    for (uint32_t row = 0; row < cell_h; row++, out += dst_stride) {
+      uint32_t mask = masks[row], px = 0;
+      for (; px + 8 <= cell_w; px += 8, mask <<= 8) {
+        __m256i sel = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((int)mask), bits), bits);
+        _mm256_storeu_si256((__m256i *)(out + px), _mm256_blendv_epi8(vbg, vfg, sel));
+      }
+      for (; px < cell_w; px++, mask <<= 1)
+        out[px] = mask >> 31 ? fg[i] : bg[i];
+    }
+  }
+}
+
+static const pixel_kernels_t pixel_kernels_sse2 = {
+  .name = "sse2",
+  .fill = pixel_fill_sse2,
+  .fill_stream = pixel_fill_stream_sse2,
+  .blend = pixel_blend_sse2,
+  .glyph_cells = pixel_glyph_cells_sse2,
+};
+
+static const pixel_kernels_t pixel_kernels_avx2 = {
+  .name = "avx2",
+  .fill = pixel_fill_avx2,
+  .fill_stream = pixel_fill_stream_avx2,
+  .blend = pixel_blend_avx2,
+  .glyph_cells = pixel_glyph_cells_avx2,
+};
+
+static const pixel_kernels_t pixel_kernels_avx512 = {
+  .name = "avx512",
+  .fill = pixel_fill_avx512,
+  .fill_stream = pixel_fill_stream_avx512,
+  .blend = pixel_blend_avx512,
+  .glyph_cells = pixel_glyph_cells_avx2, // glyph rows are at most 8-16 pixels wide
+};
+#endif
+
+/* Every kernel set this CPU can run, best last; scalar is always first */
+static const pixel_kernels_t *pixel_kernels_available[4];
+static uint32_t pixel_kernels_available_len;
+
+/* The kernels the renderer uses */
+static const pixel_kernels_t *pixel_kernels = &pixel_kernels_scalar;
+
+/* Probe the CPU and select the widest kernels. KASAMA_PIXEL_KERNELS=<name>
+ * forces a specific (supported) set, for benchmarking. */
+static void pixel_kernels_init(void) {
+  pixel_kernels_available_len = 0;
+  pixel_kernels_available[pixel_kernels_available_len++] = &pixel_kernels_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    pixel_kernels_available[pixel_kernels_available_len++] = &pixel_kernels_sse2;
+  if (__builtin_cpu_supports("avx2"))
+    pixel_kernels_available[pixel_kernels_available_len++] = &pixel_kernels_avx2;
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+    pixel_kernels_available[pixel_kernels_available_len++] = &pixel_kernels_avx512;
+#endif
+  pixel_kernels = pixel_kernels_available[pixel_kernels_available_len - 1];
+
+  char *forced = getenv("KASAMA_PIXEL_KERNELS");
+  for (uint32_t i = 0; forced && i < pixel_kernels_available_len; i++) {
+    if (strcmp(forced, pixel_kernels_available[i]->name) == 0)
+      pixel_kernels = pixel_kernels_available[i];
+  }
+}
+
+/* ------------------- Simple renderer helpers ------------------------------ */
+
+/* The drawing helpers write into one swapchain buffer and record what they
+ * touched in that buffer's damage list, so only changed pixels are sent to
+ * (and composited by) the compositor. */
+
+/* Clear a region of pixels in the shm buffer. Pixels are 32-bit ARGB or similar. */
+static void renderer_clear(uint32_t *pixels, uint32_t width, uint32_t height,
+                           uint32_t color_rgb, damage_t *damage) {
+  /* Clear width * height contiguous pixels to color_rgb. Full-frame clears
+   * are streamed past the cache. */
+  uint64_t size = (uint64_t)width * height;
+  if (size * sizeof(*pixels) >= PIXEL_STREAM_THRESHOLD)
+    pixel_kernels->fill_stream(pixels, size, color_rgb);
+  else
+    pixel_kernels->fill(pixels, size, color_rgb);
+
+  damage_add(damage, (rect_t){.w = width, .h = height});
+}
+
+/* The first `band_h` rows of src, moved up `shift` rows into dst (which may
+ * be src); the `shift` rows left at the bottom of the band are cleared.
+ * Rows are contiguous, so the move is one bulk copy. Nothing is added to
+ * damage: the caller knows what the band means. */
+static void renderer_scroll(uint32_t *dst, const uint32_t *src, uint32_t width, uint32_t band_h,
+                            uint32_t shift, uint32_t color_rgb) {
+  uint64_t moved = (uint64_t)(band_h - shift) * width;
+  if (dst == src)
+    memmove(dst, src + (uint64_t)shift * width, moved * sizeof(*dst));
+  else
+    memcpy(dst, src + (uint64_t)shift * width, moved * sizeof(*dst));
+  pixel_kernels->fill(dst + moved, (uint64_t)shift * width, color_rgb);
+}
+
+/* Copy a rect between two buffers of the same size. Used to bring a buffer
+ * up to date, so it does not count as new damage. */
+static void renderer_copy_rect(uint32_t *dst, const uint32_t *src,
+                               uint32_t stride, rect_t r) {
+  for (uint32_t y = r.y; y < r.y + r.h; y++) {
+    uint64_t row = (uint64_t)y * stride + r.x;
+    memcpy(dst + row, src + row, (uint64_t)r.w * sizeof(*dst));
+  }
+}
+
+/* ------------------- Render pool ----------------------------------------- */
+
+/* Persistent worker threads that run a batch of `count` independent jobs,
+ * e.g. the row bands of a frame, and return once all of them are done. The
+ * calling thread takes part as participant 0.
+ *
+ * Work stealing: every participant starts on an equal, contiguous share of
+ * the jobs and takes them from the front. Once its share is empty it steals
+ * the back half of the largest share left. A share is a (next, end) pair
+ * packed into one atomic word, so taking a job and stealing are each one
+ * compare-and-swap; a thief only ever swaps out a non-empty share, and an
+ * owner only refills its own share once it is empty.
+ *
+ * Jobs must write disjoint memory, so the pixels they draw need no locks.
+ * The mutex and condition variables only park idle workers between batches.
+ */
+
+#define RENDER_POOL_MAX_THREADS 64U
+
+typedef struct render_pool_t render_pool_t;
+typedef struct render_worker_t render_worker_t;
+typedef struct render_share_t render_share_t;
+typedef void (*render_job_fn_t)(void *ctx, uint32_t index);
+
+/* Jobs [next, end) of one participant, on its own cache line */
+struct render_share_t {
+  _Alignas(64) _Atomic uint64_t range;   // next << 32 | end
+};
+
+struct render_worker_t {
+  render_pool_t *pool;
+  uint32_t index;              // share index, 1..threads - 1
+  pthread_t thread;
+};
+
+struct render_pool_t {
+  uint32_t threads;            // participants, the caller included
+  render_worker_t workers[RENDER_POOL_MAX_THREADS - 1];
+  render_share_t shares[RENDER_POOL_MAX_THREADS];
+
+  pthread_mutex_t lock;        // guards the batch fields below
+  pthread_cond_t start;        // a batch was posted, or shutdown
+  pthread_cond_t done;         // the last worker left the batch
+  uint64_t generation;         // batches posted so far
+  uint32_t active;             // workers still inside the current batch
+  bool shutdown;
+  render_job_fn_t fn;
+  void *ctx;
+
+  uint64_t batches, jobs;      // stats, written by the caller only
+  _Atomic uint64_t steals;
+};
+
+static inline uint64_t render_range(uint32_t next, uint32_t end) {
+  return (uint64_t)next << 32 | end;
+}
+
+/* Move the back half of the fullest other share into `self`, which is
+ * empty. Returns false once every share is empty. */
+static bool render_pool_steal(render_pool_t *pool, uint32_t self) {
+  for (;;) {
+    uint32_t victim = self, most = 0;
+    uint64_t victim_range = 0;
+    for (uint32_t i = 0; i < pool->threads; i++) {
+      uint64_t range = atomic_load(&pool->shares[i].range);
+      uint32_t left = (uint32_t)range - (uint32_t)(range >> 32);
+      if (i != self && (uint32_t)(range >> 32) < (uint32_t)range && left > most) {
+        victim = i;
+        most = left;
+        victim_range = range;
+      }
+    }
+    if (victim == self)
+      return false;
+
+    uint32_t next = (uint32_t)(victim_range >> 32), end = (uint32_t)victim_range;
+    uint32_t split = end - (end - next + 1) / 2;
+    if (atomic_compare_exchange_weak(&pool->shares[victim].range, &victim_range, render_range(next, split))) {
+      atomic_store(&pool->shares[self].range, render_range(split, end));
+      atomic_fetch_add_explicit(&pool->steals, 1, memory_order_relaxed);
+      return true;
+    }
+  }
+}
+
+/* Run jobs until every share is empty */
+static void render_pool_work(render_pool_t *pool, uint32_t self) {
+  _Atomic uint64_t *share = &pool->shares[self].range;
+  do {
+    uint64_t range = atomic_load(share);
+    while ((uint32_t)(range >> 32) < (uint32_t)range) {
+      uint32_t next = (uint32_t)(range >> 32);
+      if (atomic_compare_exchange_weak(share, &range, range + (1ULL << 32))) {
+        pool->fn(pool->ctx, next);
+        range = atomic_load(share);
+      }
+    }
+  } while (render_pool_steal(pool, self));
+}
+
+static void *render_pool_worker(void *arg) {
+  render_worker_t *worker = arg;
+  render_pool_t *pool = worker->pool;
+  uint64_t seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->shutdown && pool->generation == seen)
+      pthread_cond_wait(&pool->start, &pool->lock);
+    if (pool->shutdown)
+      break;
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    render_pool_work(pool, worker->index);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->active == 0)
+      pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+static void render_pool_free(render_pool_t *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = true;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  for (uint32_t i = 1; i < pool->threads; i++)
+    pthread_join(pool->workers[i - 1].thread, NULL);
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->start);
+  pthread_mutex_destroy(&pool->lock);
+}
+
+/* Start threads - 1 workers (clamped to RENDER_POOL_MAX_THREADS in all).
+ * Workers block every signal, so signals keep going to the main thread's
+ * signalfd. Returns 0, or -1 with errno set. */
+static int render_pool_init(render_pool_t *pool, uint32_t threads) {
+  memset(pool, 0, sizeof(*pool));
+  threads = threads < 1 ? 1 : threads > RENDER_POOL_MAX_THREADS ? RENDER_POOL_MAX_THREADS : threads;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->threads = 1;
+
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  int err = 0;
+  for (uint32_t i = 1; i < threads && err == 0; i++) {
+    render_worker_t *worker = &pool->workers[i - 1];
+    *worker = (render_worker_t){.pool = pool, .index = i};
+    err = pthread_create(&worker->thread, NULL, render_pool_worker, worker);
+    if (err == 0)
+      pool->threads++;
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if (err) {
+    render_pool_free(pool);
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+/* Run fn(ctx, i) for every i in [0, count) across the pool and wait for
+ * all of them. Jobs run in no particular order. */
+static void render_pool_run(render_pool_t *pool, uint32_t count, render_job_fn_t fn, void *ctx) {
+  pool->batches++;
+  pool->jobs += count;
+  if (pool->threads == 1 || count <= 1) {
+    for (uint32_t i = 0; i < count; i++)
+      fn(ctx, i);
+    return;
+  }
+
+  uint32_t threads = pool->threads;
+  for (uint32_t i = 0; i < threads; i++)
+    atomic_store(&pool->shares[i].range,
+                 render_range((uint32_t)((uint64_t)count * i / threads),
+                              (uint32_t)((uint64_t)count * (i + 1) / threads)));
+  pthread_mutex_lock(&pool->lock);
+  pool->fn = fn;
+  pool->ctx = ctx;
+  pool->active = threads - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  render_pool_work(pool, 0);
+
+  // the other participants may still be running jobs they took
+  pthread_mutex_lock(&pool->lock);
+  while (pool->active)
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/* ------------------- Entities --------------------------------------------- */
+
+/* The entity demo and stress benchmark draw many small moving rectangles.
+ * Entities are stored as structure-of-arrays, so each per-frame pass streams
+ * only the fields it needs, a SIMD register at a time:
+ *  1. update: integrate x and y (position += velocity * dt), bouncing off
+ *     the world's walls
+ *  2. cull: test a register of entities at a time against the window, and
+ *     clip each survivor to a compact pixel rect while its fields are still
+ *     in L1, so no later pass goes back to the SoA arrays
+ *  3. bin: copy the rects into per-tile lists of ENTITY_TILE_SIZE pixel
+ *     tiles (a counting sort, so draw order is kept)
+ *  4. draw: clear each tile and fill its rects, reading the tile's list
+ *     sequentially while that part of the framebuffer is in L1/L2, instead
+ *     of scattering rects across the whole buffer
+ * The world can be larger than the window; entities outside it cost a
+ * compare in the cull pass and nothing after.
+ *
+ * Only tiles with entities now or in the last drawn frame are repainted,
+ * and their rows become the frame's damage.
+ */
+
+#define ENTITY_TILE_SIZE 64U  /* 64 * 64 * 4 bytes = 16 KiB, fits L1 */
+
+typedef struct entity_kernels_t entity_kernels_t;
+typedef struct entity_rect_t entity_rect_t;
+
+struct entity_kernels_t {
+  const char *name;
+  // pos += vel * dt for `count` entities along one axis, reflecting at 0 and
+  // world - size (and clamped there if a step overshoots the whole world)
+  void (*integrate)(float *pos, float *vel, const float *size, uint64_t count, float dt, float world);
+  // clips every entity that covers a pixel of [0, view_w) x [0, view_h) to
+  // it and writes the rects to `out`, in order; returns how many
+  uint64_t (*cull)(const entity_store_t *store, uint32_t view_w, uint32_t view_h, entity_rect_t *out);
+  // fills `count` rects, each clipped to the tile [x0, x1) x [y0, y1) it
+  // overlaps, into a stride == width buffer, in order
+  void (*draw)(uint32_t *pixels, uint32_t width, const entity_rect_t *rects, uint32_t count,
+               uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+};
+
+/* A visible entity clipped to the window, as the draw pass reads it */
+struct entity_rect_t {
+  uint16_t x0, y0, x1, y1;     // pixels, x1/y1 exclusive
+  uint32_t color;
+};
+
+struct entity_store_t {
+  float *x, *y;                // top-left corner, world pixels
+  float *vx, *vy;              // pixels per second
+  float *w, *h;                // size in pixels, whole numbers
+  uint32_t *color;
+  uint64_t len, cap;
+  float world_w, world_h;      // entities bounce off these walls
+  bool moved;                  // updated since the last draw
+
+  // rebuilt by entity_store_bin for every frame
+  entity_rect_t *rects;        // cap entries, one per visible entity
+  uint64_t visible_len;
+  uint32_t view_w, view_h;
+  uint32_t tiles_x, tiles_y;
+  uint32_t *tile_start;        // tiles + 1 offsets into tile_items
+  entity_rect_t *tile_items;   // copies of rects, grouped by tile
+  uint64_t tile_items_len, tile_items_cap;
+  bool *tile_drawn;            // the tile had entities in the last drawn frame
+};
+
+/* floorf without libm; positions are well inside int32_t range */
+static inline float entity_floor(float v) {
+  float t = (float)(int32_t)v;
+  return t > v ? t - 1.0f : t;
+}
+
+/* Clip entity i to the window. Returns false if it covers no pixel of it,
+ * e.g. a sliver whose float extent overlaps but whose pixels don't. */
+static inline bool entity_clip(const entity_store_t *store, uint64_t i, uint32_t view_w, uint32_t view_h,
+                               entity_rect_t *r) {
+  float x0 = entity_floor(store->x[i]), y0 = entity_floor(store->y[i]);
+  float x1 = x0 + store->w[i], y1 = y0 + store->h[i];
+  x0 = x0 > 0.0f ? x0 : 0.0f;
+  y0 = y0 > 0.0f ? y0 : 0.0f;
+  x1 = x1 < (float)view_w ? x1 : (float)view_w;
+  y1 = y1 < (float)view_h ? y1 : (float)view_h;
+  if (!(x0 < x1 && y0 < y1))
+    return false;
+  *r = (entity_rect_t){(uint16_t)x0, (uint16_t)y0, (uint16_t)x1, (uint16_t)y1, store->color[i]};
+  return true;
+}
+
+/* Fill a span; rects are mostly a few pixels wide, too short to be worth a
+ * call through the kernel table or a loop. Up to 8 pixels take two or four
+ * overlapping 8-byte stores, whatever the count. */
+static inline void entity_fill_span(uint32_t *dst, uint32_t count, uint32_t color) {
+  uint64_t pair = (uint64_t)color << 32 | color;
+  if (count > 8) {
+    pixel_kernels->fill(dst, count, color);
+  } else if (count >= 4) {
+    memcpy(dst, &pair, sizeof(pair));
+    memcpy(dst + 2, &pair, sizeof(pair));
+    memcpy(dst + count - 4, &pair, sizeof(pair));
+    memcpy(dst + count - 2, &pair, sizeof(pair));
+  } else if (count >= 2) {
+    memcpy(dst, &pair, sizeof(pair));
+    memcpy(dst + count - 2, &pair, sizeof(pair));
+  } else if (count) {
+    dst[0] = color;
+  }
+}
+
+static void entity_integrate_scalar(float *pos, float *vel, const float *size, uint64_t count,
+                                    float dt, float world) {
+  for (uint64_t i = 0; i < count; i++) {
+    float max = world - size[i];
+    float p = pos[i] + vel[i] * dt;
+    bool lo = p < 0.0f, hi = p > max;
+    if (lo || hi)
+      vel[i] = -vel[i];
+    if (hi)
+      p = max + max - p;
+    if (lo)
+      p = -p;
+    p = p < max ? p : max;
+    pos[i] = p > 0.0f ? p : 0.0f;
+  }
+}
+
+static uint64_t entity_cull_range(const entity_store_t *store, uint64_t start, uint32_t view_w,
+                                  uint32_t view_h, entity_rect_t *out) {
+  const float *x = store->x, *y = store->y, *w = store->w, *h = store->h;
+  float fw = (float)view_w, fh = (float)view_h;
+  uint64_t n = 0;
+  for (uint64_t i = start; i < store->len; i++) {
+    if (x[i] < fw && x[i] + w[i] > 0.0f && y[i] < fh && y[i] + h[i] > 0.0f)
+      n += entity_clip(store, i, view_w, view_h, &out[n]);
+  }
+  return n;
+}
+
+static uint64_t entity_cull_scalar(const entity_store_t *store, uint32_t view_w, uint32_t view_h,
+                                   entity_rect_t *out) {
+  return entity_cull_range(store, 0, view_w, view_h, out);
+}
+
+static void entity_draw_scalar(uint32_t *pixels, uint32_t width, const entity_rect_t *rects, uint32_t count,
+                               uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+  for (uint32_t k = 0; k < count; k++) {
+    entity_rect_t r = rects[k];
+    uint32_t rx0 = r.x0 > x0 ? r.x0 : x0, rx1 = r.x1 < x1 ? r.x1 : x1;
+    uint32_t ry0 = r.y0 > y0 ? r.y0 : y0, ry1 = r.y1 < y1 ? r.y1 : y1;
+    for (uint32_t y = ry0; y < ry1; y++)
+      entity_fill_span(pixels + (uint64_t)y * width + rx0, rx1 - rx0, r.color);
+  }
+}
+
+static const entity_kernels_t entity_kernels_scalar = {
+  .name = "scalar",
+  .integrate = entity_integrate_scalar,
+  .cull = entity_cull_scalar,
+  .draw = entity_draw_scalar,
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* The vector kernels do the same float operations in the same order as the
+ * scalar ones, so every kernel set moves entities identically. */
+
+__attribute__((target("sse2")))
+static void entity_integrate_sse2(float *pos, float *vel, const float *size, uint64_t count,
+                                  float dt, float world) {
+  __m128 vdt = _mm_set1_ps(dt), vworld = _mm_set1_ps(world), zero = _mm_setzero_ps();
+  __m128 sign = _mm_set1_ps(-0.0f);
+  uint64_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 max = _mm_sub_ps(vworld, _mm_loadu_ps(size + i));
+    __m128 v = _mm_loadu_ps(vel + i);
+    __m128 p = _mm_add_ps(_mm_loadu_ps(pos + i), _mm_mul_ps(v, vdt));
+    __m128 lo = _mm_cmplt_ps(p, zero), hi = _mm_cmpgt_ps(p, max);
+    __m128 bounce = _mm_or_ps(lo, hi);
+    _mm_storeu_ps(vel + i, _mm_xor_ps(v, _mm_and_ps(bounce, sign)));
+    __m128 reflected_hi = _mm_sub_ps(_mm_add_ps(max, max), p);
+    p = _mm_or_ps(_mm_and_ps(hi, reflected_hi), _mm_andnot_ps(hi, p));
+    p = _mm_or_ps(_mm_and_ps(lo, _mm_xor_ps(p, sign)), _mm_andnot_ps(lo, p));
+    _mm_storeu_ps(pos + i, _mm_max_ps(_mm_min_ps(p, max), zero));
+  }
+  entity_integrate_scalar(pos + i, vel + i, size + i, count - i, dt, world);
+}
+
+__attribute__((target("sse2")))
+static uint64_t entity_cull_sse2(const entity_store_t *store, uint32_t view_w, uint32_t view_h,
+                                 entity_rect_t *out) {
+  __m128 vw = _mm_set1_ps((float)view_w), vh = _mm_set1_ps((float)view_h);
+  __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+  uint64_t n = 0, i = 0;
+  for (; i + 4 <= store->len; i += 4) {
+    // entity_clip four at a time; floor is truncation, less one for
+    // negative non-integers (SSE2 has no roundps)
+    __m128 px = _mm_loadu_ps(store->x + i), py = _mm_loadu_ps(store->y + i);
+    __m128 tx = _mm_cvtepi32_ps(_mm_cvttps_epi32(px)), ty = _mm_cvtepi32_ps(_mm_cvttps_epi32(py));
+    tx = _mm_sub_ps(tx, _mm_and_ps(_mm_cmpgt_ps(tx, px), one));
+    ty = _mm_sub_ps(ty, _mm_and_ps(_mm_cmpgt_ps(ty, py), one));
+    __m128 x1 = _mm_min_ps(_mm_add_ps(tx, _mm_loadu_ps(store->w + i)), vw);
+    __m128 y1 = _mm_min_ps(_mm_add_ps(ty, _mm_loadu_ps(store->h + i)), vh);
+    __m128 x0 = _mm_max_ps(tx, zero), y0 = _mm_max_ps(ty, zero);
+    uint32_t mask = (uint32_t)_mm_movemask_ps(_mm_and_ps(_mm_cmplt_ps(x0, x1), _mm_cmplt_ps(y0, y1)));
+    if (!mask)
+      continue;
+    int32_t r[4][4];
+    _mm_storeu_si128((__m128i *)r[0], _mm_cvttps_epi32(x0));
+    _mm_storeu_si128((__m128i *)r[1], _mm_cvttps_epi32(y0));
+    _mm_storeu_si128((__m128i *)r[2], _mm_cvttps_epi32(x1));
+    _mm_storeu_si128((__m128i *)r[3], _mm_cvttps_epi32(y1));
+    for (; mask; mask &= mask - 1) {
+      uint32_t k = (uint32_t)__builtin_ctz(mask);
+      out[n++] = (entity_rect_t){(uint16_t)r[0][k], (uint16_t)r[1][k], (uint16_t)r[2][k], (uint16_t)r[3][k],
+                                 store->color[i + k]};
+    }
+  }
+  return n + entity_cull_range(store, i, view_w, view_h, out + n);
+}
+
+static const entity_kernels_t entity_kernels_sse2 = {
+  .name = "sse2",
+  .integrate = entity_integrate_sse2,
+  .cull = entity_cull_sse2,
+  .draw = entity_draw_scalar, // SSE2's masked store bypasses the cache
+};
+
+__attribute__((target("avx2")))
+static void entity_integrate_avx2(float *pos, float *vel, const float *size, uint64_t count,
+                                  float dt, float world) {
+  __m256 vdt = _mm256_set1_ps(dt), vworld = _mm256_set1_ps(world), zero = _mm256_setzero_ps();
+  __m256 sign = _mm256_set1_ps(-0.0f);
+  uint64_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 max = _mm256_sub_ps(vworld, _mm256_loadu_ps(size + i));
+    __m256 v = _mm256_loadu_ps(vel + i);
+    __m256 p = _mm256_add_ps(_mm256_loadu_ps(pos + i), _mm256_mul_ps(v, vdt));
+    __m256 lo = _mm256_cmp_ps(p, zero, _CMP_LT_OQ), hi = _mm256_cmp_ps(p, max, _CMP_GT_OQ);
+    _mm256_storeu_ps(vel + i, _mm256_xor_ps(v, _mm256_and_ps(_mm256_or_ps(lo, hi), sign)));
+    p = _mm256_blendv_ps(p, _mm256_sub_ps(_mm256_add_ps(max, max), p), hi);
+    p = _mm256_blendv_ps(p, _mm256_xor_ps(p, sign), lo);
+    _mm256_storeu_ps(pos + i, _mm256_max_ps(_mm256_min_ps(p, max), zero));
+  }
+  entity_integrate_scalar(pos + i, vel + i, size + i, count - i, dt, world);
+}
+
+__attribute__((target("avx2")))
+static uint64_t entity_cull_avx2(const entity_store_t *store, uint32_t view_w, uint32_t view_h,
+                                 entity_rect_t *out) {
+  __m256 vw = _mm256_set1_ps((float)view_w), vh = _mm256_set1_ps((float)view_h);
+  __m256 zero = _mm256_setzero_ps();
+  uint64_t n = 0, i = 0;
+  for (; i + 8 <= store->len; i += 8) {
+    // entity_clip eight at a time
+    __m256 tx = _mm256_floor_ps(_mm256_loadu_ps(store->x + i));
+    __m256 ty = _mm256_floor_ps(_mm256_loadu_ps(store->y + i));
+    __m256 x1 = _mm256_min_ps(_mm256_add_ps(tx, _mm256_loadu_ps(store->w + i)), vw);
+    __m256 y1 = _mm256_min_ps(_mm256_add_ps(ty, _mm256_loadu_ps(store->h + i)), vh);
+    __m256 x0 = _mm256_max_ps(tx, zero), y0 = _mm256_max_ps(ty, zero);
+    uint32_t mask = (uint32_t)_mm256_movemask_ps(
+      _mm256_and_ps(_mm256_cmp_ps(x0, x1, _CMP_LT_OQ), _mm256_cmp_ps(y0, y1, _CMP_LT_OQ)));
+    if (!mask)
+      continue;
+    int32_t r[4][8];
+    _mm256_storeu_si256((__m256i *)r[0], _mm256_cvttps_epi32(x0));
+    _mm256_storeu_si256((__m256i *)r[1], _mm256_cvttps_epi32(y0));
+    _mm256_storeu_si256((__m256i *)r[2], _mm256_cvttps_epi32(x1));
+    _mm256_storeu_si256((__m256i *)r[3], _mm256_cvttps_epi32(y1));
+    for (; mask; mask &= mask - 1) {
+      uint32_t k = (uint32_t)__builtin_ctz(mask);
+      out[n++] = (entity_rect_t){(uint16_t)r[0][k], (uint16_t)r[1][k], (uint16_t)r[2][k], (uint16_t)r[3][k],
+                                 store->color[i + k]};
+    }
+  }
+  return n + entity_cull_range(store, i, view_w, view_h, out + n);
+}
+
+/* A rect of up to 8x8 pixels, nearly every one, is eight masked stores.
+ * Width and height differ from rect to rect, so loops and entity_fill_span's
+ * branches on them mispredict; the mask and the fixed row count don't
+ * branch at all. Rects clipped to the tile are never empty. */
+__attribute__((target("avx2")))
+static void entity_draw_avx2(uint32_t *pixels, uint32_t width, const entity_rect_t *rects, uint32_t count,
+                             uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  for (uint32_t k = 0; k < count; k++) {
+    entity_rect_t r = rects[k];
+    uint32_t rx0 = r.x0 > x0 ? r.x0 : x0, rx1 = r.x1 < x1 ? r.x1 : x1;
+    uint32_t ry0 = r.y0 > y0 ? r.y0 : y0, ry1 = r.y1 < y1 ? r.y1 : y1;
+    uint32_t w = rx1 - rx0, h = ry1 - ry0;
+    uint32_t *dst = pixels + (uint64_t)ry0 * width + rx0;
+    if (w > 8 || h > 8) {
+      for (uint32_t y = ry0; y < ry1; y++, dst += width)
+        entity_fill_span(dst, w, r.color);
+      continue;
+    }
+    __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32((int32_t)w), lanes);
+    __m256i color = _mm256_set1_epi32((int32_t)r.color);
+    // rows past the rect's height store its last row again
+    uint32_t *last = dst + (uint64_t)(h - 1) * width;
+    for (uint32_t j = 0; j < 8; j++)
+      _mm256_maskstore_epi32((int *)(j < h ? dst + (uint64_t)j * width : last), mask, color);
+  }
+}
+
+static const entity_kernels_t entity_kernels_avx2 = {
+  .name = "avx2",
+  .integrate = entity_integrate_avx2,
+  .cull = entity_cull_avx2,
+  .draw = entity_draw_avx2,
+};
+#endif
+
+/* The kernels the entity store uses */
+static const entity_kernels_t *entity_kernels = &entity_kernels_scalar;
+
+/* Select the widest kernels the CPU runs. KASAMA_ENTITY_KERNELS=<name>
+ * forces a specific (supported) set, for benchmarking. */
+static void entity_kernels_init(void) {
+  const entity_kernels_t *available[3] = {&entity_kernels_scalar};
+  uint32_t available_len = 1;
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    available[available_len++] = &entity_kernels_sse2;
+  if (__builtin_cpu_supports("avx2"))
+    available[available_len++] = &entity_kernels_avx2;
+#endif
+  entity_kernels = available[available_len - 1];
+
+  char *forced = getenv("KASAMA_ENTITY_KERNELS");
+  for (uint32_t i = 0; forced && i < available_len; i++) {
+    if (strcmp(forced, available[i]->name) == 0)
+      entity_kernels = available[i];
+  }
+}
+
+static void entity_store_free(entity_store_t *store) {
+  free(store->x);
+  free(store->y);
+  free(store->vx);
+  free(store->vy);
+  free(store->w);
+  free(store->h);
+  free(store->color);
+  free(store->rects);
+  free(store->tile_start);
+  free(store->tile_items);
+  free(store->tile_drawn);
+  memset(store, 0, sizeof(*store));
+}
+
+/* Allocate room for `cap` entities in a world_w x world_h world. Arrays are
+ * cache-line aligned. Returns 0, or -1 with errno set. */
+static int entity_store_init(entity_store_t *store, uint64_t cap, float world_w, float world_h) {
+  assert(cap > 0 && cap <= UINT32_MAX);
+  memset(store, 0, sizeof(*store));
+  uint64_t floats = (cap * sizeof(float) + 63) & ~(uint64_t)63;
+  store->x = aligned_alloc(64, floats);
+  store->y = aligned_alloc(64, floats);
+  store->vx = aligned_alloc(64, floats);
+  store->vy = aligned_alloc(64, floats);
+  store->w = aligned_alloc(64, floats);
+  store->h = aligned_alloc(64, floats);
+  store->color = aligned_alloc(64, floats);
+  store->rects = malloc(sizeof(*store->rects) * cap);
+  if (!store->x || !store->y || !store->vx || !store->vy || !store->w || !store->h ||
+      !store->color || !store->rects) {
+    entity_store_free(store);
+    errno = ENOMEM;
+    return -1;
+  }
+  store->cap = cap;
+  store->world_w = world_w;
+  store->world_h = world_h;
+  return 0;
+}
+
+/* Add a w x h entity at (x, y) moving at (vx, vy) pixels per second.
+ * Returns its index, or -1 if the store is full. */
+static int64_t entity_store_add(entity_store_t *store, float x, float y, float vx, float vy,
+                                uint32_t w, uint32_t h, uint32_t color) {
+  if (store->len == store->cap)
+    return -1;
+  uint64_t i = store->len++;
+  store->x[i] = x;
+  store->y[i] = y;
+  store->vx[i] = vx;
+  store->vy[i] = vy;
+  store->w[i] = (float)w;
+  store->h[i] = (float)h;
+  store->color[i] = color;
+  store->moved = true;
+  return (int64_t)i;
+}
+
+/* Advance every entity by dt seconds */
+static void entity_store_update(entity_store_t *store, float dt) {
+  entity_kernels->integrate(store->x, store->vx, store->w, store->len, dt, store->world_w);
+  entity_kernels->integrate(store->y, store->vy, store->h, store->len, dt, store->world_h);
+  store->moved = true;
+}
+
+/* Resize the tile grid for a view_w x view_h window. Tiles of a new size
+ * count as drawn, so the first frame repaints all of them. */
+static int entity_store_tiles(entity_store_t *store, uint32_t view_w, uint32_t view_h) {
+  if (store->tile_start && view_w == store->view_w && view_h == store->view_h)
+    return 0;
+  uint32_t tiles_x = (view_w + ENTITY_TILE_SIZE - 1) / ENTITY_TILE_SIZE;
+  uint32_t tiles_y = (view_h + ENTITY_TILE_SIZE - 1) / ENTITY_TILE_SIZE;
+  uint64_t tiles = (uint64_t)tiles_x * tiles_y;
+  uint32_t *tile_start = realloc(store->tile_start, sizeof(*tile_start) * (tiles + 1));
+  if (!tile_start)
+    return -1;
+  store->tile_start = tile_start;
+  bool *tile_drawn = realloc(store->tile_drawn, sizeof(*tile_drawn) * tiles);
+  if (!tile_drawn)
+    return -1;
+  store->tile_drawn = tile_drawn;
+  for (uint64_t t = 0; t < tiles; t++)
+    tile_drawn[t] = true;
+  store->view_w = view_w;
+  store->view_h = view_h;
+  store->tiles_x = tiles_x;
+  store->tiles_y = tiles_y;
+  return 0;
+}
+
+/* Cull against a view_w x view_h window and bin the visible entities into
+ * tiles. Rects keep 16-bit coordinates, so a wider or taller view fails
+ * with EOVERFLOW. Returns 0, or -1 with errno set. */
+static int entity_store_bin(entity_store_t *store, uint32_t view_w, uint32_t view_h) {
+  if (view_w > UINT16_MAX || view_h > UINT16_MAX) {
+    errno = EOVERFLOW;
+    return -1;
+  }
+  if (entity_store_tiles(store, view_w, view_h) == -1)
+    return -1;
+  uint64_t rects_len = entity_kernels->cull(store, view_w, view_h, store->rects);
+  store->visible_len = rects_len;
+
+  // count the tiles each rect spans; most small rects sit in a single one
+  uint32_t tiles = store->tiles_x * store->tiles_y;
+  uint32_t *count = store->tile_start;
+  memset(count, 0, sizeof(*count) * (tiles + 1));
+  uint64_t items = 0;
+  for (uint64_t k = 0; k < rects_len; k++) {
+    entity_rect_t r = store->rects[k];
+    uint32_t tx0 = r.x0 / ENTITY_TILE_SIZE, tx1 = (uint32_t)(r.x1 - 1) / ENTITY_TILE_SIZE;
+    uint32_t ty0 = r.y0 / ENTITY_TILE_SIZE, ty1 = (uint32_t)(r.y1 - 1) / ENTITY_TILE_SIZE;
+    if (tx0 == tx1 && ty0 == ty1) {
+      count[ty0 * store->tiles_x + tx0 + 1]++;
+      items++;
+      continue;
+    }
+    for (uint32_t ty = ty0; ty <= ty1; ty++) {
+      for (uint32_t tx = tx0; tx <= tx1; tx++)
+        count[ty * store->tiles_x + tx + 1]++;
+    }
+    items += (uint64_t)(tx1 - tx0 + 1) * (ty1 - ty0 + 1);
+  }
+
+  if (items > store->tile_items_cap) {
+    uint64_t cap = store->tile_items_cap ? store->tile_items_cap : 1024;
+    while (cap < items)
+      cap *= 2;
+    entity_rect_t *tile_items = realloc(store->tile_items, sizeof(*tile_items) * cap);
+    if (!tile_items)
+      return -1;
+    store->tile_items = tile_items;
+    store->tile_items_cap = cap;
+  }
+  store->tile_items_len = items;
+
+  // prefix sums turn counts into start offsets; the scatter below then
+  // advances tile_start[t] to the end of tile t, i.e. the start of t + 1
+  for (uint32_t t = 1; t <= tiles; t++)
+    count[t] += count[t - 1];
+  for (uint64_t k = 0; k < rects_len; k++) {
+    entity_rect_t r = store->rects[k];
+    uint32_t tx0 = r.x0 / ENTITY_TILE_SIZE, tx1 = (uint32_t)(r.x1 - 1) / ENTITY_TILE_SIZE;
+    uint32_t ty0 = r.y0 / ENTITY_TILE_SIZE, ty1 = (uint32_t)(r.y1 - 1) / ENTITY_TILE_SIZE;
+    if (tx0 == tx1 && ty0 == ty1) {
+      store->tile_items[count[ty0 * store->tiles_x + tx0]++] = r;
+      continue;
+    }
+    for (uint32_t ty = ty0; ty <= ty1; ty++) {
+      for (uint32_t tx = tx0; tx <= tx1; tx++)
+        store->tile_items[count[ty * store->tiles_x + tx]++] = r;
+    }
+  }
+  memmove(count + 1, count, sizeof(*count) * tiles);
+  count[0] = 0;
+  return 0;
+}
+
+/* Repaint the tiles of tile row ty that have entities now or had some in
+ * the last drawn frame. Returns the repainted span of the row, with x1 == 0
+ * if nothing was. Tile rows are disjoint in pixels and tile state, so
+ * several may be drawn at once. */
+static rect_t entity_store_draw_row(entity_store_t *store, uint32_t *pixels, uint32_t background,
+                                    bool cleared, uint32_t ty) {
+  uint32_t width = store->view_w, height = store->view_h;
+  uint32_t y0 = ty * ENTITY_TILE_SIZE;
+  uint32_t y1 = y0 + ENTITY_TILE_SIZE < height ? y0 + ENTITY_TILE_SIZE : height;
+  uint32_t damage_x0 = UINT32_MAX, damage_x1 = 0;
+
+  for (uint32_t tx = 0; tx < store->tiles_x; tx++) {
+    uint32_t t = ty * store->tiles_x + tx;
+    uint32_t start = store->tile_start[t], end = store->tile_start[t + 1];
+    bool drawn = store->tile_drawn[t];
+    store->tile_drawn[t] = start != end;
+    if (start == end && (!drawn || cleared))
+      continue;
+
+    uint32_t x0 = tx * ENTITY_TILE_SIZE;
+    uint32_t x1 = x0 + ENTITY_TILE_SIZE < width ? x0 + ENTITY_TILE_SIZE : width;
+    if (!cleared) {
+      for (uint32_t y = y0; y < y1; y++)
+        entity_fill_span(pixels + (uint64_t)y * width + x0, x1 - x0, background);
+    }
+    entity_kernels->draw(pixels, width, store->tile_items + start, end - start, x0, y0, x1, y1);
+    damage_x0 = x0 < damage_x0 ? x0 : damage_x0;
+    damage_x1 = x1;
+  }
+
+  if (!damage_x1)
+    return (rect_t){0};
+  return (rect_t){.x = damage_x0, .y = y0, .w = damage_x1 - damage_x0, .h = y1 - y0};
+}
+
+/* Repaint, tile by tile, every tile that has entities now or had some in
+ * the last drawn frame, from the rects the last entity_store_bin produced.
+ * - pixels: a stride == width buffer of the size passed to entity_store_bin
+ * - cleared: the buffer was just cleared to `background`, so tiles without
+ *   entities need no repaint
+ */
+static void entity_store_draw(entity_store_t *store, uint32_t *pixels, uint32_t background,
+                              bool cleared, damage_t *damage) {
+  for (uint32_t ty = 0; ty < store->tiles_y; ty++) {
+    rect_t span = entity_store_draw_row(store, pixels, background, cleared, ty);
+    if (span.w)
+      damage_add(damage, span);
+  }
+  store->moved = false;
+}
+
+/* ------------------- Text rendering -------------------------------------- */
+
+/* Terminal text is drawn from a glyph atlas: every (codepoint, style) pair
+ * that appears on screen is rasterized once into a fixed-size slot holding a
+ * coverage mask (one byte per pixel) and, for bitmap fonts, a 1-bit row mask.
+ * Rows of cells are then composited straight into the swapchain buffer, one
+ * pixel row at a time across all cells so the framebuffer is written
+ * sequentially.
+ *
+ * Fonts come from an embedded 8x8 bitmap font (drawn at 8x16) or from a PSF1 /
+ * PSF2 console font loaded from disk.
+ */
+
+#define GLYPH_MAX_WIDTH 32U        /* row masks are 32 bits wide */
+#define GLYPH_ATLAS_CAP 1024U      /* glyph slots; the atlas is flushed when full */
+#define GLYPH_CACHE_CAP 2048U      /* hash slots, power of two, > GLYPH_ATLAS_CAP */
+#define GLYPH_STYLE_BOLD 0x1U
+#define GLYPH_STYLE_UNDERLINE 0x2U
+#define GLYPH_STYLE_COUNT 4U
+#define TEXT_ROW_CHUNK 256U        /* cells resolved to glyph slots per batch */
+
+typedef struct font_t font_t;
+typedef struct font_map_entry_t font_map_entry_t;
+typedef struct glyph_atlas_stats_t glyph_atlas_stats_t;
+typedef struct text_cell_t text_cell_t;
+
+struct font_map_entry_t {
+  uint32_t codepoint;
+  uint32_t glyph;
+};
+
+/* A monospace bitmap font. Rows are 1 bit per pixel, MSB leftmost. */
+struct font_t {
+  uint32_t width;
+  uint32_t height;
+  uint32_t glyph_count;
+  uint32_t bytes_per_row;
+  uint8_t *bitmaps;            // glyph_count * height * bytes_per_row
+  font_map_entry_t *map;       // codepoint -> glyph, sorted by codepoint
+  uint32_t map_len;
+  uint32_t fallback_glyph;     // drawn for codepoints the font lacks
+};
+
+/* One cell handed to the row blitter */
+struct text_cell_t {
+  uint32_t codepoint;
+  uint32_t fg;
+  uint32_t bg;
+  uint8_t style;               // GLYPH_STYLE_* bits
+};
+
+struct glyph_atlas_stats_t {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t flushes;
+};
+
+struct glyph_atlas_t {
+  const font_t *font;
+  uint32_t cell_w;
+  uint32_t cell_h;
+
+  uint8_t *coverage;           // GLYPH_ATLAS_CAP slots of cell_w * cell_h bytes
+  uint32_t *row_masks;         // GLYPH_ATLAS_CAP slots of cell_h masks
+  bool binary[GLYPH_ATLAS_CAP]; // coverage is only 0 or 255: row masks are exact
+  uint32_t len;
+
+  uint32_t cache_keys[GLYPH_CACHE_CAP]; // codepoint << 2 | style, plus one; 0 = empty
+  uint16_t cache_slots[GLYPH_CACHE_CAP];
+  int16_t ascii[GLYPH_STYLE_COUNT][128]; // direct lookup for the common case, -1 = none
+
+  glyph_atlas_stats_t stats;
+};
+
+/* font8x8_basic by Daniel Hepper (public domain): U+0020..U+007E, one byte
+ * per row, least significant bit leftmost. */
+static const uint8_t font8x8_basic[95][8] = {
+  {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // ' '
+  {0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00}, // '!'
+  {0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // '"'
+  {0x36, 0x36, 0x7F, 0x36, 0x7F, 0x36, 0x36, 0x00}, // '#'
+  {0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00}, // '$'
+  {0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00}, // '%'
+  {0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00}, // '&'
+  {0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00}, // '''
+  {0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00}, // '('
+  {0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00}, // ')'
+  {0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00}, // '*'
+  {0x00, 0x0C, 0x0C, 0x3F, 0x0C, 0x0C, 0x00, 0x00}, // '+'
+  {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x06}, // ','
+  {0x00, 0x00, 0x00, 0x3F, 0x00, 0x00, 0x00, 0x00}, // '-'
+  {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00}, // '.'
+  {0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00}, // '/'
+  {0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00}, // '0'
+  {0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00}, // '1'
+  {0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00}, // '2'
+  {0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00}, // '3'
+  {0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00}, // '4'
+  {0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00}, // '5'
+  {0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00}, // '6'
+  {0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00}, // '7'
+  {0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00}, // '8'
+  {0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00}, // '9'
+  {0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00}, // ':'
+  {0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x06}, // ';'
+  {0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00}, // '<'
+  {0x00, 0x00, 0x3F, 0x00, 0x00, 0x3F, 0x00, 0x00}, // '='
+  {0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00}, // '>'
+  {0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00}, // '?'
+  {0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00}, // '@'
+  {0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00}, // 'A'
+  {0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00}, // 'B'
+  {0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00}, // 'C'
+  {0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00}, // 'D'
+  {0x7F, 0x46, 0x16, 0x1E, 0x16, 0x46, 0x7F, 0x00}, // 'E'
+  {0x7F, 0x46, 0x16, 0x1E, 0x16, 0x06, 0x0F, 0x00}, // 'F'
+  {0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00}, // 'G'
+  {0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00}, // 'H'
+  {0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00}, // 'I'
+  {0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00}, // 'J'
+  {0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00}, // 'K'
+  {0x0F, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7F, 0x00}, // 'L'
+  {0x63, 0x77, 0x7F, 0x7F, 0x6B, 0x63, 0x63, 0x00}, // 'M'
+  {0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00}, // 'N'
+  {0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00}, // 'O'
+  {0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x0F, 0x00}, // 'P'
+  {0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00}, // 'Q'
+  {0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00}, // 'R'
+  {0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00}, // 'S'
+  {0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00}, // 'T'
+  {0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3F, 0x00}, // 'U'
+  {0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00}, // 'V'
+  {0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00}, // 'W'
+  {0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00}, // 'X'
+  {0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00}, // 'Y'
+  {0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00}, // 'Z'
+  {0x1E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1E, 0x00}, // '['
+  {0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x40, 0x00}, // '\'
+  {0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00}, // ']'
+  {0x08, 0x1C, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00}, // '^'
+  {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF}, // '_'
+  {0x0C, 0x0C, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00}, // '`'
+  {0x00, 0x00, 0x1E, 0x30, 0x3E, 0x33, 0x6E, 0x00}, // 'a'
+  {0x07, 0x06, 0x06, 0x3E, 0x66, 0x66, 0x3B, 0x00}, // 'b'
+  {0x00, 0x00, 0x1E, 0x33, 0x03, 0x33, 0x1E, 0x00}, // 'c'
+  {0x38, 0x30, 0x30, 0x3E, 0x33, 0x33, 0x6E, 0x00}, // 'd'
+  {0x00, 0x00, 0x1E, 0x33, 0x3F, 0x03, 0x1E, 0x00}, // 'e'
+  {0x1C, 0x36, 0x06, 0x0F, 0x06, 0x06, 0x0F, 0x00}, // 'f'
+  {0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x1F}, // 'g'
+  {0x07, 0x06, 0x36, 0x6E, 0x66, 0x66, 0x67, 0x00}, // 'h'
+  {0x0C, 0x00, 0x0E, 0x0C, 0x0C, 0x0C, 0x1E, 0x00}, // 'i'
+  {0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E}, // 'j'
+  {0x07, 0x06, 0x66, 0x36, 0x1E, 0x36, 0x67, 0x00}, // 'k'
+  {0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00}, // 'l'
+  {0x00, 0x00, 0x33, 0x7F, 0x7F, 0x6B, 0x63, 0x00}, // 'm'
+  {0x00, 0x00, 0x1F, 0x33, 0x33, 0x33, 0x33, 0x00}, // 'n'
+  {0x00, 0x00, 0x1E, 0x33, 0x33, 0x33, 0x1E, 0x00}, // 'o'
+  {0x00, 0x00, 0x3B, 0x66, 0x66, 0x3E, 0x06, 0x0F}, // 'p'
+  {0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x78}, // 'q'
+  {0x00, 0x00, 0x3B, 0x6E, 0x66, 0x06, 0x0F, 0x00}, // 'r'
+  {0x00, 0x00, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x00}, // 's'
+  {0x08, 0x0C, 0x3E, 0x0C, 0x0C, 0x2C, 0x18, 0x00}, // 't'
+  {0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6E, 0x00}, // 'u'
+  {0x00, 0x00, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00}, // 'v'
+  {0x00, 0x00, 0x63, 0x6B, 0x7F, 0x7F, 0x36, 0x00}, // 'w'
+  {0x00, 0x00, 0x63, 0x36, 0x1C, 0x36, 0x63, 0x00}, // 'x'
+  {0x00, 0x00, 0x33, 0x33, 0x33, 0x3E, 0x30, 0x1F}, // 'y'
+  {0x00, 0x00, 0x3F, 0x19, 0x0C, 0x26, 0x3F, 0x00}, // 'z'
+  {0x38, 0x0C, 0x0C, 0x07, 0x0C, 0x0C, 0x38, 0x00}, // '{'
+  {0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00}, // '|'
+  {0x07, 0x0C, 0x0C, 0x38, 0x0C, 0x0C, 0x07, 0x00}, // '}'
+  {0x6E, 0x3B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // '~'
+};
+
+static void font_free(font_t *font) {
+  free(font->bitmaps);
+  free(font->map);
+  memset(font, 0, sizeof(*font));
+}
+
+static uint8_t font_reverse_bits(uint8_t b) {
+  b = (uint8_t)((b & 0xF0) >> 4 | (b & 0x0F) << 4);
+  b = (uint8_t)((b & 0xCC) >> 2 | (b & 0x33) << 2);
+  return (uint8_t)((b & 0xAA) >> 1 | (b & 0x55) << 1);
+}
+
+/* Build the embedded font: font8x8_basic with every row doubled to 8x16,
+ * plus a hollow box as the fallback glyph.
+ * - Returns 0, or -1 if out of memory. */
+static int font_load_embedded(font_t *font) {
+  const uint32_t ascii_count = sizeof(font8x8_basic) / sizeof(font8x8_basic[0]);
+  memset(font, 0, sizeof(*font));
+  font->width = 8;
+  font->height = 16;
+  font->bytes_per_row = 1;
+  font->glyph_count = ascii_count + 1;
+  font->fallback_glyph = ascii_count;
+  font->bitmaps = calloc(font->glyph_count, font->height);
+  font->map = calloc(ascii_count, sizeof(*font->map));
+  font->map_len = ascii_count;
+  if (!font->bitmaps || !font->map) {
+    font_free(font);
+    return -1;
+  }
+
+  for (uint32_t g = 0; g < ascii_count; g++) {
+    for (uint32_t row = 0; row < 8; row++) {
+      uint8_t bits = font_reverse_bits(font8x8_basic[g][row]);
+      font->bitmaps[g * 16 + row * 2] = bits;
+      font->bitmaps[g * 16 + row * 2 + 1] = bits;
+    }
+    font->map[g] = (font_map_entry_t){.codepoint = 0x20 + g, .glyph = g};
+  }
+
+  uint8_t *box = font->bitmaps + ascii_count * 16;
+  box[2] = box[13] = 0x7E;
+  for (uint32_t row = 3; row < 13; row++)
+    box[row] = 0x42;
+  return 0;
+}
+
+static int font_map_compare(const void *a, const void *b) {
+  uint32_t ca = ((const font_map_entry_t *)a)->codepoint;
+  uint32_t cb = ((const font_map_entry_t *)b)->codepoint;
+  return ca < cb ? -1 : ca > cb;
+}
+
+static int font_map_push(font_t *font, uint32_t *cap, uint32_t codepoint, uint32_t glyph) {
+  if (font->map_len == *cap) {
+    uint32_t new_cap = *cap ? *cap * 2 : 512;
+    font_map_entry_t *map = realloc(font->map, sizeof(*map) * new_cap);
+    if (!map)
+      return -1;
+    font->map = map;
+    *cap = new_cap;
+  }
+  font->map[font->map_len++] = (font_map_entry_t){.codepoint = codepoint, .glyph = glyph};
+  return 0;
+}
+
+/* Decode one UTF-8 sequence from [*p, end); advances *p. Returns the
+ * codepoint, or U+FFFD for malformed input (consuming the bad lead byte, or
+ * the valid prefix of a truncated sequence). */
+static uint32_t utf8_decode_one(const uint8_t **p, const uint8_t *end) {
+  const uint8_t *s = *p;
+  uint32_t c = *s++, need;
+  if (c < 0x80) {
+    need = 0;
+  } else if (c >= 0xC2 && c < 0xE0) {
+    need = 1;
+    c &= 0x1F;
+  } else if (c >= 0xE0 && c < 0xF0) {
+    need = 2;
+    c &= 0x0F;
+  } else if (c >= 0xF0 && c < 0xF5) {
+    need = 3;
+    c &= 0x07;
+  } else {
+    *p = s;
+    return 0xFFFD;
+  }
+  for (; need > 0; need--) {
+    if (s == end || (*s & 0xC0) != 0x80) {
+      *p = s;
+      return 0xFFFD;
+    }
+    c = c << 6 | (*s++ & 0x3F);
+  }
+  *p = s;
+  return c;
+}
+
+/* Find the glyph for a codepoint; identity when the font has no map */
+static bool font_find_glyph(const font_t *font, uint32_t codepoint, uint32_t *glyph) {
+  if (font->map_len == 0) {
+    *glyph = codepoint;
+    return codepoint < font->glyph_count;
+  }
+
+  uint32_t lo = 0, hi = font->map_len;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (font->map[mid].codepoint < codepoint)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == font->map_len || font->map[lo].codepoint != codepoint)
+    return false;
+  *glyph = font->map[lo].glyph;
+  return true;
+}
+
+static uint32_t font_glyph_index(const font_t *font, uint32_t codepoint) {
+  uint32_t glyph;
+  return font_find_glyph(font, codepoint, &glyph) ? glyph : font->fallback_glyph;
+}
+
+/* Load a PSF1 or PSF2 console font (uncompressed, e.g. from
+ * /usr/share/consolefonts after gunzip). The unicode table, when present,
+ * becomes the codepoint map; otherwise glyph i is codepoint i.
+ * - Returns 0, or -1 with errno set (EINVAL for a malformed file).
+ */
+static int font_load_psf(font_t *font, const char *path) {
+  memset(font, 0, sizeof(*font));
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+  off_t file_size = lseek(fd, 0, SEEK_END);
+  if (file_size <= 0) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  uint8_t *file = mmap(NULL, (size_t)file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  int err = errno;
+  close(fd);
+  if (file == MAP_FAILED) {
+    errno = err;
+    return -1;
+  }
+
+  const uint8_t *end = file + file_size;
+  const uint8_t *glyphs = NULL, *table = NULL;
+  uint32_t glyph_size = 0, map_cap = 0;
+  bool psf2 = false;
+  err = EINVAL;
+
+  if (file_size >= 4 && file[0] == 0x36 && file[1] == 0x04) {
+    font->width = 8;
+    font->height = file[3];
+    font->glyph_count = (file[2] & 0x01) ? 512 : 256;
+    glyph_size = font->height;
+    glyphs = file + 4;
+    if (file[2] & 0x02)
+      table = glyphs + (uint64_t)glyph_size * font->glyph_count;
+  } else if (file_size >= 32 && file[0] == 0x72 && file[1] == 0xb5 && file[2] == 0x4a && file[3] == 0x86) {
+    uint32_t header[8]; // magic, version, header size, flags, count, glyph size, height, width
+    memcpy(header, file, sizeof(header));
+    psf2 = true;
+    font->glyph_count = header[4];
+    glyph_size = header[5];
+    font->height = header[6];
+    font->width = header[7];
+    glyphs = file + (header[2] < file_size ? header[2] : file_size);
+    if (header[3] & 0x01)
+      table = glyphs + (uint64_t)glyph_size * font->glyph_count;
+  } else {
+    goto fail;
+  }
+
+  font->bytes_per_row = (font->width + 7) / 8;
+  if (font->width == 0 || font->width > GLYPH_MAX_WIDTH || font->height == 0 ||
+      font->glyph_count == 0 || glyph_size < font->bytes_per_row * font->height ||
+      (uint64_t)glyph_size * font->glyph_count > (uint64_t)(end - glyphs))
+    goto fail;
+
+  err = ENOMEM;
+  font->bitmaps = malloc((uint64_t)font->glyph_count * font->height * font->bytes_per_row);
+  if (!font->bitmaps)
+    goto fail;
+  for (uint32_t g = 0; g < font->glyph_count; g++)
+    memcpy(font->bitmaps + (uint64_t)g * font->height * font->bytes_per_row,
+           glyphs + (uint64_t)g * glyph_size, (uint64_t)font->height * font->bytes_per_row);
+
+  // per glyph: its codepoints, optional combining sequences, then a terminator
+  for (uint32_t g = 0; table && g < font->glyph_count && table < end; g++) {
+    bool in_sequence = false;
+    while (table < end) {
+      uint32_t codepoint;
+      if (psf2) {
+        if (*table == 0xFF) {
+          table++;
+          break;
+        }
+        if (*table == 0xFE) {
+          table++;
+          in_sequence = true;
+          continue;
+        }
+        codepoint = utf8_decode_one(&table, end);
+      } else {
+        if (end - table < 2)
+          break;
+        codepoint = (uint32_t)(table[0] | table[1] << 8);
+        table += 2;
+        if (codepoint == 0xFFFF)
+          break;
+        if (codepoint == 0xFFFE) {
+          in_sequence = true;
+          continue;
+        }
+      }
+      if (!in_sequence && font_map_push(font, &map_cap, codepoint, g) == -1)
+        goto fail;
+    }
+  }
+  if (font->map_len > 0)
+    qsort(font->map, font->map_len, sizeof(*font->map), font_map_compare);
+
+  if (!font_find_glyph(font, 0xFFFD, &font->fallback_glyph) &&
+      !font_find_glyph(font, '?', &font->fallback_glyph))
+    font->fallback_glyph = 0;
+
+  munmap(file, (size_t)file_size);
+  return 0;
+
+fail:
+  munmap(file, (size_t)file_size);
+  font_free(font);
+  errno = err;
+  return -1;
+}
+
+/* Set up an atlas whose cells are the font's glyph size.
+ * - Returns 0, or -1 if out of memory. */
+static int glyph_atlas_init(glyph_atlas_t *atlas, const font_t *font) {
+  memset(atlas, 0, sizeof(*atlas));
+  atlas->font = font;
+  atlas->cell_w = font->width;
+  atlas->cell_h = font->height;
+  atlas->coverage = malloc((uint64_t)GLYPH_ATLAS_CAP * atlas->cell_w * atlas->cell_h);
+  atlas->row_masks = malloc(sizeof(*atlas->row_masks) * GLYPH_ATLAS_CAP * atlas->cell_h);
+  if (!atlas->coverage || !atlas->row_masks) {
+    free(atlas->coverage);
+    free(atlas->row_masks);
+    return -1;
+  }
+  memset(atlas->ascii, 0xff, sizeof(atlas->ascii));
+  return 0;
+}
+
+static void glyph_atlas_free(glyph_atlas_t *atlas) {
+  free(atlas->coverage);
+  free(atlas->row_masks);
+  memset(atlas, 0, sizeof(*atlas));
+}
+
+/* Drop every cached glyph. Cheap enough that a full atlas simply starts over. */
+static void glyph_atlas_flush(glyph_atlas_t *atlas) {
+  atlas->len = 0;
+  memset(atlas->cache_keys, 0, sizeof(atlas->cache_keys));
+  memset(atlas->ascii, 0xff, sizeof(atlas->ascii));
+  atlas->stats.flushes++;
+}
+
+/* Rasterize (codepoint, style) into a new slot. Bold is synthesized by
+ * smearing one pixel right, underline by filling the second-to-last row. */
+static uint32_t glyph_atlas_rasterize(glyph_atlas_t *atlas, uint32_t codepoint, uint32_t style) {
+  if (atlas->len == GLYPH_ATLAS_CAP)
+    glyph_atlas_flush(atlas);
+
+  const font_t *font = atlas->font;
+  uint32_t slot = atlas->len++;
+  uint32_t glyph = font_glyph_index(font, codepoint);
+  const uint8_t *bitmap = font->bitmaps + (uint64_t)glyph * font->height * font->bytes_per_row;
+  uint32_t *masks = atlas->row_masks + (uint64_t)slot * atlas->cell_h;
+  uint8_t *coverage = atlas->coverage + (uint64_t)slot * atlas->cell_w * atlas->cell_h;
+  uint32_t width_mask = atlas->cell_w == 32 ? UINT32_MAX : ~(UINT32_MAX >> atlas->cell_w);
+
+  for (uint32_t row = 0; row < atlas->cell_h; row++) {
+    uint32_t mask = 0;
+    for (uint32_t b = 0; b < font->bytes_per_row; b++)
+      mask |= (uint32_t)bitmap[row * font->bytes_per_row + b] << (24 - 8 * b);
+    if (style & GLYPH_STYLE_BOLD)
+      mask |= mask >> 1;
+    if ((style & GLYPH_STYLE_UNDERLINE) && row == atlas->cell_h - 2)
+      mask = UINT32_MAX;
+    mask &= width_mask;
+    masks[row] = mask;
+
+    for (uint32_t x = 0; x < atlas->cell_w; x++)
+      coverage[row * atlas->cell_w + x] = (mask >> (31 - x)) & 1 ? 255 : 0;
+  }
+  atlas->binary[slot] = true; // bitmap fonts only ever produce full coverage
+  return slot;
+}
+
+/* Atlas slot for (codepoint, style), rasterizing it on first use */
+static uint32_t glyph_atlas_lookup(glyph_atlas_t *atlas, uint32_t codepoint, uint32_t style) {
+  if (codepoint < 128 && atlas->ascii[style][codepoint] >= 0) {
+    atlas->stats.hits++;
+    return (uint32_t)atlas->ascii[style][codepoint];
+  }
+
+  uint32_t key = (codepoint << 2 | style) + 1;
+  uint32_t h = (key * 2654435761U) & (GLYPH_CACHE_CAP - 1);
+  while (atlas->cache_keys[h] != 0) {
+    if (atlas->cache_keys[h] == key) {
+      atlas->stats.hits++;
+      return atlas->cache_slots[h];
+    }
+    h = (h + 1) & (GLYPH_CACHE_CAP - 1);
+  }
+
+  atlas->stats.misses++;
+  uint64_t flushes = atlas->stats.flushes;
+  uint32_t slot = glyph_atlas_rasterize(atlas, codepoint, style);
+  if (atlas->stats.flushes != flushes) // the table was emptied under us
+    h = (key * 2654435761U) & (GLYPH_CACHE_CAP - 1);
+  atlas->cache_keys[h] = key;
+  atlas->cache_slots[h] = (uint16_t)slot;
+  if (codepoint < 128)
+    atlas->ascii[style][codepoint] = (int16_t)slot;
+  return slot;
+}
+
+/* Resolve up to TEXT_ROW_CHUNK cells to atlas slots and colors. Returns true
+ * if every glyph is binary, so the glyph_cells kernel alone draws them. */
+static bool text_resolve_cells(glyph_atlas_t *atlas, const text_cell_t *cells, uint64_t n,
+                               uint32_t *slots, uint32_t *fg, uint32_t *bg) {
+  uint64_t flushes = atlas->stats.flushes;
+  for (uint64_t i = 0; i < n; i++)
+    slots[i] = glyph_atlas_lookup(atlas, cells[i].codepoint, cells[i].style);
+  if (atlas->stats.flushes != flushes) {
+    // a flush mid-chunk recycled slots resolved before it; a chunk is far
+    // smaller than the atlas, so the second pass can't flush again
+    for (uint64_t i = 0; i < n; i++)
+      slots[i] = glyph_atlas_lookup(atlas, cells[i].codepoint, cells[i].style);
+  }
+
+  bool all_binary = true;
+  for (uint64_t i = 0; i < n; i++) {
+    fg[i] = cells[i].fg;
+    bg[i] = cells[i].bg;
+    all_binary &= atlas->binary[slots[i]];
+  }
+  return all_binary;
+}
+
+/* Draw n resolved cells side by side from dst: the glyph_cells kernel
+ * expands them, then the rare glyphs with partial coverage are blended over
+ * what it wrote. Only reads the atlas, so disjoint rows may be drawn from
+ * several threads at once. */
+static void text_draw_cells(const glyph_atlas_t *atlas, uint32_t *dst, uint64_t dst_stride,
+                            const uint32_t *slots, const uint32_t *fg, const uint32_t *bg,
+                            uint64_t n, bool all_binary) {
+  uint32_t cell_w = atlas->cell_w, cell_h = atlas->cell_h;
+  pixel_kernels->glyph_cells(dst, dst_stride, atlas->row_masks, slots, fg, bg, n, cell_w, cell_h);
+
+  for (uint64_t i = 0; !all_binary && i < n; i++) {
+    if (atlas->binary[slots[i]])
+      continue;
+    const uint8_t *cov = atlas->coverage + (uint64_t)slots[i] * cell_h * cell_w;
+    for (uint32_t row = 0; row < cell_h; row++) {
+      uint32_t *px_out = dst + row * dst_stride + i * cell_w;
+      for (uint32_t px = 0; px < cell_w; px++, cov++) {
+        uint32_t res = 0;
+        for (uint32_t shift = 0; shift < 32; shift += 8)
+          res |= pixel_div255(((fg[i] >> shift) & 0xff) * *cov + ((bg[i] >> shift) & 0xff) * (255 - *cov)) << shift;
+        px_out[px] = res;
+      }
+    }
+  }
+}
+
+/* Cells of a row that fit entirely inside dst_w x dst_h from pixel (x, y) */
+static uint64_t text_row_fit(const glyph_atlas_t *atlas, uint64_t dst_w, uint64_t dst_h,
+                             uint64_t x, uint64_t y, uint64_t cells_len) {
+  if (x >= dst_w || y + atlas->cell_h > dst_h)
+    return 0;
+  return cells_len < (dst_w - x) / atlas->cell_w ? cells_len : (dst_w - x) / atlas->cell_w;
+}
+
+/* Draw a row of cells with its top-left corner at pixel (x, y).
+ * - dst_stride: row pitch in pixels
+ * Cells that don't fit entirely inside dst_w x dst_h are not drawn. The
+ * drawn area is added to damage.
+ *
+ * Glyphs are resolved to atlas slots once per batch of cells and the batch
+ * is expanded by text_draw_cells.
+ */
+static void text_draw_row(glyph_atlas_t *atlas, uint32_t *dst, uint64_t dst_w, uint64_t dst_h,
+                          uint32_t dst_stride, uint64_t x, uint64_t y,
+                          const text_cell_t *cells, uint64_t cells_len, damage_t *damage) {
+  cells_len = text_row_fit(atlas, dst_w, dst_h, x, y, cells_len);
+  if (cells_len == 0)
+    return;
+
+  uint32_t slots[TEXT_ROW_CHUNK], fg[TEXT_ROW_CHUNK], bg[TEXT_ROW_CHUNK];
+  for (uint64_t start = 0; start < cells_len; start += TEXT_ROW_CHUNK) {
+    uint64_t n = cells_len - start < TEXT_ROW_CHUNK ? cells_len - start : TEXT_ROW_CHUNK;
+    bool all_binary = text_resolve_cells(atlas, cells + start, n, slots, fg, bg);
+    text_draw_cells(atlas, dst + y * dst_stride + x + start * atlas->cell_w, dst_stride,
+                    slots, fg, bg, n, all_binary);
+  }
+
+  damage_add(damage, (rect_t){.x = (uint32_t)x, .y = (uint32_t)y,
+                              .w = (uint32_t)(cells_len * atlas->cell_w), .h = atlas->cell_h});
+}
+
+/* ------------------- Terminal -------------------------------------------- */
+
+/* The model the renderer draws from: a grid of cells, a cursor, and a parser
+ * that PTY output is fed through as soon as it is read. The parser only
+ * marks rows dirty; term_draw repaints them when the next frame is rendered.
+ *
+ * A cell is 8 bytes: the codepoint and an index into a table of the
+ * distinct styles (colors and attributes) in use, so a screenful of
+ * same-colored text costs one style. The screen and the most recent
+ * scrollback share a ring of rows. Scrolling moves the ring's top by one row
+ * and blanks the row that comes in, so no row is copied. Rows that leave the
+ * ring are compressed into the scrollback history (term_history_t), whose
+ * memory is capped: past the budget, its oldest chunks are written to an
+ * unlinked temporary file and read back through mmap.
+ *
+ * The parser is the DEC-compatible state machine of the VT500 series (as
+ * described by Paul Williams, vt100.net/emu/dec_ansi_parser), in its 7-bit
+ * form: bytes 0x80-0x9f are UTF-8 continuation bytes here, so C1 controls
+ * only exist as ESC sequences. From any state, CAN and SUB abort a sequence
+ * and ESC starts a new one. Printable text, the C0 controls a shell relies
+ * on (CR, LF, BS, HT), DECSC/DECRC, IND, NEL, RI and RIS, SGR, and the CSI
+ * cursor movement and erase sequences are interpreted; every other
+ * sequence, and DCS, OSC, SOS, PM and APC strings, are consumed and ignored.
+ *
+ * Most of what programs write is text between sequences, so the ground
+ * state doesn't go byte by byte. A scan kernel finds the end of a run of
+ * printable ASCII, or decodes a run of well-formed UTF-8, and the run is
+ * copied into the cells a row at a time. Whatever a kernel stops at (a
+ * control, a malformed or truncated sequence) goes through the state
+ * machine. The first TERM_SCAN_MIN_RUN bytes of a run are scanned one at a
+ * time: colored output is mostly runs of a few bytes between sequences,
+ * over before a vector scan pays off, and only longer runs reach the SIMD
+ * kernels.
+ */
+
+#define TERM_DEFAULT_FG 0xd0d0d0U
+#define TERM_DEFAULT_BG 0x101010U
+#define TERM_TAB_WIDTH 8U
+#define TERM_CSI_MAX_PARAMS 16U    /* enough for "ESC [ 38 ; 2 ; r ; g ; b ; 48 ; 2 ; r ; g ; b m" */
+#define TERM_MAX_COLLECT 2U        /* private marker and intermediate bytes kept */
+#define TERM_DECODE_CHUNK 256U     /* codepoints decoded per scan kernel call */
+#define TERM_SCAN_MIN_RUN 16U      /* bytes, or codepoints, scanned one at a time first */
+#define TERM_STYLE_INVERSE 0x100U  /* term_style_t flag next to the GLYPH_STYLE_* bits */
+#define TERM_STYLES_MAX 65536U     /* distinct styles; more are drawn in the default style */
+#define TERM_HOT_LINES 256U        /* scrollback rows kept as cells, in the ring */
+#define TERM_HISTORY_CHUNK (64U << 10) /* compressed scrollback is kept and spilled in chunks */
+#define TERM_HISTORY_LINES 100000U /* default scrollback, KASAMA_SCROLLBACK_LINES */
+#define TERM_HISTORY_BUDGET (4U << 20) /* default memory for it, KASAMA_SCROLLBACK_KB */
+
+typedef enum term_parse_state_t term_parse_state_t;
+typedef struct term_cell_t term_cell_t;
+typedef struct term_history_t term_history_t;
+typedef struct term_scan_kernels_t term_scan_kernels_t;
+typedef struct term_style_t term_style_t;
+typedef struct term_styles_t term_styles_t;
+
+enum term_parse_state_t {
+  TERM_GROUND,
+  TERM_ESCAPE,
+  TERM_ESCAPE_INTERMEDIATE,
+  TERM_CSI_ENTRY,
+  TERM_CSI_PARAM,
+  TERM_CSI_INTERMEDIATE,
+  TERM_CSI_IGNORE,
+  TERM_DCS_ENTRY,
+  TERM_DCS_PARAM,
+  TERM_DCS_INTERMEDIATE,
+  TERM_DCS_PASSTHROUGH,
+  TERM_DCS_IGNORE,
+  TERM_OSC_STRING,
+  TERM_SOS_PM_APC_STRING,
+};
+
+struct term_scan_kernels_t {
+  const char *name;
+  // length of the run of printable ASCII (0x20-0x7e) that `data` starts with
+  uint64_t (*ascii)(const uint8_t *data, uint64_t len);
+  // decode the run of printable ASCII and well-formed UTF-8 sequences that
+  // `data` starts with, at most `cap` codepoints, into `out`; sets *out_len
+  // and returns the bytes consumed. Stops before a control, a malformed
+  // sequence and a sequence cut short by `len`
+  uint64_t (*utf8)(const uint8_t *data, uint64_t len, uint32_t *out, uint64_t cap, uint64_t *out_len);
+};
+
+/* A grid cell */
+struct term_cell_t {
+  uint32_t codepoint;
+  uint32_t style;              // index into term_styles_t, 0 = default
+};
+
+struct term_style_t {
+  uint32_t fg, bg;
+  uint32_t flags;              // GLYPH_STYLE_* bits, TERM_STYLE_INVERSE
+};
+
+/* Every style a cell has had, each stored once. Styles are never removed,
+ * since scrollback rows refer to them for as long as they are kept. */
+struct term_styles_t {
+  term_style_t *styles;
+  uint32_t len, cap;
+  uint32_t *index;             // open addressing: style + 1, 0 = empty
+  uint32_t index_cap;          // power of two, at least twice len
+  uint64_t dropped;            // styles that didn't fit TERM_STYLES_MAX
+};
+
+/* Scrollback past the ring, oldest first. Each row is run-length encoded
+ * (term_history_encode) into a log of TERM_HISTORY_CHUNK sized chunks; a
+ * row never straddles two. Chunks stay in memory up to `budget` bytes;
+ * past that the oldest are written to the spill file, and read back by
+ * mapping them. The oldest rows are dropped beyond max_lines, and chunks
+ * that no kept row is in are freed (or their range punched out of the
+ * file). */
+struct term_history_t {
+  uint64_t *offsets;           // log offset of each row, ring of offsets_cap from head
+  uint32_t head, len, offsets_cap;
+  uint32_t max_lines;
+
+  uint8_t **chunks;            // chunks[i] holds chunk first_chunk + i, NULL once spilled
+  uint32_t chunks_len, chunks_cap;
+  uint64_t first_chunk;
+  uint64_t write_pos;          // log offset of the next row
+  uint64_t budget;             // bytes of chunks kept in memory
+  uint64_t memory;             // bytes of chunks in memory now
+  uint8_t *encode_buf;         // one encoded row
+
+  int spill_fd;                // -1 until something is spilled
+  uint64_t spilled;            // bytes of chunks in the file now
+  uint8_t *mapped;             // the last spilled chunk read, mapped
+  uint64_t mapped_chunk;
+
+  uint64_t rows_added, rows_dropped;
+  uint64_t bytes_encoded;      // over all rows added
+  uint64_t spill_failures;     // chunks dropped because the file couldn't take them
+};
+
+struct term_t {
+  uint32_t cols, rows;
+  term_cell_t *ring;           // ring_rows * cols: the screen and the hot scrollback
+  uint32_t *ring_len;          // per ring row: its cells from here on are blank
+  uint32_t ring_rows;          // rows + TERM_HOT_LINES
+  uint32_t top;                // ring row of screen row 0
+  uint32_t hot_len;            // scrollback rows above it still in the ring
+  term_history_t history;      // and the ones before those
+  term_styles_t styles;
+  term_style_t pen_style;      // SGR state: style of what is printed next
+  uint32_t pen;                // ... and its index
+  uint32_t erase_pen;          // style of erased cells: the pen's background
+
+  uint32_t view_offset;        // rows scrolled back, 0 = the screen is in view
+  uint64_t *dirty_rows;        // bit per row of the view
+  bool dirty;                  // something needs repainting
+  uint32_t scrolled;           // rows the view's contents moved up since the last repaint
+  term_cell_t *view_buf;       // a history row decoded for the view
+  text_cell_t *draw_buf;       // a row expanded for the blitter
+
+  uint32_t cursor_x;           // == cols while a wrap is pending
+  uint32_t cursor_y;
+  uint32_t saved_x, saved_y;   // DECSC
+  bool cursor_visible;         // blink phase
+  bool cursor_drawn;
+  uint32_t cursor_drawn_x, cursor_drawn_y;
+  bool pointer_visible;        // the mouse pointer is over the grid
+  uint32_t pointer_x, pointer_y; // cell under it, drawn inverted too
+  bool pointer_drawn;
+  uint32_t pointer_drawn_x, pointer_drawn_y;
+
+  term_parse_state_t parse_state;
+  uint32_t utf8_codepoint;     // sequence being assembled, may span reads
+  uint32_t utf8_length;
+  uint32_t utf8_remaining;     // continuation bytes still expected
+  uint32_t csi_params[TERM_CSI_MAX_PARAMS];
+  uint32_t csi_params_len;
+  uint8_t collected[TERM_MAX_COLLECT]; // private marker (e.g. the ? of "ESC [ ? 25 l") and intermediates
+  uint32_t collected_len;      // > TERM_MAX_COLLECT: too many, the sequence is ignored
+
+  uint64_t bytes_parsed;
+};
+
+/* ---- Scan kernels ---- */
+
+/* Whether a decoded sequence of `length` bytes is the shortest encoding of
+ * a Unicode scalar value */
+static bool term_utf8_valid(uint32_t codepoint, uint32_t length) {
+  static const uint32_t min[] = {0, 0, 0x80, 0x800, 0x10000};
+  return codepoint >= min[length] && codepoint <= 0x10ffff &&
+         (codepoint < 0xd800 || codepoint > 0xdfff);
+}
+
+/* Decode the printable ASCII byte or well-formed UTF-8 sequence at data[0].
+ * Returns its length, or 0 if it is neither or is cut short by `len`. */
+static uint32_t term_utf8_decode(const uint8_t *data, uint64_t len, uint32_t *codepoint) {
+  uint8_t c = data[0];
+  if (c >= 0x20 && c < 0x7f) {
+    *codepoint = c;
+    return 1;
+  }
+  if (c < 0xc2 || c > 0xf4)
+    return 0;
+  uint32_t length = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : 2;
+  if (len < length)
+    return 0;
+  uint32_t cp = c & (0x7fU >> length);
+  for (uint32_t i = 1; i < length; i++) {
+    if ((data[i] & 0xc0) != 0x80)
+      return 0;
+    cp = cp << 6 | (data[i] & 0x3f);
+  }
+  if (!term_utf8_valid(cp, length))
+    return 0;
+  *codepoint = cp;
+  return length;
+}
+
+static uint64_t term_scan_ascii_scalar(const uint8_t *data, uint64_t len) {
+  uint64_t i = 0;
+  while (i < len && data[i] >= 0x20 && data[i] < 0x7f)
+    i++;
+  return i;
+}
+
+static uint64_t term_scan_utf8_scalar(const uint8_t *data, uint64_t len, uint32_t *out, uint64_t cap,
+                                      uint64_t *out_len) {
+  uint64_t i = 0, n = 0;
+  uint32_t length;
+  while (n < cap && i < len && (length = term_utf8_decode(data + i, len - i, out + n)) != 0) {
+    i += length;
+    n++;
+  }
+  *out_len = n;
+  return i;
+}
+
+/* How much of a block of `width` bytes, starting at a sequence boundary,
+ * the SIMD UTF-8 kernels can take, from a bit per byte for
+ *   bad      bytes that end the run: controls, DEL, C0, C1 and F5-FF
+ *   cont     continuation bytes, 80-BF
+ *   lead2    lead bytes of sequences of 2 or more bytes, C0-FF
+ *   lead3    of 3 or more, E0-FF
+ *   lead4    of 4, F0-FF
+ *   invalid  leads whose sequence decodes to an overlong form, a surrogate
+ *            or a codepoint past U+10FFFF
+ * A lead of length n is followed by exactly n - 1 continuations, so the
+ * bytes are well-formed up to the first bit where cont disagrees with
+ * (lead2 << 1 | lead3 << 2 | lead4 << 3), or a bad or invalid byte. A
+ * sequence cut there, or by the end of the block, is left out. Returns the
+ * bytes taken, sets *starts to the first byte of each sequence in them and
+ * *stop if the run ends in this block. */
+static uint32_t term_utf8_block(uint32_t width, uint64_t bad, uint64_t cont, uint64_t lead2,
+                                uint64_t lead3, uint64_t lead4, uint64_t invalid,
+                                uint64_t *starts, bool *stop) {
+  uint64_t block = (1ULL << width) - 1;
+  uint64_t errors = (bad | invalid | ((lead2 << 1 | lead3 << 2 | lead4 << 3) ^ cont)) & block;
+  uint32_t end = errors ? (uint32_t)__builtin_ctzll(errors) : width;
+  *stop = errors != 0;
+
+  *starts = ~cont & ((1ULL << end) - 1);
+  if (*starts) {
+    uint32_t last = 63 - (uint32_t)__builtin_clzll(*starts);
+    uint32_t length = 1 + (uint32_t)(lead2 >> last & 1) + (uint32_t)(lead3 >> last & 1) +
+                      (uint32_t)(lead4 >> last & 1);
+    if (last + length > end) {
+      end = last;
+      *starts &= (1ULL << last) - 1;
+    }
+  }
+  return end;
+}
+
+/* How many of the bytes before `end` start a sequence that continues past
+ * it, in well-formed UTF-8. This is what term_utf8_block leaves for the
+ * next block when it doesn't stop, but from three loads rather than from
+ * the whole block's masks, which keeps the next block's loads off the
+ * critical path. */
+static uint32_t term_utf8_carry(const uint8_t *end) {
+  return end[-1] >= 0xc0 ? 1 : end[-2] >= 0xe0 ? 2 : end[-3] >= 0xf0 ? 3 : 0;
+}
+
+/* Keep the codepoints decoded at the first byte of each sequence: out[i]
+ * holds the one starting at byte i, for i < width; moves them to out[0..]
+ * in order and returns how many. Every lane is copied and the count only
+ * advances at a start, so there is no branch to mispredict. */
+static uint32_t term_utf8_compact(uint32_t *out, uint32_t width, uint64_t starts) {
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < width; i++) {
+    out[n] = out[i];
+    n += (uint32_t)(starts >> i & 1);
+  }
+  return n;
+}
+
+static const term_scan_kernels_t term_scan_kernels_scalar = {
+  .name = "scalar",
+  .ascii = term_scan_ascii_scalar,
+  .utf8 = term_scan_utf8_scalar,
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+/* A byte is printable ASCII if it is greater than 0x1f as a signed byte
+ * (which also rules out 0x80-0xff) and isn't DEL. In the UTF-8 kernels,
+ * signed compares also sort the high bytes: 80-BF are -128..-65, C0-DF
+ * -64..-33, E0-EF -32..-17 and F0-FF -16..-1. A block without high bytes
+ * is widened to codepoints directly; any other block is decoded at every
+ * byte at once and the codepoints at sequence starts are kept. */
+
+__attribute__((target("sse2")))
+static uint64_t term_scan_ascii_sse2(const uint8_t *data, uint64_t len) {
+  const __m128i space = _mm_set1_epi8(0x1f), del = _mm_set1_epi8(0x7f);
+  uint64_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i printable = _mm_andnot_si128(_mm_cmpeq_epi8(v, del), _mm_cmpgt_epi8(v, space));
+    uint32_t stop = ~(uint32_t)_mm_movemask_epi8(printable) & 0xffff;
+    if (stop)
+      return i + (uint64_t)__builtin_ctz(stop);
+  }
+  return i + term_scan_ascii_scalar(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static uint64_t term_scan_ascii_avx2(const uint8_t *data, uint64_t len) {
+  const __m256i space = _mm256_set1_epi8(0x1f), del = _mm256_set1_epi8(0x7f);
+  uint64_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i printable = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, del), _mm256_cmpgt_epi8(v, space));
+    uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(printable);
+    if (stop)
+      return i + (uint64_t)__builtin_ctz(stop);
+  }
+  return i + term_scan_ascii_sse2(data + i, len - i);
+}
+
+/* Decode the sequence that would start at each of 4 bytes, given the
+ * byte and the 3 after it in 32-bit lanes: all four lengths are assembled
+ * and the lead byte picks one. Stores the codepoints and returns a bit per
+ * lane whose sequence is invalid (term_utf8_block). */
+__attribute__((target("sse2")))
+static uint32_t term_utf8_decode4_sse2(__m128i b0, __m128i b1, __m128i b2, __m128i b3, uint32_t *out) {
+  const __m128i low6 = _mm_set1_epi32(0x3f);
+  b1 = _mm_and_si128(b1, low6);
+  b2 = _mm_and_si128(b2, low6);
+  b3 = _mm_and_si128(b3, low6);
+  __m128i cp2 = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(b0, _mm_set1_epi32(0x1f)), 6), b1);
+  __m128i cp3 = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(b0, _mm_set1_epi32(0x0f)), 12),
+                                          _mm_slli_epi32(b1, 6)), b2);
+  __m128i cp4 = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(b0, _mm_set1_epi32(0x07)), 18),
+                                          _mm_slli_epi32(b1, 12)),
+                             _mm_or_si128(_mm_slli_epi32(b2, 6), b3));
+  __m128i is2 = _mm_cmpgt_epi32(b0, _mm_set1_epi32(0xbf));
+  __m128i is3 = _mm_cmpgt_epi32(b0, _mm_set1_epi32(0xdf));
+  __m128i is4 = _mm_cmpgt_epi32(b0, _mm_set1_epi32(0xef));
+
+  __m128i cp = _mm_or_si128(_mm_andnot_si128(is2, b0), _mm_and_si128(is2, cp2));
+  cp = _mm_or_si128(_mm_andnot_si128(is3, cp), _mm_and_si128(is3, cp3));
+  cp = _mm_or_si128(_mm_andnot_si128(is4, cp), _mm_and_si128(is4, cp4));
+  _mm_storeu_si128((__m128i *)out, cp);
+
+  __m128i surrogate = _mm_and_si128(_mm_cmpgt_epi32(cp3, _mm_set1_epi32(0xd7ff)),
+                                    _mm_cmplt_epi32(cp3, _mm_set1_epi32(0xe000)));
+  __m128i bad3 = _mm_andnot_si128(is4, _mm_and_si128(is3, _mm_or_si128(
+                   _mm_cmplt_epi32(cp3, _mm_set1_epi32(0x800)), surrogate)));
+  __m128i bad4 = _mm_and_si128(is4, _mm_or_si128(_mm_cmplt_epi32(cp4, _mm_set1_epi32(0x10000)),
+                                                 _mm_cmpgt_epi32(cp4, _mm_set1_epi32(0x10ffff))));
+  return (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(bad3, bad4)));
+}
+
+/* Decode the sequence starting at each of the 16 bytes at p (reading up
+ * to p[18]) into out[0..15], for a block without 4-byte sequences. Every
+ * codepoint then fits 16 bits, whose high and low bytes are assembled in
+ * byte lanes from the byte and the 2 after it:
+ *   1 byte    0xxxxxxx                    high 0, low b0
+ *   2 bytes   110yyyyy 10xxxxxx           high b0 >> 2 & 7, low b0 << 6 | b1 & 0x3f
+ *   3 bytes   1110zzzz 10yyyyyy 10xxxxxx  high b0 << 4 | (b1 & 0x3f) >> 2, low b1 << 6 | b2 & 0x3f
+ * Overlong 3-byte forms and surrogates show in the first two bytes: E0
+ * followed by 80-9F and ED followed by A0-BF. Returns a bit per such lead. */
+__attribute__((target("sse2")))
+static uint32_t term_utf8_decode16_sse2(const uint8_t *p, uint32_t *out) {
+  const __m128i zero = _mm_setzero_si128(), low6 = _mm_set1_epi8(0x3f);
+  __m128i b0 = _mm_loadu_si128((const __m128i *)p);
+  __m128i b1 = _mm_loadu_si128((const __m128i *)(p + 1));
+  __m128i b2 = _mm_loadu_si128((const __m128i *)(p + 2));
+  __m128i c1 = _mm_and_si128(b1, low6), c2 = _mm_and_si128(b2, low6);
+  // there are no byte shifts: shift 16-bit lanes and drop what crossed over
+  __m128i b0_shl6 = _mm_and_si128(_mm_slli_epi16(b0, 6), _mm_set1_epi8((char)0xc0));
+  __m128i c1_shl6 = _mm_and_si128(_mm_slli_epi16(c1, 6), _mm_set1_epi8((char)0xc0));
+
+  __m128i low2 = _mm_or_si128(b0_shl6, c1);
+  __m128i high2 = _mm_and_si128(_mm_srli_epi16(b0, 2), _mm_set1_epi8(0x07));
+  __m128i low3 = _mm_or_si128(c1_shl6, c2);
+  __m128i high3 = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(b0, 4), _mm_set1_epi8((char)0xf0)),
+                               _mm_and_si128(_mm_srli_epi16(c1, 2), _mm_set1_epi8(0x0f)));
+
+  __m128i is2 = _mm_cmplt_epi8(b0, _mm_set1_epi8(-64)); // below C0 as signed: ASCII or continuation
+  is2 = _mm_andnot_si128(is2, _mm_cmplt_epi8(b0, zero));
+  __m128i is3 = _mm_and_si128(_mm_cmpgt_epi8(b0, _mm_set1_epi8(-33)), _mm_cmplt_epi8(b0, zero));
+  __m128i low = _mm_or_si128(_mm_andnot_si128(is2, b0), _mm_and_si128(is2, low2));
+  low = _mm_or_si128(_mm_andnot_si128(is3, low), _mm_and_si128(is3, low3));
+  __m128i high = _mm_or_si128(_mm_andnot_si128(is3, _mm_and_si128(is2, high2)), _mm_and_si128(is3, high3));
+
+  __m128i lo = _mm_unpacklo_epi8(low, high), hi = _mm_unpackhi_epi8(low, high);
+  _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi16(lo, zero));
+  _mm_storeu_si128((__m128i *)(out + 4), _mm_unpackhi_epi16(lo, zero));
+  _mm_storeu_si128((__m128i *)(out + 8), _mm_unpacklo_epi16(hi, zero));
+  _mm_storeu_si128((__m128i *)(out + 12), _mm_unpackhi_epi16(hi, zero));
+
+  __m128i overlong = _mm_and_si128(_mm_cmpeq_epi8(b0, _mm_set1_epi8((char)0xe0)),
+                                   _mm_cmplt_epi8(b1, _mm_set1_epi8((char)0xa0)));
+  __m128i surrogate = _mm_and_si128(_mm_cmpeq_epi8(b0, _mm_set1_epi8((char)0xed)),
+                                    _mm_cmpgt_epi8(b1, _mm_set1_epi8((char)0x9f)));
+  return (uint32_t)_mm_movemask_epi8(_mm_or_si128(overlong, surrogate));
+}
+
+/* term_utf8_decode16_sse2 for a block with 4-byte sequences, in 32-bit
+ * lanes 4 at a time (reads up to p[18] too) */
+__attribute__((target("sse2")))
+static uint32_t term_utf8_decode16_wide_sse2(const uint8_t *p, uint32_t *out) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i b[4][4]; // bytes k..k+3 of every position
+  for (uint32_t k = 0; k < 4; k++) {
+    __m128i bytes = _mm_loadu_si128((const __m128i *)(p + k));
+    __m128i lo = _mm_unpacklo_epi8(bytes, zero), hi = _mm_unpackhi_epi8(bytes, zero);
+    b[k][0] = _mm_unpacklo_epi16(lo, zero);
+    b[k][1] = _mm_unpackhi_epi16(lo, zero);
+    b[k][2] = _mm_unpacklo_epi16(hi, zero);
+    b[k][3] = _mm_unpackhi_epi16(hi, zero);
+  }
+  uint32_t invalid = 0;
+  for (uint32_t g = 0; g < 4; g++)
+    invalid |= term_utf8_decode4_sse2(b[0][g], b[1][g], b[2][g], b[3][g], out + g * 4) << (g * 4);
+  return invalid;
+}
+
+__attribute__((target("sse2")))
+static uint64_t term_scan_utf8_sse2(const uint8_t *data, uint64_t len, uint32_t *out, uint64_t cap,
+                                    uint64_t *out_len) {
+  const __m128i zero = _mm_setzero_si128(), space = _mm_set1_epi8(0x1f), del = _mm_set1_epi8(0x7f);
+  uint64_t i = 0, n = 0;
+  while (i + 16 + 3 <= len && n + 16 <= cap) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i printable = _mm_andnot_si128(_mm_cmpeq_epi8(v, del), _mm_cmpgt_epi8(v, space));
+    uint32_t high = (uint32_t)_mm_movemask_epi8(v);
+
+    if (high == 0) {
+      __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+      _mm_storeu_si128((__m128i *)(out + n), _mm_unpacklo_epi16(lo, zero));
+      _mm_storeu_si128((__m128i *)(out + n + 4), _mm_unpackhi_epi16(lo, zero));
+      _mm_storeu_si128((__m128i *)(out + n + 8), _mm_unpacklo_epi16(hi, zero));
+      _mm_storeu_si128((__m128i *)(out + n + 12), _mm_unpackhi_epi16(hi, zero));
+      uint32_t stop = ~(uint32_t)_mm_movemask_epi8(printable) & 0xffff;
+      uint32_t run = stop ? (uint32_t)__builtin_ctz(stop) : 16;
+      i += run;
+      n += run;
+      if (stop)
+        break;
+      continue;
+    }
+
+    __m128i c0c1 = _mm_cmpeq_epi8(_mm_and_si128(v, _mm_set1_epi8((char)0xfe)), _mm_set1_epi8((char)0xc0));
+    uint32_t bad = (~((uint32_t)_mm_movemask_epi8(printable) | high) & 0xffff) |
+                   (uint32_t)_mm_movemask_epi8(c0c1) |
+                   ((uint32_t)_mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_set1_epi8(-12))) & high);
+    uint32_t cont = (uint32_t)_mm_movemask_epi8(_mm_cmplt_epi8(v, _mm_set1_epi8(-64)));
+    uint32_t lead2 = (uint32_t)_mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_set1_epi8(-65))) & high;
+    uint32_t lead3 = (uint32_t)_mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_set1_epi8(-33))) & high;
+    uint32_t lead4 = (uint32_t)_mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_set1_epi8(-17))) & high;
+
+    uint32_t invalid = lead4 ? term_utf8_decode16_wide_sse2(data + i, out + n)
+                             : term_utf8_decode16_sse2(data + i, out + n);
+
+    uint64_t starts;
+    bool stop;
+    uint32_t used = term_utf8_block(16, bad, cont, lead2, lead3, lead4, invalid & high, &starts, &stop);
+    n += term_utf8_compact(out + n, 16, starts);
+    if (stop) {
+      i += used;
+      break;
+    }
+    i += 16 - term_utf8_carry(data + i + 16);
+  }
+
+  uint64_t rest;
+  i += term_scan_utf8_scalar(data + i, len - i, out + n, cap - n, &rest);
+  *out_len = n + rest;
+  return i;
+}
+
+/* For each set of 8 lanes (a bit each), the lanes in order, a nibble
+ * each from the lowest: what _mm256_permutevar8x32_epi32 needs to pack
+ * them to the front. Built by term_scan_kernels_init. */
+static uint32_t term_compact_table[256];
+
+static void term_compact_table_init(void) {
+  for (uint32_t mask = 0; mask < 256; mask++) {
+    uint32_t entry = 0, n = 0;
+    for (uint32_t lane = 0; lane < 8; lane++) {
+      if (mask >> lane & 1)
+        entry |= lane << (4 * n++);
+    }
+    term_compact_table[mask] = entry;
+  }
+}
+
+/* term_utf8_decode4_sse2 for 8 lanes */
+__attribute__((target("avx2")))
+static uint32_t term_utf8_decode8_avx2(__m256i b0, __m256i b1, __m256i b2, __m256i b3, uint32_t *out) {
+  const __m256i low6 = _mm256_set1_epi32(0x3f);
+  b1 = _mm256_and_si256(b1, low6);
+  b2 = _mm256_and_si256(b2, low6);
+  b3 = _mm256_and_si256(b3, low6);
+  __m256i cp2 = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(b0, _mm256_set1_epi32(0x1f)), 6), b1);
+  __m256i cp3 = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(b0, _mm256_set1_epi32(0x0f)), 12),
+                                                _mm256_slli_epi32(b1, 6)), b2);
+  __m256i cp4 = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(b0, _mm256_set1_epi32(0x07)), 18),
+                                                _mm256_slli_epi32(b1, 12)),
+                                _mm256_or_si256(_mm256_slli_epi32(b2, 6), b3));
+  __m256i is2 = _mm256_cmpgt_epi32(b0, _mm256_set1_epi32(0xbf));
+  __m256i is3 = _mm256_cmpgt_epi32(b0, _mm256_set1_epi32(0xdf));
+  __m256i is4 = _mm256_cmpgt_epi32(b0, _mm256_set1_epi32(0xef));
+
+  __m256i cp = _mm256_blendv_epi8(b0, cp2, is2);
+  cp = _mm256_blendv_epi8(cp, cp3, is3);
+  cp = _mm256_blendv_epi8(cp, cp4, is4);
+  _mm256_storeu_si256((__m256i *)out, cp);
+
+  __m256i surrogate = _mm256_and_si256(_mm256_cmpgt_epi32(cp3, _mm256_set1_epi32(0xd7ff)),
+                                       _mm256_cmpgt_epi32(_mm256_set1_epi32(0xe000), cp3));
+  __m256i bad3 = _mm256_andnot_si256(is4, _mm256_and_si256(is3, _mm256_or_si256(
+                   _mm256_cmpgt_epi32(_mm256_set1_epi32(0x800), cp3), surrogate)));
+  __m256i bad4 = _mm256_and_si256(is4, _mm256_or_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(0x10000), cp4),
+                                                       _mm256_cmpgt_epi32(cp4, _mm256_set1_epi32(0x10ffff))));
+  return (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_or_si256(bad3, bad4)));
+}
+
+/* term_utf8_decode16_sse2 for 32 bytes (reads up to p[34]). The unpacks
+ * interleave within 128-bit lanes, so the 16-bit codepoints come out as
+ * positions 0-7 and 16-23 in one vector and 8-15 and 24-31 in the other. */
+__attribute__((target("avx2")))
+static uint32_t term_utf8_decode32_avx2(const uint8_t *p, uint32_t *out) {
+  const __m256i zero = _mm256_setzero_si256(), low6 = _mm256_set1_epi8(0x3f);
+  __m256i b0 = _mm256_loadu_si256((const __m256i *)p);
+  __m256i b1 = _mm256_loadu_si256((const __m256i *)(p + 1));
+  __m256i b2 = _mm256_loadu_si256((const __m256i *)(p + 2));
+  __m256i c1 = _mm256_and_si256(b1, low6), c2 = _mm256_and_si256(b2, low6);
+  __m256i b0_shl6 = _mm256_and_si256(_mm256_slli_epi16(b0, 6), _mm256_set1_epi8((char)0xc0));
+  __m256i c1_shl6 = _mm256_and_si256(_mm256_slli_epi16(c1, 6), _mm256_set1_epi8((char)0xc0));
+
+  __m256i low2 = _mm256_or_si256(b0_shl6, c1);
+  __m256i high2 = _mm256_and_si256(_mm256_srli_epi16(b0, 2), _mm256_set1_epi8(0x07));
+  __m256i low3 = _mm256_or_si256(c1_shl6, c2);
+  __m256i high3 = _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi16(b0, 4), _mm256_set1_epi8((char)0xf0)),
+                                  _mm256_and_si256(_mm256_srli_epi16(c1, 2), _mm256_set1_epi8(0x0f)));
+
+  __m256i negative = _mm256_cmpgt_epi8(zero, b0);
+  __m256i is2 = _mm256_andnot_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(-64), b0), negative);
+  __m256i is3 = _mm256_and_si256(_mm256_cmpgt_epi8(b0, _mm256_set1_epi8(-33)), negative);
+  __m256i low = _mm256_blendv_epi8(_mm256_blendv_epi8(b0, low2, is2), low3, is3);
+  __m256i high = _mm256_blendv_epi8(_mm256_and_si256(is2, high2), high3, is3);
+
+  __m256i lo = _mm256_unpacklo_epi8(low, high), hi = _mm256_unpackhi_epi8(low, high);
+  _mm256_storeu_si256((__m256i *)out, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(lo)));
+  _mm256_storeu_si256((__m256i *)(out + 8), _mm256_cvtepu16_epi32(_mm256_castsi256_si128(hi)));
+  _mm256_storeu_si256((__m256i *)(out + 16), _mm256_cvtepu16_epi32(_mm256_extracti128_si256(lo, 1)));
+  _mm256_storeu_si256((__m256i *)(out + 24), _mm256_cvtepu16_epi32(_mm256_extracti128_si256(hi, 1)));
+
+  __m256i overlong = _mm256_and_si256(_mm256_cmpeq_epi8(b0, _mm256_set1_epi8((char)0xe0)),
+                                      _mm256_cmpgt_epi8(_mm256_set1_epi8((char)0xa0), b1));
+  __m256i surrogate = _mm256_and_si256(_mm256_cmpeq_epi8(b0, _mm256_set1_epi8((char)0xed)),
+                                       _mm256_cmpgt_epi8(b1, _mm256_set1_epi8((char)0x9f)));
+  return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(overlong, surrogate));
+}
+
+/* term_utf8_decode16_wide_sse2 for 32 bytes, 8 lanes at a time */
+__attribute__((target("avx2")))
+static uint32_t term_utf8_decode32_wide_avx2(const uint8_t *p, uint32_t *out) {
+  uint32_t invalid = 0;
+  for (uint32_t g = 0; g < 4; g++, p += 8) {
+    invalid |= term_utf8_decode8_avx2(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)p)),
+                                      _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(p + 1))),
+                                      _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(p + 2))),
+                                      _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(p + 3))),
+                                      out + g * 8) << (g * 8);
+  }
+  return invalid;
+}
+
+__attribute__((target("avx2")))
+static uint64_t term_scan_utf8_avx2(const uint8_t *data, uint64_t len, uint32_t *out, uint64_t cap,
+                                    uint64_t *out_len) {
+  const __m256i space = _mm256_set1_epi8(0x1f), del = _mm256_set1_epi8(0x7f);
+  const __m256i nibbles = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+  uint64_t i = 0, n = 0;
+  while (i + 32 + 3 <= len && n + 32 <= cap) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i printable = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, del), _mm256_cmpgt_epi8(v, space));
+    uint32_t high = (uint32_t)_mm256_movemask_epi8(v);
+
+    if (high == 0) {
+      for (uint32_t g = 0; g < 4; g++) {
+        __m128i bytes = _mm_loadl_epi64((const __m128i *)(data + i + g * 8));
+        _mm256_storeu_si256((__m256i *)(out + n + g * 8), _mm256_cvtepu8_epi32(bytes));
+      }
+      uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(printable);
+      uint32_t run = stop ? (uint32_t)__builtin_ctz(stop) : 32;
+      i += run;
+      n += run;
+      if (stop)
+        break;
+      continue;
+    }
+
+    __m256i c0c1 = _mm256_cmpeq_epi8(_mm256_and_si256(v, _mm256_set1_epi8((char)0xfe)),
+                                     _mm256_set1_epi8((char)0xc0));
+    uint32_t bad = ~((uint32_t)_mm256_movemask_epi8(printable) | high) |
+                   (uint32_t)_mm256_movemask_epi8(c0c1) |
+                   ((uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(-12))) & high);
+    uint32_t cont = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_set1_epi8(-64), v));
+    uint32_t lead2 = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(-65))) & high;
+    uint32_t lead3 = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(-33))) & high;
+    uint32_t lead4 = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(-17))) & high;
+
+    uint32_t decoded[32];
+    uint32_t invalid = lead4 ? term_utf8_decode32_wide_avx2(data + i, decoded)
+                             : term_utf8_decode32_avx2(data + i, decoded);
+
+    uint64_t starts;
+    bool stop;
+    uint32_t used = term_utf8_block(32, bad, cont, lead2, lead3, lead4, invalid & high, &starts, &stop);
+    for (uint32_t g = 0; g < 4; g++) {
+      // pack the lanes at sequence starts to the front: lane k of the index
+      // vector is the nibble k of the group's compaction table entry
+      uint32_t mask = (uint32_t)(starts >> (g * 8)) & 0xff;
+      __m256i index = _mm256_and_si256(_mm256_srlv_epi32(_mm256_set1_epi32((int)term_compact_table[mask]), nibbles),
+                                       _mm256_set1_epi32(7));
+      __m256i lanes = _mm256_loadu_si256((const __m256i *)(decoded + g * 8));
+      _mm256_storeu_si256((__m256i *)(out + n), _mm256_permutevar8x32_epi32(lanes, index));
+      n += (uint32_t)__builtin_popcount(mask);
+    }
+    if (stop) {
+      i += used;
+      break;
+    }
+    i += 32 - term_utf8_carry(data + i + 32);
+  }
+
+  uint64_t rest;
+  i += term_scan_utf8_sse2(data + i, len - i, out + n, cap - n, &rest);
+  *out_len = n + rest;
+  return i;
+}
+
+static const term_scan_kernels_t term_scan_kernels_sse2 = {
+  .name = "sse2",
+  .ascii = term_scan_ascii_sse2,
+  .utf8 = term_scan_utf8_sse2,
+};
+
+static const term_scan_kernels_t term_scan_kernels_avx2 = {
+  .name = "avx2",
+  .ascii = term_scan_ascii_avx2,
+  .utf8 = term_scan_utf8_avx2,
+};
+#endif
+
+/* Every kernel set this CPU can run, best last; scalar is always first */
+static const term_scan_kernels_t *term_scan_kernels_available[3];
+static uint32_t term_scan_kernels_available_len;
+
+/* The kernels term_feed uses */
+static const term_scan_kernels_t *term_scan_kernels = &term_scan_kernels_scalar;
+
+/* Select the widest kernels the CPU runs. KASAMA_SCAN_KERNELS=<name> forces
+ * a specific (supported) set, for benchmarking. */
+static void term_scan_kernels_init(void) {
+  term_scan_kernels_available_len = 0;
+  term_scan_kernels_available[term_scan_kernels_available_len++] = &term_scan_kernels_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    term_scan_kernels_available[term_scan_kernels_available_len++] = &term_scan_kernels_sse2;
+  if (__builtin_cpu_supports("avx2")) {
+    term_compact_table_init();
+    term_scan_kernels_available[term_scan_kernels_available_len++] = &term_scan_kernels_avx2;
+  }
+#endif
+  term_scan_kernels = term_scan_kernels_available[term_scan_kernels_available_len - 1];
+
+  char *forced = getenv("KASAMA_SCAN_KERNELS");
+  for (uint32_t i = 0; forced && i < term_scan_kernels_available_len; i++) {
+    if (strcmp(forced, term_scan_kernels_available[i]->name) == 0)
+      term_scan_kernels = term_scan_kernels_available[i];
+  }
+}
+
+/* ---- Styles ---- */
+
+static const uint32_t term_palette[16] = { // xterm's
+  0x000000, 0xcd0000, 0x00cd00, 0xcdcd00, 0x0000ee, 0xcd00cd, 0x00cdcd, 0xe5e5e5,
+  0x7f7f7f, 0xff0000, 0x00ff00, 0xffff00, 0x5c5cff, 0xff00ff, 0x00ffff, 0xffffff,
+};
+
+/* Color n of the 256-color palette: 16 named colors, a 6x6x6 cube, 24 grays */
+static uint32_t term_color256(uint32_t n) {
+  static const uint8_t levels[6] = {0, 95, 135, 175, 215, 255};
+  if (n < 16)
+    return term_palette[n];
+  if (n < 232) {
+    n -= 16;
+    return (uint32_t)levels[n / 36] << 16 | (uint32_t)levels[n / 6 % 6] << 8 | levels[n % 6];
+  }
+  uint32_t gray = 8 + (n - 232) * 10;
+  return gray << 16 | gray << 8 | gray;
+}
+
+static uint32_t term_style_hash(term_style_t style) {
+  uint64_t h = ((uint64_t)style.fg << 32 | style.bg) * 0x9e3779b97f4a7c15ULL;
+  h ^= (h >> 29) + style.flags * 0xbf58476d1ce4e5b9ULL;
+  return (uint32_t)(h ^ h >> 32);
+}
+
+static bool term_style_equal(term_style_t a, term_style_t b) {
+  return a.fg == b.fg && a.bg == b.bg && a.flags == b.flags;
+}
+
+/* Returns 0, or -1 with errno set */
+static int term_styles_init(term_styles_t *styles) {
+  memset(styles, 0, sizeof(*styles));
+  styles->cap = 64;
+  styles->index_cap = 128;
+  styles->styles = malloc(sizeof(*styles->styles) * styles->cap);
+  styles->index = calloc(styles->index_cap, sizeof(*styles->index));
+  if (!styles->styles || !styles->index) {
+    free(styles->styles);
+    free(styles->index);
+    return -1;
+  }
+  term_style_t dflt = {.fg = TERM_DEFAULT_FG, .bg = TERM_DEFAULT_BG};
+  styles->styles[styles->len++] = dflt;
+  styles->index[term_style_hash(dflt) & (styles->index_cap - 1)] = 1;
+  return 0;
+}
+
+static void term_styles_free(term_styles_t *styles) {
+  free(styles->styles);
+  free(styles->index);
+  memset(styles, 0, sizeof(*styles));
+}
+
+/* Double the hash index. Returns 0, or -1 with errno set. */
+static int term_styles_rehash(term_styles_t *styles) {
+  uint32_t cap = styles->index_cap * 2;
+  uint32_t *index = calloc(cap, sizeof(*index));
+  if (!index)
+    return -1;
+  for (uint32_t i = 0; i < styles->len; i++) {
+    uint32_t slot = term_style_hash(styles->styles[i]) & (cap - 1);
+    while (index[slot])
+      slot = (slot + 1) & (cap - 1);
+    index[slot] = i + 1;
+  }
+  free(styles->index);
+  styles->index = index;
+  styles->index_cap = cap;
+  return 0;
+}
+
+/* The index of `style`, added if it is new. A style that can't be added
+ * (the table is full, or out of memory) comes back as the default one. */
+static uint32_t term_style_intern(term_styles_t *styles, term_style_t style) {
+  uint32_t mask = styles->index_cap - 1;
+  uint32_t slot = term_style_hash(style) & mask;
+  for (; styles->index[slot]; slot = (slot + 1) & mask) {
+    if (term_style_equal(styles->styles[styles->index[slot] - 1], style))
+      return styles->index[slot] - 1;
+  }
+
+  if (styles->len == TERM_STYLES_MAX)
+    goto dropped;
+  if (styles->len == styles->cap) {
+    term_style_t *grown = realloc(styles->styles, sizeof(*grown) * styles->cap * 2);
+    if (!grown)
+      goto dropped;
+    styles->styles = grown;
+    styles->cap *= 2;
+  }
+  if ((styles->len + 1) * 2 > styles->index_cap) {
+    if (term_styles_rehash(styles) == -1)
+      goto dropped;
+    mask = styles->index_cap - 1;
+    for (slot = term_style_hash(style) & mask; styles->index[slot]; slot = (slot + 1) & mask)
+      ;
+  }
+  styles->styles[styles->len] = style;
+  styles->index[slot] = ++styles->len;
+  return styles->len - 1;
+
+dropped:
+  styles->dropped++;
+  return 0;
+}
+
+/* ---- Scrollback history ---- */
+
+/* Rows are stored as: the number of cells up to the last one that isn't a
+ * default blank, then runs of (style, count, count codepoints), all LEB128
+ * varints. Plain text costs about a byte per character. */
+
+#define TERM_HISTORY_ROW_MAX ((TERM_HISTORY_CHUNK - 16) / 8) /* cells an encoded row can hold */
+
+static uint8_t *term_varint_put(uint8_t *out, uint32_t v) {
+  while (v >= 0x80) {
+    *out++ = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  *out++ = (uint8_t)v;
+  return out;
+}
+
+static const uint8_t *term_varint_get(const uint8_t *in, uint32_t *v) {
+  uint32_t value = 0;
+  for (uint32_t shift = 0;; shift += 7) {
+    uint8_t b = *in++;
+    value |= (uint32_t)(b & 0x7f) << shift;
+    if (b < 0x80 || shift >= 28)
+      break;
+  }
+  *v = value;
+  return in;
+}
+
+static bool term_cell_blank(term_cell_t cell) {
+  return cell.codepoint == ' ' && cell.style == 0;
+}
+
+/* Encode `len` cells into `out`, which holds 8 bytes a cell plus 16.
+ * Returns the bytes written. */
+static uint64_t term_history_encode(const term_cell_t *cells, uint32_t len, uint8_t *out) {
+  while (len > 0 && term_cell_blank(cells[len - 1]))
+    len--;
+  len = len < TERM_HISTORY_ROW_MAX ? len : TERM_HISTORY_ROW_MAX;
+  uint8_t *p = term_varint_put(out, len);
+  for (uint32_t i = 0; i < len;) {
+    uint32_t style = cells[i].style, n = 1;
+    while (i + n < len && cells[i + n].style == style)
+      n++;
+    p = term_varint_put(p, style);
+    p = term_varint_put(p, n);
+    for (uint32_t end = i + n; i < end; i++)
+      p = term_varint_put(p, cells[i].codepoint);
+  }
+  return (uint64_t)(p - out);
+}
+
+/* Decode a row into `cols` cells, blank past its end */
+static void term_history_decode(const uint8_t *in, term_cell_t *cells, uint32_t cols) {
+  uint32_t len, x = 0;
+  in = term_varint_get(in, &len);
+  while (x < len) {
+    uint32_t style, n, codepoint;
+    in = term_varint_get(in, &style);
+    in = term_varint_get(in, &n);
+    for (uint32_t end = x + n; x < end; x++) {
+      in = term_varint_get(in, &codepoint);
+      if (x < cols)
+        cells[x] = (term_cell_t){.codepoint = codepoint, .style = style};
+    }
+  }
+  for (; x < cols; x++)
+    cells[x] = (term_cell_t){.codepoint = ' '};
+}
+
+/* Returns 0, or -1 with errno set */
+static int term_history_init(term_history_t *history, uint32_t cols) {
+  memset(history, 0, sizeof(*history));
+  history->max_lines = TERM_HISTORY_LINES;
+  history->budget = TERM_HISTORY_BUDGET;
+  history->spill_fd = -1;
+  history->mapped_chunk = UINT64_MAX;
+  uint64_t cells = cols < TERM_HISTORY_ROW_MAX ? cols : TERM_HISTORY_ROW_MAX;
+  history->encode_buf = malloc(cells * 8 + 16);
+  return history->encode_buf ? 0 : -1;
+}
+
+static void term_history_release(term_history_t *history, uint32_t i) {
+  if (history->chunks[i]) {
+    free(history->chunks[i]);
+    history->chunks[i] = NULL;
+    history->memory -= TERM_HISTORY_CHUNK;
+    return;
+  }
+  uint64_t chunk = history->first_chunk + i;
+  if (history->mapped_chunk == chunk) {
+    munmap(history->mapped, TERM_HISTORY_CHUNK);
+    history->mapped = NULL;
+    history->mapped_chunk = UINT64_MAX;
+  }
+  fallocate(history->spill_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+            (off_t)(chunk * TERM_HISTORY_CHUNK), TERM_HISTORY_CHUNK);
+  history->spilled -= TERM_HISTORY_CHUNK;
+}
+
+/* Release the chunks before the one the oldest kept row is in */
+static void term_history_trim(term_history_t *history) {
+  uint64_t keep = (history->len ? history->offsets[history->head] : history->write_pos) / TERM_HISTORY_CHUNK;
+  uint32_t n = 0;
+  while (n < history->chunks_len && history->first_chunk + n < keep)
+    term_history_release(history, n++);
+  if (n == 0)
+    return;
+  memmove(history->chunks, history->chunks + n, sizeof(*history->chunks) * (history->chunks_len - n));
+  history->chunks_len -= n;
+  history->first_chunk += n;
+}
+
+static void term_history_drop(term_history_t *history, uint32_t n) {
+  n = n < history->len ? n : history->len;
+  history->head = history->offsets_cap ? (history->head + n) % history->offsets_cap : 0;
+  history->len -= n;
+  history->rows_dropped += n;
+  term_history_trim(history);
+}
+
+/* Open the spill file: unlinked from the start, so nothing is left behind */
+static int term_history_spill_open(void) {
+  const char *dirs[] = {getenv("TMPDIR"), "/var/tmp", "/tmp"};
+  for (uint32_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+    if (!dirs[i] || !dirs[i][0])
+      continue;
+    int fd = open(dirs[i], O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd != -1)
+      return fd;
+  }
+  return -1;
+}
+
+/* Write out the oldest chunk still in memory, other than the one being
+ * filled. If that fails, the rows up to the end of it are dropped instead.
+ * Returns false if there was no such chunk. */
+static bool term_history_spill(term_history_t *history) {
+  uint32_t i = 0;
+  while (i + 1 < history->chunks_len && !history->chunks[i])
+    i++;
+  if (i + 1 >= history->chunks_len)
+    return false;
+
+  uint64_t chunk = history->first_chunk + i;
+  if (history->spill_fd == -1)
+    history->spill_fd = term_history_spill_open();
+  if (history->spill_fd != -1 &&
+      pwrite(history->spill_fd, history->chunks[i], TERM_HISTORY_CHUNK,
+             (off_t)(chunk * TERM_HISTORY_CHUNK)) == TERM_HISTORY_CHUNK) {
+    free(history->chunks[i]);
+    history->chunks[i] = NULL;
+    history->memory -= TERM_HISTORY_CHUNK;
+    history->spilled += TERM_HISTORY_CHUNK;
+    return true;
+  }
+
+  history->spill_failures++;
+  uint64_t end = (chunk + 1) * TERM_HISTORY_CHUNK;
+  uint32_t n = 0;
+  while (n < history->len && history->offsets[(history->head + n) % history->offsets_cap] < end)
+    n++;
+  term_history_drop(history, n);
+  return true;
+}
+
+/* Spill chunks until the ones in memory, the one being filled aside, fit
+ * the budget */
+static void term_history_fit(term_history_t *history) {
+  while (history->memory > history->budget + TERM_HISTORY_CHUNK && term_history_spill(history))
+    ;
+}
+
+/* Make room for one more row offset. Returns false if there is none. */
+static bool term_history_reserve(term_history_t *history) {
+  if (history->len == history->max_lines)
+    term_history_drop(history, 1);
+  if (history->len < history->offsets_cap)
+    return true;
+
+  uint32_t cap = history->offsets_cap ? history->offsets_cap * 2 : 1024;
+  cap = cap < history->max_lines ? cap : history->max_lines;
+  uint64_t *offsets = malloc(sizeof(*offsets) * cap);
+  if (!offsets)
+    return false;
+  for (uint32_t i = 0; i < history->len; i++)
+    offsets[i] = history->offsets[(history->head + i) % history->offsets_cap];
+  free(history->offsets);
+  history->offsets = offsets;
+  history->offsets_cap = cap;
+  history->head = 0;
+  return true;
+}
+
+/* Append the row that just left the ring. It is dropped if there is no
+ * memory for it. */
+static void term_history_push(term_history_t *history, const term_cell_t *cells, uint32_t len) {
+  if (history->max_lines == 0 || !term_history_reserve(history))
+    return;
+
+  uint64_t size = term_history_encode(cells, len, history->encode_buf);
+  uint64_t at = history->write_pos % TERM_HISTORY_CHUNK;
+  if (at > 0 && at + size > TERM_HISTORY_CHUNK) // rows don't straddle chunks
+    history->write_pos += TERM_HISTORY_CHUNK - at;
+  uint64_t chunk = history->write_pos / TERM_HISTORY_CHUNK;
+
+  if (history->chunks_len == 0)
+    history->first_chunk = chunk;
+  if (chunk - history->first_chunk == history->chunks_len) {
+    if (history->chunks_len == history->chunks_cap) {
+      uint32_t cap = history->chunks_cap ? history->chunks_cap * 2 : 16;
+      uint8_t **chunks = realloc(history->chunks, sizeof(*chunks) * cap);
+      if (!chunks)
+        return;
+      history->chunks = chunks;
+      history->chunks_cap = cap;
+    }
+    uint8_t *fresh = malloc(TERM_HISTORY_CHUNK);
+    if (!fresh)
+      return;
+    history->chunks[history->chunks_len++] = fresh;
+    history->memory += TERM_HISTORY_CHUNK;
+    term_history_fit(history);
+  }
+
+  memcpy(history->chunks[chunk - history->first_chunk] + history->write_pos % TERM_HISTORY_CHUNK,
+         history->encode_buf, size);
+  history->offsets[(history->head + history->len) % history->offsets_cap] = history->write_pos;
+  history->len++;
+  history->write_pos += size;
+  history->rows_added++;
+  history->bytes_encoded += size;
+}
+
+/* Decode row i (0 = oldest) into `cols` cells. Returns false if it can't be
+ * read back, leaving the cells blank. */
+static bool term_history_get(term_history_t *history, uint32_t i, term_cell_t *cells, uint32_t cols) {
+  uint64_t off = history->offsets[(history->head + i) % history->offsets_cap];
+  uint64_t chunk = off / TERM_HISTORY_CHUNK;
+  const uint8_t *data = history->chunks[chunk - history->first_chunk];
+  if (!data && history->mapped_chunk != chunk) {
+    if (history->mapped)
+      munmap(history->mapped, TERM_HISTORY_CHUNK);
+    history->mapped = mmap(NULL, TERM_HISTORY_CHUNK, PROT_READ, MAP_PRIVATE, history->spill_fd,
+                           (off_t)(chunk * TERM_HISTORY_CHUNK));
+    history->mapped_chunk = chunk;
+    if (history->mapped == MAP_FAILED) {
+      history->mapped = NULL;
+      history->mapped_chunk = UINT64_MAX;
+    }
+  }
+  if (!data)
+    data = history->mapped;
+  if (!data) {
+    term_history_decode((const uint8_t[]){0}, cells, cols);
+    return false;
+  }
+  term_history_decode(data + off % TERM_HISTORY_CHUNK, cells, cols);
+  return true;
+}
+
+static void term_history_clear(term_history_t *history) {
+  term_history_drop(history, history->len);
+}
+
+static void term_history_free(term_history_t *history) {
+  term_history_clear(history);
+  for (uint32_t i = 0; i < history->chunks_len; i++)
+    term_history_release(history, i);
+  if (history->mapped)
+    munmap(history->mapped, TERM_HISTORY_CHUNK);
+  if (history->spill_fd != -1)
+    close(history->spill_fd);
+  free(history->chunks);
+  free(history->offsets);
+  free(history->encode_buf);
+  memset(history, 0, sizeof(*history));
+  history->spill_fd = -1;
+}
+
+/* ---- Grid ---- */
+
+static void term_blank(term_cell_t *cells, uint64_t n, uint32_t style) {
+  for (uint64_t i = 0; i < n; i++)
+    cells[i] = (term_cell_t){.codepoint = ' ', .style = style};
+}
+
+/* Ring row of screen row y */
+static uint32_t term_ring_row(term_t *term, uint32_t y) {
+  uint32_t row = term->top + y;
+  return row < term->ring_rows ? row : row - term->ring_rows;
+}
+
+static term_cell_t *term_row_cells(term_t *term, uint32_t ring_row) {
+  return term->ring + (uint64_t)ring_row * term->cols;
+}
+
+/* Row y of the view needs repainting */
+static void term_mark_view_row(term_t *term, uint32_t y) {
+  term->dirty_rows[y / 64] |= 1ULL << (y % 64);
+  term->dirty = true;
+}
+
+/* Screen row y changed */
+static void term_mark_row(term_t *term, uint32_t y) {
+  if (y + term->view_offset < term->rows)
+    term_mark_view_row(term, y + term->view_offset);
+}
+
+static void term_mark_all(term_t *term) {
+  for (uint32_t y = 0; y < term->rows; y++)
+    term_mark_view_row(term, y);
+}
+
+/* The view's contents moved up n rows: so do the dirty rows, and the n rows
+ * that come in at the bottom are dirty. The renderer can then shift the
+ * last frame's pixels (term_take_scroll) and repaint just those. */
+static void term_shift_view(term_t *term, uint32_t n) {
+  if (term->scrolled == term->rows)
+    return; // a screenful already: every row is dirty
+  term->scrolled = term->scrolled + n < term->rows ? term->scrolled + n : term->rows;
+  if (term->scrolled == term->rows) {
+    term_mark_all(term);
+    return;
+  }
+  uint32_t words = (term->rows + 63) / 64, skip = n / 64, bits = n % 64;
+  for (uint32_t w = 0; w < words; w++) {
+    uint64_t lo = w + skip < words ? term->dirty_rows[w + skip] : 0;
+    uint64_t hi = w + skip + 1 < words ? term->dirty_rows[w + skip + 1] : 0;
+    term->dirty_rows[w] = bits ? lo >> bits | hi << (64 - bits) : lo;
+  }
+  for (uint32_t y = term->rows - n; y < term->rows; y++)
+    term_mark_view_row(term, y);
+}
+
+static bool term_row_dirty(const term_t *term, uint32_t y) {
+  return term->dirty_rows[y / 64] >> (y % 64) & 1;
+}
+
+/* Scrollback rows: in the history and the ring */
+static uint32_t term_scrollback_len(const term_t *term) {
+  return term->history.len + term->hot_len;
+}
+
+/* Allocate a blank cols x rows grid. Returns 0, or -1 with errno set. */
+static int term_init(term_t *term, uint32_t cols, uint32_t rows) {
+  assert(cols > 0 && rows > 0);
+  memset(term, 0, sizeof(*term));
+  term->ring_rows = rows + TERM_HOT_LINES;
+  term->ring = malloc(sizeof(*term->ring) * cols * term->ring_rows);
+  term->ring_len = calloc(term->ring_rows, sizeof(*term->ring_len));
+  term->dirty_rows = calloc((rows + 63) / 64, sizeof(*term->dirty_rows));
+  term->view_buf = malloc(sizeof(*term->view_buf) * cols);
+  term->draw_buf = malloc(sizeof(*term->draw_buf) * cols);
+  bool styles = false, history = false;
+  if (!term->ring || !term->ring_len || !term->dirty_rows || !term->view_buf || !term->draw_buf ||
+      !(styles = term_styles_init(&term->styles) == 0) ||
+      !(history = term_history_init(&term->history, cols) == 0)) {
+    if (styles)
+      term_styles_free(&term->styles);
+    free(term->ring);
+    free(term->ring_len);
+    free(term->dirty_rows);
+    free(term->view_buf);
+    free(term->draw_buf);
+    return -1;
+  }
+  term->cols = cols;
+  term->rows = rows;
+  term->cursor_visible = true;
+  term->pen_style = term->styles.styles[0];
+  term_blank(term->ring, (uint64_t)cols * term->ring_rows, 0);
+  term_mark_all(term);
+  return 0;
+}
+
+static void term_free(term_t *term) {
+  term_history_free(&term->history);
+  term_styles_free(&term->styles);
+  free(term->ring);
+  free(term->ring_len);
+  free(term->dirty_rows);
+  free(term->view_buf);
+  free(term->draw_buf);
+  memset(term, 0, sizeof(*term));
+}
+
+/* Reshape the grid to cols x rows. Rows keep their text, cut or padded but
+ * not rewrapped. When the screen gets shorter, the rows above the cursor
+ * that no longer fit scroll into the scrollback and those below it are
+ * dropped; rows past what the ring holds go to the history. The view
+ * returns to the screen.
+ * - Returns 0, or -1 with errno set and the grid as it was.
+ */
+static int term_resize(term_t *term, uint32_t cols, uint32_t rows) {
+  assert(cols > 0 && rows > 0);
+  if (cols == term->cols && rows == term->rows)
+    return 0;
+  uint32_t ring_rows = rows + TERM_HOT_LINES;
+  uint64_t encode_cells = cols < TERM_HISTORY_ROW_MAX ? cols : TERM_HISTORY_ROW_MAX;
+  term_cell_t *ring = malloc(sizeof(*ring) * cols * ring_rows);
+  uint32_t *ring_len = calloc(ring_rows, sizeof(*ring_len));
+  uint64_t *dirty_rows = calloc((rows + 63) / 64, sizeof(*dirty_rows));
+  term_cell_t *view_buf = malloc(sizeof(*view_buf) * cols);
+  text_cell_t *draw_buf = malloc(sizeof(*draw_buf) * cols);
+  uint8_t *encode_buf = malloc(encode_cells * 8 + 16);
+  if (!ring || !ring_len || !dirty_rows || !view_buf || !draw_buf || !encode_buf) {
+    free(ring);
+    free(ring_len);
+    free(dirty_rows);
+    free(view_buf);
+    free(draw_buf);
+    free(encode_buf);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  // old rows by their place relative to screen row 0, scrollback negative:
+  // the new screen starts at `lost`, with up to TERM_HOT_LINES rows above it
+  uint32_t lost = term->cursor_y >= rows ? term->cursor_y + 1 - rows : 0;
+  uint32_t hot = term->hot_len + lost < TERM_HOT_LINES ? term->hot_len + lost : TERM_HOT_LINES;
+  uint32_t screen = term->rows - lost < rows ? term->rows - lost : rows;
+  int64_t first = (int64_t)lost - hot;
+  for (int64_t y = -(int64_t)term->hot_len; y < first; y++) {
+    uint32_t row = (uint32_t)(((int64_t)term->top + term->ring_rows + y) % term->ring_rows);
+    term_history_push(&term->history, term_row_cells(term, row), term->ring_len[row]);
+  }
+  term_blank(ring, (uint64_t)cols * ring_rows, 0);
+  uint32_t copy = cols < term->cols ? cols : term->cols;
+  for (uint32_t i = 0; i < hot + screen; i++) {
+    uint32_t row = (uint32_t)(((int64_t)term->top + term->ring_rows + first + i) % term->ring_rows);
+    memcpy(ring + (uint64_t)i * cols, term_row_cells(term, row), sizeof(*ring) * copy);
+    ring_len[i] = term->ring_len[row] < cols ? term->ring_len[row] : cols;
+  }
+
+  free(term->ring);
+  free(term->ring_len);
+  free(term->dirty_rows);
+  free(term->view_buf);
+  free(term->draw_buf);
+  free(term->history.encode_buf);
+  term->ring = ring;
+  term->ring_len = ring_len;
+  term->dirty_rows = dirty_rows;
+  term->view_buf = view_buf;
+  term->draw_buf = draw_buf;
+  term->history.encode_buf = encode_buf;
+  term->cols = cols;
+  term->rows = rows;
+  term->ring_rows = ring_rows;
+  term->top = hot;
+  term->hot_len = hot;
+
+  // a wrap pending at the old width doesn't carry over
+  term->cursor_y -= lost;
+  term->cursor_x = term->cursor_x < cols ? term->cursor_x : cols - 1;
+  term->saved_y = term->saved_y > lost ? term->saved_y - lost : 0;
+  term->saved_y = term->saved_y < rows ? term->saved_y : rows - 1;
+  term->saved_x = term->saved_x < cols ? term->saved_x : cols - 1;
+  term->pointer_visible = false; // until the pointer moves again
+  term->cursor_drawn = false;
+  term->pointer_drawn = false;
+  term->view_offset = 0;
+  term->scrolled = 0;
+  term_mark_all(term);
+  return 0;
+}
+
+/* Keep up to `lines` rows of scrollback past the ring, in up to `budget`
+ * bytes of memory (plus the chunk being filled) before spilling to disk */
+static void term_set_scrollback(term_t *term, uint32_t lines, uint64_t budget) {
+  term_history_t *history = &term->history;
+  history->max_lines = lines;
+  history->budget = budget;
+  if (history->len > lines)
+    term_history_drop(history, history->len - lines);
+  term_history_fit(history);
+}
+
+static void term_stats_log(term_t *term) {
+  term_history_t *h = &term->history;
+  LOG("scrollback: rows=%u hot=%u ring_kb=%" PRIu64 " added=%" PRIu64 " dropped=%" PRIu64
+      " bytes_per_row=%.1f memory_kb=%" PRIu64 " spilled_kb=%" PRIu64 " spill_failures=%" PRIu64
+      " styles=%u styles_dropped=%" PRIu64 "\n",
+      h->len, term->hot_len, (uint64_t)term->ring_rows * term->cols * sizeof(*term->ring) >> 10,
+      h->rows_added, h->rows_dropped, h->rows_added ? (double)h->bytes_encoded / h->rows_added : 0.0,
+      h->memory >> 10, h->spilled >> 10, h->spill_failures, term->styles.len, term->styles.dropped);
+}
+
+/* Blank cells [from, to) of a ring row in the erase style */
+static void term_erase(term_t *term, uint32_t ring_row, uint32_t from, uint32_t to) {
+  uint32_t *len = &term->ring_len[ring_row];
+  if (term->erase_pen == 0 && from >= *len)
+    return; // already blank
+  uint32_t end = term->erase_pen == 0 && to > *len ? *len : to;
+  term_blank(term_row_cells(term, ring_row) + from, end - from, term->erase_pen);
+  if (term->erase_pen != 0)
+    *len = to > *len ? to : *len;
+  else if (end == *len)
+    *len = from;
+}
+
+/* Scrollback and the screen move up a row. The oldest row in the ring
+ * leaves for the history if the ring is full, and becomes the new bottom
+ * row. */
+static void term_scroll_up(term_t *term) {
+  uint32_t bottom = term_ring_row(term, term->rows); // == the oldest ring row when full
+  if (term->hot_len == term->ring_rows - term->rows)
+    term_history_push(&term->history, term_row_cells(term, bottom), term->ring_len[bottom]);
+  else
+    term->hot_len++;
+  term->top = term_ring_row(term, 1);
+  term_erase(term, bottom, 0, term->cols);
+
+  if (term->view_offset > 0 && term->view_offset < term_scrollback_len(term))
+    term->view_offset++; // keep looking at the same rows
+  else
+    term_shift_view(term, 1);
+}
+
+/* The screen moves down a row, dropping the bottom one. Rare, so rows are
+ * just copied. */
+static void term_scroll_down(term_t *term) {
+  for (uint32_t y = term->rows - 1; y > 0; y--) {
+    uint32_t to = term_ring_row(term, y), from = term_ring_row(term, y - 1);
+    memcpy(term_row_cells(term, to), term_row_cells(term, from), sizeof(*term->ring) * term->cols);
+    term->ring_len[to] = term->ring_len[from];
+  }
+  uint32_t top = term_ring_row(term, 0);
+  term->ring_len[top] = term->cols;
+  term_erase(term, top, 0, term->cols);
+  term_mark_all(term);
+}
+
+static void term_linefeed(term_t *term) {
+  if (term->cursor_y + 1 < term->rows)
+    term->cursor_y++;
+  else
+    term_scroll_up(term);
+}
+
+static void term_reverse_linefeed(term_t *term) {
+  if (term->cursor_y > 0)
+    term->cursor_y--;
+  else
+    term_scroll_down(term);
+}
+
+/* Claim up to `len` cells at the cursor, wrapping first if a wrap is
+ * pending: returns the first one and sets *fit to how many are left on the
+ * row, and moves the cursor past them */
+static term_cell_t *term_put_span(term_t *term, uint64_t len, uint64_t *fit) {
+  if (term->cursor_x == term->cols) {
+    term->cursor_x = 0;
+    term_linefeed(term);
+  }
+  uint64_t room = term->cols - term->cursor_x;
+  *fit = len < room ? len : room;
+  uint32_t ring_row = term_ring_row(term, term->cursor_y);
+  term_cell_t *cells = term_row_cells(term, ring_row) + term->cursor_x;
+  term_mark_row(term, term->cursor_y);
+  term->cursor_x += (uint32_t)*fit;
+  if (term->ring_len[ring_row] < term->cursor_x)
+    term->ring_len[ring_row] = term->cursor_x;
+  return cells;
+}
+
+static void term_put(term_t *term, uint32_t codepoint) {
+  uint64_t fit;
+  term_cell_t *cell = term_put_span(term, 1, &fit);
+  *cell = (term_cell_t){.codepoint = codepoint, .style = term->pen};
+}
+
+/* term_put for a run of printable ASCII, a row at a time */
+static void term_put_ascii(term_t *term, const uint8_t *text, uint64_t len) {
+  while (len > 0) {
+    uint64_t fit;
+    term_cell_t *cells = term_put_span(term, len, &fit);
+    for (uint64_t i = 0; i < fit; i++)
+      cells[i] = (term_cell_t){.codepoint = text[i], .style = term->pen};
+    text += fit;
+    len -= fit;
+  }
+}
+
+/* term_put for a run of decoded codepoints, a row at a time */
+static void term_put_codepoints(term_t *term, const uint32_t *codepoints, uint64_t len) {
+  while (len > 0) {
+    uint64_t fit;
+    term_cell_t *cells = term_put_span(term, len, &fit);
+    for (uint64_t i = 0; i < fit; i++)
+      cells[i] = (term_cell_t){.codepoint = codepoints[i], .style = term->pen};
+    codepoints += fit;
+    len -= fit;
+  }
+}
+
+/* ---- Parser ---- */
+
+/* Parameter i of the current CSI sequence, with 0 or missing meaning `dflt` */
+static uint32_t term_csi_param(term_t *term, uint32_t i, uint32_t dflt) {
+  return i < term->csi_params_len && term->csi_params[i] ? term->csi_params[i] : dflt;
+}
+
+/* The pen changed: intern it, and the style erased cells get from it */
+static void term_set_pen(term_t *term, term_style_t pen) {
+  term->pen_style = pen;
+  term->pen = term_style_intern(&term->styles, pen);
+  term->erase_pen = term_style_intern(&term->styles, (term_style_t){
+    .fg = pen.fg, .bg = pen.bg, .flags = pen.flags & TERM_STYLE_INVERSE});
+}
+
+/* The color of an extended SGR color (38 or 48) starting at parameter *i:
+ * ";5;n" from the 256-color palette or ";2;r;g;b". Moves *i past it;
+ * returns false for a malformed one. */
+static bool term_sgr_color(term_t *term, uint32_t *i, uint32_t *color) {
+  uint32_t *params = term->csi_params, len = term->csi_params_len;
+  if (*i + 1 < len && params[*i + 1] == 5 && *i + 2 < len) {
+    *color = term_color256(params[*i + 2] & 0xff);
+    *i += 2;
+    return true;
+  }
+  if (*i + 1 < len && params[*i + 1] == 2 && *i + 4 < len) {
+    *color = (params[*i + 2] & 0xff) << 16 | (params[*i + 3] & 0xff) << 8 | (params[*i + 4] & 0xff);
+    *i += 4;
+    return true;
+  }
+  *i = len;
+  return false;
+}
+
+/* SGR: bold, underline, inverse, and 8, 16, 256 and 24-bit colors */
+static void term_sgr(term_t *term) {
+  term_style_t pen = term->pen_style;
+  uint32_t len = term->csi_params_len ? term->csi_params_len : 1;
+  for (uint32_t i = 0; i < len; i++) {
+    uint32_t p = term->csi_params[i], color;
+    if (p == 0)
+      pen = term->styles.styles[0];
+    else if (p == 1)
+      pen.flags |= GLYPH_STYLE_BOLD;
+    else if (p == 4)
+      pen.flags |= GLYPH_STYLE_UNDERLINE;
+    else if (p == 7)
+      pen.flags |= TERM_STYLE_INVERSE;
+    else if (p == 22)
+      pen.flags &= ~GLYPH_STYLE_BOLD;
+    else if (p == 24)
+      pen.flags &= ~GLYPH_STYLE_UNDERLINE;
+    else if (p == 27)
+      pen.flags &= ~TERM_STYLE_INVERSE;
+    else if (p >= 30 && p <= 37)
+      pen.fg = term_palette[p - 30];
+    else if (p == 38 && term_sgr_color(term, &i, &color))
+      pen.fg = color;
+    else if (p == 39)
+      pen.fg = TERM_DEFAULT_FG;
+    else if (p >= 40 && p <= 47)
+      pen.bg = term_palette[p - 40];
+    else if (p == 48 && term_sgr_color(term, &i, &color))
+      pen.bg = color;
+    else if (p == 49)
+      pen.bg = TERM_DEFAULT_BG;
+    else if (p >= 90 && p <= 97)
+      pen.fg = term_palette[p - 90 + 8];
+    else if (p >= 100 && p <= 107)
+      pen.bg = term_palette[p - 100 + 8];
+  }
+  if (!term_style_equal(pen, term->pen_style))
+    term_set_pen(term, pen);
+}
+
+static void term_csi_dispatch(term_t *term, uint8_t final) {
+  if (term->collected_len > 0)
+    return; // DEC private modes and sequences with intermediates, ignored
+
+  uint32_t n = term_csi_param(term, 0, 1);
+  uint32_t x = term->cursor_x < term->cols ? term->cursor_x : term->cols - 1;
+  uint32_t row = term_ring_row(term, term->cursor_y);
+
+  switch (final) {
+  case 'A': term->cursor_y = n > term->cursor_y ? 0 : term->cursor_y - n; break;
+  case 'B': term->cursor_y = term->cursor_y + n >= term->rows ? term->rows - 1 : term->cursor_y + n; break;
+  case 'C': term->cursor_x = x + n >= term->cols ? term->cols - 1 : x + n; break;
+  case 'D': term->cursor_x = n > x ? 0 : x - n; break;
+  case 'H':
+  case 'f': {
+    uint32_t y = term_csi_param(term, 0, 1), col = term_csi_param(term, 1, 1);
+    term->cursor_y = (y > term->rows ? term->rows : y) - 1;
+    term->cursor_x = (col > term->cols ? term->cols : col) - 1;
+    break;
+  }
+  case 'J': { // erase in display: 0 below, 1 above, 2 all, 3 scrollback
+    uint32_t mode = term_csi_param(term, 0, 0);
+    if (mode == 3) {
+      term_history_clear(&term->history);
+      term->hot_len = 0;
+      term->view_offset = 0;
+      term_mark_all(term);
+      break;
+    }
+    if (mode > 2)
+      break;
+    uint32_t from = mode == 0 ? term->cursor_y + 1 : 0, to = mode == 1 ? term->cursor_y : term->rows;
+    for (uint32_t y = from; y < to; y++) {
+      term_erase(term, term_ring_row(term, y), 0, term->cols);
+      term_mark_row(term, y);
+    }
+    if (mode != 2)
+      term_erase(term, row, mode == 0 ? x : 0, mode == 0 ? term->cols : x + 1);
+    term_mark_row(term, term->cursor_y);
+    break;
+  }
+  case 'K': { // erase in line: 0 right, 1 left, 2 all
+    uint32_t mode = term_csi_param(term, 0, 0);
+    uint32_t from = mode == 0 ? x : 0, to = mode == 1 ? x + 1 : term->cols;
+    term_erase(term, row, from, to);
+    term_mark_row(term, term->cursor_y);
+    break;
+  }
+  case 'm': term_sgr(term); break;
+  default:
+    break; // everything else: not interpreted yet
+  }
+}
+
+static void term_esc_dispatch(term_t *term, uint8_t final) {
+  if (term->collected_len > 0)
+    return; // charset designations and the like, ignored
+
+  switch (final) {
+  case '7': // DECSC
+    term->saved_x = term->cursor_x;
+    term->saved_y = term->cursor_y;
+    break;
+  case '8': // DECRC
+    term->cursor_x = term->saved_x;
+    term->cursor_y = term->saved_y;
+    break;
+  case 'D': term_linefeed(term); break; // IND
+  case 'E': // NEL
+    term->cursor_x = 0;
+    term_linefeed(term);
+    break;
+  case 'M': term_reverse_linefeed(term); break; // RI
+  case 'c': // RIS; scrollback is kept
+    term_set_pen(term, term->styles.styles[0]);
+    for (uint32_t y = 0; y < term->rows; y++)
+      term_erase(term, term_ring_row(term, y), 0, term->cols);
+    term->view_offset = 0;
+    term_mark_all(term);
+    term->cursor_x = term->cursor_y = 0;
+    term->saved_x = term->saved_y = 0;
+    break;
+  default:
+    break;
+  }
+}
+
+/* C0 controls; ESC, CAN and SUB never get here */
+static void term_execute(term_t *term, uint8_t c) {
+  switch (c) {
+  case '\r': term->cursor_x = 0; break;
+  case '\n':
+  case '\v':
+  case '\f': term_linefeed(term); break;
+  case '\b':
+    if (term->cursor_x > 0)
+      term->cursor_x--;
+    break;
+  case '\t': {
+    uint32_t x = (term->cursor_x / TERM_TAB_WIDTH + 1) * TERM_TAB_WIDTH;
+    term->cursor_x = x < term->cols ? x : term->cols - 1;
+    break;
+  }
+  default: break; // BEL, SO/SI, ...
+  }
+}
+
+/* Forget the parameters and intermediates of the last sequence */
+static void term_clear(term_t *term) {
+  term->csi_params_len = 0;
+  term->collected_len = 0;
+  memset(term->csi_params, 0, sizeof(term->csi_params));
+}
+
+static void term_collect(term_t *term, uint8_t c) {
+  if (term->collected_len < TERM_MAX_COLLECT)
+    term->collected[term->collected_len] = c;
+  if (term->collected_len <= TERM_MAX_COLLECT)
+    term->collected_len++;
+}
+
+static void term_param(term_t *term, uint8_t c) {
+  if (term->csi_params_len == 0)
+    term->csi_params_len = 1;
+  if (c == ';') {
+    if (term->csi_params_len < TERM_CSI_MAX_PARAMS)
+      term->csi_params_len++;
+    return;
+  }
+  uint32_t *param = &term->csi_params[term->csi_params_len - 1];
+  if (*param < 10000)
+    *param = *param * 10 + (c - '0');
+}
+
+/* One byte through the state machine. Bytes above 0x7f only mean something
+ * in the ground state, as UTF-8; inside sequences and strings they are
+ * ignored. */
+static void term_parse_byte(term_t *term, uint8_t c) {
+  if (term->utf8_remaining) {
+    if ((c & 0xc0) == 0x80) {
+      term->utf8_codepoint = term->utf8_codepoint << 6 | (c & 0x3f);
+      if (--term->utf8_remaining == 0)
+        term_put(term, term_utf8_valid(term->utf8_codepoint, term->utf8_length) ? term->utf8_codepoint : 0xfffd);
+      return;
+    }
+    term->utf8_remaining = 0;
+    term_put(term, 0xfffd); // truncated sequence; c starts something new
+  }
+
+  // transitions from any state
+  if (c == 0x18 || c == 0x1a) { // CAN, SUB
+    term->parse_state = TERM_GROUND;
+    return;
+  }
+  if (c == 0x1b) {
+    term_clear(term);
+    term->parse_state = TERM_ESCAPE;
+    return;
+  }
+
+  bool c0 = c < 0x20, intermediate = c >= 0x20 && c < 0x30;
+  bool digit = (c >= '0' && c <= '9') || c == ';', marker = c >= 0x3c && c <= 0x3f;
+  bool final = c >= 0x40 && c < 0x7f;
+
+  switch (term->parse_state) {
+  case TERM_GROUND:
+    if (c0) {
+      term_execute(term, c);
+    } else if (c < 0x7f) {
+      term_put(term, c);
+    } else if (c >= 0xc2 && c <= 0xf4) {
+      term->utf8_length = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : 2;
+      term->utf8_remaining = term->utf8_length - 1;
+      term->utf8_codepoint = c & (0x7fU >> term->utf8_length);
+    } else if (c != 0x7f) {
+      term_put(term, 0xfffd);
+    }
+    break;
+
+  case TERM_ESCAPE:
+    if (c0) {
+      term_execute(term, c);
+    } else if (intermediate) {
+      term_collect(term, c);
+      term->parse_state = TERM_ESCAPE_INTERMEDIATE;
+    } else if (c == '[') {
+      term->parse_state = TERM_CSI_ENTRY;
+    } else if (c == ']') {
+      term->parse_state = TERM_OSC_STRING;
+    } else if (c == 'P') {
+      term->parse_state = TERM_DCS_ENTRY;
+    } else if (c == 'X' || c == '^' || c == '_') {
+      term->parse_state = TERM_SOS_PM_APC_STRING;
+    } else if (c >= 0x30 && c < 0x7f) {
+      term_esc_dispatch(term, c);
+      term->parse_state = TERM_GROUND;
+    }
+    break;
+
+  case TERM_ESCAPE_INTERMEDIATE:
+    if (c0) {
+      term_execute(term, c);
+    } else if (intermediate) {
+      term_collect(term, c);
+    } else if (c >= 0x30 && c < 0x7f) {
+      term_esc_dispatch(term, c);
+      term->parse_state = TERM_GROUND;
+    }
+    break;
+
+  case TERM_CSI_ENTRY:
+  case TERM_CSI_PARAM:
+    if (c0) {
+      term_execute(term, c);
+    } else if (digit) {
+      term_param(term, c);
+      term->parse_state = TERM_CSI_PARAM;
+    } else if (marker && term->parse_state == TERM_CSI_ENTRY) {
+      term_collect(term, c);
+      term->parse_state = TERM_CSI_PARAM;
+    } else if (c == ':' || marker) {
+      term->parse_state = TERM_CSI_IGNORE;
+    } else if (intermediate) {
+      term_collect(term, c);
+      term->parse_state = TERM_CSI_INTERMEDIATE;
+    } else if (final) {
+      term_csi_dispatch(term, c);
+      term->parse_state = TERM_GROUND;
+    }
+    break;
+
+  case TERM_CSI_INTERMEDIATE:
+    if (c0) {
+      term_execute(term, c);
+    } else if (intermediate) {
+      term_collect(term, c);
+    } else if (c >= 0x30 && c < 0x40) {
+      term->parse_state = TERM_CSI_IGNORE;
+    } else if (final) {
+      term_csi_dispatch(term, c);
+      term->parse_state = TERM_GROUND;
+    }
+    break;
+
+  case TERM_CSI_IGNORE:
+    if (c0)
+      term_execute(term, c);
+    else if (final)
+      term->parse_state = TERM_GROUND;
+    break;
+
+  case TERM_DCS_ENTRY:
+  case TERM_DCS_PARAM:
+    if (digit) {
+      term_param(term, c);
+      term->parse_state = TERM_DCS_PARAM;
+    } else if (marker && term->parse_state == TERM_DCS_ENTRY) {
+      term_collect(term, c);
+      term->parse_state = TERM_DCS_PARAM;
+    } else if (c == ':' || marker) {
+      term->parse_state = TERM_DCS_IGNORE;
+    } else if (intermediate) {
+      term_collect(term, c);
+      term->parse_state = TERM_DCS_INTERMEDIATE;
+    } else if (final) {
+      term->parse_state = TERM_DCS_PASSTHROUGH; // no DCS is interpreted
+    }
+    break;
+
+  case TERM_DCS_INTERMEDIATE:
+    if (intermediate)
+      term_collect(term, c);
+    else if (c >= 0x30 && c < 0x40)
+      term->parse_state = TERM_DCS_IGNORE;
+    else if (final)
+      term->parse_state = TERM_DCS_PASSTHROUGH;
+    break;
+
+  case TERM_OSC_STRING:
+    if (c == 0x07) // BEL ends it as well as ST, as in xterm
+      term->parse_state = TERM_GROUND;
+    break;
+
+  case TERM_DCS_PASSTHROUGH:
+  case TERM_DCS_IGNORE:
+  case TERM_SOS_PM_APC_STRING:
+    break; // until ST, i.e. the ESC that starts it
+  }
+}
+
+/* Run PTY output through the parser. Input may stop anywhere, including in
+ * the middle of a UTF-8 or escape sequence; the rest is picked up by the
+ * next call. */
+static void term_feed(term_t *term, const uint8_t *data, uint64_t len) {
+  term->bytes_parsed += len;
+  term->dirty = true; // the cursor moves even when no cell changes
+
+  uint32_t codepoints[TERM_DECODE_CHUNK];
+  for (uint64_t i = 0; i < len;) {
+    if (term->parse_state == TERM_GROUND && term->utf8_remaining == 0) {
+      uint64_t run, decoded;
+      if (data[i] < 0x80) {
+        uint64_t probe = len - i < TERM_SCAN_MIN_RUN ? len - i : TERM_SCAN_MIN_RUN;
+        run = term_scan_ascii_scalar(data + i, probe);
+        if (run == TERM_SCAN_MIN_RUN)
+          run += term_scan_kernels->ascii(data + i + run, len - i - run);
+        term_put_ascii(term, data + i, run);
+      } else {
+        run = term_scan_utf8_scalar(data + i, len - i, codepoints, TERM_SCAN_MIN_RUN, &decoded);
+        if (decoded == TERM_SCAN_MIN_RUN) {
+          uint64_t more;
+          run += term_scan_kernels->utf8(data + i + run, len - i - run, codepoints + decoded,
+                                         TERM_DECODE_CHUNK - decoded, &more);
+          decoded += more;
+        }
+        term_put_codepoints(term, codepoints, decoded);
+      }
+      i += run;
+      if (run > 0)
+        continue;
+    }
+    term_parse_byte(term, data[i++]);
+  }
+}
+
+/* Flip the cursor blink phase */
+static void term_blink(term_t *term) {
+  term->cursor_visible = !term->cursor_visible;
+  term->dirty = true;
+}
+
+/* Move the mouse pointer's cell, or hide it when the pointer leaves.
+ * Returns true if that changes what is drawn. */
+static bool term_set_pointer(term_t *term, bool visible, uint32_t x, uint32_t y) {
+  x = x < term->cols ? x : term->cols - 1;
+  y = y < term->rows ? y : term->rows - 1;
+  if (visible == term->pointer_visible && (!visible || (x == term->pointer_x && y == term->pointer_y)))
+    return false;
+  term->pointer_visible = visible;
+  term->pointer_x = x;
+  term->pointer_y = y;
+  term->dirty = true;
+  return true;
+}
+
+/* Scroll the view `delta` rows back into the scrollback (negative: towards
+ * the screen). Returns true if it moved. */
+static bool term_scroll_view(term_t *term, int64_t delta) {
+  int64_t offset = (int64_t)term->view_offset + delta;
+  offset = offset < 0 ? 0 : offset;
+  offset = offset > term_scrollback_len(term) ? term_scrollback_len(term) : offset;
+  if ((uint32_t)offset == term->view_offset)
+    return false;
+  term->view_offset = (uint32_t)offset;
+  term_mark_all(term);
+  return true;
+}
+
+/* The cells of row y of the view; sets *len to how many there are, the rest
+ * of the row is blank */
+static const term_cell_t *term_view_row(term_t *term, uint32_t y, uint32_t *len) {
+  if (y >= term->view_offset) {
+    uint32_t row = term_ring_row(term, y - term->view_offset);
+    *len = term->ring_len[row];
+    return term_row_cells(term, row);
+  }
+  uint32_t back = term->view_offset - y; // 1 = the newest scrollback row
+  if (back <= term->hot_len) {
+    uint32_t row = term->top >= back ? term->top - back : term->top + term->ring_rows - back;
+    *len = term->ring_len[row];
+    return term_row_cells(term, row);
+  }
+  term_history_get(&term->history, term->history.len - (back - term->hot_len), term->view_buf, term->cols);
+  *len = term->cols;
+  return term->view_buf;
+}
+
+/* Resolve row y of the view to colors in `out` (cols cells), with the
+ * cursor and the mouse pointer drawn as inverted cells. A pointer over the
+ * cursor leaves it as it is rather than inverting it twice. */
+static void term_expand_row(term_t *term, uint32_t y, uint32_t cursor_x, uint32_t cursor_y, text_cell_t *out) {
+  uint32_t len;
+  const term_cell_t *cells = term_view_row(term, y, &len);
+  const term_style_t *styles = term->styles.styles;
+  for (uint32_t x = 0; x < len; x++) {
+    const term_style_t *style = &styles[cells[x].style];
+    bool inverse = style->flags & TERM_STYLE_INVERSE;
+    out[x] = (text_cell_t){.codepoint = cells[x].codepoint, .fg = inverse ? style->bg : style->fg,
+                           .bg = inverse ? style->fg : style->bg,
+                           .style = (uint8_t)(style->flags & (GLYPH_STYLE_COUNT - 1))};
+  }
+  for (uint32_t x = len; x < term->cols; x++)
+    out[x] = (text_cell_t){.codepoint = ' ', .fg = TERM_DEFAULT_FG, .bg = TERM_DEFAULT_BG};
+
+  bool cursor = term->cursor_visible && y == cursor_y;
+  if (cursor) {
+    uint32_t fg = out[cursor_x].fg;
+    out[cursor_x].fg = out[cursor_x].bg;
+    out[cursor_x].bg = fg;
+  }
+  if (term->pointer_visible && y == term->pointer_y && !(cursor && term->pointer_x == cursor_x)) {
+    uint32_t fg = out[term->pointer_x].fg;
+    out[term->pointer_x].fg = out[term->pointer_x].bg;
+    out[term->pointer_x].bg = fg;
+  }
+}
+
+/* Before a repaint: the rows the view's contents moved up since the last
+ * one, if the caller is to shift the pixels drawn then by as many rows
+ * (`can_shift`) and that is less than a screen. Otherwise returns 0 and
+ * every row is repainted. */
+static uint32_t term_take_scroll(term_t *term, bool can_shift) {
+  uint32_t n = term->scrolled;
+  term->scrolled = 0;
+  if (n == 0)
+    return 0;
+  if (!can_shift || n >= term->rows) {
+    term_mark_all(term);
+    return 0;
+  }
+  // the inverted cursor and pointer cells moved up with everything else
+  term->cursor_drawn_y -= n;
+  term->cursor_drawn &= term->cursor_drawn_y < term->rows - n;
+  term->pointer_drawn_y -= n;
+  term->pointer_drawn &= term->pointer_drawn_y < term->rows - n;
+  return n;
+}
+
+/* Start a repaint: mark the rows the cursor and the pointer leave and enter
+ * as dirty. Returns the cell of the view the cursor is drawn on; cursor_y
+ * is past the last row when the view is scrolled away from it. */
+static void term_draw_begin(term_t *term, uint32_t *cursor_x, uint32_t *cursor_y) {
+  term_take_scroll(term, false); // nobody shifted the pixels
+  *cursor_x = term->cursor_x < term->cols ? term->cursor_x : term->cols - 1;
+  *cursor_y = term->cursor_y + term->view_offset;
+  bool shown = term->cursor_visible && *cursor_y < term->rows;
+  bool cursor_moved = term->cursor_drawn != shown ||
+                      term->cursor_drawn_x != *cursor_x || term->cursor_drawn_y != *cursor_y;
+  if (cursor_moved && term->cursor_drawn)
+    term_mark_view_row(term, term->cursor_drawn_y);
+  if (cursor_moved && shown)
+    term_mark_view_row(term, *cursor_y);
+
+  bool pointer_moved = term->pointer_drawn != term->pointer_visible ||
+                       term->pointer_drawn_x != term->pointer_x || term->pointer_drawn_y != term->pointer_y;
+  if (pointer_moved && term->pointer_drawn)
+    term_mark_view_row(term, term->pointer_drawn_y);
+  if (pointer_moved && term->pointer_visible)
+    term_mark_view_row(term, term->pointer_y);
+}
+
+static void term_draw_end(term_t *term, uint32_t cursor_x, uint32_t cursor_y) {
+  term->cursor_drawn = term->cursor_visible && cursor_y < term->rows;
+  term->cursor_drawn_x = cursor_x;
+  term->cursor_drawn_y = cursor_y;
+  term->pointer_drawn = term->pointer_visible;
+  term->pointer_drawn_x = term->pointer_x;
+  term->pointer_drawn_y = term->pointer_y;
+  memset(term->dirty_rows, 0, sizeof(*term->dirty_rows) * ((term->rows + 63) / 64));
+  term->dirty = false;
+}
+
+/* Repaint the dirty rows (all rows if `full`) into a width x height buffer,
+ * with the cursor and the mouse pointer drawn as inverted cells. */
+static void term_draw(term_t *term, glyph_atlas_t *atlas, uint32_t *pixels,
+                      uint32_t width, uint32_t height, bool full, damage_t *damage) {
+  uint32_t cursor_x, cursor_y;
+  term_draw_begin(term, &cursor_x, &cursor_y);
+
+  for (uint32_t y = 0; y < term->rows; y++) {
+    if (!full && !term_row_dirty(term, y))
+      continue;
+    term_expand_row(term, y, cursor_x, cursor_y, term->draw_buf);
+    text_draw_row(atlas, pixels, width, height, width, 0, (uint64_t)y * atlas->cell_h,
+                  term->draw_buf, term->cols, damage);
+  }
+
+  term_draw_end(term, cursor_x, cursor_y);
+}
+
+/* Tell the PTY (and so the foreground program) the grid size. */
+static int pty_set_size(int pty_fd, term_t *term, glyph_atlas_t *atlas) {
+  struct winsize ws = {
+    .ws_row = (unsigned short)term->rows,
+    .ws_col = (unsigned short)term->cols,
+    .ws_xpixel = (unsigned short)(term->cols * atlas->cell_w),
+    .ws_ypixel = (unsigned short)(term->rows * atlas->cell_h),
+  };
+  return ioctl(pty_fd, TIOCSWINSZ, &ws);
+}
+
+/* Grid cells along a side of `pixels`: as many as fit, but at least one */
+static uint32_t term_cells_fit(uint32_t pixels, uint32_t cell) {
+  return pixels / cell > 0 ? pixels / cell : 1;
+}
+
+/* The window took a new size: reshape the grid to the cells that fit, and
+ * tell the shell if that changed its size. On failure the grid keeps its
+ * size and is drawn clipped or padded. */
+static void term_fit_window(state_t *state) {
+  term_t *term = state->term;
+  uint32_t cols = term_cells_fit(state->width, state->atlas->cell_w);
+  uint32_t rows = term_cells_fit(state->height, state->atlas->cell_h);
+  if (cols == term->cols && rows == term->rows)
+    return;
+  if (term_resize(term, cols, rows) == -1) {
+    LOG("term_resize %ux%u: %s\n", cols, rows, strerror(errno));
+    return;
+  }
+  if (state->input.pty_fd != -1 && pty_set_size(state->input.pty_fd, term, state->atlas) == -1)
+    LOG("pty_set_size: %s\n", strerror(errno));
+}
+
+/* Start $SHELL (or /bin/sh) on a new PTY sized for the terminal.
+ * - child_mask: signal mask for the child; the caller's blocked set (which
+ *   routes SIGCHLD to a signalfd) must not leak into the shell
+ * - Returns the non-blocking master fd, or -1 with errno set.
+ */
+static int pty_spawn(term_t *term, glyph_atlas_t *atlas, const sigset_t *child_mask, pid_t *child) {
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master == -1)
+    return -1;
+  char *slave_path = NULL;
+  if (grantpt(master) == -1 || unlockpt(master) == -1 || !(slave_path = ptsname(master)) ||
+      pty_set_size(master, term, atlas) == -1) {
+    int err = errno;
+    close(master);
+    errno = err;
+    return -1;
+  }
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    int err = errno;
+    close(master);
+    errno = err;
+    return -1;
+  }
+
+  if (pid == 0) {
+    // the slave opened after setsid() becomes the controlling terminal
+    sigprocmask(SIG_SETMASK, child_mask, NULL);
+    if (setsid() == -1)
+      _exit(127);
+    int slave = open(slave_path, O_RDWR);
+    if (slave == -1)
+      _exit(127);
+    close(master);
+    dup2(slave, STDIN_FILENO);
+    dup2(slave, STDOUT_FILENO);
+    dup2(slave, STDERR_FILENO);
+    if (slave > STDERR_FILENO)
+      close(slave);
+
+    char *shell = getenv("SHELL");
+    if (!shell || !*shell)
+      shell = "/bin/sh";
+    setenv("TERM", "dumb", 1); // only the sequences term_feed understands
+    execl(shell, shell, (char *)NULL);
+    _exit(127);
+  }
+
+  int flags = fcntl(master, F_GETFL);
+  if (flags == -1 || fcntl(master, F_SETFL, flags | O_NONBLOCK) == -1 ||
+      fcntl(master, F_SETFD, FD_CLOEXEC) == -1) {
+    int err = errno;
+    close(master);
+    errno = err;
+    return -1;
+  }
+
+  *child = pid;
+  return master;
+}
+
+/* ------------------- Parallel rendering ---------------------------------- */
+
+/* The optional parallel backend for render_frame (KASAMA_RENDER_THREADS > 1).
+ * A frame is drawn in phases, each a render_pool batch over pieces of the
+ * framebuffer that don't overlap:
+ *  1. clear: bands of rows of about RENDER_BAND_BYTES, roughly an L2
+ *  2. text: one job per dirty terminal row
+ *  3. entities: one job per row of ENTITY_TILE_SIZE tiles
+ * Anything that mutates shared state (glyph lookups that may rasterize into
+ * the atlas, entity binning, damage) happens on the calling thread between
+ * batches; the jobs only write pixels and their own slots of the scratch
+ * arrays below. Phases are joined in order, so later ones draw over earlier
+ * ones exactly as the serial path does. */
+
+#define RENDER_BAND_BYTES (256U << 10)
+
+struct render_tiles_t {
+  render_pool_t pool;
+
+  // the frame being drawn
+  uint32_t *pixels;
+  uint32_t width, height;
+  uint32_t background;
+  uint32_t band_rows;          // rows per clear job
+
+  // text: dirty rows resolved to slots and colors on the calling thread
+  glyph_atlas_t *atlas;
+  uint32_t cols;               // cells drawn per row
+  uint32_t *text_rows;         // terminal rows to draw
+  bool *text_binary;           // per text_rows entry, see text_resolve_cells
+  uint32_t *slots, *fg, *bg;   // text_rows_len * cols
+  uint32_t text_rows_len;
+  uint64_t text_cap;           // cells the arrays above hold
+
+  // entities
+  entity_store_t *entities;
+  bool cleared;
+  rect_t *entity_spans;        // repainted span per tile row
+  uint32_t entity_spans_cap;
+};
+
+static void render_tiles_free(render_tiles_t *tiles) {
+  render_pool_free(&tiles->pool);
+  free(tiles->text_rows);
+  free(tiles->text_binary);
+  free(tiles->slots);
+  free(tiles->fg);
+  free(tiles->bg);
+  free(tiles->entity_spans);
+}
+
+/* Returns 0, or -1 with errno set */
+static int render_tiles_init(render_tiles_t *tiles, uint32_t threads) {
+  memset(tiles, 0, sizeof(*tiles));
+  return render_pool_init(&tiles->pool, threads);
+}
+
+static void render_tiles_clear_job(void *ctx, uint32_t band) {
+  render_tiles_t *tiles = ctx;
+  uint32_t y0 = band * tiles->band_rows;
+  uint32_t rows = tiles->height - y0 < tiles->band_rows ? tiles->height - y0 : tiles->band_rows;
+  uint32_t *dst = tiles->pixels + (uint64_t)y0 * tiles->width;
+  uint64_t frame_bytes = (uint64_t)tiles->width * tiles->height * sizeof(*dst);
+  if (frame_bytes >= PIXEL_STREAM_THRESHOLD)
+    pixel_kernels->fill_stream(dst, (uint64_t)rows * tiles->width, tiles->background);
+  else
+    pixel_kernels->fill(dst, (uint64_t)rows * tiles->width, tiles->background);
+}
+
+static void render_tiles_text_job(void *ctx, uint32_t i) {
+  render_tiles_t *tiles = ctx;
+  uint64_t cell = (uint64_t)i * tiles->cols;
+  uint64_t y = (uint64_t)tiles->text_rows[i] * tiles->atlas->cell_h;
+  text_draw_cells(tiles->atlas, tiles->pixels + y * tiles->width, tiles->width, tiles->slots + cell,
+                  tiles->fg + cell, tiles->bg + cell, tiles->cols, tiles->text_binary[i]);
+}
+
+static void render_tiles_entity_job(void *ctx, uint32_t ty) {
+  render_tiles_t *tiles = ctx;
+  tiles->entity_spans[ty] = entity_store_draw_row(tiles->entities, tiles->pixels, tiles->background,
+                                                  tiles->cleared, ty);
+}
+
+/* Resolve the terminal's dirty rows (all if `full`) on this thread, into
+ * tiles->text_rows and the slot/color arrays. Returns false if the atlas had
+ * to flush while doing so, which invalidates slots resolved before it. */
+static bool render_tiles_resolve_text(render_tiles_t *tiles, term_t *term, bool full,
+                                      uint32_t cursor_x, uint32_t cursor_y) {
+  glyph_atlas_t *atlas = tiles->atlas;
+  uint64_t flushes = atlas->stats.flushes;
+  tiles->text_rows_len = 0;
+  for (uint32_t y = 0; y < term->rows; y++) {
+    if (!full && !term_row_dirty(term, y))
+      continue;
+    uint32_t i = tiles->text_rows_len++;
+    uint64_t cell = (uint64_t)i * tiles->cols;
+    const text_cell_t *row = term->draw_buf;
+
+    term_expand_row(term, y, cursor_x, cursor_y, term->draw_buf);
+    tiles->text_rows[i] = y;
+    tiles->text_binary[i] = true;
+    for (uint64_t start = 0; start < tiles->cols; start += TEXT_ROW_CHUNK) {
+      uint64_t n = tiles->cols - start < TEXT_ROW_CHUNK ? tiles->cols - start : TEXT_ROW_CHUNK;
+      tiles->text_binary[i] &= text_resolve_cells(atlas, row + start, n, tiles->slots + cell + start,
+                                                  tiles->fg + cell + start, tiles->bg + cell + start);
+    }
+  }
+  return atlas->stats.flushes == flushes;
+}
+
+/* render_tiles_t counterpart of term_draw */
+static int render_tiles_draw_text(render_tiles_t *tiles, term_t *term, glyph_atlas_t *atlas,
+                                  bool full, damage_t *damage) {
+  tiles->atlas = atlas;
+  tiles->cols = (uint32_t)text_row_fit(atlas, tiles->width, tiles->height, 0, 0, term->cols);
+  uint32_t rows = tiles->height / atlas->cell_h < term->rows ? tiles->height / atlas->cell_h : term->rows;
+  uint64_t cells = (uint64_t)term->rows * (tiles->cols ? tiles->cols : 1);
+  if (cells > tiles->text_cap || !tiles->text_rows) {
+    uint32_t *text_rows = realloc(tiles->text_rows, sizeof(*text_rows) * term->rows);
+    bool *text_binary = realloc(tiles->text_binary, sizeof(*text_binary) * term->rows);
+    uint32_t *slots = realloc(tiles->slots, sizeof(*slots) * cells);
+    uint32_t *fg = realloc(tiles->fg, sizeof(*fg) * cells);
+    uint32_t *bg = realloc(tiles->bg, sizeof(*bg) * cells);
+    if (text_rows)
+      tiles->text_rows = text_rows;
+    if (text_binary)
+      tiles->text_binary = text_binary;
+    if (slots)
+      tiles->slots = slots;
+    if (fg)
+      tiles->fg = fg;
+    if (bg)
+      tiles->bg = bg;
+    if (!text_rows || !text_binary || !slots || !fg || !bg)
+      return -1;
+    tiles->text_cap = cells;
+  }
+
+  uint32_t cursor_x, cursor_y;
+  term_draw_begin(term, &cursor_x, &cursor_y);
+  if (tiles->cols > 0) {
+    // a screen with more distinct glyphs than the atlas holds flushes it on
+    // every pass; draw that one row by row on this thread instead
+    if (!render_tiles_resolve_text(tiles, term, full, cursor_x, cursor_y) &&
+        !render_tiles_resolve_text(tiles, term, full, cursor_x, cursor_y)) {
+      term_draw(term, atlas, tiles->pixels, tiles->width, tiles->height, full, damage);
+      return 0;
+    }
+    // rows past the bottom edge are resolved but not drawn, like text_draw_row
+    while (tiles->text_rows_len && tiles->text_rows[tiles->text_rows_len - 1] >= rows)
+      tiles->text_rows_len--;
+    render_pool_run(&tiles->pool, tiles->text_rows_len, render_tiles_text_job, tiles);
+    for (uint32_t i = 0; i < tiles->text_rows_len; i++)
+      damage_add(damage, (rect_t){.y = tiles->text_rows[i] * atlas->cell_h,
+                                  .w = tiles->cols * atlas->cell_w, .h = atlas->cell_h});
+  }
+  term_draw_end(term, cursor_x, cursor_y);
+  return 0;
+}
+
+/* render_tiles_t counterpart of entity_store_draw, after entity_store_bin */
+static int render_tiles_draw_entities(render_tiles_t *tiles, entity_store_t *entities, bool cleared,
+                                      damage_t *damage) {
+  if (entities->tiles_y > tiles->entity_spans_cap) {
+    rect_t *spans = realloc(tiles->entity_spans, sizeof(*spans) * entities->tiles_y);
+    if (!spans)
+      return -1;
+    tiles->entity_spans = spans;
+    tiles->entity_spans_cap = entities->tiles_y;
+  }
+  tiles->entities = entities;
+  tiles->cleared = cleared;
+  render_pool_run(&tiles->pool, entities->tiles_y, render_tiles_entity_job, tiles);
+  for (uint32_t ty = 0; ty < entities->tiles_y; ty++) {
+    if (tiles->entity_spans[ty].w)
+      damage_add(damage, tiles->entity_spans[ty]);
+  }
+  entities->moved = false;
+  return 0;
+}
+
+/* Draw a frame as render_frame does, with the pool. Returns 0, or -1 with
+ * errno set if scratch space could not be had; what was drawn so far is in
+ * damage either way. */
+static int render_tiles_draw(render_tiles_t *tiles, state_t *state, uint32_t *pixels,
+                             uint32_t background, bool redraw_all, damage_t *damage) {
+  tiles->pixels = pixels;
+  tiles->width = state->width;
+  tiles->height = state->height;
+  tiles->background = background;
+
+  if (redraw_all) {
+    uint64_t row_bytes = (uint64_t)state->width * sizeof(*pixels);
+    tiles->band_rows = RENDER_BAND_BYTES / row_bytes ? (uint32_t)(RENDER_BAND_BYTES / row_bytes) : 1;
+    render_pool_run(&tiles->pool, (state->height + tiles->band_rows - 1) / tiles->band_rows,
+                    render_tiles_clear_job, tiles);
+    damage_add(damage, (rect_t){.w = state->width, .h = state->height});
+  }
+
+  if (state->term &&
+      render_tiles_draw_text(tiles, state->term, state->atlas, redraw_all, damage) == -1)
+    return -1;
+
+  entity_store_t *entities = state->entities;
+  if (entities && (entities->moved || redraw_all) &&
+      entity_store_bin(entities, state->width, state->height) == 0)
+    return render_tiles_draw_entities(tiles, entities, redraw_all, damage);
+  return 0;
+}
+
+/* ------------------- Frame composition ----------------------------------- */
+
+/* Off: a scroll redraws every row, as before render_scroll (benchmarks) */
+static bool render_scroll_enabled = true;
+
+/* A frame where the terminal scrolled `rows` text rows: its band of the
+ * front buffer lands in `pixels` shifted up by that many rows, so only the
+ * rows that came in (and any other dirty ones) are drawn. What was presented
+ * below the band is caught up on as usual. Core Wayland has no way to say
+ * "these pixels moved", so the whole band is damage for the compositor. */
+static void render_scroll(state_t *state, uint32_t *pixels, int slot, uint32_t rows, uint32_t background) {
+  swapchain_t *chain = &state->swapchain;
+  swapchain_buffer_t *buffer = &chain->buffers[slot];
+  uint32_t cell_h = state->atlas->cell_h;
+  uint32_t band_h = state->term->rows * cell_h < state->height ? state->term->rows * cell_h : state->height;
+  uint32_t shift = rows * cell_h < band_h ? rows * cell_h : band_h;
+
+  uint32_t *front = swapchain_pixels(state, chain->front);
+  renderer_scroll(pixels, front, state->width, band_h, shift, background);
+  for (uint32_t i = 0; chain->front != slot && i < buffer->missed.len; i++) {
+    rect_t r = buffer->missed.rects[i];
+    if (r.y + r.h <= band_h)
+      continue;
+    uint32_t top = r.y > band_h ? r.y : band_h;
+    r.h = r.y + r.h - top;
+    r.y = top;
+    renderer_copy_rect(pixels, front, state->width, r);
+  }
+  damage_add(&buffer->damage, (rect_t){.w = state->width, .h = band_h});
+  state->frame.scrolls++;
+  state->frame.scrolled_rows += rows;
+}
+
+/* Compose a full frame by drawing the entities and other UI elements.
+ * - Returns true if a frame was presented, false if nothing had changed or
+ *   no buffer could be had.
+ */
+static bool render_frame(wayland_conn_t *conn, state_t *state) {
+  /* The frame is drawn into a buffer the compositor has released, then
+   * attached to the surface and committed. This drives on-screen pixels.
+   */
+  const uint32_t background = state->term ? TERM_DEFAULT_BG : 0xffffff;
+
+  swapchain_t *chain = &state->swapchain;
+  if ((chain->width != state->width || chain->height != state->height) &&
+      swapchain_resize(conn, state) == -1)
+    return false;
+  int slot = swapchain_acquire(conn, state);
+  if (slot == -1)
+    return false;
+  swapchain_buffer_t *buffer = &chain->buffers[slot];
+  uint32_t *pixels = swapchain_pixels(state, slot);
+
+  // a terminal that only scrolled moves the last frame's pixels instead of
+  // redrawing them; anything drawn over the text (entities) rules that out
+  uint32_t scroll = 0;
+  if (state->term)
+    scroll = term_take_scroll(state->term, render_scroll_enabled && chain->front != -1 &&
+                                               !state->redraw_all && !state->entities);
+
+  // catch up on what was presented while this buffer was out
+  if (chain->front == -1) {
+    state->redraw_all = true;
+  } else if (scroll) {
+    render_scroll(state, pixels, slot, scroll, background);
+  } else if (chain->front != slot) {
+    uint32_t *front = swapchain_pixels(state, chain->front);
+    for (uint32_t i = 0; i < buffer->missed.len; i++)
+      renderer_copy_rect(pixels, front, state->width, buffer->missed.rects[i]);
+  }
+  damage_reset(&buffer->missed);
+
+  bool redraw_all = state->redraw_all;
+  state->redraw_all = false;
+  if (state->tiles) {
+    // joined before the commit below; on failure, draw what's left next time
+    if (render_tiles_draw(state->tiles, state, pixels, background, redraw_all, &buffer->damage) == -1) {
+      LOG("render_tiles_draw: %s\n", strerror(errno));
+      state->redraw_all = true;
+    }
+  } else {
+    if (redraw_all)
+      renderer_clear(pixels, state->width, state->height, background, &buffer->damage);
+
+    if (state->term)
+      term_draw(state->term, state->atlas, pixels, state->width, state->height, redraw_all, &buffer->damage);
+
+    entity_store_t *entities = state->entities;
+    if (entities && (entities->moved || redraw_all) &&
+        entity_store_bin(entities, state->width, state->height) == 0)
+      entity_store_draw(entities, pixels, background, redraw_all, &buffer->damage);
+  }
+
+  if (buffer->damage.len == 0)
+    return false; // nothing changed; the buffer stays free for the next frame
+
+  // paced by the compositor: the next frame waits for this callback
+  state->frame.callback = wayland_wl_surface_frame(conn, state->wl_surface);
+  swapchain_present(conn, state, slot);
+  return true;
+}
+
+/* ------------------- Frame scheduling ------------------------------------ */
+
+/* Event sources call frame_mark_dirty for every change that needs painting
+ * and frame_maybe_render once per loop turn. A wl_surface.frame callback is
+ * only requested with a frame that actually presents something, so an idle
+ * client has no callback outstanding and nothing wakes it up. Under load the
+ * compositor's callbacks gate rendering to one frame per refresh.
+ */
+
+static void frame_mark_dirty(state_t *state) {
+  frame_scheduler_t *frame = &state->frame;
+  frame->updates++;
+  if (frame->dirty)
+    return; // coalesced into the pending frame
+
+  uint64_t now = monotonic_ns();
+  frame->dirty = true;
+  frame->dirty_since_ns = now;
+  if (frame->idle_since_ns) {
+    frame->idle_ns_total += now - frame->idle_since_ns;
+    frame->idle_since_ns = 0;
+  }
+}
+
+static void frame_enter_idle(frame_scheduler_t *frame) {
+  if (!frame->dirty && !frame->callback && !frame->idle_since_ns)
+    frame->idle_since_ns = monotonic_ns();
+}
+
+/* wl_callback.done for the outstanding frame callback.
+ * - time_ms: the compositor's timestamp for the frame, used to spot
+ *   refreshes that went by without a callback */
+static void frame_callback_done(state_t *state, uint32_t time_ms) {
+  frame_scheduler_t *frame = &state->frame;
+  if (frame->last_done_ms) {
+    uint32_t interval = time_ms - frame->last_done_ms;
+    if (interval && (!frame->refresh_ms || interval < frame->refresh_ms))
+      frame->refresh_ms = interval;
+    // a callback 2.5 refreshes after the last means two were missed
+    if (frame->refresh_ms && interval > frame->refresh_ms + frame->refresh_ms / 2)
+      frame->skipped += (interval + frame->refresh_ms / 2) / frame->refresh_ms - 1;
+  }
+  frame->last_done_ms = time_ms;
+  frame->callback = 0;
+  frame->deferred_counted = false;
+  if (!state->startup.first_frame_ns)
+    state->startup.first_frame_ns = monotonic_ns() - state->startup.start_ns;
+
+  // the frame that showed an input change is on screen now
+  input_t *input = &state->input;
+  if (input->unpresented) {
+    input->latency_ms[input->latency_len++ % INPUT_LATENCY_CAP] = time_ms - input->unpresented_ms;
+    input->unpresented = false;
+  }
+  frame_enter_idle(frame);
+}
+
+/* Render if something is dirty and the compositor is ready for a frame. */
+static void frame_maybe_render(wayland_conn_t *conn, state_t *state) {
+  frame_scheduler_t *frame = &state->frame;
+  if (!frame->dirty)
+    return;
+  if (frame->callback) {
+    if (!frame->deferred_counted) {
+      frame->deferred++;
+      frame->deferred_counted = true;
+    }
+    return;
+  }
+
+  uint64_t dirty_since = frame->dirty_since_ns;
+  frame->dirty = false;
+  uint64_t render_start = monotonic_ns();
+  if (render_frame(conn, state)) {
+    uint64_t now = monotonic_ns();
+    uint64_t latency = now - dirty_since;
+    frame->render_us[frame->render_len++ % FRAME_TIMES_CAP] = (uint32_t)((now - render_start) / 1000);
+    input_t *input = &state->input;
+    if (input->unrendered) {
+      input->unpresented = true;
+      input->unpresented_ms = input->unrendered_ms;
+      input->unrendered = false;
+    }
+    frame->renders++;
+    frame->latency_ns_total += latency;
+    if (latency > frame->latency_ns_max)
+      frame->latency_ns_max = latency;
+    wayland_conn_stats_frame(conn);
+  }
+  frame_enter_idle(frame);
+}
+
+static void frame_stats_log(state_t *state) {
+  frame_scheduler_t *frame = &state->frame;
+  LOG("frames: renders=%" PRIu64 " updates=%" PRIu64 " deferred=%" PRIu64 " skipped=%" PRIu64
+      " latency avg=%.2fms max=%.2fms idle=%.1fs refresh=%ums scrolls=%" PRIu64 " scrolled_rows=%" PRIu64 "\n",
+      frame->renders, frame->updates, frame->deferred, frame->skipped,
+      frame->renders ? (double)frame->latency_ns_total / (double)frame->renders / 1e6 : 0.0,
+      (double)frame->latency_ns_max / 1e6, (double)frame->idle_ns_total / 1e9, frame->refresh_ms,
+      frame->scrolls, frame->scrolled_rows);
+
+  static const uint32_t p[] = {50, 99, 100};
+  uint32_t us[3];
+  if (sample_ring_percentiles(frame->render_us, frame->render_len, FRAME_TIMES_CAP, p, us, 3))
+    LOG("frame time: samples=%" PRIu64 " p50=%uus p99=%uus max=%uus\n", frame->render_len, us[0], us[1], us[2]);
+}
+
+/* ------------------- Input ----------------------------------------------- */
+
+/* Pointer and keyboard events are not applied as they arrive. The handlers
+ * below decode each one into an input_event_t and collect a wl_pointer's
+ * events until its wl_pointer.frame, which closes one logical event; on a
+ * seat older than version 5 there are no frames and every event stands
+ * alone. Complete frames and key events go to a queue in arrival order, and
+ * a motion followed directly by another motion is folded into it, so a
+ * 1000 Hz mouse costs one pointer update per loop turn however many
+ * motions it sent. Buttons, keys and modifier changes are never merged or
+ * reordered. input_drain applies the queue once per loop turn, after the
+ * socket has been read.
+ *
+ * There is no xkb: keys are mapped with a US layout and the default
+ * modifier masks, enough to type into a shell.
+ */
+
+#define INPUT_BTN_LEFT 0x110U      /* evdev codes of pointer buttons start here */
+#define INPUT_MOD_SHIFT 0x1U       /* default xkb modifier masks */
+#define INPUT_MOD_CAPS 0x2U
+#define INPUT_MOD_CTRL 0x4U
+#define INPUT_MOD_ALT 0x8U
+
+/* evdev key code -> US layout character, unshifted and shifted */
+static const char input_keymap[58][2] = {
+  [1] = {0x1b, 0x1b},
+  [2] = {'1', '!'}, [3] = {'2', '@'}, [4] = {'3', '#'}, [5] = {'4', '$'}, [6] = {'5', '%'},
+  [7] = {'6', '^'}, [8] = {'7', '&'}, [9] = {'8', '*'}, [10] = {'9', '('}, [11] = {'0', ')'},
+  [12] = {'-', '_'}, [13] = {'=', '+'}, [14] = {0x7f, 0x7f}, [15] = {'\t', '\t'},
+  [16] = {'q', 'Q'}, [17] = {'w', 'W'}, [18] = {'e', 'E'}, [19] = {'r', 'R'}, [20] = {'t', 'T'},
+  [21] = {'y', 'Y'}, [22] = {'u', 'U'}, [23] = {'i', 'I'}, [24] = {'o', 'O'}, [25] = {'p', 'P'},
+  [26] = {'[', '{'}, [27] = {']', '}'}, [28] = {'\r', '\r'},
+  [30] = {'a', 'A'}, [31] = {'s', 'S'}, [32] = {'d', 'D'}, [33] = {'f', 'F'}, [34] = {'g', 'G'},
+  [35] = {'h', 'H'}, [36] = {'j', 'J'}, [37] = {'k', 'K'}, [38] = {'l', 'L'},
+  [39] = {';', ':'}, [40] = {'\'', '"'}, [41] = {'`', '~'}, [43] = {'\\', '|'},
+  [44] = {'z', 'Z'}, [45] = {'x', 'X'}, [46] = {'c', 'C'}, [47] = {'v', 'V'}, [48] = {'b', 'B'},
+  [49] = {'n', 'N'}, [50] = {'m', 'M'}, [51] = {',', '<'}, [52] = {'.', '>'}, [53] = {'/', '?'},
+  [55] = {'*', '*'}, [57] = {' ', ' '},
+};
+
+/* The bytes a key press sends to the PTY.
+ * - Returns how many were written to out (up to 4), 0 for keys without a
+ *   mapping (modifiers, function keys, ...).
+ */
+static uint32_t input_key_bytes(uint32_t key, uint32_t modifiers, char out[4]) {
+  switch (key) { // cursor keys, in normal (not application) mode
+  case 103: memcpy(out, "\x1b[A", 3); return 3;
+  case 108: memcpy(out, "\x1b[B", 3); return 3;
+  case 106: memcpy(out, "\x1b[C", 3); return 3;
+  case 105: memcpy(out, "\x1b[D", 3); return 3;
+  default: break;
+  }
+  if (key >= sizeof(input_keymap) / sizeof(input_keymap[0]) || !input_keymap[key][0])
+    return 0;
+
+  char c = input_keymap[key][(modifiers & INPUT_MOD_SHIFT) != 0];
+  if ((modifiers & INPUT_MOD_CAPS) && c >= 'a' && c <= 'z')
+    c = (char)(c - 'a' + 'A');
+  else if ((modifiers & INPUT_MOD_CAPS) && c >= 'A' && c <= 'Z' && (modifiers & INPUT_MOD_SHIFT))
+    c = (char)(c - 'A' + 'a');
+  if ((modifiers & INPUT_MOD_CTRL) && c >= '@' && c <= '~')
+    c = (char)(c & 0x1f); // ^A..^Z, ^[ and friends
+
+  uint32_t n = 0;
+  if (modifiers & INPUT_MOD_ALT)
+    out[n++] = 0x1b; // meta sends ESC first
+  out[n++] = c;
+  return n;
+}
+
+/* Remember the oldest timestamp behind a change that is not on screen yet */
+static void input_note_change(input_t *input, uint32_t time_ms) {
+  if (!time_ms || input->unrendered)
+    return;
+  input->unrendered = true;
+  input->unrendered_ms = time_ms;
+}
+
+/* PTY output was read: the keys written before it have been answered */
+static void input_note_output(input_t *input) {
+  if (!input->unechoed)
+    return;
+  input->unechoed = false;
+  input_note_change(input, input->unechoed_ms);
+}
+
+static void input_write_key(input_t *input, const input_event_t *event) {
+  char bytes[4];
+  uint32_t n = input_key_bytes(event->code, input->modifiers, bytes);
+  if (n == 0 || input->pty_fd == -1 || write(input->pty_fd, bytes, n) != (ssize_t)n) {
+    input->stats.keys_dropped++;
+    return;
+  }
+  input->stats.keys++;
+  if (!input->unechoed && event->time_ms) {
+    input->unechoed = true;
+    input->unechoed_ms = event->time_ms;
+  }
+}
+
+/* Shift+PageUp and Shift+PageDown scroll the view a page through the
+ * scrollback; any other key brings it back to the screen. Returns true if
+ * the key was taken for that. */
+static bool input_scroll_key(state_t *state, const input_event_t *event) {
+  term_t *term = state->term;
+  if (!term)
+    return false;
+  bool page_up = event->code == 104, page_down = event->code == 109;
+  if (!(state->input.modifiers & INPUT_MOD_SHIFT) || !(page_up || page_down)) {
+    if (term_scroll_view(term, -(int64_t)term->view_offset))
+      frame_mark_dirty(state);
+    return false;
+  }
+  int64_t page = term->rows > 1 ? term->rows - 1 : 1;
+  if (term_scroll_view(term, page_up ? page : -page)) {
+    input_note_change(&state->input, event->time_ms);
+    frame_mark_dirty(state);
+  }
+  return true;
+}
+
+/* Apply every queued event to the client state, in order. The pointer's
+ * cell is only looked at once, after the whole batch. */
+static void input_drain(state_t *state) {
+  input_t *input = &state->input;
+  if (input->queue_len == 0)
+    return;
+  input->stats.drains++;
+
+  uint32_t pointer_ms = 0; // oldest event that moved the pointer
+  for (uint32_t i = 0; i < input->queue_len; i++) {
+    const input_event_t *event = &input->queue[i];
+    switch (event->kind) {
+    case INPUT_ENTER:
+    case INPUT_MOTION:
+      state->pointer_inside = true;
+      state->pointer_x = event->x;
+      state->pointer_y = event->y;
+      if (!pointer_ms)
+        pointer_ms = event->time_ms;
+      break;
+    case INPUT_LEAVE:
+      state->pointer_inside = false;
+      break;
+    case INPUT_BUTTON:
+      if (event->code >= INPUT_BTN_LEFT && event->code - INPUT_BTN_LEFT < 32) {
+        uint32_t bit = 1U << (event->code - INPUT_BTN_LEFT);
+        if (event->pressed)
+          state->pointer_button_state |= bit;
+        else
+          state->pointer_button_state &= ~bit;
+      }
+      break;
+    case INPUT_KEY:
+      if (event->pressed && !input_scroll_key(state, event))
+        input_write_key(input, event);
+      break;
+    case INPUT_MODIFIERS:
+      input->modifiers = event->code;
+      break;
+    }
+  }
+  input->queue_len = 0;
+
+  term_t *term = state->term;
+  if (!term || !state->atlas)
+    return;
+  bool inside = state->pointer_inside && state->pointer_x >= 0 && state->pointer_y >= 0;
+  uint32_t x = inside ? (uint32_t)state->pointer_x / state->atlas->cell_w : 0;
+  uint32_t y = inside ? (uint32_t)state->pointer_y / state->atlas->cell_h : 0;
+  if (term_set_pointer(term, inside, x, y)) {
+    input->stats.updates++;
+    input_note_change(input, pointer_ms);
+    frame_mark_dirty(state);
+  }
+}
+
+/* Append to the queue, folding a motion into a motion right before it. A
+ * full queue is applied on the spot rather than dropping anything. */
+static void input_queue_push(state_t *state, const input_event_t *event) {
+  input_t *input = &state->input;
+  if (event->kind == INPUT_MOTION && input->queue_len &&
+      input->queue[input->queue_len - 1].kind == INPUT_MOTION) {
+    input_event_t *last = &input->queue[input->queue_len - 1];
+    last->x = event->x;
+    last->y = event->y;
+    if (!last->time_ms)
+      last->time_ms = event->time_ms;
+    input->stats.merged++;
+    return;
+  }
+  if (input->queue_len == INPUT_QUEUE_CAP)
+    input_drain(state);
+  input->queue[input->queue_len++] = *event;
+}
+
+/* wl_pointer.frame: the events since the last one form one logical event */
+static void input_pointer_frame(state_t *state) {
+  input_t *input = &state->input;
+  for (uint32_t i = 0; i < input->frame_len; i++)
+    input_queue_push(state, &input->frame[i]);
+  input->frame_len = 0;
+  input->stats.pointer_frames++;
+}
+
+static void input_pointer_event(state_t *state, const input_event_t *event) {
+  input_t *input = &state->input;
+  input->stats.events++;
+  if (input->seat_version < 5) {
+    input->frame[input->frame_len++] = *event;
+    input_pointer_frame(state);
+    return;
+  }
+  if (input->frame_len == INPUT_FRAME_CAP)
+    input_pointer_frame(state); // a runaway frame; close it early
+  input->frame[input->frame_len++] = *event;
+}
+
+static void input_key_event(state_t *state, const input_event_t *event) {
+  state->input.stats.events++;
+  input_queue_push(state, event);
+}
+
+static void input_stats_log(state_t *state) {
+  input_t *input = &state->input;
+  input_stats_t *s = &input->stats;
+  LOG("input: events=%" PRIu64 " merged=%" PRIu64 " frames=%" PRIu64 " drains=%" PRIu64
+      " updates=%" PRIu64 " keys=%" PRIu64 " dropped=%" PRIu64 "\n",
+      s->events, s->merged, s->pointer_frames, s->drains, s->updates, s->keys, s->keys_dropped);
+
+  static const uint32_t p[] = {50, 90, 99, 100};
+  uint32_t ms[4];
+  if (sample_ring_percentiles(input->latency_ms, input->latency_len, INPUT_LATENCY_CAP, p, ms, 4))
+    LOG("input to photon: samples=%" PRIu64 " p50=%ums p90=%ums p99=%ums max=%ums\n",
+        input->latency_len, ms[0], ms[1], ms[2], ms[3]);
+}
+
+/* ------------------- Event handlers ------------------------------------- */
+
+/* One handler per (interface, opcode) the client cares about; they're wired
+ * into the per-interface vtables at the end of this section. */
+
+/* A payload too short for its signature, or a string running past it. */
+static void wayland_event_malformed(wayland_conn_t *conn, const char *event, uint32_t object_id) {
+  fprintf(stderr, "malformed %s event on object %u\n", event, object_id);
+  conn->error = EPROTO;
+}
+
+static void wayland_wl_display_handle_error(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                            char *payload, uint64_t payload_len) {
+  (void)state;
+  wayland_wl_display_error_t event;
+  if (!wayland_wl_display_error_unpack(payload, payload_len, &event)) {
+    wayland_event_malformed(conn, "wl_display.error", object_id);
+    return;
+  }
+  fprintf(stderr, "fatal error: target_id=%u code=%u error=%.*s\n", event.object_id, event.code,
+          (int)event.message_len, event.message);
+  conn->error = EPROTO;
+}
+
+static void wayland_wl_display_handle_delete_id(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                                char *payload, uint64_t payload_len) {
+  (void)state;
+  wayland_wl_display_delete_id_t event;
+  if (!wayland_wl_display_delete_id_unpack(payload, payload_len, &event)) {
+    wayland_event_malformed(conn, "wl_display.delete_id", object_id);
+    return;
+  }
+  wayland_object_release(conn, event.id);
+}
+
+static void wayland_wl_registry_handle_global(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                              char *payload, uint64_t payload_len) {
+  wayland_wl_registry_global_t event;
+  if (!wayland_wl_registry_global_unpack(payload, payload_len, &event)) {
+    wayland_event_malformed(conn, "wl_registry.global", object_id);
+    return;
+  }
+  const char *interface = event.interface;
+  uint32_t interface_len = event.interface_len, name = event.name, version = event.version;
+  LOG("<- wl_registry@%u.global: name=%u interface=%s version=%u\n",
+      object_id, name, interface, version);
+
+  // bound at the lowest version that has every request we send
+  if (strcmp(interface, "wl_compositor") == 0 && version >= 4 && !state->wl_compositor) {
+    state->wl_compositor = wayland_wl_registry_bind(conn, object_id, name, interface, interface_len,
+                                                    4, &wayland_wl_compositor_vtable);
+  } else if (strcmp(interface, "wl_shm") == 0 && !state->wl_shm) {
+    state->wl_shm = wayland_wl_registry_bind(conn, object_id, name, interface, interface_len,
+                                             1, &wayland_wl_shm_vtable);
+  } else if (strcmp(interface, "xdg_wm_base") == 0 && !state->xdg_wm_base) {
+    state->xdg_wm_base = wayland_wl_registry_bind(conn, object_id, name, interface, interface_len,
+                                                  1, &wayland_xdg_wm_base_vtable);
+  } else if (strcmp(interface, "wl_seat") == 0 && !state->wl_seat) {
+    // version 5 brings wl_pointer.frame, which input batching relies on
+    state->input.seat_version = version < 5 ? version : 5;
+    state->wl_seat = wayland_wl_registry_bind(conn, object_id, name, interface, interface_len,
+                                              state->input.seat_version, &wayland_wl_seat_vtable);
+  }
+}
+
+static void wayland_wl_callback_handle_done(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                            char *payload, uint64_t payload_len) {
+  wayland_wl_callback_done_t event;
+  if (!wayland_wl_callback_done_unpack(payload, payload_len, &event)) {
+    wayland_event_malformed(conn, "wl_callback.done", object_id);
+    return;
+  }
+  if (object_id == state->sync_callback)
+    state->sync_callback = 0;
+  if (object_id == state->frame.callback)
+    frame_callback_done(state, event.callback_data);
+  // wl_callback is destroyed by the compositor once done; delete_id follows
+  wayland_object_destroy(conn, object_id);
+}
+
+static void wayland_wl_buffer_handle_release(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                             char *payload, uint64_t payload_len) {
+  (void)payload; (void)payload_len;
+  uint32_t slot = conn->objects[object_id].data;
+  if (slot == UINT32_MAX) {
+    swapchain_retired_release(conn, state, object_id); // from before a resize
+    return;
+  }
+  assert(slot < state->swapchain.len && state->swapchain.buffers[slot].wl_buffer == object_id);
+  state->swapchain.buffers[slot].busy = false;
+}
+
+static void wayland_xdg_wm_base_handle_ping(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                            char *payload, uint64_t payload_len) {
+  (void)state;
+  wayland_xdg_wm_base_ping_t event;
+  if (!wayland_xdg_wm_base_ping_unpack(payload, payload_len, &event)) {
+    wayland_event_malformed(conn, "xdg_wm_base.ping", object_id);
+    return;
+  }
+  wayland_xdg_wm_base_pong(conn, object_id, event.serial);
+}
+
+static void wayland_xdg_surface_handle_configure(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                                 char *payload, uint64_t payload_len) {
+  wayland_xdg_surface_configure_t event;
+  if (!wayland_xdg_surface_configure_unpack(payload, payload_len, &event)) {
+    wayland_event_malformed(conn, "xdg_surface.configure", object_id);
+    return;
+  }
+  wayland_xdg_surface_ack_configure(conn, object_id, event.serial);
+  if (state->state == STATE_NONE) {
+    state->state = STATE_SURFACE_ACKED_CONFIGURE;
+    state->startup.configure_ns = monotonic_ns() - state->startup.start_ns;
+  }
+
+  // the configure sequence is complete: adopt the toplevel's size, cut down
+  // to what the pool can hold, and let the next render rebuild the swapchain
+  uint32_t width = state->configure_width, height = state->configure_height;
+  swapchain_clamp_size(&width, &height);
+  if (width && height && (width != state->width || height != state->height)) {
+    state->width = width;
+    state->height = height;
+    if (state->term)
+      term_fit_window(state);
+    if (state->swapchain.len)
+      frame_mark_dirty(state);
+  }
+}
+
+static void wayland_xdg_toplevel_handle_configure(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                                  char *payload, uint64_t payload_len) {
+  wayland_xdg_toplevel_configure_t event;
+  if (!wayland_xdg_toplevel_configure_unpack(payload, payload_len, &event) ||
+      event.width < 0 || event.height < 0) {
+    wayland_event_malformed(conn, "xdg_toplevel.configure", object_id);
+    return;
+  }
+  // applied by the xdg_surface.configure that ends the sequence
+  state->configure_width = (uint32_t)event.width;
+  state->configure_height = (uint32_t)event.height;
+}
+
+static void wayland_xdg_toplevel_handle_close(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                              char *payload, uint64_t payload_len) {
+  (void)conn; (void)object_id; (void)payload; (void)payload_len;
+  state->state = STATE_CLOSED;
+}
+
+static void wayland_wl_seat_handle_capabilities(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                                char *payload, uint64_t payload_len) {
+  wayland_wl_seat_capabilities_t event;
+  if (!wayland_wl_seat_capabilities_unpack(payload, payload_len, &event)) {
+    wayland_event_malformed(conn, "wl_seat.capabilities", object_id);
+    return;
+  }
+  input_t *input = &state->input;
+  bool pointer = event.capabilities & wayland_wl_seat_capability_pointer;
+  bool keyboard = event.capabilities & wayland_wl_seat_capability_keyboard;
+
+  if (pointer && !input->wl_pointer) {
+    input->wl_pointer = wayland_wl_seat_get_pointer(conn, object_id);
+  } else if (!pointer && input->wl_pointer) {
+    // before version 3 there is no release; the compositor stops sending
+    if (input->seat_version >= 3)
+      wayland_wl_pointer_release(conn, input->wl_pointer);
+    input->wl_pointer = 0;
+    input->frame_len = 0;
+    input_queue_push(state, &(input_event_t){.kind = INPUT_LEAVE});
+  }
+
+  if (keyboard && !input->wl_keyboard) {
+    input->wl_keyboard = wayland_wl_seat_get_keyboard(conn, object_id);
+  } else if (!keyboard && input->wl_keyboard) {
+    if (input->seat_version >= 3)
+      wayland_wl_keyboard_release(conn, input->wl_keyboard);
+    input->wl_keyboard = 0;
+  }
+}
+
+static void wayland_wl_pointer_handle_enter(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                            char *payload, uint64_t payload_len) {
+  wayland_wl_pointer_enter_t event;
+  if (!wayland_wl_pointer_enter_unpack(payload, payload_len, &event)) {
+    wayland_event_malformed(conn, "wl_pointer.enter", object_id);
+    return;
+  }
+  input_pointer_event(state, &(input_event_t){.kind = INPUT_ENTER,
+                                              .x = wayland_fixed_to_double(event.surface_x),
+                                              .y = wayland_fixed_to_double(event.surface_y)});
+}
+
+static void wayland_wl_pointer_handle_leave(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                            char *payload, uint64_t payload_len) {
+  wayland_wl_pointer_leave_t event;
+  if (!wayland_wl_pointer_leave_unpack(payload, payload_len, &event)) {
+    wayland_event_malformed(conn, "wl_pointer.leave", object_id);
+    return;
+  }
+  input_pointer_event(state, &(input_event_t){.kind = INPUT_LEAVE});
+}
+
+static void wayland_wl_pointer_handle_motion(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                             char *payload, uint64_t payload_len) {
+  wayland_wl_pointer_motion_t event;
+  if (!wayland_wl_pointer_motion_unpack(payload, payload_len, &event)) {
+    wayland_event_malformed(conn, "wl_pointer.motion", object_id);
+    return;
+  }
+  input_pointer_event(state, &(input_event_t){.kind = INPUT_MOTION, .time_ms = event.time,
+                                              .x = wayland_fixed_to_double(event.surface_x),
+                                              .y = wayland_fixed_to_double(event.surface_y)});
+}
+
+static void wayland_wl_pointer_handle_button(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                             char *payload, uint64_t payload_len) {
+  wayland_wl_pointer_button_t event;
+  if (!wayland_wl_pointer_button_unpack(payload, payload_len, &event)) {
+    wayland_event_malformed(conn, "wl_pointer.button", object_id);
+    return;
+  }
+  input_pointer_event(state, &(input_event_t){.kind = INPUT_BUTTON, .code = event.button,
+                                              .pressed = event.state == wayland_wl_pointer_button_state_pressed,
+                                              .time_ms = event.time});
+}
+
+static void wayland_wl_pointer_handle_frame(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                            char *payload, uint64_t payload_len) {
+  (void)conn; (void)object_id; (void)payload; (void)payload_len;
+  input_pointer_frame(state);
+}
+
+/* No xkb: the keymap fd is only there to be closed */
+static void wayland_wl_keyboard_handle_keymap(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                              char *payload, uint64_t payload_len) {
+  (void)state;
+  wayland_wl_keyboard_keymap_t event;
+  int fd = wayland_conn_take_fd(conn);
+  if (fd != -1)
+    close(fd);
+  if (!wayland_wl_keyboard_keymap_unpack(payload, payload_len, &event) || fd == -1)
+    wayland_event_malformed(conn, "wl_keyboard.keymap", object_id);
+}
+
+static void wayland_wl_keyboard_handle_key(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                           char *payload, uint64_t payload_len) {
+  wayland_wl_keyboard_key_t event;
+  if (!wayland_wl_keyboard_key_unpack(payload, payload_len, &event)) {
+    wayland_event_malformed(conn, "wl_keyboard.key", object_id);
+    return;
+  }
+  input_key_event(state, &(input_event_t){.kind = INPUT_KEY, .code = event.key, .time_ms = event.time,
+                                          .pressed = event.state == wayland_wl_keyboard_key_state_pressed});
+}
+
+static void wayland_wl_keyboard_handle_modifiers(wayland_conn_t *conn, state_t *state, uint32_t object_id,
+                                                 char *payload, uint64_t payload_len) {
+  wayland_wl_keyboard_modifiers_t event;
+  if (!wayland_wl_keyboard_modifiers_unpack(payload, payload_len, &event)) {
+    wayland_event_malformed(conn, "wl_keyboard.modifiers", object_id);
+    return;
+  }
+  uint32_t modifiers = event.mods_depressed | event.mods_latched | event.mods_locked;
+  input_key_event(state, &(input_event_t){.kind = INPUT_MODIFIERS, .code = modifiers});
+}
+
+static const wayland_event_handler_t wayland_wl_display_events[] = {
+  wayland_wl_display_handle_error,
+  wayland_wl_display_handle_delete_id,
+};
+static const wayland_event_handler_t wayland_wl_registry_events[] = {
+  wayland_wl_registry_handle_global,
+  NULL, // global_remove
+};
+static const wayland_event_handler_t wayland_wl_callback_events[] = {
+  wayland_wl_callback_handle_done,
+};
+static const wayland_event_handler_t wayland_wl_shm_events[] = {
+  NULL, // format
+};
+static const wayland_event_handler_t wayland_wl_buffer_events[] = {
+  wayland_wl_buffer_handle_release,
+};
+static const wayland_event_handler_t wayland_wl_surface_events[] = {
+  NULL, // enter
+  NULL, // leave
+  NULL, // preferred_buffer_scale
+  NULL, // preferred_buffer_transform
+};
+static const wayland_event_handler_t wayland_wl_seat_events[] = {
+  wayland_wl_seat_handle_capabilities,
+  NULL, // name
+};
+static const wayland_event_handler_t wayland_wl_pointer_events[] = {
+  wayland_wl_pointer_handle_enter,
+  wayland_wl_pointer_handle_leave,
+  wayland_wl_pointer_handle_motion,
+  wayland_wl_pointer_handle_button,
+  NULL, // axis
+  wayland_wl_pointer_handle_frame,
+  NULL, // axis_source
+  NULL, // axis_stop
+  NULL, // axis_discrete
+};
+static const wayland_event_handler_t wayland_wl_keyboard_events[] = {
+  wayland_wl_keyboard_handle_keymap,
+  NULL, // enter
+  NULL, // leave
+  wayland_wl_keyboard_handle_key,
+  wayland_wl_keyboard_handle_modifiers,
+  NULL, // repeat_info
+};
+static const wayland_event_handler_t wayland_xdg_wm_base_events[] = {
+  wayland_xdg_wm_base_handle_ping,
+};
+static const wayland_event_handler_t wayland_xdg_surface_events[] = {
+  wayland_xdg_surface_handle_configure,
+};
+static const wayland_event_handler_t wayland_xdg_toplevel_events[] = {
+  wayland_xdg_toplevel_handle_configure,
+  wayland_xdg_toplevel_handle_close,
+  NULL, // configure_bounds
+  NULL, // wm_capabilities
+};
+
+#define WAYLAND_VTABLE(iface, id, handlers) \
+  {.name = iface, .interface = id, .event_count = sizeof(handlers) / sizeof(handlers[0]), .events = handlers}
+
+static const wayland_vtable_t wayland_wl_display_vtable =
+  WAYLAND_VTABLE("wl_display", WAYLAND_WL_DISPLAY, wayland_wl_display_events);
+static const wayland_vtable_t wayland_wl_registry_vtable =
+  WAYLAND_VTABLE("wl_registry", WAYLAND_WL_REGISTRY, wayland_wl_registry_events);
+static const wayland_vtable_t wayland_wl_callback_vtable =
+  WAYLAND_VTABLE("wl_callback", WAYLAND_WL_CALLBACK, wayland_wl_callback_events);
+static const wayland_vtable_t wayland_wl_compositor_vtable =
+  {.name = "wl_compositor", .interface = WAYLAND_WL_COMPOSITOR};
+static const wayland_vtable_t wayland_wl_shm_vtable =
+  WAYLAND_VTABLE("wl_shm", WAYLAND_WL_SHM, wayland_wl_shm_events);
+static const wayland_vtable_t wayland_wl_shm_pool_vtable =
+  {.name = "wl_shm_pool", .interface = WAYLAND_WL_SHM_POOL};
+static const wayland_vtable_t wayland_wl_buffer_vtable =
+  WAYLAND_VTABLE("wl_buffer", WAYLAND_WL_BUFFER, wayland_wl_buffer_events);
+static const wayland_vtable_t wayland_wl_surface_vtable =
+  WAYLAND_VTABLE("wl_surface", WAYLAND_WL_SURFACE, wayland_wl_surface_events);
+static const wayland_vtable_t wayland_wl_seat_vtable =
+  WAYLAND_VTABLE("wl_seat", WAYLAND_WL_SEAT, wayland_wl_seat_events);
+static const wayland_vtable_t wayland_wl_pointer_vtable =
+  WAYLAND_VTABLE("wl_pointer", WAYLAND_WL_POINTER, wayland_wl_pointer_events);
+static const wayland_vtable_t wayland_wl_keyboard_vtable = {
+  .name = "wl_keyboard", .interface = WAYLAND_WL_KEYBOARD,
+  .event_count = sizeof(wayland_wl_keyboard_events) / sizeof(wayland_wl_keyboard_events[0]),
+  .events = wayland_wl_keyboard_events, .event_fds = wayland_wl_keyboard_event_fds};
+static const wayland_vtable_t wayland_xdg_wm_base_vtable =
+  WAYLAND_VTABLE("xdg_wm_base", WAYLAND_XDG_WM_BASE, wayland_xdg_wm_base_events);
+static const wayland_vtable_t wayland_xdg_surface_vtable =
+  WAYLAND_VTABLE("xdg_surface", WAYLAND_XDG_SURFACE, wayland_xdg_surface_events);
+static const wayland_vtable_t wayland_xdg_toplevel_vtable =
+  WAYLAND_VTABLE("xdg_toplevel", WAYLAND_XDG_TOPLEVEL, wayland_xdg_toplevel_events);
+
+/* ------------------- Event handling ------------------------------------- */
+
+/* Close the fds of an event that no handler takes them from. They were
+ * queued in order with every other event's, so leaving them would hand
+ * them to the next event that carries one. */
+static void wayland_event_drop_fds(wayland_conn_t *conn, const wayland_vtable_t *vtable, uint16_t opcode) {
+  for (uint32_t fds = vtable->event_fds ? vtable->event_fds[opcode] : 0; fds > 0; fds--) {
+    int fd = wayland_conn_take_fd(conn);
+    if (fd != -1)
+      close(fd);
+  }
+}
+
+/* Parse and handle an incoming Wayland message
+ * - conn: connection the message arrived on (fd arguments are taken from its
+ *   queue with wayland_conn_take_fd)
+ * - state: our client state
+ * - msg: pointer to one complete message, in place in the receive ring
+ *   (will be advanced past it)
+ * - msg_len: remaining length in buffer
+ *
+ * This function should:
+ *  - Read sender_id, object_id, opcode, and dispatch to proper handlers.
+ *  - Update state fields based on registry announcements (globals), seat
+ *    capabilities (pointer/keyboard), pointer events (motion/button), and
+ *    other relevant protocol events.
+ */
+static void wayland_handle_message(wayland_conn_t *conn, state_t *state, char **msg, uint64_t *msg_len) {
+  uint32_t object_id = buf_read_u32(msg, msg_len);
+  uint16_t opcode = buf_read_u16(msg, msg_len);
+  uint16_t announced_size = buf_read_u16(msg, msg_len);
+  assert(announced_size >= wayland_header_size && announced_size - wayland_header_size <= *msg_len);
+
+  uint64_t payload_len = announced_size - wayland_header_size;
+  char *payload = *msg;
+  *msg += payload_len;
+  *msg_len -= payload_len;
+
+  if (object_id >= conn->objects_len || !conn->objects[object_id].vtable) {
+    fprintf(stderr, "<- event for unknown object: object=%u opcode=%u\n", object_id, opcode);
+    conn->error = EPROTO;
+    return;
+  }
+
+  wayland_object_t *object = &conn->objects[object_id];
+  const wayland_vtable_t *vtable = object->vtable;
+  if (opcode >= vtable->event_count) {
+    fprintf(stderr, "<- %s@%u: bad opcode %u\n", vtable->name, object_id, opcode);
+    conn->error = EPROTO;
+    return;
+  }
+  if (object->zombie) {
+    wayland_event_drop_fds(conn, vtable, opcode); // sent before the compositor saw our destroy
+    return;
+  }
+
+  TRACE_EVENT_BEGIN(record, object->interface, object_id, opcode, announced_size, payload, payload_len);
+  if (vtable->events[opcode])
+    vtable->events[opcode](conn, state, object_id, payload, payload_len);
+  else
+    wayland_event_drop_fds(conn, vtable, opcode);
+  TRACE_EVENT_END(record);
+}
+
+/* ------------------- Receive engine ---------------------------------------- */
+
+/* Pop the oldest file descriptor received on the connection. Events with an
+ * fd argument (e.g. wl_keyboard.keymap) call this while being handled; the
+ * fds arrive in the same order as the events that carry them.
+ * - Returns the fd (now owned by the caller) or -1 if none is queued.
+ */
+static int wayland_conn_take_fd(wayland_conn_t *conn) {
+  if (conn->in_fds_len == 0)
+    return -1;
+  int fd = conn->in_fds[conn->in_fds_head];
+  conn->in_fds_head = (conn->in_fds_head + 1) & (WAYLAND_MAX_FDS_IN - 1);
+  conn->in_fds_len--;
+  return fd;
+}
+
+#ifndef KASAMA_LIBWAYLAND
+/* Pull as much as the socket holds into the free part of the receive ring
+ * with a single recvmsg(), collecting any SCM_RIGHTS fds into the fd queue.
+ * - Returns the number of bytes read, 0 if nothing was available (or the ring
+ *   is full and needs dispatching first), -1 with errno on error or hang-up.
+ */
+static int64_t wayland_conn_read(wayland_conn_t *conn) {
+  if (conn->error) {
+    errno = conn->error;
+    return -1;
+  }
+  if (conn->in_len == WAYLAND_IN_CAP)
+    return 0;
+
+  struct iovec iov[2];
+  int iovcnt = 1;
+  uint32_t tail = (conn->in_head + conn->in_len) & (WAYLAND_IN_CAP - 1);
+  uint32_t free_len = WAYLAND_IN_CAP - conn->in_len;
+  uint32_t first = WAYLAND_IN_CAP - tail;
+  if (first > free_len)
+    first = free_len;
+  iov[0] = (struct iovec){.iov_base = conn->in + tail, .iov_len = first};
+  if (first < free_len) {
+    iov[1] = (struct iovec){.iov_base = conn->in, .iov_len = free_len - first};
+    iovcnt = 2;
+  }
+
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * WAYLAND_MAX_FDS_IN)];
+    struct cmsghdr align;
+  } control;
+  struct msghdr socket_msg = {
+    .msg_iov = iov,
+    .msg_iovlen = iovcnt,
+    .msg_control = control.buf,
+    .msg_controllen = sizeof(control.buf),
+  };
+
+  ssize_t received;
+  do {
+    received = recvmsg(conn->fd, &socket_msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    conn->stats.recvmsg_calls++;
+    wayland_conn_count_syscall(conn);
+  } while (received == -1 && errno == EINTR);
+
+  if (received == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return 0;
+    conn->error = errno;
+    return -1;
+  }
+  if (received == 0) {
+    conn->error = ECONNRESET; // compositor went away
+    errno = conn->error;
+    return -1;
+  }
+
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&socket_msg); cmsg; cmsg = CMSG_NXTHDR(&socket_msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    uint64_t fds_len = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (uint64_t i = 0; i < fds_len; i++) {
+      int fd;
+      memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+      if (conn->in_fds_len == WAYLAND_MAX_FDS_IN) {
+        close(fd);
+        conn->error = EOVERFLOW;
+        continue;
+      }
+      uint32_t slot = (conn->in_fds_head + conn->in_fds_len) & (WAYLAND_MAX_FDS_IN - 1);
+      conn->in_fds[slot] = fd;
+      conn->in_fds_len++;
+      conn->stats.fds_received++;
+    }
+  }
+  if (socket_msg.msg_flags & MSG_CTRUNC)
+    conn->error = EOVERFLOW; // fds were dropped by the kernel, events would desync
+
+  conn->in_len += (uint32_t)received;
+  conn->stats.bytes_received += (uint64_t)received;
+  return received;
+}
+
+/* Dispatch every complete message in the receive ring, in place. A message
+ * whose header or body has not fully arrived stays queued for the next read.
+ * - Returns the number of messages dispatched, or -1 with errno on a
+ *   malformed stream or a protocol error reported by a handler.
+ */
+static int64_t wayland_conn_dispatch(wayland_conn_t *conn, state_t *state) {
+  int64_t dispatched = 0;
+
+  while (conn->in_len >= wayland_header_size && !conn->error) {
+    // header words are 4-aligned and the ring size is a multiple of 4, so
+    // neither word can be split by the wrap
+    uint32_t size_word;
+    memcpy(&size_word, conn->in + ((conn->in_head + 4) & (WAYLAND_IN_CAP - 1)), sizeof(size_word));
+    uint32_t size = size_word >> 16;
+    // a message over the protocol limit would overrun in_scratch where it
+    // wraps, and one over WAYLAND_IN_CAP could never arrive whole
+    if (size < wayland_header_size || size != roundup_4(size) || size > WAYLAND_MAX_MSG_SIZE) {
+      conn->error = EPROTO;
+      break;
+    }
+    if (conn->in_len < size)
+      break;
+
+    char *msg = conn->in + conn->in_head;
+    if (conn->in_head + size > WAYLAND_IN_CAP) {
+      uint32_t first = WAYLAND_IN_CAP - conn->in_head;
+      memcpy(conn->in_scratch, msg, first);
+      memcpy(conn->in_scratch + first, conn->in, size - first);
+      msg = conn->in_scratch;
+    }
+
+    uint64_t msg_len = size;
+    wayland_handle_message(conn, state, &msg, &msg_len);
+    assert(msg_len == 0);
+
+    conn->in_head = (conn->in_head + size) & (WAYLAND_IN_CAP - 1);
+    conn->in_len -= size;
+    dispatched++;
+  }
+
+  if (conn->in_len == 0)
+    conn->in_head = 0; // next read lands contiguously
+
+  conn->stats.messages_dispatched += (uint64_t)dispatched;
+  if ((uint64_t)dispatched > conn->stats.max_messages_per_read)
+    conn->stats.max_messages_per_read = (uint64_t)dispatched;
+
+  if (conn->error) {
+    errno = conn->error;
+    return -1;
+  }
+  return dispatched;
+}
+#endif
+
+/* ------------------- libwayland-client transport ------------------------- */
+
+/* With -DKASAMA_LIBWAYLAND the transport functions above are these instead,
+ * and the connection is libwayland-client's. The client doesn't change: it
+ * still packs every request with the generated _pack() stubs and handles
+ * every event through its vtables with the generated _unpack(). In between,
+ *  - wayland_msg_end walks the packed request by its signature into a
+ *    wl_argument array for wl_proxy_marshal_array_flags, turning object ids
+ *    into proxies; a new_id gets its proxy and a dispatcher
+ *  - the dispatcher packs libwayland's demarshaled arguments back into wire
+ *    format and hands the message to wayland_handle_message, with object
+ *    arguments turned back into our ids and fds put on the fd queue
+ * Object ids stay ours; libwayland numbers its proxies itself and keeps
+ * delete_id to itself, so a destroyed object's id is recycled at once.
+ * The conversions cost time the wire engine doesn't spend, and that is
+ * part of what kasama_bench's wire benchmark compares. libwayland's
+ * syscalls are out of sight here: conn->stats counts messages, not bytes or
+ * syscalls, on this transport.
+ */
+#ifdef KASAMA_LIBWAYLAND
+#define WAYLAND_WL_MAX_ARGS 20U /* WL_CLOSURE_MAX_ARGS */
+
+static const struct wl_interface *const wayland_wl_interfaces[] = {
+  [WAYLAND_WL_DISPLAY] = &wayland_wl_display_wl_interface,
+  [WAYLAND_WL_REGISTRY] = &wayland_wl_registry_wl_interface,
+  [WAYLAND_WL_CALLBACK] = &wayland_wl_callback_wl_interface,
+  [WAYLAND_WL_COMPOSITOR] = &wayland_wl_compositor_wl_interface,
+  [WAYLAND_WL_SHM] = &wayland_wl_shm_wl_interface,
+  [WAYLAND_WL_SHM_POOL] = &wayland_wl_shm_pool_wl_interface,
+  [WAYLAND_WL_BUFFER] = &wayland_wl_buffer_wl_interface,
+  [WAYLAND_WL_SURFACE] = &wayland_wl_surface_wl_interface,
+  [WAYLAND_WL_SEAT] = &wayland_wl_seat_wl_interface,
+  [WAYLAND_WL_POINTER] = &wayland_wl_pointer_wl_interface,
+  [WAYLAND_WL_KEYBOARD] = &wayland_wl_keyboard_wl_interface,
+  [WAYLAND_XDG_WM_BASE] = &wayland_xdg_wm_base_wl_interface,
+  [WAYLAND_XDG_SURFACE] = &wayland_xdg_surface_wl_interface,
+  [WAYLAND_XDG_TOPLEVEL] = &wayland_xdg_toplevel_wl_interface,
+};
+
+static int wayland_wl_dispatch(const void *data, void *target, uint32_t opcode,
+                               const struct wl_message *event, union wl_argument *args);
+
+static int wayland_conn_connect(wayland_conn_t *conn) {
+  struct wl_display *display = wl_display_connect(NULL);
+  if (!display)
+    return -1;
+  if (wayland_conn_init(conn, wl_display_get_fd(display)) == -1) {
+    wl_display_disconnect(display);
+    return -1;
+  }
+  conn->display = display;
+  conn->objects[wayland_display_object_id].proxy = (struct wl_proxy *)display;
+  return 0;
+}
+
+static void wayland_conn_free(wayland_conn_t *conn) {
+  for (uint32_t id = wayland_display_object_id + 1; id < conn->objects_len; id++) {
+    if (conn->objects[id].proxy)
+      wl_proxy_destroy(conn->objects[id].proxy);
+  }
+  for (uint32_t i = 0; i < conn->out_fds_len; i++)
+    close(conn->out_fds[i]);
+  for (uint32_t i = 0; i < conn->in_fds_len; i++)
+    close(conn->in_fds[(conn->in_fds_head + i) & (WAYLAND_MAX_FDS_IN - 1)]);
+  if (conn->display)
+    wl_display_disconnect(conn->display); // closes the socket
+  free(conn->objects);
+  memset(conn, 0, sizeof(*conn));
+  conn->fd = -1;
+}
+
+/* The object is gone on our side: libwayland's proxy goes with it, and the
+ * id is ours to reuse, since it never went on the wire. */
+static void wayland_conn_drop_proxy(wayland_conn_t *conn, uint32_t id) {
+  if (conn->objects[id].proxy)
+    wl_proxy_destroy(conn->objects[id].proxy);
+  conn->objects[id].proxy = NULL;
+  wayland_object_release(conn, id);
+}
+
+static int wayland_conn_flush(wayland_conn_t *conn) {
+  if (conn->error) {
+    errno = conn->error;
+    return -1;
+  }
+  if (wl_display_flush(conn->display) == -1) {
+    if (errno == EAGAIN) {
+      conn->stats.eagain++;
+      conn->out_blocked = true;
+      return 0;
+    }
+    conn->error = errno;
+    return -1;
+  }
+  conn->out_blocked = false;
+  return 0;
+}
+
+/* Kept until wayland_msg_end hands it to the request that carries it;
+ * libwayland marshals a dup of its own, so ours is closed right after. */
+static int wayland_conn_queue_fd(wayland_conn_t *conn, int fd) {
+  if (conn->out_fds_len == WAYLAND_MAX_FDS_OUT) {
+    errno = EMFILE;
+    return -1;
+  }
+  int dup_fd = dup(fd);
+  if (dup_fd == -1)
+    return -1;
+  conn->out_fds[conn->out_fds_len++] = dup_fd;
+  return 0;
+}
+
+static uint32_t *wayland_msg_begin(wayland_conn_t *conn, uint32_t size) {
+  assert(size >= wayland_header_size && size % 4 == 0 && size <= WAYLAND_MSG_SCRATCH);
+  if (conn->error) {
+    errno = conn->error;
+    return NULL;
+  }
+  return (uint32_t *)conn->scratch;
+}
+
+/* The interface an untyped new_id (wl_registry.bind) names */
+static const struct wl_interface *wayland_wl_interface_named(const char *name) {
+  for (uint32_t i = 0; i < sizeof(wayland_wl_interfaces) / sizeof(wayland_wl_interfaces[0]); i++) {
+    if (wayland_wl_interfaces[i] && strcmp(wayland_wl_interfaces[i]->name, name) == 0)
+      return wayland_wl_interfaces[i];
+  }
+  return NULL;
+}
+
+static void wayland_msg_end(wayland_conn_t *conn, uint32_t *msg, uint32_t size) {
+  uint32_t object_id = msg[0], opcode = msg[1] & 0xffff;
+  wayland_object_t *object = &conn->objects[object_id];
+  const struct wl_message *request = &wayland_wl_interfaces[object->interface]->methods[opcode];
+  union wl_argument args[WAYLAND_WL_MAX_ARGS];
+  struct wl_array arrays[WAYLAND_WL_MAX_ARGS];
+  const struct wl_interface *creates = NULL;
+  uint32_t version = wl_proxy_get_version(object->proxy), new_id = 0, n = 0;
+  int fds[WAYLAND_WL_MAX_ARGS];
+  uint32_t fds_len = 0;
+  const uint32_t *p = msg + 2;
+
+  for (const char *sig = request->signature; *sig; sig++) {
+    switch (*sig) {
+    case 'i': case 'u': case 'f':
+      args[n].u = *p++;
+      break;
+    case 's': {
+      uint32_t len = *p++;
+      args[n].s = len ? (const char *)p : NULL;
+      p += (len + 3) / 4;
+      break;
+    }
+    case 'a':
+      arrays[n] = (struct wl_array){.size = *p, .alloc = *p, .data = (void *)(p + 1)};
+      args[n].a = &arrays[n];
+      p += 1 + (*p + 3) / 4;
+      break;
+    case 'o':
+      args[n].o = *p ? (struct wl_object *)conn->objects[*p].proxy : NULL;
+      p++;
+      break;
+    case 'n':
+      new_id = *p++;
+      args[n].o = NULL;
+      creates = request->types[n];
+      if (!creates) { // bind: the interface name and version come first
+        creates = wayland_wl_interface_named(args[n - 2].s);
+        version = args[n - 1].u;
+      }
+      break;
+    case 'h':
+      args[n].h = fds[fds_len++] = conn->out_fds[0];
+      conn->out_fds_len--;
+      memmove(conn->out_fds, conn->out_fds + 1, sizeof(int) * conn->out_fds_len);
+      break;
+    default: // since version, nullable
+      continue;
+    }
+    n++;
+  }
+
+  struct wl_proxy *created = wl_proxy_marshal_array_flags(object->proxy, opcode, creates, version, 0, args);
+  for (uint32_t i = 0; i < fds_len; i++)
+    close(fds[i]); // marshaled as a dup
+  if (new_id) {
+    if (!created) {
+      conn->error = ENOMEM;
+      return;
+    }
+    conn->objects[new_id].proxy = created;
+    wl_proxy_add_dispatcher(created, wayland_wl_dispatch, conn, (void *)(uintptr_t)new_id);
+  }
+
+#ifdef KASAMA_TRACE
+  trace_record(TRACE_REQUEST, object->interface, object_id, (uint16_t)opcode, (uint16_t)size,
+               size > wayland_header_size ? msg[2] : 0);
+#else
+  (void)size;
+#endif
+}
+
+/* Every event of every proxy we created lands here, demarshaled; it goes
+ * back on the wire format for wayland_handle_message. */
+static int wayland_wl_dispatch(const void *data, void *target, uint32_t opcode,
+                               const struct wl_message *event, union wl_argument *args) {
+  wayland_conn_t *conn = (wayland_conn_t *)data;
+  uint32_t *msg = (uint32_t *)conn->in_scratch, at = 2, n = 0;
+  const uint32_t cap = WAYLAND_MAX_MSG_SIZE / 4;
+
+  for (const char *sig = event->signature; *sig && !conn->error; sig++) {
+    switch (*sig) {
+    case 'i': case 'u': case 'f':
+      if (at == cap)
+        conn->error = EMSGSIZE;
+      else
+        msg[at++] = args[n].u;
+      break;
+    case 's': {
+      uint32_t len = args[n].s ? (uint32_t)strlen(args[n].s) + 1 : 0;
+      if (at + 2 + len / 4 > cap)
+        conn->error = EMSGSIZE;
+      else
+        at += wayland_pack_bytes(msg + at, args[n].s, len, len ? len - 1 : 0);
+      break;
+    }
+    case 'a':
+      if (at + 2 + args[n].a->size / 4 > cap)
+        conn->error = EMSGSIZE;
+      else
+        at += wayland_pack_bytes(msg + at, args[n].a->data, (uint32_t)args[n].a->size,
+                                 (uint32_t)args[n].a->size);
+      break;
+    case 'o':
+      if (at == cap)
+        conn->error = EMSGSIZE;
+      else
+        msg[at++] = args[n].o ? (uint32_t)(uintptr_t)wl_proxy_get_user_data((struct wl_proxy *)args[n].o) : 0;
+      break;
+    case 'h':
+      if (conn->in_fds_len == WAYLAND_MAX_FDS_IN) {
+        close(args[n].h);
+        conn->error = EOVERFLOW;
+      } else {
+        conn->in_fds[(conn->in_fds_head + conn->in_fds_len++) & (WAYLAND_MAX_FDS_IN - 1)] = args[n].h;
+        conn->stats.fds_received++;
+      }
+      break;
+    case 'n': // none of the interfaces we bind create objects from events
+      conn->error = EPROTO;
+      break;
+    default:
+      continue;
+    }
+    n++;
+  }
+  if (conn->error)
+    return -1;
+
+  msg[0] = (uint32_t)(uintptr_t)wl_proxy_get_user_data(target);
+  msg[1] = at * 4 << 16 | opcode;
+  char *cursor = (char *)msg;
+  uint64_t len = at * 4;
+  wayland_handle_message(conn, conn->dispatch_state, &cursor, &len);
+  return 0;
+}
+
+/* Read what the socket holds into libwayland's queue. The queue must be
+ * empty, which it is after every wayland_conn_dispatch.
+ * - Returns 1 if the socket was read, 0 if the queue needs dispatching first,
+ *   -1 with errno on error or hang-up.
+ */
+static int64_t wayland_conn_read(wayland_conn_t *conn) {
+  if (conn->error) {
+    errno = conn->error;
+    return -1;
+  }
+  if (wl_display_prepare_read(conn->display) == -1)
+    return 0;
+  conn->stats.recvmsg_calls++;
+  if (wl_display_read_events(conn->display) == -1) {
+    conn->error = errno;
+    return -1;
+  }
+  return 1;
+}
+
+static int64_t wayland_conn_dispatch(wayland_conn_t *conn, state_t *state) {
+  conn->dispatch_state = state;
+  int dispatched = wl_display_dispatch_pending(conn->display);
+  conn->dispatch_state = NULL;
+  if (dispatched == -1 && !conn->error)
+    conn->error = wl_display_get_error(conn->display);
+  if (conn->error) {
+    errno = conn->error;
+    return -1;
+  }
+
+  conn->stats.messages_dispatched += (uint64_t)dispatched;
+  if ((uint64_t)dispatched > conn->stats.max_messages_per_read)
+    conn->stats.max_messages_per_read = (uint64_t)dispatched;
+  return dispatched;
+}
+#endif
+
+/* ------------------- PTY recording --------------------------------------- */
+
+/* With KASAMA_RECORD=path, every PTY read is appended to a recording before
+ * it is parsed, so a session can be pushed through the whole pipeline again
+ * later (kasama_replay.c), as fast as it goes or at the speed it came in.
+ * A recording is a recording_header_t followed by one record per read:
+ *   varint  microseconds since the previous record (the first: since open)
+ *   varint  length
+ *   bytes   what read() returned
+ * Varints are the scrollback's LEB128. Records are collected in a buffer and
+ * written out when it fills and at exit, so recording costs a memcpy per
+ * read, not a write().
+ */
+#define RECORDING_MAGIC "KASAMAR1"
+#define RECORDING_BUF (256U * 1024U)
+#define RECORDING_RECORD_MAX 10U   /* two varints, without the bytes */
+
+typedef struct recording_header_t recording_header_t;
+typedef struct recorder_t recorder_t;
+
+struct recording_header_t {
+  char magic[8];
+  uint16_t cols, rows;         // grid size when recording started
+  uint32_t reserved;
+};
+
+struct recorder_t {
+  int fd;
+  uint64_t last_ns;            // time of the previous record
+  uint64_t records;
+  uint64_t bytes;              // PTY bytes recorded
+  bool failed;                 // a write failed; nothing more is recorded
+  uint32_t buf_len;
+  uint8_t buf[RECORDING_BUF];
+};
+
+/* Create (or truncate) the recording at path for a cols x rows grid.
+ * - Returns 0, or -1 with errno set.
+ */
+static int recorder_open(recorder_t *recorder, const char *path, uint32_t cols, uint32_t rows) {
+  memset(recorder, 0, sizeof(*recorder));
+  recorder->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (recorder->fd == -1)
+    return -1;
+  recording_header_t header = {.magic = RECORDING_MAGIC, .cols = (uint16_t)cols, .rows = (uint16_t)rows};
+  memcpy(recorder->buf, &header, sizeof(header));
+  recorder->buf_len = sizeof(header);
+  recorder->last_ns = monotonic_ns();
+  return 0;
+}
+
+static int recorder_write_all(recorder_t *recorder, const uint8_t *data, uint64_t len) {
+  while (len > 0) {
+    ssize_t n = write(recorder->fd, data, len);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      recorder->failed = true;
+      return -1;
+    }
+    data += n;
+    len -= (uint64_t)n;
+  }
+  return 0;
+}
+
+static int recorder_flush(recorder_t *recorder) {
+  if (recorder->failed)
+    return -1;
+  int ret = recorder_write_all(recorder, recorder->buf, recorder->buf_len);
+  recorder->buf_len = 0;
+  return ret;
+}
+
+/* Append one PTY read. A write error stops the recording, not the terminal. */
+static void recorder_write(recorder_t *recorder, const uint8_t *data, uint32_t len) {
+  if (recorder->failed)
+    return;
+  uint64_t now = monotonic_ns();
+  uint64_t delta_us = (now - recorder->last_ns) / 1000;
+  recorder->last_ns = now;
+  if (recorder->buf_len + RECORDING_RECORD_MAX + len > RECORDING_BUF && recorder_flush(recorder) == -1)
+    return;
+
+  uint8_t *p = recorder->buf + recorder->buf_len;
+  p = term_varint_put(p, delta_us < UINT32_MAX ? (uint32_t)delta_us : UINT32_MAX);
+  p = term_varint_put(p, len);
+  recorder->buf_len = (uint32_t)(p - recorder->buf);
+  if (recorder->buf_len + len > RECORDING_BUF) { // a read bigger than the buffer
+    if (recorder_flush(recorder) == -1)
+      return;
+    recorder_write_all(recorder, data, len);
+  } else {
+    memcpy(recorder->buf + recorder->buf_len, data, len);
+    recorder->buf_len += len;
+  }
+  recorder->records++;
+  recorder->bytes += len;
+}
+
+/* Flush what's buffered and close the file.
+ * - Returns 0, or -1 with errno set if any write failed.
+ */
+static int recorder_close(recorder_t *recorder) {
+  int ret = recorder_flush(recorder);
+  int err = errno;
+  if (close(recorder->fd) == -1 && ret == 0)
+    return -1;
+  recorder->fd = -1;
+  errno = err;
+  return ret;
+}
+
+/* ------------------- Event loop ------------------------------------------ */
+
+/* One thread, one epoll set, four kinds of source:
+ *  - The Wayland socket, level-triggered. Each wakeup does a single read into
+ *    the receive ring and dispatches it; whatever is left wakes us again next
+ *    turn. EPOLLOUT is armed only while the outgoing ring is blocked on a
+ *    full socket.
+ *  - The PTY master, edge-triggered. It is read in PTY_READ_CHUNK pieces that
+ *    go straight to the parser, until EAGAIN or until PTY_READ_BUDGET_NS of
+ *    parsing in one turn. The budget is time, not bytes, because what a byte
+ *    costs depends on what it does (a newline at the bottom scrolls the
+ *    grid); it is a fraction of a refresh so a flood can't push renders past
+ *    their vblank. When the budget runs out the edge won't fire again, so the
+ *    next epoll_wait doesn't block and the backlog is read after the other
+ *    sources have had their turn.
+ *  - A timerfd for the cursor blink and a signalfd for SIGCHLD and SIGUSR1
+ *    (trace dump), level-triggered and drained on every wakeup.
+ *    The blink stops (cursor solid) after CURSOR_BLINK_TIMEOUT_NS without
+ *    output, so an idle terminal has no timer waking it.
+ * Painting is not driven by any of them. Sources only mark the frame dirty;
+ * each turn ends with frame_maybe_render, which renders at most once and
+ * only after the last frame's wl_surface.frame callback fired. However fast
+ * a program writes, it gets at most one repaint per display refresh.
+ */
+
+#define PTY_READ_CHUNK (64U * 1024U)
+#define PTY_READ_BUDGET_NS 4000000ULL /* per loop turn, a quarter of a 60 Hz frame */
+#define REACTOR_MAX_EVENTS 8U
+#define CURSOR_BLINK_NS 500000000ULL
+#define CURSOR_BLINK_TIMEOUT_NS 10000000000ULL
+
+typedef struct reactor_t reactor_t;
+typedef struct reactor_stats_t reactor_stats_t;
+typedef enum reactor_source_t reactor_source_t;
+
+enum reactor_source_t {
+  REACTOR_WAYLAND,
+  REACTOR_PTY,
+  REACTOR_TIMER,
+  REACTOR_SIGNAL,
+};
+
+struct reactor_stats_t {
+  uint64_t turns;              // epoll_wait calls
+  uint64_t pty_reads;
+  uint64_t pty_bytes;
+  uint64_t pty_budget_hits;    // turns that left PTY data for the next one
+  uint64_t blinks;
+};
+
+struct reactor_t {
+  int epoll_fd;
+  int pty_fd;                  // -1 once the child side hung up
+  int timer_fd;
+  int signal_fd;
+  pid_t child;
+  bool pty_backlog;            // budget ran out before EAGAIN
+  bool wayland_out_armed;      // EPOLLOUT in the Wayland fd's interest set
+  bool blink_armed;
+  uint64_t last_output_ns;     // the blink times out relative to this
+  recorder_t *recorder;        // KASAMA_RECORD, NULL when not recording
+
+  uint8_t pty_buf[PTY_READ_CHUNK];
+  reactor_stats_t stats;
+};
+
+static int reactor_watch(reactor_t *reactor, int op, int fd, reactor_source_t source, uint32_t events) {
+  struct epoll_event ev = {.events = events, .data.u32 = source};
+  return epoll_ctl(reactor->epoll_fd, op, fd, &ev);
+}
+
+/* Start or stop the periodic cursor blink timer. */
+static int reactor_arm_blink(reactor_t *reactor, bool arm) {
+  struct timespec period = {.tv_sec = CURSOR_BLINK_NS / 1000000000ULL,
+                            .tv_nsec = CURSOR_BLINK_NS % 1000000000ULL};
+  struct itimerspec spec = {0};
+  if (arm)
+    spec = (struct itimerspec){.it_interval = period, .it_value = period};
+  if (timerfd_settime(reactor->timer_fd, 0, &spec, NULL) == -1)
+    return -1;
+  reactor->blink_armed = arm;
+  return 0;
+}
+
+/* Blink timer tick: flip the cursor, or park it visible and stop the timer
+ * once nothing has been printed for CURSOR_BLINK_TIMEOUT_NS. */
+static void reactor_blink(reactor_t *reactor, state_t *state) {
+  if (!state->term)
+    return;
+  if (monotonic_ns() - reactor->last_output_ns >= CURSOR_BLINK_TIMEOUT_NS) {
+    reactor_arm_blink(reactor, false);
+    if (state->term->cursor_visible)
+      return;
+  }
+  term_blink(state->term);
+  reactor->stats.blinks++;
+  frame_mark_dirty(state);
+}
+
+/* Create the epoll set and register every source.
+ * - signals: blocked by the caller, delivered through the signalfd instead
+ * - Returns 0, or -1 with errno set.
+ */
+static int reactor_init(reactor_t *reactor, int wayland_fd, int pty_fd, pid_t child,
+                        const sigset_t *signals) {
+  memset(reactor, 0, sizeof(*reactor));
+  reactor->pty_fd = pty_fd;
+  reactor->child = child;
+  reactor->timer_fd = reactor->signal_fd = -1;
+
+  reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (reactor->epoll_fd == -1)
+    return -1;
+
+  reactor->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (reactor->timer_fd == -1)
+    return -1;
+  reactor->last_output_ns = monotonic_ns();
+  if (reactor_arm_blink(reactor, true) == -1)
+    return -1;
+
+  reactor->signal_fd = signalfd(-1, signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (reactor->signal_fd == -1)
+    return -1;
+
+  if (reactor_watch(reactor, EPOLL_CTL_ADD, wayland_fd, REACTOR_WAYLAND, EPOLLIN) == -1 ||
+      reactor_watch(reactor, EPOLL_CTL_ADD, pty_fd, REACTOR_PTY, EPOLLIN | EPOLLET) == -1 ||
+      reactor_watch(reactor, EPOLL_CTL_ADD, reactor->timer_fd, REACTOR_TIMER, EPOLLIN) == -1 ||
+      reactor_watch(reactor, EPOLL_CTL_ADD, reactor->signal_fd, REACTOR_SIGNAL, EPOLLIN) == -1)
+    return -1;
+  return 0;
+}
+
+static void reactor_free(reactor_t *reactor) {
+  int fds[] = {reactor->epoll_fd, reactor->timer_fd, reactor->signal_fd, reactor->pty_fd};
+  for (uint64_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+    if (fds[i] != -1)
+      close(fds[i]);
+  }
+  memset(reactor, 0, sizeof(*reactor));
+}
+
+/* The child side is gone: stop watching the master. Whatever it wrote last
+ * has already been read. */
+static void reactor_close_pty(reactor_t *reactor) {
+  epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, reactor->pty_fd, NULL);
+  close(reactor->pty_fd);
+  reactor->pty_fd = -1;
+  reactor->pty_backlog = false;
+}
+
+/* Read and parse PTY output until EAGAIN or the per-turn budget is spent. */
+static void reactor_read_pty(reactor_t *reactor, state_t *state) {
+  uint64_t start = monotonic_ns(), now = start;
+  reactor->pty_backlog = false;
+
+  while (reactor->pty_fd != -1) {
+    if (now - start >= PTY_READ_BUDGET_NS) {
+      reactor->pty_backlog = true;
+      reactor->stats.pty_budget_hits++;
+      break;
+    }
+    ssize_t n = read(reactor->pty_fd, reactor->pty_buf, sizeof(reactor->pty_buf));
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    if (n <= 0) { // EIO once the last slave fd closes
+      reactor_close_pty(reactor);
+      state->input.pty_fd = -1;
+      break;
+    }
+
+    reactor->stats.pty_reads++;
+    reactor->stats.pty_bytes += (uint64_t)n;
+    if (reactor->recorder)
+      recorder_write(reactor->recorder, reactor->pty_buf, (uint32_t)n);
+    term_feed(state->term, reactor->pty_buf, (uint64_t)n);
+    now = monotonic_ns();
+  }
+
+  if (now != start) {
+    input_note_output(&state->input);
+    frame_mark_dirty(state);
+    reactor->last_output_ns = now;
+    if (!reactor->blink_armed)
+      reactor_arm_blink(reactor, true);
+  }
+}
+
+static void reactor_handle_signals(reactor_t *reactor, state_t *state) {
+  struct signalfd_siginfo info;
+  while (read(reactor->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+    if (info.ssi_signo == SIGCHLD) {
+      int status;
+      pid_t pid;
+      while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        if (pid == reactor->child) {
+          reactor->child = -1;
+          state->state = STATE_CLOSED; // the shell exited, so does the window
+        }
+      }
+    } else if (info.ssi_signo == SIGUSR1) {
+      const char *path = trace_path();
+      if (trace_dump(path) == -1)
+        fprintf(stderr, "trace dump to %s: %s\n", path, strerror(errno));
+    }
+  }
+}
+
+/* Keep EPOLLOUT armed exactly while queued requests wait on a full socket. */
+static int reactor_update_wayland_out(reactor_t *reactor, wayland_conn_t *conn) {
+  if (conn->out_blocked == reactor->wayland_out_armed)
+    return 0;
+  reactor->wayland_out_armed = conn->out_blocked;
+  return reactor_watch(reactor, EPOLL_CTL_MOD, conn->fd, REACTOR_WAYLAND,
+                       EPOLLIN | (conn->out_blocked ? EPOLLOUT : 0));
+}
+
+/* Run until the window is closed or the shell exits.
+ * - Returns 0, or -1 with errno set if the connection or a source broke.
+ */
+static int reactor_run(reactor_t *reactor, wayland_conn_t *conn, state_t *state) {
+  struct epoll_event events[REACTOR_MAX_EVENTS];
+
+  while (state->state != STATE_CLOSED) {
+    int n = epoll_wait(reactor->epoll_fd, events, REACTOR_MAX_EVENTS, reactor->pty_backlog ? 0 : -1);
+    reactor->stats.turns++;
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+      return -1;
+
+    bool pty_ready = reactor->pty_backlog;
+    for (int i = 0; i < n; i++) {
+      uint32_t ev = events[i].events;
+      switch ((reactor_source_t)events[i].data.u32) {
+      case REACTOR_WAYLAND:
+        if (ev & EPOLLIN) {
+          if (wayland_conn_read(conn) == -1 || wayland_conn_dispatch(conn, state) == -1)
+            return -1;
+        } else if (ev & (EPOLLERR | EPOLLHUP)) {
+          conn->error = ECONNRESET;
+          errno = conn->error;
+          return -1;
+        }
+        if ((ev & EPOLLOUT) && wayland_conn_flush(conn) == -1)
+          return -1;
+        break;
+      case REACTOR_PTY:
+        pty_ready = true; // EPOLLHUP too: the final output is still to be read
+        break;
+      case REACTOR_TIMER: {
+        uint64_t expirations;
+        if (read(reactor->timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+          reactor_blink(reactor, state);
+        break;
+      }
+      case REACTOR_SIGNAL:
+        reactor_handle_signals(reactor, state);
+        break;
+      }
+    }
+
+    // after the socket, so input queued this turn is handled before the
+    // next chunk of output
+    input_drain(state);
+    if (pty_ready)
+      reactor_read_pty(reactor, state);
+
+    if (state->state != STATE_CLOSED)
+      frame_maybe_render(conn, state);
+
+    if (wayland_conn_flush(conn) == -1 || reactor_update_wayland_out(reactor, conn) == -1)
+      return -1;
+  }
+  return 0;
+}
+
+/* ------------------- Startup -------------------------------------------- */
+
+/* Startup is pipelined so the compositor's round trips overlap our own work:
+ *  1) client_startup_begin sends wl_display.get_registry and a
+ *     wl_display.sync in one flush and returns without waiting, so the
+ *     caller can load fonts meanwhile.
+ *  2) client_startup_finish waits for the sync. Every global was bound from
+ *     that one batch of events as it was dispatched, and the binds go out in
+ *     the same flush as create_surface, get_xdg_surface, get_toplevel and the
+ *     initial commit: the ids are ours, so nothing waits for the binds.
+ *  3) While the compositor answers with the first configure, the shm pool
+ *     and the swapchain's buffers are created for the size we asked for. If
+ *     the configure picks another size, the first render_frame rebuilds the
+ *     chain from the same pool.
+ * That is two round trips (registry, configure) to a window that can be
+ * drawn, the minimum xdg-shell allows.
+ */
+
+/* Connect and ask for the globals, without waiting for them.
+ * - Returns 0, or -1 with errno set.
+ */
+static int client_startup_begin(wayland_conn_t *conn, state_t *state) {
+  state->pool.fd = -1;
+  state->input.pty_fd = -1;
+  state->startup = (startup_stats_t){.start_ns = monotonic_ns()};
+  if (wayland_conn_connect(conn) == -1)
+    return -1;
+  LOG("connected: fd=%d\n", conn->fd);
+
+  state->wl_registry = wayland_wl_display_get_registry(conn);
+  state->sync_callback = state->wl_registry ? wayland_wl_display_sync(conn) : 0;
+  if (!state->sync_callback)
+    return -1;
+  return wayland_conn_flush(conn);
+}
+
+static int client_startup_wait(wayland_conn_t *conn, state_t *state) {
+  state->startup.waits++;
+  return swapchain_wait_event(conn, state);
+}
+
+/* Get a configured window with its swapchain, ready for the first
+ * render_frame.
+ * - state: width and height set to the initial window size
+ * - Returns 0, or -1 with errno set (EPROTONOSUPPORT if a needed global is
+ *   missing).
+ */
+static int client_startup_finish(wayland_conn_t *conn, state_t *state) {
+  while (state->sync_callback) {
+    if (client_startup_wait(conn, state) == -1)
+      return -1;
+  }
+  state->startup.globals_ns = monotonic_ns() - state->startup.start_ns;
+  if (!state->wl_compositor || !state->wl_shm || !state->xdg_wm_base) {
+    fprintf(stderr, "compositor lacks wl_compositor v4, wl_shm or xdg_wm_base\n");
+    errno = EPROTONOSUPPORT;
+    return -1;
+  }
+
+  // the window: an initial commit without a buffer asks for a configure
+  state->wl_surface = wayland_wl_compositor_create_surface(conn, state);
+  state->xdg_surface = wayland_xdg_wm_base_get_xdg_surface(conn, state);
+  state->xdg_toplevel = wayland_xdg_surface_get_toplevel(conn, state);
+  if (!state->xdg_toplevel)
+    return -1;
+  wayland_wl_surface_commit(conn, state);
+  if (wayland_conn_flush(conn) == -1)
+    return -1;
+
+  // pixels, speculatively at the size we asked for; the pool starts with
+  // room for a full chain
+  shm_pool_t *pool = &state->pool;
+  if (swapchain_frame_size(state) > SWAPCHAIN_FRAME_MAX) {
+    errno = EOVERFLOW;
+    return -1;
+  }
+  if (shm_pool_init(pool, SWAPCHAIN_MAX * shm_round_up((uint32_t)swapchain_frame_size(state), SHM_POOL_ALIGN)) == -1)
+    return -1;
+  pool->wl_shm_pool = wayland_wl_shm_create_pool(conn, state->wl_shm, pool->fd, pool->size);
+  if (!pool->wl_shm_pool || swapchain_init(conn, state) == -1 || wayland_conn_flush(conn) == -1)
+    return -1;
+#ifdef MADV_POPULATE_WRITE
+  // fault in the buffer the first frame is drawn into (best effort, 5.14+)
+  shm_block_t first = state->swapchain.buffers[0].block;
+  madvise(pool->data + first.offset, first.size, MADV_POPULATE_WRITE);
+#endif
+
+  while (state->state == STATE_NONE) {
+    if (client_startup_wait(conn, state) == -1)
+      return -1;
+  }
+  return 0;
+}
+
+static void startup_stats_log(state_t *state) {
+  startup_stats_t *s = &state->startup;
+  LOG("startup: globals=%.2fms configure=%.2fms first_frame=%.2fms waits=%u\n",
+      (double)s->globals_ns / 1e6, (double)s->configure_ns / 1e6, (double)s->first_frame_ns / 1e6,
+      s->waits);
+}
+
+/* Drop the connection and the shm pool. The compositor cleans up every
+ * object of a client that hangs up, so nothing is destroyed explicitly. */
+static void client_shutdown(wayland_conn_t *conn, state_t *state) {
+  shm_pool_destroy(&state->pool);
+  wayland_conn_free(conn);
+}
+
+/* ------------------- Main (program flow) --------------------------------- */
+
+/* The main routine:
+ *  - Connects to the Wayland display and asks for the globals
+ *  - Loads the font while they arrive, then binds the globals (wl_compositor,
+ *    wl_shm, wl_seat, xdg_wm_base) and creates an xdg_surface and
+ *    xdg_toplevel in one flush
+ *  - Creates the shm pool and the swapchain's buffers while it waits for the
+ *    first configure
+ *  - Starts a shell on a PTY and hands everything to the event loop, which
+ *    parses its output, feeds it keystrokes and paints on frame callbacks
+ *    through render_frame.
+ */
+#ifndef KASAMA_NO_MAIN
+#define WINDOW_WIDTH 800U
+#define WINDOW_HEIGHT 600U
+#define ENTITY_DEMO_SPEED 200U   /* top entity speed, pixels per second along an axis */
+#define ENTITY_DEMO_IDLE_MS 16   /* wait for events at most this long without a frame callback */
+
+/* The entity demo: `count` ENTITY_SIZE squares at random places and
+ * velocities in a world of twice the window's width and height, drawn
+ * instead of a terminal until the window is closed. Each frame moves them
+ * by the time since the last one and waits for its callback.
+ * - Returns 0, or -1 with errno set.
+ */
+static int entity_demo(wayland_conn_t *conn, state_t *state, uint64_t count) {
+  if (count == 0 || count > UINT32_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+  entity_kernels_init();
+  static entity_store_t store;
+  uint32_t world_w = 2 * (state->width > ENTITY_SIZE ? state->width : ENTITY_SIZE);
+  uint32_t world_h = 2 * (state->height > ENTITY_SIZE ? state->height : ENTITY_SIZE);
+  if (entity_store_init(&store, count, (float)world_w, (float)world_h) == -1)
+    return -1;
+  uint32_t seed = (uint32_t)monotonic_ns() | 1;
+  for (uint64_t i = 0; i < count; i++) {
+    uint32_t r[5];
+    for (uint32_t k = 0; k < 5; k++) {
+      seed ^= seed << 13; // xorshift
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      r[k] = seed;
+    }
+    entity_store_add(&store, (float)(r[0] % (world_w - ENTITY_SIZE)), (float)(r[1] % (world_h - ENTITY_SIZE)),
+                     (float)(r[2] % (2 * ENTITY_DEMO_SPEED)) - (float)ENTITY_DEMO_SPEED,
+                     (float)(r[3] % (2 * ENTITY_DEMO_SPEED)) - (float)ENTITY_DEMO_SPEED,
+                     ENTITY_SIZE, ENTITY_SIZE, r[4] & 0xffffff);
+  }
+  state->entities = &store;
+  LOG("entities: count=%" PRIu64 " world=%ux%u kernels=%s\n", count, world_w, world_h, entity_kernels->name);
+
+  int ret = 0;
+  uint64_t last = monotonic_ns();
+  while (ret == 0 && state->state != STATE_CLOSED) {
+    uint64_t now = monotonic_ns();
+    float dt = (float)(now - last) / 1e9f;
+    last = now;
+    entity_store_update(&store, dt < 0.1f ? dt : 0.1f); // a stall doesn't teleport them
+    frame_mark_dirty(state);
+    frame_maybe_render(conn, state);
+
+    // a frame that wasn't drawn (no free buffer, or nothing on screen)
+    // leaves no callback to wait for, so retry after a while
+    if (wayland_conn_flush(conn) == -1) {
+      ret = -1;
+      break;
+    }
+    struct pollfd pfd = {.fd = conn->fd, .events = POLLIN};
+    int ready = poll(&pfd, 1, state->frame.callback ? -1 : ENTITY_DEMO_IDLE_MS);
+    wayland_conn_count_syscall(conn);
+    if (ready == -1 && errno != EINTR)
+      ret = -1;
+    else if (ready > 0 && (wayland_conn_read(conn) == -1 || wayland_conn_dispatch(conn, state) == -1))
+      ret = -1;
+    input_drain(state);
+  }
+  LOG("entities: visible=%" PRIu64 " (last frame)\n", store.visible_len);
+  startup_stats_log(state);
+  frame_stats_log(state);
+  wayland_conn_stats_log(conn);
+  state->entities = NULL;
+  entity_store_free(&store);
+  return ret;
+}
+
+int main(void) {
+  pixel_kernels_init();
+  term_scan_kernels_init();
+
+  static wayland_conn_t conn; // rings are too big for the stack
+  static reactor_t reactor;
+  state_t state = {.width = WINDOW_WIDTH, .height = WINDOW_HEIGHT, .redraw_all = true};
+
+  if (client_startup_begin(&conn, &state) == -1) {
+    fprintf(stderr, "startup failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  // the font loads while the compositor answers the registry; the grid
+  // waits for the configured size
+  font_t font;
+  glyph_atlas_t atlas;
+  term_t term;
+  char *font_path = getenv("KASAMA_FONT");
+  if (font_path ? font_load_psf(&font, font_path) : font_load_embedded(&font)) {
+    fprintf(stderr, "can't load font %s: %s\n", font_path ? font_path : "(embedded)", strerror(errno));
+    return 1;
+  }
+  if (glyph_atlas_init(&atlas, &font) == -1) {
+    perror("glyph_atlas_init");
+    return 1;
+  }
+  if (client_startup_finish(&conn, &state) == -1) {
+    fprintf(stderr, "startup failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  // KASAMA_ENTITIES=n runs the entity demo with n entities instead of a shell
+  char *entities = getenv("KASAMA_ENTITIES");
+  if (entities) {
+    int ret = entity_demo(&conn, &state, strtoull(entities, NULL, 10));
+    if (ret == -1)
+      fprintf(stderr, "entity demo: %s\n", strerror(errno));
+    glyph_atlas_free(&atlas);
+    font_free(&font);
+    client_shutdown(&conn, &state);
+    return ret == -1 ? 1 : 0;
+  }
+
+  if (term_init(&term, term_cells_fit(state.width, atlas.cell_w), term_cells_fit(state.height, atlas.cell_h)) == -1) {
+    perror("terminal");
+    return 1;
+  }
+  // KASAMA_SCROLLBACK_LINES=n keeps n rows of scrollback, of which up to
+  // KASAMA_SCROLLBACK_KB=n KiB (compressed) stay in memory
+  char *scrollback_lines = getenv("KASAMA_SCROLLBACK_LINES");
+  char *scrollback_kb = getenv("KASAMA_SCROLLBACK_KB");
+  term_set_scrollback(&term, scrollback_lines ? (uint32_t)strtoul(scrollback_lines, NULL, 10) : TERM_HISTORY_LINES,
+                      scrollback_kb ? strtoull(scrollback_kb, NULL, 10) << 10 : TERM_HISTORY_BUDGET);
+  state.atlas = &atlas;
+  state.term = &term;
+
+  // SIGCHLD and SIGUSR1 (dump the trace) are read from a signalfd,
+  // so they must stay blocked; the shell gets the original mask back
+  sigset_t signals, old_mask;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGCHLD);
+  sigaddset(&signals, SIGUSR1);
+  sigprocmask(SIG_BLOCK, &signals, &old_mask);
+
+  pid_t child;
+  int pty_fd = pty_spawn(&term, &atlas, &old_mask, &child);
+  if (pty_fd == -1) {
+    perror("pty_spawn");
+    return 1;
+  }
+  if (reactor_init(&reactor, conn.fd, pty_fd, child, &signals) == -1) {
+    perror("reactor_init");
+    return 1;
+  }
+  state.input.pty_fd = pty_fd;
+
+  // KASAMA_RECORD=path records the shell's output for kasama_replay
+  static recorder_t recorder;
+  char *record_path = getenv("KASAMA_RECORD");
+  if (record_path) {
+    if (recorder_open(&recorder, record_path, term.cols, term.rows) == -1) {
+      fprintf(stderr, "can't record to %s: %s\n", record_path, strerror(errno));
+      return 1;
+    }
+    reactor.recorder = &recorder;
+  }
+
+  // KASAMA_RENDER_THREADS=n (n > 1) draws frames on n threads; started after
+  // the fork above, with the signals routed to the signalfd already blocked
+  static render_tiles_t tiles;
+  char *render_threads = getenv("KASAMA_RENDER_THREADS");
+  if (render_threads && strtoul(render_threads, NULL, 10) > 1) {
+    if (render_tiles_init(&tiles, (uint32_t)strtoul(render_threads, NULL, 10)) == -1) {
+      perror("render_tiles_init");
+      return 1;
+    }
+    state.tiles = &tiles;
+  }
+
+  frame_mark_dirty(&state); // the first frame
+  int ret = reactor_run(&reactor, &conn, &state);
+  if (ret == -1)
+    fprintf(stderr, "event loop: %s\n", strerror(errno));
+  LOG("loop: turns=%" PRIu64 " pty_reads=%" PRIu64 " pty_bytes=%" PRIu64 " budget_hits=%" PRIu64 " blinks=%" PRIu64 "\n",
+      reactor.stats.turns, reactor.stats.pty_reads, reactor.stats.pty_bytes,
+      reactor.stats.pty_budget_hits, reactor.stats.blinks);
+  startup_stats_log(&state);
+  frame_stats_log(&state);
+  wayland_conn_stats_log(&conn);
+  input_stats_log(&state);
+  term_stats_log(&term);
+  if (reactor.recorder) {
+    LOG("recording: records=%" PRIu64 " bytes=%" PRIu64 "\n", recorder.records, recorder.bytes);
+    if (recorder_close(&recorder) == -1)
+      fprintf(stderr, "recording to %s: %s\n", record_path, strerror(errno));
+  }
+  if (state.tiles)
+    LOG("render: threads=%u batches=%" PRIu64 " jobs=%" PRIu64 " steals=%" PRIu64 "\n",
+        tiles.pool.threads, tiles.pool.batches, tiles.pool.jobs, atomic_load(&tiles.pool.steals));
+#ifdef KASAMA_TRACE
+  if (getenv("KASAMA_TRACE_FILE") && trace_dump(trace_path()) == -1)
+    fprintf(stderr, "trace dump to %s: %s\n", trace_path(), strerror(errno));
+#endif
+
+  if (reactor.child > 0)
+    kill(reactor.child, SIGHUP);
+  reactor_free(&reactor);
+  if (state.tiles)
+    render_tiles_free(state.tiles);
+  term_free(&term);
+  glyph_atlas_free(&atlas);
+  font_free(&font);
+  client_shutdown(&conn, &state);
+  return ret == -1 ? 1 : 0;
 }
+#endif
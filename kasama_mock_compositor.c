@@ -0,0 +1,902 @@
+/* kasama_mock_compositor.c
+ *
+ * ------------------------------------------------------------
+ *
+ * A headless stand-in for a Wayland compositor, with just enough of the
+ * protocol to run kasama against it: wl_display, wl_registry, wl_compositor,
+ * wl_shm with its pools and buffers, wl_surface, wl_seat (no capabilities)
+ * and xdg_wm_base with xdg_surface/xdg_toplevel. Clients are served one at a
+ * time.
+ *
+ * Nothing is displayed. Commits are "scanned out" on a virtual vsync: the
+ * damaged pixels are read from the client's shm pool (so the memory traffic
+ * of a real compositor is there), the frame callbacks committed since the
+ * last vsync fire, and the buffer shown before is released. With a rate of 0
+ * every commit is scanned out as soon as it arrives, which is what the
+ * throughput benchmarks want.
+ *
+ * -z simulates an interactive resize: from the first frame on, every vsync
+ * sends a new toplevel size, sweeping between half and one and a half times
+ * the -s size by the given number of pixels per vsync.
+ *
+ * -o plays a broken compositor: the first wl_display.sync after wl_shm is
+ * bound is answered with 1000 wl_shm.format events and then one event that
+ * declares the given size, past the protocol's 4096 bytes. The client reads
+ * the filler in its first 16 KiB, so the big event wraps the end of its
+ * receive ring; it must hang up with a protocol error.
+ *
+ * Compile / run:
+ *   gcc -std=c11 -O2 -o kasama_mock_compositor kasama_mock_compositor.c
+ *   ./kasama_mock_compositor [-d name] [-r hz] [-s WxH] [-z px] [-o bytes] [-1] [-v]
+ *   WAYLAND_DISPLAY=kasama-mock-0 ./kasama
+ *
+ * kasama_bench.c includes this file with KASAMA_MOCK_NO_MAIN defined and
+ * runs it in a child process.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _XOPEN_SOURCE 700
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MOCK_DEFAULT_NAME "kasama-mock-0"
+#define MOCK_IN_CAP 65536U         /* receive buffer, must hold one max-size message */
+#define MOCK_OUT_CAP 16384U        /* events are flushed when this fills up */
+#define MOCK_MAX_FDS 32U
+#define MOCK_MAX_SURFACES 8U
+#define MOCK_MAX_CALLBACKS 32U     /* frame callbacks per surface and state */
+#define MOCK_HEADER_SIZE 8U
+
+#define mock_roundup_4(n) (((n) + 3) & ~3U)
+
+typedef enum mock_interface_t mock_interface_t;
+typedef struct mock_config_t mock_config_t;
+typedef struct mock_stats_t mock_stats_t;
+typedef struct mock_pool_t mock_pool_t;
+typedef struct mock_surface_t mock_surface_t;
+typedef struct mock_object_t mock_object_t;
+typedef struct mock_client_t mock_client_t;
+
+enum mock_interface_t {
+  MOCK_NONE,
+  MOCK_WL_DISPLAY,
+  MOCK_WL_REGISTRY,
+  MOCK_WL_CALLBACK,
+  MOCK_WL_COMPOSITOR,
+  MOCK_WL_SHM,
+  MOCK_WL_SHM_POOL,
+  MOCK_WL_BUFFER,
+  MOCK_WL_SURFACE,
+  MOCK_WL_SEAT,
+  MOCK_XDG_WM_BASE,
+  MOCK_XDG_SURFACE,
+  MOCK_XDG_TOPLEVEL,
+};
+
+/* Globals in registry order; the name of a global is its index + 1 */
+static const struct {
+  const char *name;
+  mock_interface_t interface;
+  uint32_t version;
+} mock_globals[] = {
+  {"wl_compositor", MOCK_WL_COMPOSITOR, 5},
+  {"wl_shm", MOCK_WL_SHM, 1},
+  {"xdg_wm_base", MOCK_XDG_WM_BASE, 2},
+  {"wl_seat", MOCK_WL_SEAT, 7},
+};
+
+struct mock_config_t {
+  uint64_t vsync_ns;           // 0: scan out on every commit
+  uint32_t width, height;      // sent in the first toplevel configure
+  uint32_t drag_px;            // resize by this much per vsync, 0: fixed size
+  uint32_t oversize;           // send one event of this size, see -o; 0: never
+  bool verbose;
+};
+
+struct mock_stats_t {
+  uint64_t requests;
+  uint64_t bytes_received;
+  uint64_t bytes_sent;
+  uint64_t commits;
+  uint64_t vsyncs;             // scanouts that had something new
+  uint64_t pixels_read;        // damaged pixels read from client buffers
+  uint64_t configures;         // toplevel configures after the first
+  uint64_t pool_resizes;
+  uint32_t checksum;           // of those pixels, so the reads can't be elided
+};
+
+/* An mmap'd wl_shm_pool. Buffers keep it mapped after the pool object is
+ * destroyed, as the protocol requires. */
+struct mock_pool_t {
+  uint8_t *data;
+  uint64_t size;
+  uint32_t refs;
+  int fd;                      // kept for wl_shm_pool.resize
+};
+
+/* Double-buffered wl_surface state: requests fill `pending`, commit moves it
+ * to `committed`, and the next vsync makes that current. */
+struct mock_surface_t {
+  bool used;
+  uint32_t id;
+  uint32_t xdg_surface;
+  bool configured;             // initial configure sent
+  uint32_t drag;               // vsyncs into the simulated resize
+
+  uint32_t pending_buffer;     // 0: no attach since the last commit
+  bool pending_attached;
+  uint32_t pending_damage[4];  // bounding box x0, y0, x1, y1 (x1 == 0: none)
+  uint32_t pending_callbacks[MOCK_MAX_CALLBACKS];
+  uint32_t pending_callbacks_len;
+
+  uint32_t committed_buffer;
+  bool committed_new;          // a buffer was committed since the last vsync
+  uint32_t committed_damage[4];
+  uint32_t committed_callbacks[MOCK_MAX_CALLBACKS];
+  uint32_t committed_callbacks_len;
+
+  uint32_t current_buffer;     // scanned out, released when replaced
+};
+
+struct mock_object_t {
+  uint8_t interface;           // mock_interface_t, MOCK_NONE if free
+  union {
+    mock_pool_t *pool;         // wl_shm_pool
+    struct {                   // wl_buffer
+      mock_pool_t *pool;
+      uint32_t offset, width, height, stride;
+    } buffer;
+    uint32_t surface;          // wl_surface, xdg_surface, xdg_toplevel: index into surfaces
+  };
+};
+
+struct mock_client_t {
+  int fd;
+  bool broken;
+  uint32_t serial;
+  uint32_t shm;                // bound wl_shm, 0 if none
+  bool oversize_sent;
+
+  mock_object_t *objects;      // indexed by client-allocated id
+  uint32_t objects_cap;
+
+  uint8_t in[MOCK_IN_CAP];
+  uint32_t in_len;
+  int fds[MOCK_MAX_FDS];
+  uint32_t fds_len;
+
+  _Alignas(uint32_t) uint8_t out[MOCK_OUT_CAP];
+  uint32_t out_len;
+
+  mock_surface_t surfaces[MOCK_MAX_SURFACES];
+};
+
+static const mock_config_t *mock_config;
+static mock_stats_t mock_stats;
+
+static uint64_t mock_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* ------------------- Objects --------------------------------------------- */
+
+static mock_object_t *mock_object(mock_client_t *client, uint32_t id) {
+  if (id >= client->objects_cap || client->objects[id].interface == MOCK_NONE)
+    return NULL;
+  return &client->objects[id];
+}
+
+static mock_object_t *mock_object_new(mock_client_t *client, uint32_t id, mock_interface_t interface) {
+  if (id == 0 || id >= 0xff000000U) // ids from the server range aren't the client's to pick
+    return NULL;
+  if (id >= client->objects_cap) {
+    uint32_t cap = client->objects_cap ? client->objects_cap : 64;
+    while (cap <= id)
+      cap *= 2;
+    mock_object_t *objects = realloc(client->objects, sizeof(*objects) * cap);
+    if (!objects)
+      return NULL;
+    memset(objects + client->objects_cap, 0, sizeof(*objects) * (cap - client->objects_cap));
+    client->objects = objects;
+    client->objects_cap = cap;
+  }
+  mock_object_t *object = &client->objects[id];
+  if (object->interface != MOCK_NONE)
+    return NULL; // id still in use
+  memset(object, 0, sizeof(*object));
+  object->interface = (uint8_t)interface;
+  return object;
+}
+
+static void mock_pool_unref(mock_pool_t *pool) {
+  if (pool && --pool->refs == 0) {
+    munmap(pool->data, pool->size);
+    close(pool->fd);
+    free(pool);
+  }
+}
+
+/* ------------------- Events ---------------------------------------------- */
+
+static int mock_flush(mock_client_t *client) {
+  uint32_t sent = 0;
+  while (sent < client->out_len && !client->broken) {
+    ssize_t n = send(client->fd, client->out + sent, client->out_len - sent, MSG_NOSIGNAL);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      struct pollfd pfd = {.fd = client->fd, .events = POLLOUT};
+      poll(&pfd, 1, -1);
+      continue;
+    }
+    if (n <= 0) {
+      client->broken = true;
+      break;
+    }
+    sent += (uint32_t)n;
+  }
+  mock_stats.bytes_sent += sent;
+  client->out_len = 0;
+  return client->broken ? -1 : 0;
+}
+
+/* Queue an event whose arguments are all u32 (ids, ints, uints). */
+static void mock_send(mock_client_t *client, uint32_t object_id, uint16_t opcode,
+                      const uint32_t *args, uint32_t args_len) {
+  uint32_t size = MOCK_HEADER_SIZE + args_len * 4;
+  if (client->out_len + size > MOCK_OUT_CAP)
+    mock_flush(client);
+  uint32_t *out = (uint32_t *)(client->out + client->out_len);
+  out[0] = object_id;
+  out[1] = size << 16 | opcode;
+  if (args_len)
+    memcpy(out + 2, args, args_len * 4);
+  client->out_len += size;
+}
+
+/* -o: wl_shm.format filler, then an event of config->oversize bytes, in one
+ * send so they reach the client's socket together */
+static void mock_send_oversize(mock_client_t *client) {
+  const uint32_t filler = 1000, filler_size = MOCK_HEADER_SIZE + 4;
+  uint32_t size = mock_roundup_4(mock_config->oversize < 65532 ? mock_config->oversize : 65532);
+  uint32_t *words = calloc(filler * filler_size / 4 + size / 4, 4);
+  if (!words || mock_flush(client) == -1) {
+    free(words);
+    return;
+  }
+  uint32_t at = 0;
+  for (uint32_t i = 0; i < filler; i++) {
+    words[at++] = client->shm;
+    words[at++] = filler_size << 16; // wl_shm.format
+    words[at++] = 1;                 // xrgb8888
+  }
+  words[at] = client->shm;
+  words[at + 1] = size << 16;
+  uint32_t len = at * 4 + size, sent = 0;
+  while (sent < len) {
+    ssize_t n = send(client->fd, (char *)words + sent, len - sent, MSG_NOSIGNAL);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      struct pollfd pfd = {.fd = client->fd, .events = POLLOUT};
+      poll(&pfd, 1, -1);
+      continue;
+    }
+    if (n <= 0)
+      break; // the client hung up on us, as it should
+    sent += (uint32_t)n;
+  }
+  mock_stats.bytes_sent += sent;
+  client->oversize_sent = true;
+  free(words);
+}
+
+/* wl_registry.global and the like: u32, string, u32 */
+static void mock_send_global(mock_client_t *client, uint32_t registry, uint32_t name,
+                             const char *interface, uint32_t version) {
+  uint32_t interface_len = (uint32_t)strlen(interface) + 1;
+  uint32_t args[32] = {name, interface_len};
+  assert(mock_roundup_4(interface_len) / 4 + 3 <= sizeof(args) / sizeof(args[0]));
+  memcpy(args + 2, interface, interface_len);
+  uint32_t words = 2 + mock_roundup_4(interface_len) / 4;
+  args[words++] = version;
+  mock_send(client, registry, 0, args, words);
+}
+
+static void mock_delete_id(mock_client_t *client, uint32_t id) {
+  mock_object_t *object = mock_object(client, id);
+  if (object) {
+    if (object->interface == MOCK_WL_SHM_POOL)
+      mock_pool_unref(object->pool);
+    else if (object->interface == MOCK_WL_BUFFER)
+      mock_pool_unref(object->buffer.pool);
+    object->interface = MOCK_NONE;
+  }
+  mock_send(client, 1, 1, &id, 1); // wl_display.delete_id
+}
+
+static void mock_protocol_error(mock_client_t *client, uint32_t object_id, uint32_t code, const char *msg) {
+  fprintf(stderr, "mock: protocol error on object %u: %s\n", object_id, msg);
+  uint32_t msg_len = (uint32_t)strlen(msg) + 1;
+  uint32_t args[64] = {object_id, code, msg_len};
+  if (mock_roundup_4(msg_len) / 4 + 3 > sizeof(args) / sizeof(args[0]))
+    msg_len = 0;
+  memcpy(args + 3, msg, msg_len);
+  mock_send(client, 1, 0, args, 3 + mock_roundup_4(msg_len) / 4);
+  mock_flush(client);
+  client->broken = true;
+}
+
+/* ------------------- Scanout --------------------------------------------- */
+
+static void mock_damage_add(uint32_t *box, uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+  if (w == 0 || h == 0)
+    return;
+  if (box[2] == 0) {
+    box[0] = x, box[1] = y, box[2] = x + w, box[3] = y + h;
+    return;
+  }
+  if (x < box[0]) box[0] = x;
+  if (y < box[1]) box[1] = y;
+  if (x + w > box[2]) box[2] = x + w;
+  if (y + h > box[3]) box[3] = y + h;
+}
+
+/* Read a damaged region of a buffer the way a compositor uploading it would. */
+static void mock_read_damage(mock_object_t *buffer, const uint32_t *box) {
+  uint32_t x1 = box[2] < buffer->buffer.width ? box[2] : buffer->buffer.width;
+  uint32_t y1 = box[3] < buffer->buffer.height ? box[3] : buffer->buffer.height;
+  uint32_t sum = mock_stats.checksum;
+  for (uint32_t y = box[1]; y < y1; y++) {
+    const uint32_t *row = (const uint32_t *)(buffer->buffer.pool->data + buffer->buffer.offset +
+                                             (uint64_t)y * buffer->buffer.stride);
+    for (uint32_t x = box[0]; x < x1; x++)
+      sum += row[x];
+    if (x1 > box[0])
+      mock_stats.pixels_read += x1 - box[0];
+  }
+  mock_stats.checksum = sum;
+}
+
+/* Send xdg_toplevel.configure with a size and the xdg_surface.configure
+ * that completes it. */
+static void mock_configure(mock_client_t *client, mock_surface_t *surface, uint32_t width, uint32_t height) {
+  uint32_t toplevel[3] = {width, height, 0}; // empty states array
+  for (uint32_t id = 0; id < client->objects_cap; id++) {
+    if (client->objects[id].interface == MOCK_XDG_TOPLEVEL &&
+        &client->surfaces[client->objects[id].surface] == surface)
+      mock_send(client, id, 0, toplevel, 3);
+  }
+  uint32_t serial = ++client->serial;
+  mock_send(client, surface->xdg_surface, 0, &serial, 1);
+}
+
+/* Next step of a -z resize: a triangle wave from half the configured size
+ * to one and a half times it */
+static void mock_drag(mock_client_t *client, mock_surface_t *surface) {
+  uint32_t range = mock_config->width;
+  uint32_t t = (uint32_t)(((uint64_t)++surface->drag * mock_config->drag_px) % (2 * range));
+  uint32_t d = t < range ? t : 2 * range - t;
+  uint32_t width = mock_config->width / 2 + d;
+  uint32_t height = mock_config->height / 2 + (uint32_t)((uint64_t)d * mock_config->height / range);
+  mock_configure(client, surface, width, height);
+  mock_stats.configures++;
+}
+
+/* One virtual vsync: make committed state current, release what it
+ * replaced and fire the frame callbacks. */
+static void mock_vsync(mock_client_t *client) {
+  uint32_t time_ms = (uint32_t)(mock_now_ns() / 1000000ULL);
+  bool any = false;
+
+  for (uint32_t i = 0; i < MOCK_MAX_SURFACES; i++) {
+    mock_surface_t *surface = &client->surfaces[i];
+    if (!surface->used)
+      continue;
+
+    if (surface->committed_new) {
+      any = true;
+      surface->committed_new = false;
+      mock_object_t *buffer = mock_object(client, surface->committed_buffer);
+      if (buffer && surface->committed_damage[2])
+        mock_read_damage(buffer, surface->committed_damage);
+      memset(surface->committed_damage, 0, sizeof(surface->committed_damage));
+
+      if (surface->current_buffer && surface->current_buffer != surface->committed_buffer &&
+          mock_object(client, surface->current_buffer))
+        mock_send(client, surface->current_buffer, 0, NULL, 0); // wl_buffer.release
+      surface->current_buffer = surface->committed_buffer;
+      if (mock_config->drag_px)
+        mock_drag(client, surface);
+    }
+
+    for (uint32_t c = 0; c < surface->committed_callbacks_len; c++) {
+      uint32_t callback = surface->committed_callbacks[c];
+      mock_send(client, callback, 0, &time_ms, 1); // wl_callback.done
+      mock_delete_id(client, callback);
+      any = true;
+    }
+    surface->committed_callbacks_len = 0;
+  }
+
+  if (any)
+    mock_stats.vsyncs++;
+}
+
+static bool mock_has_committed(mock_client_t *client) {
+  for (uint32_t i = 0; i < MOCK_MAX_SURFACES; i++) {
+    mock_surface_t *surface = &client->surfaces[i];
+    if (surface->used && (surface->committed_new || surface->committed_callbacks_len))
+      return true;
+  }
+  return false;
+}
+
+static void mock_commit(mock_client_t *client, mock_surface_t *surface) {
+  mock_stats.commits++;
+
+  if (!surface->configured && surface->xdg_surface) {
+    // the initial commit of a role-less buffer-less surface asks for a configure
+    surface->configured = true;
+    mock_configure(client, surface, mock_config->width, mock_config->height);
+  }
+
+  if (surface->pending_attached) {
+    surface->committed_buffer = surface->pending_buffer;
+    surface->committed_new = true;
+    surface->pending_attached = false;
+  }
+  if (surface->pending_damage[2]) {
+    uint32_t *d = surface->pending_damage;
+    mock_damage_add(surface->committed_damage, d[0], d[1], d[2] - d[0], d[3] - d[1]);
+    memset(d, 0, sizeof(surface->pending_damage));
+  }
+  for (uint32_t c = 0; c < surface->pending_callbacks_len; c++) {
+    if (surface->committed_callbacks_len < MOCK_MAX_CALLBACKS)
+      surface->committed_callbacks[surface->committed_callbacks_len++] = surface->pending_callbacks[c];
+  }
+  surface->pending_callbacks_len = 0;
+}
+
+/* ------------------- Requests -------------------------------------------- */
+
+/* Handle one request. args points at the payload, as u32 words. */
+static void mock_handle_request(mock_client_t *client, uint32_t object_id, uint16_t opcode,
+                                const uint32_t *args, uint32_t args_len) {
+  mock_stats.requests++;
+  mock_object_t *object = mock_object(client, object_id);
+  if (!object) {
+    mock_protocol_error(client, 1, 0, "invalid object");
+    return;
+  }
+
+  // new_id arguments come first except where noted; check arity up front
+  static const uint8_t min_args[][12] = {
+    [MOCK_WL_DISPLAY] = {1, 1},
+    [MOCK_WL_REGISTRY] = {4},
+    [MOCK_WL_COMPOSITOR] = {1, 1},
+    [MOCK_WL_SHM] = {2, 0},
+    [MOCK_WL_SHM_POOL] = {6, 0, 1},
+    [MOCK_WL_BUFFER] = {0},
+    [MOCK_WL_SURFACE] = {0, 3, 4, 1, 1, 1, 0, 1, 1, 4, 2},
+    [MOCK_WL_SEAT] = {1, 1, 1, 0},
+    [MOCK_XDG_WM_BASE] = {0, 1, 2, 1},
+    [MOCK_XDG_SURFACE] = {0, 1, 3, 4, 1},
+    [MOCK_XDG_TOPLEVEL] = {0, 1, 1, 1, 2, 2, 2, 0, 0, 2, 2, 0},
+  };
+  if (opcode >= sizeof(min_args[0]) || args_len < min_args[object->interface][opcode]) {
+    mock_protocol_error(client, object_id, 1, "short request");
+    return;
+  }
+  if (mock_config->verbose)
+    fprintf(stderr, "mock: <- object %u opcode %u (%u words)\n", object_id, opcode, args_len);
+
+  switch ((mock_interface_t)object->interface) {
+  case MOCK_WL_DISPLAY:
+    if (opcode == 0) { // sync
+      uint32_t serial = ++client->serial;
+      if (!mock_object_new(client, args[0], MOCK_WL_CALLBACK))
+        return mock_protocol_error(client, 1, 0, "bad new_id");
+      if (mock_config->oversize && client->shm && !client->oversize_sent)
+        mock_send_oversize(client);
+      mock_send(client, args[0], 0, &serial, 1);
+      mock_delete_id(client, args[0]);
+    } else if (opcode == 1) { // get_registry
+      if (!mock_object_new(client, args[0], MOCK_WL_REGISTRY))
+        return mock_protocol_error(client, 1, 0, "bad new_id");
+      for (uint32_t i = 0; i < sizeof(mock_globals) / sizeof(mock_globals[0]); i++)
+        mock_send_global(client, args[0], i + 1, mock_globals[i].name, mock_globals[i].version);
+    }
+    break;
+
+  case MOCK_WL_REGISTRY: { // bind: name, interface string, version, new_id
+    uint32_t name = args[0], interface_len = args[1];
+    uint32_t words = 2 + mock_roundup_4(interface_len) / 4;
+    if (args_len < words + 2 || name == 0 || name > sizeof(mock_globals) / sizeof(mock_globals[0]))
+      return mock_protocol_error(client, object_id, 0, "bad bind");
+    uint32_t version = args[words], id = args[words + 1];
+    if (version == 0 || version > mock_globals[name - 1].version ||
+        !mock_object_new(client, id, mock_globals[name - 1].interface))
+      return mock_protocol_error(client, object_id, 0, "bad bind");
+    if (mock_globals[name - 1].interface == MOCK_WL_SHM) {
+      client->shm = id;
+      uint32_t formats[] = {0, 1}; // argb8888, xrgb8888
+      for (uint32_t i = 0; i < 2; i++)
+        mock_send(client, id, 0, &formats[i], 1);
+    } else if (mock_globals[name - 1].interface == MOCK_WL_SEAT) {
+      uint32_t capabilities = 0;
+      mock_send(client, id, 0, &capabilities, 1);
+    }
+    break;
+  }
+
+  case MOCK_WL_COMPOSITOR:
+    if (opcode == 0) { // create_surface
+      uint32_t slot = 0;
+      while (slot < MOCK_MAX_SURFACES && client->surfaces[slot].used)
+        slot++;
+      mock_object_t *surface = slot < MOCK_MAX_SURFACES ? mock_object_new(client, args[0], MOCK_WL_SURFACE) : NULL;
+      if (!surface)
+        return mock_protocol_error(client, object_id, 0, "can't create surface");
+      surface->surface = slot;
+      client->surfaces[slot] = (mock_surface_t){.used = true, .id = args[0]};
+    } else {
+      mock_protocol_error(client, object_id, 0, "regions are not supported");
+    }
+    break;
+
+  case MOCK_WL_SHM:
+    if (opcode == 0) { // create_pool: new_id, fd, size
+      if (client->fds_len == 0)
+        return mock_protocol_error(client, object_id, 0, "create_pool without an fd");
+      int fd = client->fds[0];
+      memmove(client->fds, client->fds + 1, sizeof(int) * --client->fds_len);
+      mock_pool_t *pool = calloc(1, sizeof(*pool));
+      void *data = args[1] ? mmap(NULL, args[1], PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+      mock_object_t *object_pool = mock_object_new(client, args[0], MOCK_WL_SHM_POOL);
+      if (!pool || data == MAP_FAILED || !object_pool) {
+        free(pool);
+        if (data != MAP_FAILED)
+          munmap(data, args[1]);
+        if (object_pool)
+          object_pool->interface = MOCK_NONE;
+        close(fd);
+        return mock_protocol_error(client, object_id, 2, "can't map pool");
+      }
+      *pool = (mock_pool_t){.data = data, .size = args[1], .refs = 1, .fd = fd};
+      object_pool->pool = pool;
+    }
+    break;
+
+  case MOCK_WL_SHM_POOL:
+    if (opcode == 0) { // create_buffer: new_id, offset, width, height, stride, format
+      mock_pool_t *pool = object->pool;
+      uint64_t end = (uint64_t)args[1] + (uint64_t)args[4] * args[3];
+      if (args[4] < args[2] * 4 || end > pool->size)
+        return mock_protocol_error(client, object_id, 0, "buffer outside the pool");
+      mock_object_t *buffer = mock_object_new(client, args[0], MOCK_WL_BUFFER);
+      if (!buffer)
+        return mock_protocol_error(client, 1, 0, "bad new_id");
+      buffer->buffer.pool = pool;
+      buffer->buffer.offset = args[1];
+      buffer->buffer.width = args[2];
+      buffer->buffer.height = args[3];
+      buffer->buffer.stride = args[4];
+      pool->refs++;
+    } else if (opcode == 1) { // destroy
+      mock_delete_id(client, object_id);
+    } else if (opcode == 2) { // resize
+      mock_pool_t *pool = object->pool;
+      if (args[0] < pool->size)
+        return mock_protocol_error(client, object_id, 0, "pools can't shrink");
+      // buffers hold the pool pointer, not the mapping, so a new address is fine
+      void *data = mmap(NULL, args[0], PROT_READ, MAP_SHARED, pool->fd, 0);
+      if (data == MAP_FAILED)
+        return mock_protocol_error(client, object_id, 2, "can't remap pool");
+      munmap(pool->data, pool->size);
+      pool->data = data;
+      pool->size = args[0];
+      mock_stats.pool_resizes++;
+    }
+    break;
+
+  case MOCK_WL_BUFFER: // destroy
+    mock_delete_id(client, object_id);
+    break;
+
+  case MOCK_WL_SURFACE: {
+    mock_surface_t *surface = &client->surfaces[object->surface];
+    switch (opcode) {
+    case 0: // destroy
+      surface->used = false;
+      mock_delete_id(client, object_id);
+      break;
+    case 1: // attach: buffer, x, y
+      surface->pending_buffer = args[0];
+      surface->pending_attached = true;
+      break;
+    case 2: // damage (surface coordinates; scale is always 1 here)
+    case 9: // damage_buffer
+      mock_damage_add(surface->pending_damage, args[0], args[1], args[2], args[3]);
+      break;
+    case 3: // frame
+      if (!mock_object_new(client, args[0], MOCK_WL_CALLBACK) ||
+          surface->pending_callbacks_len == MOCK_MAX_CALLBACKS)
+        return mock_protocol_error(client, object_id, 0, "bad frame callback");
+      surface->pending_callbacks[surface->pending_callbacks_len++] = args[0];
+      break;
+    case 6: // commit
+      mock_commit(client, surface);
+      break;
+    default: // regions, transform, scale, offset: accepted and ignored
+      break;
+    }
+    break;
+  }
+
+  case MOCK_WL_SEAT:
+    if (opcode == 3)
+      mock_delete_id(client, object_id); // release
+    else if (opcode <= 2)
+      mock_protocol_error(client, object_id, 0, "seat has no capabilities");
+    break;
+
+  case MOCK_XDG_WM_BASE:
+    if (opcode == 2) { // get_xdg_surface: new_id, surface
+      mock_object_t *surface = mock_object(client, args[1]);
+      if (!surface || surface->interface != MOCK_WL_SURFACE)
+        return mock_protocol_error(client, object_id, 0, "not a surface");
+      uint32_t slot = surface->surface;
+      mock_object_t *xdg_surface = mock_object_new(client, args[0], MOCK_XDG_SURFACE);
+      if (!xdg_surface)
+        return mock_protocol_error(client, 1, 0, "bad new_id");
+      xdg_surface->surface = slot;
+      client->surfaces[slot].xdg_surface = args[0];
+    } else if (opcode == 0) {
+      mock_delete_id(client, object_id);
+    } else if (opcode == 1) {
+      mock_protocol_error(client, object_id, 0, "positioners are not supported");
+    } // pong: nothing to do, the mock never pings
+    break;
+
+  case MOCK_XDG_SURFACE:
+    if (opcode == 1) { // get_toplevel
+      mock_object_t *toplevel = mock_object_new(client, args[0], MOCK_XDG_TOPLEVEL);
+      if (!toplevel)
+        return mock_protocol_error(client, 1, 0, "bad new_id");
+      toplevel->surface = object->surface;
+    } else if (opcode == 0) {
+      client->surfaces[object->surface].xdg_surface = 0;
+      mock_delete_id(client, object_id);
+    } else if (opcode == 2) {
+      mock_protocol_error(client, object_id, 0, "popups are not supported");
+    } // set_window_geometry, ack_configure: accepted
+    break;
+
+  case MOCK_XDG_TOPLEVEL:
+    if (opcode == 0)
+      mock_delete_id(client, object_id);
+    break; // titles, app ids, state changes: accepted and ignored
+
+  default: // wl_callback has no requests
+    mock_protocol_error(client, object_id, 1, "invalid method");
+    break;
+  }
+}
+
+/* Read what the socket holds and handle every complete request. */
+static int mock_read(mock_client_t *client) {
+  struct iovec iov = {.iov_base = client->in + client->in_len, .iov_len = MOCK_IN_CAP - client->in_len};
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * MOCK_MAX_FDS)];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1,
+                       .msg_control = control.buf, .msg_controllen = sizeof(control.buf)};
+
+  ssize_t n = recvmsg(client->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+  if (n == -1 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+    return 0;
+  if (n <= 0)
+    return -1;
+  mock_stats.bytes_received += (uint64_t)n;
+  client->in_len += (uint32_t)n;
+
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    uint64_t fds_len = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (uint64_t i = 0; i < fds_len; i++) {
+      int fd;
+      memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+      if (client->fds_len < MOCK_MAX_FDS)
+        client->fds[client->fds_len++] = fd;
+      else
+        close(fd);
+    }
+  }
+
+  uint32_t at = 0;
+  while (client->in_len - at >= MOCK_HEADER_SIZE && !client->broken) {
+    uint32_t header[2];
+    memcpy(header, client->in + at, sizeof(header));
+    uint32_t size = header[1] >> 16;
+    if (size < MOCK_HEADER_SIZE || size % 4) {
+      mock_protocol_error(client, 1, 1, "bad message size");
+      break;
+    }
+    if (client->in_len - at < size)
+      break;
+    uint32_t args[MOCK_IN_CAP / 4 / 16];
+    uint32_t args_len = (size - MOCK_HEADER_SIZE) / 4;
+    if (args_len > sizeof(args) / sizeof(args[0])) {
+      mock_protocol_error(client, 1, 1, "message too large");
+      break;
+    }
+    memcpy(args, client->in + at + MOCK_HEADER_SIZE, args_len * 4);
+    mock_handle_request(client, header[0], (uint16_t)header[1], args, args_len);
+    at += size;
+  }
+  memmove(client->in, client->in + at, client->in_len - at);
+  client->in_len -= at;
+  return client->broken ? -1 : 0;
+}
+
+/* ------------------- Serving --------------------------------------------- */
+
+/* Bind and listen on $XDG_RUNTIME_DIR/name (a stale socket is replaced).
+ * - Returns the listening fd, or -1 with errno set. */
+static int mock_listen(const char *name) {
+  const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+  if (!runtime_dir) {
+    errno = ENOENT;
+    return -1;
+  }
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  int len = snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s", runtime_dir, name);
+  if (len < 0 || (size_t)len >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+  unlink(addr.sun_path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 8) == -1) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+/* Serve one connected client until it hangs up or breaks the protocol. */
+static void mock_serve(int fd, const mock_config_t *config) {
+  static mock_client_t client;
+  memset(&client, 0, sizeof(client));
+  client.fd = fd;
+  mock_config = config;
+  mock_object_new(&client, 1, MOCK_WL_DISPLAY);
+
+  int timer_fd = -1;
+  if (config->vsync_ns) {
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct timespec period = {.tv_sec = (time_t)(config->vsync_ns / 1000000000ULL),
+                              .tv_nsec = (long)(config->vsync_ns % 1000000000ULL)};
+    struct itimerspec spec = {.it_interval = period, .it_value = period};
+    if (timer_fd != -1)
+      timerfd_settime(timer_fd, 0, &spec, NULL);
+  }
+
+  while (!client.broken) {
+    struct pollfd pfds[2] = {{.fd = fd, .events = POLLIN}, {.fd = timer_fd, .events = POLLIN}};
+    int ret = poll(pfds, timer_fd == -1 ? 1 : 2, -1);
+    if (ret == -1 && errno == EINTR)
+      continue;
+    if (ret == -1)
+      break;
+
+    if ((pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) && mock_read(&client) == -1)
+      break;
+    if (timer_fd != -1 && (pfds[1].revents & POLLIN)) {
+      uint64_t expirations;
+      if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+        mock_vsync(&client);
+    } else if (timer_fd == -1 && mock_has_committed(&client)) {
+      mock_vsync(&client);
+    }
+    mock_flush(&client);
+  }
+
+  for (uint32_t id = 0; id < client.objects_cap; id++) {
+    if (client.objects[id].interface == MOCK_WL_SHM_POOL)
+      mock_pool_unref(client.objects[id].pool);
+    else if (client.objects[id].interface == MOCK_WL_BUFFER)
+      mock_pool_unref(client.objects[id].buffer.pool);
+  }
+  for (uint32_t i = 0; i < client.fds_len; i++)
+    close(client.fds[i]);
+  free(client.objects);
+  if (timer_fd != -1)
+    close(timer_fd);
+  close(fd);
+}
+
+/* Accept and serve clients one after another; with `once`, only the first.
+ * Returns -1 with errno set if accept fails. */
+static int mock_run(int listen_fd, const mock_config_t *config, bool once) {
+  do {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd == -1 && errno == EINTR)
+      continue;
+    if (fd == -1)
+      return -1;
+    mock_serve(fd, config);
+    if (config->verbose)
+      fprintf(stderr, "mock: client gone: %" PRIu64 " requests, %" PRIu64 " commits, %" PRIu64
+              " vsyncs, %" PRIu64 " pixels read, %" PRIu64 " resizes, %" PRIu64 " pool resizes\n",
+              mock_stats.requests, mock_stats.commits, mock_stats.vsyncs, mock_stats.pixels_read,
+              mock_stats.configures, mock_stats.pool_resizes);
+  } while (!once);
+  return 0;
+}
+
+#ifndef KASAMA_MOCK_NO_MAIN
+int main(int argc, char **argv) {
+  mock_config_t config = {.vsync_ns = 1000000000ULL / 60, .width = 800, .height = 600};
+  const char *name = MOCK_DEFAULT_NAME;
+  bool once = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "d:r:s:z:o:1v")) != -1) {
+    switch (opt) {
+    case 'd': name = optarg; break;
+    case 'r': {
+      double hz = atof(optarg);
+      config.vsync_ns = hz > 0 ? (uint64_t)(1e9 / hz) : 0;
+      break;
+    }
+    case 's':
+      if (sscanf(optarg, "%ux%u", &config.width, &config.height) != 2) {
+        fprintf(stderr, "bad size %s, want WxH\n", optarg);
+        return 2;
+      }
+      break;
+    case 'z': config.drag_px = (uint32_t)atoi(optarg); break;
+    case 'o': config.oversize = (uint32_t)atoi(optarg); break;
+    case '1': once = true; break;
+    case 'v': config.verbose = true; break;
+    default:
+      fprintf(stderr, "usage: %s [-d name] [-r hz (0: every commit)] [-s WxH] [-z px per vsync] [-o bytes] [-1] [-v]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  int listen_fd = mock_listen(name);
+  if (listen_fd == -1) {
+    fprintf(stderr, "can't listen on $XDG_RUNTIME_DIR/%s: %s\n", name, strerror(errno));
+    return 1;
+  }
+  fprintf(stderr, "mock: listening on $XDG_RUNTIME_DIR/%s\n", name);
+  return mock_run(listen_fd, &config, once) == -1 ? 1 : 0;
+}
+#endif
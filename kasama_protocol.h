@@ -0,0 +1,1939 @@
+/* kasama_protocol.h
+ *
+ * ------------------------------------------------------------
+ *
+ * GENERATED by protocol/generate.py from wayland.xml and xdg-shell.xml.
+ * Do not edit; regenerate with:
+ *   python3 protocol/generate.py protocol/wayland.xml protocol/xdg-shell.xml > kasama_protocol.h
+ *
+ * Requests: wayland_<interface>_<request>_opcode, _size (a function of the
+ * string and array lengths when those vary it) and _pack(), which writes the
+ * whole message into a 4-byte aligned buffer of _size bytes. Fixed-size
+ * requests compile down to one store per word.
+ *
+ * Events: wayland_<interface>_<event>_event (the opcode), a struct of the
+ * arguments and _unpack(), which fills it from the payload in place (strings
+ * and arrays point into it) and returns false if the payload is malformed,
+ * a null string where the protocol doesn't allow one included.
+ *
+ * fd arguments have no bytes on the wire and appear in neither; an event
+ * that carries some also has wayland_<interface>_<event>_fds, and its
+ * interface a wayland_<interface>_event_fds[] table by opcode.
+ */
+#ifndef KASAMA_PROTOCOL_H
+#define KASAMA_PROTOCOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Write a length word, then `len` bytes zero-padded to 4. For strings `len`
+ * counts the terminator and `copy` doesn't, so the terminator comes from
+ * the padding. Returns the words written. */
+static inline uint32_t wayland_pack_bytes(uint32_t *msg, const void *data, uint32_t len,
+                                          uint32_t copy) {
+  uint32_t words = (len + 3) / 4;
+  msg[0] = len;
+  if (words)
+    msg[words] = 0;
+  memcpy(msg + 1, data, copy);
+  return 1 + words;
+}
+
+static inline bool wayland_unpack_string(const uint32_t *p, uint64_t words, uint64_t *at,
+                                         const char **s, uint32_t *len) {
+  if (*at >= words)
+    return false;
+  uint32_t wire_len = p[(*at)++];
+  uint64_t wire_words = ((uint64_t)wire_len + 3) / 4;
+  if (wire_words > words - *at)
+    return false;
+  const char *str = (const char *)(p + *at);
+  if (wire_len && str[wire_len - 1] != '\0')
+    return false;
+  *s = wire_len ? str : NULL;
+  *len = wire_len ? wire_len - 1 : 0;
+  *at += wire_words;
+  return true;
+}
+
+static inline bool wayland_unpack_array(const uint32_t *p, uint64_t words, uint64_t *at,
+                                        const void **data, uint32_t *size) {
+  if (*at >= words)
+    return false;
+  uint32_t wire_size = p[(*at)++];
+  uint64_t wire_words = ((uint64_t)wire_size + 3) / 4;
+  if (wire_words > words - *at)
+    return false;
+  *data = p + *at;
+  *size = wire_size;
+  *at += wire_words;
+  return true;
+}
+
+/* ---------------- wl_display ---------------------------------------------- */
+
+enum { wayland_wl_display_interface_version = 1 };
+enum {
+  wayland_wl_display_error_invalid_object = 0,
+  wayland_wl_display_error_invalid_method = 1,
+  wayland_wl_display_error_no_memory = 2,
+  wayland_wl_display_error_implementation = 3,
+};
+
+/* wl_display.sync */
+enum { wayland_wl_display_sync_opcode = 0, wayland_wl_display_sync_size = 12 };
+static inline void wayland_wl_display_sync_pack(uint32_t *msg, uint32_t wl_display,
+                                                uint32_t callback) {
+  msg[0] = wl_display;
+  msg[1] = 12U << 16 | 0U;
+  msg[2] = callback;
+}
+
+/* wl_display.get_registry */
+enum { wayland_wl_display_get_registry_opcode = 1, wayland_wl_display_get_registry_size = 12 };
+static inline void wayland_wl_display_get_registry_pack(uint32_t *msg, uint32_t wl_display,
+                                                        uint32_t registry) {
+  msg[0] = wl_display;
+  msg[1] = 12U << 16 | 1U;
+  msg[2] = registry;
+}
+
+/* wl_display.error */
+enum { wayland_wl_display_error_event = 0 };
+typedef struct wayland_wl_display_error_t {
+  uint32_t object_id;
+  uint32_t code;
+  const char *message; // NUL-terminated, in the receive buffer
+  uint32_t message_len; // without the terminator
+} wayland_wl_display_error_t;
+static inline bool wayland_wl_display_error_unpack(const char *payload, uint64_t payload_len,
+                                                   wayland_wl_display_error_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  uint64_t words = payload_len / 4, at = 0;
+  if (at >= words)
+    return false;
+  event->object_id = p[at++];
+  if (at >= words)
+    return false;
+  event->code = p[at++];
+  if (!wayland_unpack_string(p, words, &at, &event->message, &event->message_len))
+    return false;
+  if (!event->message)
+    return false;
+  return true;
+}
+
+/* wl_display.delete_id */
+enum { wayland_wl_display_delete_id_event = 1 };
+typedef struct wayland_wl_display_delete_id_t {
+  uint32_t id;
+} wayland_wl_display_delete_id_t;
+static inline bool wayland_wl_display_delete_id_unpack(const char *payload, uint64_t payload_len,
+                                                       wayland_wl_display_delete_id_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 4)
+    return false;
+  event->id = p[0];
+  return true;
+}
+
+/* ---------------- wl_registry --------------------------------------------- */
+
+enum { wayland_wl_registry_interface_version = 1 };
+
+/* wl_registry.bind: string lengths exclude the terminator */
+enum { wayland_wl_registry_bind_opcode = 0 };
+static inline uint32_t wayland_wl_registry_bind_size(uint32_t interface_len) {
+  return 24 + ((interface_len + 4) & ~3U);
+}
+static inline void wayland_wl_registry_bind_pack(uint32_t *msg, uint32_t size, uint32_t wl_registry,
+                                                 uint32_t name, const char *interface,
+                                                 uint32_t interface_len, uint32_t version,
+                                                 uint32_t id) {
+  msg[0] = wl_registry;
+  msg[1] = size << 16 | 0U;
+  uint32_t at = 2;
+  msg[at++] = name;
+  at += wayland_pack_bytes(msg + at, interface, interface_len + 1, interface_len);
+  msg[at++] = version;
+  msg[at++] = id;
+}
+
+/* wl_registry.global */
+enum { wayland_wl_registry_global_event = 0 };
+typedef struct wayland_wl_registry_global_t {
+  uint32_t name;
+  const char *interface; // NUL-terminated, in the receive buffer
+  uint32_t interface_len; // without the terminator
+  uint32_t version;
+} wayland_wl_registry_global_t;
+static inline bool wayland_wl_registry_global_unpack(const char *payload, uint64_t payload_len,
+                                                     wayland_wl_registry_global_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  uint64_t words = payload_len / 4, at = 0;
+  if (at >= words)
+    return false;
+  event->name = p[at++];
+  if (!wayland_unpack_string(p, words, &at, &event->interface, &event->interface_len))
+    return false;
+  if (!event->interface)
+    return false;
+  if (at >= words)
+    return false;
+  event->version = p[at++];
+  return true;
+}
+
+/* wl_registry.global_remove */
+enum { wayland_wl_registry_global_remove_event = 1 };
+typedef struct wayland_wl_registry_global_remove_t {
+  uint32_t name;
+} wayland_wl_registry_global_remove_t;
+static inline bool wayland_wl_registry_global_remove_unpack(const char *payload,
+                                                            uint64_t payload_len,
+                                                            wayland_wl_registry_global_remove_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 4)
+    return false;
+  event->name = p[0];
+  return true;
+}
+
+/* ---------------- wl_callback --------------------------------------------- */
+
+enum { wayland_wl_callback_interface_version = 1 };
+
+/* wl_callback.done */
+enum { wayland_wl_callback_done_event = 0 };
+typedef struct wayland_wl_callback_done_t {
+  uint32_t callback_data;
+} wayland_wl_callback_done_t;
+static inline bool wayland_wl_callback_done_unpack(const char *payload, uint64_t payload_len,
+                                                   wayland_wl_callback_done_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 4)
+    return false;
+  event->callback_data = p[0];
+  return true;
+}
+
+/* ---------------- wl_compositor ------------------------------------------- */
+
+enum { wayland_wl_compositor_interface_version = 6 };
+
+/* wl_compositor.create_surface */
+enum {
+  wayland_wl_compositor_create_surface_opcode = 0,
+  wayland_wl_compositor_create_surface_size = 12,
+};
+static inline void wayland_wl_compositor_create_surface_pack(uint32_t *msg, uint32_t wl_compositor,
+                                                             uint32_t id) {
+  msg[0] = wl_compositor;
+  msg[1] = 12U << 16 | 0U;
+  msg[2] = id;
+}
+
+/* wl_compositor.create_region */
+enum {
+  wayland_wl_compositor_create_region_opcode = 1,
+  wayland_wl_compositor_create_region_size = 12,
+};
+static inline void wayland_wl_compositor_create_region_pack(uint32_t *msg, uint32_t wl_compositor,
+                                                            uint32_t id) {
+  msg[0] = wl_compositor;
+  msg[1] = 12U << 16 | 1U;
+  msg[2] = id;
+}
+
+/* ---------------- wl_shm_pool --------------------------------------------- */
+
+enum { wayland_wl_shm_pool_interface_version = 2 };
+
+/* wl_shm_pool.create_buffer */
+enum { wayland_wl_shm_pool_create_buffer_opcode = 0, wayland_wl_shm_pool_create_buffer_size = 32 };
+static inline void wayland_wl_shm_pool_create_buffer_pack(uint32_t *msg, uint32_t wl_shm_pool,
+                                                          uint32_t id, int32_t offset,
+                                                          int32_t width, int32_t height,
+                                                          int32_t stride, uint32_t format) {
+  msg[0] = wl_shm_pool;
+  msg[1] = 32U << 16 | 0U;
+  msg[2] = id;
+  msg[3] = (uint32_t)offset;
+  msg[4] = (uint32_t)width;
+  msg[5] = (uint32_t)height;
+  msg[6] = (uint32_t)stride;
+  msg[7] = format;
+}
+
+/* wl_shm_pool.destroy */
+enum { wayland_wl_shm_pool_destroy_opcode = 1, wayland_wl_shm_pool_destroy_size = 8 };
+static inline void wayland_wl_shm_pool_destroy_pack(uint32_t *msg, uint32_t wl_shm_pool) {
+  msg[0] = wl_shm_pool;
+  msg[1] = 8U << 16 | 1U;
+}
+
+/* wl_shm_pool.resize */
+enum { wayland_wl_shm_pool_resize_opcode = 2, wayland_wl_shm_pool_resize_size = 12 };
+static inline void wayland_wl_shm_pool_resize_pack(uint32_t *msg, uint32_t wl_shm_pool,
+                                                   int32_t size) {
+  msg[0] = wl_shm_pool;
+  msg[1] = 12U << 16 | 2U;
+  msg[2] = (uint32_t)size;
+}
+
+/* ---------------- wl_shm -------------------------------------------------- */
+
+enum { wayland_wl_shm_interface_version = 2 };
+enum {
+  wayland_wl_shm_error_invalid_format = 0,
+  wayland_wl_shm_error_invalid_stride = 1,
+  wayland_wl_shm_error_invalid_fd = 2,
+};
+enum { wayland_wl_shm_format_argb8888 = 0, wayland_wl_shm_format_xrgb8888 = 1 };
+
+/* wl_shm.create_pool: the fd is not on the wire; queue it with the request */
+enum { wayland_wl_shm_create_pool_opcode = 0, wayland_wl_shm_create_pool_size = 16 };
+static inline void wayland_wl_shm_create_pool_pack(uint32_t *msg, uint32_t wl_shm, uint32_t id,
+                                                   int32_t size) {
+  msg[0] = wl_shm;
+  msg[1] = 16U << 16 | 0U;
+  msg[2] = id;
+  msg[3] = (uint32_t)size;
+}
+
+/* wl_shm.release (since 2) */
+enum { wayland_wl_shm_release_opcode = 1, wayland_wl_shm_release_size = 8 };
+static inline void wayland_wl_shm_release_pack(uint32_t *msg, uint32_t wl_shm) {
+  msg[0] = wl_shm;
+  msg[1] = 8U << 16 | 1U;
+}
+
+/* wl_shm.format */
+enum { wayland_wl_shm_format_event = 0 };
+typedef struct wayland_wl_shm_format_t {
+  uint32_t format;
+} wayland_wl_shm_format_t;
+static inline bool wayland_wl_shm_format_unpack(const char *payload, uint64_t payload_len,
+                                                wayland_wl_shm_format_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 4)
+    return false;
+  event->format = p[0];
+  return true;
+}
+
+/* ---------------- wl_buffer ----------------------------------------------- */
+
+enum { wayland_wl_buffer_interface_version = 1 };
+
+/* wl_buffer.destroy */
+enum { wayland_wl_buffer_destroy_opcode = 0, wayland_wl_buffer_destroy_size = 8 };
+static inline void wayland_wl_buffer_destroy_pack(uint32_t *msg, uint32_t wl_buffer) {
+  msg[0] = wl_buffer;
+  msg[1] = 8U << 16 | 0U;
+}
+
+/* wl_buffer.release */
+enum { wayland_wl_buffer_release_event = 0 };
+
+/* ---------------- wl_surface ---------------------------------------------- */
+
+enum { wayland_wl_surface_interface_version = 6 };
+enum {
+  wayland_wl_surface_error_invalid_scale = 0,
+  wayland_wl_surface_error_invalid_transform = 1,
+  wayland_wl_surface_error_invalid_size = 2,
+  wayland_wl_surface_error_invalid_offset = 3,
+  wayland_wl_surface_error_defunct_role_object = 4,
+};
+
+/* wl_surface.destroy */
+enum { wayland_wl_surface_destroy_opcode = 0, wayland_wl_surface_destroy_size = 8 };
+static inline void wayland_wl_surface_destroy_pack(uint32_t *msg, uint32_t wl_surface) {
+  msg[0] = wl_surface;
+  msg[1] = 8U << 16 | 0U;
+}
+
+/* wl_surface.attach */
+enum { wayland_wl_surface_attach_opcode = 1, wayland_wl_surface_attach_size = 20 };
+static inline void wayland_wl_surface_attach_pack(uint32_t *msg, uint32_t wl_surface,
+                                                  uint32_t buffer, int32_t x, int32_t y) {
+  msg[0] = wl_surface;
+  msg[1] = 20U << 16 | 1U;
+  msg[2] = buffer;
+  msg[3] = (uint32_t)x;
+  msg[4] = (uint32_t)y;
+}
+
+/* wl_surface.damage */
+enum { wayland_wl_surface_damage_opcode = 2, wayland_wl_surface_damage_size = 24 };
+static inline void wayland_wl_surface_damage_pack(uint32_t *msg, uint32_t wl_surface, int32_t x,
+                                                  int32_t y, int32_t width, int32_t height) {
+  msg[0] = wl_surface;
+  msg[1] = 24U << 16 | 2U;
+  msg[2] = (uint32_t)x;
+  msg[3] = (uint32_t)y;
+  msg[4] = (uint32_t)width;
+  msg[5] = (uint32_t)height;
+}
+
+/* wl_surface.frame */
+enum { wayland_wl_surface_frame_opcode = 3, wayland_wl_surface_frame_size = 12 };
+static inline void wayland_wl_surface_frame_pack(uint32_t *msg, uint32_t wl_surface,
+                                                 uint32_t callback) {
+  msg[0] = wl_surface;
+  msg[1] = 12U << 16 | 3U;
+  msg[2] = callback;
+}
+
+/* wl_surface.set_opaque_region */
+enum {
+  wayland_wl_surface_set_opaque_region_opcode = 4,
+  wayland_wl_surface_set_opaque_region_size = 12,
+};
+static inline void wayland_wl_surface_set_opaque_region_pack(uint32_t *msg, uint32_t wl_surface,
+                                                             uint32_t region) {
+  msg[0] = wl_surface;
+  msg[1] = 12U << 16 | 4U;
+  msg[2] = region;
+}
+
+/* wl_surface.set_input_region */
+enum {
+  wayland_wl_surface_set_input_region_opcode = 5,
+  wayland_wl_surface_set_input_region_size = 12,
+};
+static inline void wayland_wl_surface_set_input_region_pack(uint32_t *msg, uint32_t wl_surface,
+                                                            uint32_t region) {
+  msg[0] = wl_surface;
+  msg[1] = 12U << 16 | 5U;
+  msg[2] = region;
+}
+
+/* wl_surface.commit */
+enum { wayland_wl_surface_commit_opcode = 6, wayland_wl_surface_commit_size = 8 };
+static inline void wayland_wl_surface_commit_pack(uint32_t *msg, uint32_t wl_surface) {
+  msg[0] = wl_surface;
+  msg[1] = 8U << 16 | 6U;
+}
+
+/* wl_surface.set_buffer_transform (since 2) */
+enum {
+  wayland_wl_surface_set_buffer_transform_opcode = 7,
+  wayland_wl_surface_set_buffer_transform_size = 12,
+};
+static inline void wayland_wl_surface_set_buffer_transform_pack(uint32_t *msg, uint32_t wl_surface,
+                                                                int32_t transform) {
+  msg[0] = wl_surface;
+  msg[1] = 12U << 16 | 7U;
+  msg[2] = (uint32_t)transform;
+}
+
+/* wl_surface.set_buffer_scale (since 3) */
+enum {
+  wayland_wl_surface_set_buffer_scale_opcode = 8,
+  wayland_wl_surface_set_buffer_scale_size = 12,
+};
+static inline void wayland_wl_surface_set_buffer_scale_pack(uint32_t *msg, uint32_t wl_surface,
+                                                            int32_t scale) {
+  msg[0] = wl_surface;
+  msg[1] = 12U << 16 | 8U;
+  msg[2] = (uint32_t)scale;
+}
+
+/* wl_surface.damage_buffer (since 4) */
+enum { wayland_wl_surface_damage_buffer_opcode = 9, wayland_wl_surface_damage_buffer_size = 24 };
+static inline void wayland_wl_surface_damage_buffer_pack(uint32_t *msg, uint32_t wl_surface,
+                                                         int32_t x, int32_t y, int32_t width,
+                                                         int32_t height) {
+  msg[0] = wl_surface;
+  msg[1] = 24U << 16 | 9U;
+  msg[2] = (uint32_t)x;
+  msg[3] = (uint32_t)y;
+  msg[4] = (uint32_t)width;
+  msg[5] = (uint32_t)height;
+}
+
+/* wl_surface.offset (since 5) */
+enum { wayland_wl_surface_offset_opcode = 10, wayland_wl_surface_offset_size = 16 };
+static inline void wayland_wl_surface_offset_pack(uint32_t *msg, uint32_t wl_surface, int32_t x,
+                                                  int32_t y) {
+  msg[0] = wl_surface;
+  msg[1] = 16U << 16 | 10U;
+  msg[2] = (uint32_t)x;
+  msg[3] = (uint32_t)y;
+}
+
+/* wl_surface.enter */
+enum { wayland_wl_surface_enter_event = 0 };
+typedef struct wayland_wl_surface_enter_t {
+  uint32_t output;
+} wayland_wl_surface_enter_t;
+static inline bool wayland_wl_surface_enter_unpack(const char *payload, uint64_t payload_len,
+                                                   wayland_wl_surface_enter_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 4)
+    return false;
+  event->output = p[0];
+  return true;
+}
+
+/* wl_surface.leave */
+enum { wayland_wl_surface_leave_event = 1 };
+typedef struct wayland_wl_surface_leave_t {
+  uint32_t output;
+} wayland_wl_surface_leave_t;
+static inline bool wayland_wl_surface_leave_unpack(const char *payload, uint64_t payload_len,
+                                                   wayland_wl_surface_leave_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 4)
+    return false;
+  event->output = p[0];
+  return true;
+}
+
+/* wl_surface.preferred_buffer_scale (since 6) */
+enum { wayland_wl_surface_preferred_buffer_scale_event = 2 };
+typedef struct wayland_wl_surface_preferred_buffer_scale_t {
+  int32_t factor;
+} wayland_wl_surface_preferred_buffer_scale_t;
+static inline bool wayland_wl_surface_preferred_buffer_scale_unpack(const char *payload,
+                                                                    uint64_t payload_len,
+                                                                    wayland_wl_surface_preferred_buffer_scale_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 4)
+    return false;
+  event->factor = (int32_t)p[0];
+  return true;
+}
+
+/* wl_surface.preferred_buffer_transform (since 6) */
+enum { wayland_wl_surface_preferred_buffer_transform_event = 3 };
+typedef struct wayland_wl_surface_preferred_buffer_transform_t {
+  uint32_t transform;
+} wayland_wl_surface_preferred_buffer_transform_t;
+static inline bool wayland_wl_surface_preferred_buffer_transform_unpack(const char *payload,
+                                                                        uint64_t payload_len,
+                                                                        wayland_wl_surface_preferred_buffer_transform_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 4)
+    return false;
+  event->transform = p[0];
+  return true;
+}
+
+/* ---------------- wl_seat ------------------------------------------------- */
+
+enum { wayland_wl_seat_interface_version = 9 };
+enum {
+  wayland_wl_seat_capability_pointer = 1,
+  wayland_wl_seat_capability_keyboard = 2,
+  wayland_wl_seat_capability_touch = 4,
+};
+
+/* wl_seat.get_pointer */
+enum { wayland_wl_seat_get_pointer_opcode = 0, wayland_wl_seat_get_pointer_size = 12 };
+static inline void wayland_wl_seat_get_pointer_pack(uint32_t *msg, uint32_t wl_seat, uint32_t id) {
+  msg[0] = wl_seat;
+  msg[1] = 12U << 16 | 0U;
+  msg[2] = id;
+}
+
+/* wl_seat.get_keyboard */
+enum { wayland_wl_seat_get_keyboard_opcode = 1, wayland_wl_seat_get_keyboard_size = 12 };
+static inline void wayland_wl_seat_get_keyboard_pack(uint32_t *msg, uint32_t wl_seat, uint32_t id) {
+  msg[0] = wl_seat;
+  msg[1] = 12U << 16 | 1U;
+  msg[2] = id;
+}
+
+/* wl_seat.get_touch */
+enum { wayland_wl_seat_get_touch_opcode = 2, wayland_wl_seat_get_touch_size = 12 };
+static inline void wayland_wl_seat_get_touch_pack(uint32_t *msg, uint32_t wl_seat, uint32_t id) {
+  msg[0] = wl_seat;
+  msg[1] = 12U << 16 | 2U;
+  msg[2] = id;
+}
+
+/* wl_seat.release (since 5) */
+enum { wayland_wl_seat_release_opcode = 3, wayland_wl_seat_release_size = 8 };
+static inline void wayland_wl_seat_release_pack(uint32_t *msg, uint32_t wl_seat) {
+  msg[0] = wl_seat;
+  msg[1] = 8U << 16 | 3U;
+}
+
+/* wl_seat.capabilities */
+enum { wayland_wl_seat_capabilities_event = 0 };
+typedef struct wayland_wl_seat_capabilities_t {
+  uint32_t capabilities;
+} wayland_wl_seat_capabilities_t;
+static inline bool wayland_wl_seat_capabilities_unpack(const char *payload, uint64_t payload_len,
+                                                       wayland_wl_seat_capabilities_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 4)
+    return false;
+  event->capabilities = p[0];
+  return true;
+}
+
+/* wl_seat.name (since 2) */
+enum { wayland_wl_seat_name_event = 1 };
+typedef struct wayland_wl_seat_name_t {
+  const char *name; // NUL-terminated, in the receive buffer
+  uint32_t name_len; // without the terminator
+} wayland_wl_seat_name_t;
+static inline bool wayland_wl_seat_name_unpack(const char *payload, uint64_t payload_len,
+                                               wayland_wl_seat_name_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  uint64_t words = payload_len / 4, at = 0;
+  if (!wayland_unpack_string(p, words, &at, &event->name, &event->name_len))
+    return false;
+  if (!event->name)
+    return false;
+  return true;
+}
+
+/* ---------------- wl_pointer ---------------------------------------------- */
+
+enum { wayland_wl_pointer_interface_version = 9 };
+enum { wayland_wl_pointer_button_state_released = 0, wayland_wl_pointer_button_state_pressed = 1 };
+enum { wayland_wl_pointer_axis_vertical_scroll = 0, wayland_wl_pointer_axis_horizontal_scroll = 1 };
+
+/* wl_pointer.set_cursor */
+enum { wayland_wl_pointer_set_cursor_opcode = 0, wayland_wl_pointer_set_cursor_size = 24 };
+static inline void wayland_wl_pointer_set_cursor_pack(uint32_t *msg, uint32_t wl_pointer,
+                                                      uint32_t serial, uint32_t surface,
+                                                      int32_t hotspot_x, int32_t hotspot_y) {
+  msg[0] = wl_pointer;
+  msg[1] = 24U << 16 | 0U;
+  msg[2] = serial;
+  msg[3] = surface;
+  msg[4] = (uint32_t)hotspot_x;
+  msg[5] = (uint32_t)hotspot_y;
+}
+
+/* wl_pointer.release (since 3) */
+enum { wayland_wl_pointer_release_opcode = 1, wayland_wl_pointer_release_size = 8 };
+static inline void wayland_wl_pointer_release_pack(uint32_t *msg, uint32_t wl_pointer) {
+  msg[0] = wl_pointer;
+  msg[1] = 8U << 16 | 1U;
+}
+
+/* wl_pointer.enter */
+enum { wayland_wl_pointer_enter_event = 0 };
+typedef struct wayland_wl_pointer_enter_t {
+  uint32_t serial;
+  uint32_t surface;
+  int32_t surface_x;  // 24.8 fixed point
+  int32_t surface_y;  // 24.8 fixed point
+} wayland_wl_pointer_enter_t;
+static inline bool wayland_wl_pointer_enter_unpack(const char *payload, uint64_t payload_len,
+                                                   wayland_wl_pointer_enter_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 16)
+    return false;
+  event->serial = p[0];
+  event->surface = p[1];
+  event->surface_x = (int32_t)p[2];
+  event->surface_y = (int32_t)p[3];
+  return true;
+}
+
+/* wl_pointer.leave */
+enum { wayland_wl_pointer_leave_event = 1 };
+typedef struct wayland_wl_pointer_leave_t {
+  uint32_t serial;
+  uint32_t surface;
+} wayland_wl_pointer_leave_t;
+static inline bool wayland_wl_pointer_leave_unpack(const char *payload, uint64_t payload_len,
+                                                   wayland_wl_pointer_leave_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 8)
+    return false;
+  event->serial = p[0];
+  event->surface = p[1];
+  return true;
+}
+
+/* wl_pointer.motion */
+enum { wayland_wl_pointer_motion_event = 2 };
+typedef struct wayland_wl_pointer_motion_t {
+  uint32_t time;
+  int32_t surface_x;  // 24.8 fixed point
+  int32_t surface_y;  // 24.8 fixed point
+} wayland_wl_pointer_motion_t;
+static inline bool wayland_wl_pointer_motion_unpack(const char *payload, uint64_t payload_len,
+                                                    wayland_wl_pointer_motion_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 12)
+    return false;
+  event->time = p[0];
+  event->surface_x = (int32_t)p[1];
+  event->surface_y = (int32_t)p[2];
+  return true;
+}
+
+/* wl_pointer.button */
+enum { wayland_wl_pointer_button_event = 3 };
+typedef struct wayland_wl_pointer_button_t {
+  uint32_t serial;
+  uint32_t time;
+  uint32_t button;
+  uint32_t state;
+} wayland_wl_pointer_button_t;
+static inline bool wayland_wl_pointer_button_unpack(const char *payload, uint64_t payload_len,
+                                                    wayland_wl_pointer_button_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 16)
+    return false;
+  event->serial = p[0];
+  event->time = p[1];
+  event->button = p[2];
+  event->state = p[3];
+  return true;
+}
+
+/* wl_pointer.axis */
+enum { wayland_wl_pointer_axis_event = 4 };
+typedef struct wayland_wl_pointer_axis_t {
+  uint32_t time;
+  uint32_t axis;
+  int32_t value;  // 24.8 fixed point
+} wayland_wl_pointer_axis_t;
+static inline bool wayland_wl_pointer_axis_unpack(const char *payload, uint64_t payload_len,
+                                                  wayland_wl_pointer_axis_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 12)
+    return false;
+  event->time = p[0];
+  event->axis = p[1];
+  event->value = (int32_t)p[2];
+  return true;
+}
+
+/* wl_pointer.frame (since 5) */
+enum { wayland_wl_pointer_frame_event = 5 };
+
+/* wl_pointer.axis_source (since 5) */
+enum { wayland_wl_pointer_axis_source_event = 6 };
+typedef struct wayland_wl_pointer_axis_source_t {
+  uint32_t axis_source;
+} wayland_wl_pointer_axis_source_t;
+static inline bool wayland_wl_pointer_axis_source_unpack(const char *payload, uint64_t payload_len,
+                                                         wayland_wl_pointer_axis_source_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 4)
+    return false;
+  event->axis_source = p[0];
+  return true;
+}
+
+/* wl_pointer.axis_stop (since 5) */
+enum { wayland_wl_pointer_axis_stop_event = 7 };
+typedef struct wayland_wl_pointer_axis_stop_t {
+  uint32_t time;
+  uint32_t axis;
+} wayland_wl_pointer_axis_stop_t;
+static inline bool wayland_wl_pointer_axis_stop_unpack(const char *payload, uint64_t payload_len,
+                                                       wayland_wl_pointer_axis_stop_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 8)
+    return false;
+  event->time = p[0];
+  event->axis = p[1];
+  return true;
+}
+
+/* wl_pointer.axis_discrete (since 5) */
+enum { wayland_wl_pointer_axis_discrete_event = 8 };
+typedef struct wayland_wl_pointer_axis_discrete_t {
+  uint32_t axis;
+  int32_t discrete;
+} wayland_wl_pointer_axis_discrete_t;
+static inline bool wayland_wl_pointer_axis_discrete_unpack(const char *payload,
+                                                           uint64_t payload_len,
+                                                           wayland_wl_pointer_axis_discrete_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 8)
+    return false;
+  event->axis = p[0];
+  event->discrete = (int32_t)p[1];
+  return true;
+}
+
+/* wl_pointer.axis_value120 (since 8) */
+enum { wayland_wl_pointer_axis_value120_event = 9 };
+typedef struct wayland_wl_pointer_axis_value120_t {
+  uint32_t axis;
+  int32_t value120;
+} wayland_wl_pointer_axis_value120_t;
+static inline bool wayland_wl_pointer_axis_value120_unpack(const char *payload,
+                                                           uint64_t payload_len,
+                                                           wayland_wl_pointer_axis_value120_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 8)
+    return false;
+  event->axis = p[0];
+  event->value120 = (int32_t)p[1];
+  return true;
+}
+
+/* wl_pointer.axis_relative_direction (since 9) */
+enum { wayland_wl_pointer_axis_relative_direction_event = 10 };
+typedef struct wayland_wl_pointer_axis_relative_direction_t {
+  uint32_t axis;
+  uint32_t direction;
+} wayland_wl_pointer_axis_relative_direction_t;
+static inline bool wayland_wl_pointer_axis_relative_direction_unpack(const char *payload,
+                                                                     uint64_t payload_len,
+                                                                     wayland_wl_pointer_axis_relative_direction_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 8)
+    return false;
+  event->axis = p[0];
+  event->direction = p[1];
+  return true;
+}
+
+/* ---------------- wl_keyboard --------------------------------------------- */
+
+enum { wayland_wl_keyboard_interface_version = 9 };
+enum {
+  wayland_wl_keyboard_keymap_format_no_keymap = 0,
+  wayland_wl_keyboard_keymap_format_xkb_v1 = 1,
+};
+enum { wayland_wl_keyboard_key_state_released = 0, wayland_wl_keyboard_key_state_pressed = 1 };
+
+/* wl_keyboard.release (since 3) */
+enum { wayland_wl_keyboard_release_opcode = 0, wayland_wl_keyboard_release_size = 8 };
+static inline void wayland_wl_keyboard_release_pack(uint32_t *msg, uint32_t wl_keyboard) {
+  msg[0] = wl_keyboard;
+  msg[1] = 8U << 16 | 0U;
+}
+
+/* wl_keyboard.keymap: the fd arrives out of band, take it with wayland_conn_take_fd() */
+enum { wayland_wl_keyboard_keymap_event = 0, wayland_wl_keyboard_keymap_fds = 1 };
+typedef struct wayland_wl_keyboard_keymap_t {
+  uint32_t format;
+  uint32_t size;
+} wayland_wl_keyboard_keymap_t;
+static inline bool wayland_wl_keyboard_keymap_unpack(const char *payload, uint64_t payload_len,
+                                                     wayland_wl_keyboard_keymap_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 8)
+    return false;
+  event->format = p[0];
+  event->size = p[1];
+  return true;
+}
+
+/* wl_keyboard.enter */
+enum { wayland_wl_keyboard_enter_event = 1 };
+typedef struct wayland_wl_keyboard_enter_t {
+  uint32_t serial;
+  uint32_t surface;
+  const void *keys;
+  uint32_t keys_size;
+} wayland_wl_keyboard_enter_t;
+static inline bool wayland_wl_keyboard_enter_unpack(const char *payload, uint64_t payload_len,
+                                                    wayland_wl_keyboard_enter_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  uint64_t words = payload_len / 4, at = 0;
+  if (at >= words)
+    return false;
+  event->serial = p[at++];
+  if (at >= words)
+    return false;
+  event->surface = p[at++];
+  if (!wayland_unpack_array(p, words, &at, &event->keys, &event->keys_size))
+    return false;
+  return true;
+}
+
+/* wl_keyboard.leave */
+enum { wayland_wl_keyboard_leave_event = 2 };
+typedef struct wayland_wl_keyboard_leave_t {
+  uint32_t serial;
+  uint32_t surface;
+} wayland_wl_keyboard_leave_t;
+static inline bool wayland_wl_keyboard_leave_unpack(const char *payload, uint64_t payload_len,
+                                                    wayland_wl_keyboard_leave_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 8)
+    return false;
+  event->serial = p[0];
+  event->surface = p[1];
+  return true;
+}
+
+/* wl_keyboard.key */
+enum { wayland_wl_keyboard_key_event = 3 };
+typedef struct wayland_wl_keyboard_key_t {
+  uint32_t serial;
+  uint32_t time;
+  uint32_t key;
+  uint32_t state;
+} wayland_wl_keyboard_key_t;
+static inline bool wayland_wl_keyboard_key_unpack(const char *payload, uint64_t payload_len,
+                                                  wayland_wl_keyboard_key_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 16)
+    return false;
+  event->serial = p[0];
+  event->time = p[1];
+  event->key = p[2];
+  event->state = p[3];
+  return true;
+}
+
+/* wl_keyboard.modifiers */
+enum { wayland_wl_keyboard_modifiers_event = 4 };
+typedef struct wayland_wl_keyboard_modifiers_t {
+  uint32_t serial;
+  uint32_t mods_depressed;
+  uint32_t mods_latched;
+  uint32_t mods_locked;
+  uint32_t group;
+} wayland_wl_keyboard_modifiers_t;
+static inline bool wayland_wl_keyboard_modifiers_unpack(const char *payload, uint64_t payload_len,
+                                                        wayland_wl_keyboard_modifiers_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 20)
+    return false;
+  event->serial = p[0];
+  event->mods_depressed = p[1];
+  event->mods_latched = p[2];
+  event->mods_locked = p[3];
+  event->group = p[4];
+  return true;
+}
+
+/* wl_keyboard.repeat_info (since 4) */
+enum { wayland_wl_keyboard_repeat_info_event = 5 };
+typedef struct wayland_wl_keyboard_repeat_info_t {
+  int32_t rate;
+  int32_t delay;
+} wayland_wl_keyboard_repeat_info_t;
+static inline bool wayland_wl_keyboard_repeat_info_unpack(const char *payload, uint64_t payload_len,
+                                                          wayland_wl_keyboard_repeat_info_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 8)
+    return false;
+  event->rate = (int32_t)p[0];
+  event->delay = (int32_t)p[1];
+  return true;
+}
+
+static const uint8_t wayland_wl_keyboard_event_fds[] = {1, 0, 0, 0, 0, 0};
+
+/* ---------------- xdg_wm_base --------------------------------------------- */
+
+enum { wayland_xdg_wm_base_interface_version = 6 };
+enum {
+  wayland_xdg_wm_base_error_role = 0,
+  wayland_xdg_wm_base_error_defunct_surfaces = 1,
+  wayland_xdg_wm_base_error_not_the_topmost_popup = 2,
+  wayland_xdg_wm_base_error_invalid_popup_parent = 3,
+  wayland_xdg_wm_base_error_invalid_surface_state = 4,
+  wayland_xdg_wm_base_error_invalid_positioner = 5,
+  wayland_xdg_wm_base_error_unresponsive = 6,
+};
+
+/* xdg_wm_base.destroy */
+enum { wayland_xdg_wm_base_destroy_opcode = 0, wayland_xdg_wm_base_destroy_size = 8 };
+static inline void wayland_xdg_wm_base_destroy_pack(uint32_t *msg, uint32_t xdg_wm_base) {
+  msg[0] = xdg_wm_base;
+  msg[1] = 8U << 16 | 0U;
+}
+
+/* xdg_wm_base.create_positioner */
+enum {
+  wayland_xdg_wm_base_create_positioner_opcode = 1,
+  wayland_xdg_wm_base_create_positioner_size = 12,
+};
+static inline void wayland_xdg_wm_base_create_positioner_pack(uint32_t *msg, uint32_t xdg_wm_base,
+                                                              uint32_t id) {
+  msg[0] = xdg_wm_base;
+  msg[1] = 12U << 16 | 1U;
+  msg[2] = id;
+}
+
+/* xdg_wm_base.get_xdg_surface */
+enum {
+  wayland_xdg_wm_base_get_xdg_surface_opcode = 2,
+  wayland_xdg_wm_base_get_xdg_surface_size = 16,
+};
+static inline void wayland_xdg_wm_base_get_xdg_surface_pack(uint32_t *msg, uint32_t xdg_wm_base,
+                                                            uint32_t id, uint32_t surface) {
+  msg[0] = xdg_wm_base;
+  msg[1] = 16U << 16 | 2U;
+  msg[2] = id;
+  msg[3] = surface;
+}
+
+/* xdg_wm_base.pong */
+enum { wayland_xdg_wm_base_pong_opcode = 3, wayland_xdg_wm_base_pong_size = 12 };
+static inline void wayland_xdg_wm_base_pong_pack(uint32_t *msg, uint32_t xdg_wm_base,
+                                                 uint32_t serial) {
+  msg[0] = xdg_wm_base;
+  msg[1] = 12U << 16 | 3U;
+  msg[2] = serial;
+}
+
+/* xdg_wm_base.ping */
+enum { wayland_xdg_wm_base_ping_event = 0 };
+typedef struct wayland_xdg_wm_base_ping_t {
+  uint32_t serial;
+} wayland_xdg_wm_base_ping_t;
+static inline bool wayland_xdg_wm_base_ping_unpack(const char *payload, uint64_t payload_len,
+                                                   wayland_xdg_wm_base_ping_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 4)
+    return false;
+  event->serial = p[0];
+  return true;
+}
+
+/* ---------------- xdg_surface --------------------------------------------- */
+
+enum { wayland_xdg_surface_interface_version = 6 };
+enum {
+  wayland_xdg_surface_error_not_constructed = 1,
+  wayland_xdg_surface_error_already_constructed = 2,
+  wayland_xdg_surface_error_unconfigured_buffer = 3,
+  wayland_xdg_surface_error_invalid_serial = 4,
+  wayland_xdg_surface_error_invalid_size = 5,
+  wayland_xdg_surface_error_defunct_role_object = 6,
+};
+
+/* xdg_surface.destroy */
+enum { wayland_xdg_surface_destroy_opcode = 0, wayland_xdg_surface_destroy_size = 8 };
+static inline void wayland_xdg_surface_destroy_pack(uint32_t *msg, uint32_t xdg_surface) {
+  msg[0] = xdg_surface;
+  msg[1] = 8U << 16 | 0U;
+}
+
+/* xdg_surface.get_toplevel */
+enum { wayland_xdg_surface_get_toplevel_opcode = 1, wayland_xdg_surface_get_toplevel_size = 12 };
+static inline void wayland_xdg_surface_get_toplevel_pack(uint32_t *msg, uint32_t xdg_surface,
+                                                         uint32_t id) {
+  msg[0] = xdg_surface;
+  msg[1] = 12U << 16 | 1U;
+  msg[2] = id;
+}
+
+/* xdg_surface.get_popup */
+enum { wayland_xdg_surface_get_popup_opcode = 2, wayland_xdg_surface_get_popup_size = 20 };
+static inline void wayland_xdg_surface_get_popup_pack(uint32_t *msg, uint32_t xdg_surface,
+                                                      uint32_t id, uint32_t parent,
+                                                      uint32_t positioner) {
+  msg[0] = xdg_surface;
+  msg[1] = 20U << 16 | 2U;
+  msg[2] = id;
+  msg[3] = parent;
+  msg[4] = positioner;
+}
+
+/* xdg_surface.set_window_geometry */
+enum {
+  wayland_xdg_surface_set_window_geometry_opcode = 3,
+  wayland_xdg_surface_set_window_geometry_size = 24,
+};
+static inline void wayland_xdg_surface_set_window_geometry_pack(uint32_t *msg, uint32_t xdg_surface,
+                                                                int32_t x, int32_t y, int32_t width,
+                                                                int32_t height) {
+  msg[0] = xdg_surface;
+  msg[1] = 24U << 16 | 3U;
+  msg[2] = (uint32_t)x;
+  msg[3] = (uint32_t)y;
+  msg[4] = (uint32_t)width;
+  msg[5] = (uint32_t)height;
+}
+
+/* xdg_surface.ack_configure */
+enum { wayland_xdg_surface_ack_configure_opcode = 4, wayland_xdg_surface_ack_configure_size = 12 };
+static inline void wayland_xdg_surface_ack_configure_pack(uint32_t *msg, uint32_t xdg_surface,
+                                                          uint32_t serial) {
+  msg[0] = xdg_surface;
+  msg[1] = 12U << 16 | 4U;
+  msg[2] = serial;
+}
+
+/* xdg_surface.configure */
+enum { wayland_xdg_surface_configure_event = 0 };
+typedef struct wayland_xdg_surface_configure_t {
+  uint32_t serial;
+} wayland_xdg_surface_configure_t;
+static inline bool wayland_xdg_surface_configure_unpack(const char *payload, uint64_t payload_len,
+                                                        wayland_xdg_surface_configure_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 4)
+    return false;
+  event->serial = p[0];
+  return true;
+}
+
+/* ---------------- xdg_toplevel -------------------------------------------- */
+
+enum { wayland_xdg_toplevel_interface_version = 6 };
+enum {
+  wayland_xdg_toplevel_error_invalid_resize_edge = 0,
+  wayland_xdg_toplevel_error_invalid_parent = 1,
+  wayland_xdg_toplevel_error_invalid_size = 2,
+};
+enum {
+  wayland_xdg_toplevel_resize_edge_none = 0,
+  wayland_xdg_toplevel_resize_edge_top = 1,
+  wayland_xdg_toplevel_resize_edge_bottom = 2,
+  wayland_xdg_toplevel_resize_edge_left = 4,
+  wayland_xdg_toplevel_resize_edge_top_left = 5,
+  wayland_xdg_toplevel_resize_edge_bottom_left = 6,
+  wayland_xdg_toplevel_resize_edge_right = 8,
+  wayland_xdg_toplevel_resize_edge_top_right = 9,
+  wayland_xdg_toplevel_resize_edge_bottom_right = 10,
+};
+enum {
+  wayland_xdg_toplevel_state_maximized = 1,
+  wayland_xdg_toplevel_state_fullscreen = 2,
+  wayland_xdg_toplevel_state_resizing = 3,
+  wayland_xdg_toplevel_state_activated = 4,
+  wayland_xdg_toplevel_state_tiled_left = 5,
+  wayland_xdg_toplevel_state_tiled_right = 6,
+  wayland_xdg_toplevel_state_tiled_top = 7,
+  wayland_xdg_toplevel_state_tiled_bottom = 8,
+  wayland_xdg_toplevel_state_suspended = 9,
+};
+enum {
+  wayland_xdg_toplevel_wm_capabilities_window_menu = 1,
+  wayland_xdg_toplevel_wm_capabilities_maximize = 2,
+  wayland_xdg_toplevel_wm_capabilities_fullscreen = 3,
+  wayland_xdg_toplevel_wm_capabilities_minimize = 4,
+};
+
+/* xdg_toplevel.destroy */
+enum { wayland_xdg_toplevel_destroy_opcode = 0, wayland_xdg_toplevel_destroy_size = 8 };
+static inline void wayland_xdg_toplevel_destroy_pack(uint32_t *msg, uint32_t xdg_toplevel) {
+  msg[0] = xdg_toplevel;
+  msg[1] = 8U << 16 | 0U;
+}
+
+/* xdg_toplevel.set_parent */
+enum { wayland_xdg_toplevel_set_parent_opcode = 1, wayland_xdg_toplevel_set_parent_size = 12 };
+static inline void wayland_xdg_toplevel_set_parent_pack(uint32_t *msg, uint32_t xdg_toplevel,
+                                                        uint32_t parent) {
+  msg[0] = xdg_toplevel;
+  msg[1] = 12U << 16 | 1U;
+  msg[2] = parent;
+}
+
+/* xdg_toplevel.set_title: string lengths exclude the terminator */
+enum { wayland_xdg_toplevel_set_title_opcode = 2 };
+static inline uint32_t wayland_xdg_toplevel_set_title_size(uint32_t title_len) {
+  return 12 + ((title_len + 4) & ~3U);
+}
+static inline void wayland_xdg_toplevel_set_title_pack(uint32_t *msg, uint32_t size,
+                                                       uint32_t xdg_toplevel, const char *title,
+                                                       uint32_t title_len) {
+  msg[0] = xdg_toplevel;
+  msg[1] = size << 16 | 2U;
+  uint32_t at = 2;
+  at += wayland_pack_bytes(msg + at, title, title_len + 1, title_len);
+}
+
+/* xdg_toplevel.set_app_id: string lengths exclude the terminator */
+enum { wayland_xdg_toplevel_set_app_id_opcode = 3 };
+static inline uint32_t wayland_xdg_toplevel_set_app_id_size(uint32_t app_id_len) {
+  return 12 + ((app_id_len + 4) & ~3U);
+}
+static inline void wayland_xdg_toplevel_set_app_id_pack(uint32_t *msg, uint32_t size,
+                                                        uint32_t xdg_toplevel, const char *app_id,
+                                                        uint32_t app_id_len) {
+  msg[0] = xdg_toplevel;
+  msg[1] = size << 16 | 3U;
+  uint32_t at = 2;
+  at += wayland_pack_bytes(msg + at, app_id, app_id_len + 1, app_id_len);
+}
+
+/* xdg_toplevel.show_window_menu */
+enum {
+  wayland_xdg_toplevel_show_window_menu_opcode = 4,
+  wayland_xdg_toplevel_show_window_menu_size = 24,
+};
+static inline void wayland_xdg_toplevel_show_window_menu_pack(uint32_t *msg, uint32_t xdg_toplevel,
+                                                              uint32_t seat, uint32_t serial,
+                                                              int32_t x, int32_t y) {
+  msg[0] = xdg_toplevel;
+  msg[1] = 24U << 16 | 4U;
+  msg[2] = seat;
+  msg[3] = serial;
+  msg[4] = (uint32_t)x;
+  msg[5] = (uint32_t)y;
+}
+
+/* xdg_toplevel.move */
+enum { wayland_xdg_toplevel_move_opcode = 5, wayland_xdg_toplevel_move_size = 16 };
+static inline void wayland_xdg_toplevel_move_pack(uint32_t *msg, uint32_t xdg_toplevel,
+                                                  uint32_t seat, uint32_t serial) {
+  msg[0] = xdg_toplevel;
+  msg[1] = 16U << 16 | 5U;
+  msg[2] = seat;
+  msg[3] = serial;
+}
+
+/* xdg_toplevel.resize */
+enum { wayland_xdg_toplevel_resize_opcode = 6, wayland_xdg_toplevel_resize_size = 20 };
+static inline void wayland_xdg_toplevel_resize_pack(uint32_t *msg, uint32_t xdg_toplevel,
+                                                    uint32_t seat, uint32_t serial,
+                                                    uint32_t edges) {
+  msg[0] = xdg_toplevel;
+  msg[1] = 20U << 16 | 6U;
+  msg[2] = seat;
+  msg[3] = serial;
+  msg[4] = edges;
+}
+
+/* xdg_toplevel.set_max_size */
+enum { wayland_xdg_toplevel_set_max_size_opcode = 7, wayland_xdg_toplevel_set_max_size_size = 16 };
+static inline void wayland_xdg_toplevel_set_max_size_pack(uint32_t *msg, uint32_t xdg_toplevel,
+                                                          int32_t width, int32_t height) {
+  msg[0] = xdg_toplevel;
+  msg[1] = 16U << 16 | 7U;
+  msg[2] = (uint32_t)width;
+  msg[3] = (uint32_t)height;
+}
+
+/* xdg_toplevel.set_min_size */
+enum { wayland_xdg_toplevel_set_min_size_opcode = 8, wayland_xdg_toplevel_set_min_size_size = 16 };
+static inline void wayland_xdg_toplevel_set_min_size_pack(uint32_t *msg, uint32_t xdg_toplevel,
+                                                          int32_t width, int32_t height) {
+  msg[0] = xdg_toplevel;
+  msg[1] = 16U << 16 | 8U;
+  msg[2] = (uint32_t)width;
+  msg[3] = (uint32_t)height;
+}
+
+/* xdg_toplevel.set_maximized */
+enum { wayland_xdg_toplevel_set_maximized_opcode = 9, wayland_xdg_toplevel_set_maximized_size = 8 };
+static inline void wayland_xdg_toplevel_set_maximized_pack(uint32_t *msg, uint32_t xdg_toplevel) {
+  msg[0] = xdg_toplevel;
+  msg[1] = 8U << 16 | 9U;
+}
+
+/* xdg_toplevel.unset_maximized */
+enum {
+  wayland_xdg_toplevel_unset_maximized_opcode = 10,
+  wayland_xdg_toplevel_unset_maximized_size = 8,
+};
+static inline void wayland_xdg_toplevel_unset_maximized_pack(uint32_t *msg, uint32_t xdg_toplevel) {
+  msg[0] = xdg_toplevel;
+  msg[1] = 8U << 16 | 10U;
+}
+
+/* xdg_toplevel.set_fullscreen */
+enum {
+  wayland_xdg_toplevel_set_fullscreen_opcode = 11,
+  wayland_xdg_toplevel_set_fullscreen_size = 12,
+};
+static inline void wayland_xdg_toplevel_set_fullscreen_pack(uint32_t *msg, uint32_t xdg_toplevel,
+                                                            uint32_t output) {
+  msg[0] = xdg_toplevel;
+  msg[1] = 12U << 16 | 11U;
+  msg[2] = output;
+}
+
+/* xdg_toplevel.unset_fullscreen */
+enum {
+  wayland_xdg_toplevel_unset_fullscreen_opcode = 12,
+  wayland_xdg_toplevel_unset_fullscreen_size = 8,
+};
+static inline void wayland_xdg_toplevel_unset_fullscreen_pack(uint32_t *msg,
+                                                              uint32_t xdg_toplevel) {
+  msg[0] = xdg_toplevel;
+  msg[1] = 8U << 16 | 12U;
+}
+
+/* xdg_toplevel.set_minimized */
+enum {
+  wayland_xdg_toplevel_set_minimized_opcode = 13,
+  wayland_xdg_toplevel_set_minimized_size = 8,
+};
+static inline void wayland_xdg_toplevel_set_minimized_pack(uint32_t *msg, uint32_t xdg_toplevel) {
+  msg[0] = xdg_toplevel;
+  msg[1] = 8U << 16 | 13U;
+}
+
+/* xdg_toplevel.configure */
+enum { wayland_xdg_toplevel_configure_event = 0 };
+typedef struct wayland_xdg_toplevel_configure_t {
+  int32_t width;
+  int32_t height;
+  const void *states;
+  uint32_t states_size;
+} wayland_xdg_toplevel_configure_t;
+static inline bool wayland_xdg_toplevel_configure_unpack(const char *payload, uint64_t payload_len,
+                                                         wayland_xdg_toplevel_configure_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  uint64_t words = payload_len / 4, at = 0;
+  if (at >= words)
+    return false;
+  event->width = (int32_t)p[at++];
+  if (at >= words)
+    return false;
+  event->height = (int32_t)p[at++];
+  if (!wayland_unpack_array(p, words, &at, &event->states, &event->states_size))
+    return false;
+  return true;
+}
+
+/* xdg_toplevel.close */
+enum { wayland_xdg_toplevel_close_event = 1 };
+
+/* xdg_toplevel.configure_bounds (since 4) */
+enum { wayland_xdg_toplevel_configure_bounds_event = 2 };
+typedef struct wayland_xdg_toplevel_configure_bounds_t {
+  int32_t width;
+  int32_t height;
+} wayland_xdg_toplevel_configure_bounds_t;
+static inline bool wayland_xdg_toplevel_configure_bounds_unpack(const char *payload,
+                                                                uint64_t payload_len,
+                                                                wayland_xdg_toplevel_configure_bounds_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  if (payload_len < 8)
+    return false;
+  event->width = (int32_t)p[0];
+  event->height = (int32_t)p[1];
+  return true;
+}
+
+/* xdg_toplevel.wm_capabilities (since 5) */
+enum { wayland_xdg_toplevel_wm_capabilities_event = 3 };
+typedef struct wayland_xdg_toplevel_wm_capabilities_t {
+  const void *capabilities;
+  uint32_t capabilities_size;
+} wayland_xdg_toplevel_wm_capabilities_t;
+static inline bool wayland_xdg_toplevel_wm_capabilities_unpack(const char *payload,
+                                                               uint64_t payload_len,
+                                                               wayland_xdg_toplevel_wm_capabilities_t *event) {
+  const uint32_t *p = (const uint32_t *)payload;
+  uint64_t words = payload_len / 4, at = 0;
+  if (!wayland_unpack_array(p, words, &at, &event->capabilities, &event->capabilities_size))
+    return false;
+  return true;
+}
+
+/* Message names for decoders and debug output; only compiled in with
+ * KASAMA_PROTOCOL_NAMES. `creates` is the interface of the object a message
+ * creates through its new_id argument. */
+#ifdef KASAMA_PROTOCOL_NAMES
+typedef struct wayland_message_name_t {
+  const char *name;
+  const char *creates;
+} wayland_message_name_t;
+
+enum { wayland_wl_display_request_count = 2 };
+static const wayland_message_name_t wayland_wl_display_request_names[] = {
+  {"sync", "wl_callback"},
+  {"get_registry", "wl_registry"},
+};
+enum { wayland_wl_display_event_count = 2 };
+static const wayland_message_name_t wayland_wl_display_event_names[] = {
+  {"error", NULL},
+  {"delete_id", NULL},
+};
+enum { wayland_wl_registry_request_count = 1 };
+static const wayland_message_name_t wayland_wl_registry_request_names[] = {
+  {"bind", NULL},
+};
+enum { wayland_wl_registry_event_count = 2 };
+static const wayland_message_name_t wayland_wl_registry_event_names[] = {
+  {"global", NULL},
+  {"global_remove", NULL},
+};
+enum { wayland_wl_callback_request_count = 0 };
+static const wayland_message_name_t wayland_wl_callback_request_names[] = {
+  {NULL, NULL},
+};
+enum { wayland_wl_callback_event_count = 1 };
+static const wayland_message_name_t wayland_wl_callback_event_names[] = {
+  {"done", NULL},
+};
+enum { wayland_wl_compositor_request_count = 2 };
+static const wayland_message_name_t wayland_wl_compositor_request_names[] = {
+  {"create_surface", "wl_surface"},
+  {"create_region", "wl_region"},
+};
+enum { wayland_wl_compositor_event_count = 0 };
+static const wayland_message_name_t wayland_wl_compositor_event_names[] = {
+  {NULL, NULL},
+};
+enum { wayland_wl_shm_pool_request_count = 3 };
+static const wayland_message_name_t wayland_wl_shm_pool_request_names[] = {
+  {"create_buffer", "wl_buffer"},
+  {"destroy", NULL},
+  {"resize", NULL},
+};
+enum { wayland_wl_shm_pool_event_count = 0 };
+static const wayland_message_name_t wayland_wl_shm_pool_event_names[] = {
+  {NULL, NULL},
+};
+enum { wayland_wl_shm_request_count = 2 };
+static const wayland_message_name_t wayland_wl_shm_request_names[] = {
+  {"create_pool", "wl_shm_pool"},
+  {"release", NULL},
+};
+enum { wayland_wl_shm_event_count = 1 };
+static const wayland_message_name_t wayland_wl_shm_event_names[] = {
+  {"format", NULL},
+};
+enum { wayland_wl_buffer_request_count = 1 };
+static const wayland_message_name_t wayland_wl_buffer_request_names[] = {
+  {"destroy", NULL},
+};
+enum { wayland_wl_buffer_event_count = 1 };
+static const wayland_message_name_t wayland_wl_buffer_event_names[] = {
+  {"release", NULL},
+};
+enum { wayland_wl_surface_request_count = 11 };
+static const wayland_message_name_t wayland_wl_surface_request_names[] = {
+  {"destroy", NULL},
+  {"attach", NULL},
+  {"damage", NULL},
+  {"frame", "wl_callback"},
+  {"set_opaque_region", NULL},
+  {"set_input_region", NULL},
+  {"commit", NULL},
+  {"set_buffer_transform", NULL},
+  {"set_buffer_scale", NULL},
+  {"damage_buffer", NULL},
+  {"offset", NULL},
+};
+enum { wayland_wl_surface_event_count = 4 };
+static const wayland_message_name_t wayland_wl_surface_event_names[] = {
+  {"enter", NULL},
+  {"leave", NULL},
+  {"preferred_buffer_scale", NULL},
+  {"preferred_buffer_transform", NULL},
+};
+enum { wayland_wl_seat_request_count = 4 };
+static const wayland_message_name_t wayland_wl_seat_request_names[] = {
+  {"get_pointer", "wl_pointer"},
+  {"get_keyboard", "wl_keyboard"},
+  {"get_touch", "wl_touch"},
+  {"release", NULL},
+};
+enum { wayland_wl_seat_event_count = 2 };
+static const wayland_message_name_t wayland_wl_seat_event_names[] = {
+  {"capabilities", NULL},
+  {"name", NULL},
+};
+enum { wayland_wl_pointer_request_count = 2 };
+static const wayland_message_name_t wayland_wl_pointer_request_names[] = {
+  {"set_cursor", NULL},
+  {"release", NULL},
+};
+enum { wayland_wl_pointer_event_count = 11 };
+static const wayland_message_name_t wayland_wl_pointer_event_names[] = {
+  {"enter", NULL},
+  {"leave", NULL},
+  {"motion", NULL},
+  {"button", NULL},
+  {"axis", NULL},
+  {"frame", NULL},
+  {"axis_source", NULL},
+  {"axis_stop", NULL},
+  {"axis_discrete", NULL},
+  {"axis_value120", NULL},
+  {"axis_relative_direction", NULL},
+};
+enum { wayland_wl_keyboard_request_count = 1 };
+static const wayland_message_name_t wayland_wl_keyboard_request_names[] = {
+  {"release", NULL},
+};
+enum { wayland_wl_keyboard_event_count = 6 };
+static const wayland_message_name_t wayland_wl_keyboard_event_names[] = {
+  {"keymap", NULL},
+  {"enter", NULL},
+  {"leave", NULL},
+  {"key", NULL},
+  {"modifiers", NULL},
+  {"repeat_info", NULL},
+};
+enum { wayland_xdg_wm_base_request_count = 4 };
+static const wayland_message_name_t wayland_xdg_wm_base_request_names[] = {
+  {"destroy", NULL},
+  {"create_positioner", "xdg_positioner"},
+  {"get_xdg_surface", "xdg_surface"},
+  {"pong", NULL},
+};
+enum { wayland_xdg_wm_base_event_count = 1 };
+static const wayland_message_name_t wayland_xdg_wm_base_event_names[] = {
+  {"ping", NULL},
+};
+enum { wayland_xdg_surface_request_count = 5 };
+static const wayland_message_name_t wayland_xdg_surface_request_names[] = {
+  {"destroy", NULL},
+  {"get_toplevel", "xdg_toplevel"},
+  {"get_popup", "xdg_popup"},
+  {"set_window_geometry", NULL},
+  {"ack_configure", NULL},
+};
+enum { wayland_xdg_surface_event_count = 1 };
+static const wayland_message_name_t wayland_xdg_surface_event_names[] = {
+  {"configure", NULL},
+};
+enum { wayland_xdg_toplevel_request_count = 14 };
+static const wayland_message_name_t wayland_xdg_toplevel_request_names[] = {
+  {"destroy", NULL},
+  {"set_parent", NULL},
+  {"set_title", NULL},
+  {"set_app_id", NULL},
+  {"show_window_menu", NULL},
+  {"move", NULL},
+  {"resize", NULL},
+  {"set_max_size", NULL},
+  {"set_min_size", NULL},
+  {"set_maximized", NULL},
+  {"unset_maximized", NULL},
+  {"set_fullscreen", NULL},
+  {"unset_fullscreen", NULL},
+  {"set_minimized", NULL},
+};
+enum { wayland_xdg_toplevel_event_count = 4 };
+static const wayland_message_name_t wayland_xdg_toplevel_event_names[] = {
+  {"configure", NULL},
+  {"close", NULL},
+  {"configure_bounds", NULL},
+  {"wm_capabilities", NULL},
+};
+#endif
+
+/* The same protocol as libwayland's wl_interface descriptions, for the
+ * libwayland-client transport; only compiled in with
+ * KASAMA_PROTOCOL_WL_INTERFACES, after <wayland-util.h>. They are what
+ * wayland-scanner's private code would be, under kasama's names. Arguments
+ * of interfaces outside these files are typed NULL: any object. */
+#ifdef KASAMA_PROTOCOL_WL_INTERFACES
+static const struct wl_interface wayland_wl_display_wl_interface;
+static const struct wl_interface wayland_wl_registry_wl_interface;
+static const struct wl_interface wayland_wl_callback_wl_interface;
+static const struct wl_interface wayland_wl_compositor_wl_interface;
+static const struct wl_interface wayland_wl_shm_pool_wl_interface;
+static const struct wl_interface wayland_wl_shm_wl_interface;
+static const struct wl_interface wayland_wl_buffer_wl_interface;
+static const struct wl_interface wayland_wl_surface_wl_interface;
+static const struct wl_interface wayland_wl_seat_wl_interface;
+static const struct wl_interface wayland_wl_pointer_wl_interface;
+static const struct wl_interface wayland_wl_keyboard_wl_interface;
+static const struct wl_interface wayland_xdg_wm_base_wl_interface;
+static const struct wl_interface wayland_xdg_surface_wl_interface;
+static const struct wl_interface wayland_xdg_toplevel_wl_interface;
+
+static const struct wl_interface *wayland_wl_display_sync_wl_types[] = {
+  &wayland_wl_callback_wl_interface,
+};
+static const struct wl_interface *wayland_wl_display_get_registry_wl_types[] = {
+  &wayland_wl_registry_wl_interface,
+};
+static const struct wl_message wayland_wl_display_wl_requests[] = {
+  {"sync", "n", wayland_wl_display_sync_wl_types},
+  {"get_registry", "n", wayland_wl_display_get_registry_wl_types},
+};
+static const struct wl_interface *wayland_wl_display_error_wl_types[] = {
+  NULL, NULL, NULL,
+};
+static const struct wl_interface *wayland_wl_display_delete_id_wl_types[] = {
+  NULL,
+};
+static const struct wl_message wayland_wl_display_wl_events[] = {
+  {"error", "ous", wayland_wl_display_error_wl_types},
+  {"delete_id", "u", wayland_wl_display_delete_id_wl_types},
+};
+static const struct wl_interface wayland_wl_display_wl_interface = {
+  "wl_display", 1, 2, wayland_wl_display_wl_requests, 2, wayland_wl_display_wl_events,
+};
+
+static const struct wl_interface *wayland_wl_registry_bind_wl_types[] = {
+  NULL, NULL, NULL, NULL,
+};
+static const struct wl_message wayland_wl_registry_wl_requests[] = {
+  {"bind", "usun", wayland_wl_registry_bind_wl_types},
+};
+static const struct wl_interface *wayland_wl_registry_global_wl_types[] = {
+  NULL, NULL, NULL,
+};
+static const struct wl_interface *wayland_wl_registry_global_remove_wl_types[] = {
+  NULL,
+};
+static const struct wl_message wayland_wl_registry_wl_events[] = {
+  {"global", "usu", wayland_wl_registry_global_wl_types},
+  {"global_remove", "u", wayland_wl_registry_global_remove_wl_types},
+};
+static const struct wl_interface wayland_wl_registry_wl_interface = {
+  "wl_registry", 1, 1, wayland_wl_registry_wl_requests, 2, wayland_wl_registry_wl_events,
+};
+
+static const struct wl_interface *wayland_wl_callback_done_wl_types[] = {
+  NULL,
+};
+static const struct wl_message wayland_wl_callback_wl_events[] = {
+  {"done", "u", wayland_wl_callback_done_wl_types},
+};
+static const struct wl_interface wayland_wl_callback_wl_interface = {
+  "wl_callback", 1, 0, NULL, 1, wayland_wl_callback_wl_events,
+};
+
+static const struct wl_interface *wayland_wl_compositor_create_surface_wl_types[] = {
+  &wayland_wl_surface_wl_interface,
+};
+static const struct wl_interface *wayland_wl_compositor_create_region_wl_types[] = {
+  NULL,
+};
+static const struct wl_message wayland_wl_compositor_wl_requests[] = {
+  {"create_surface", "n", wayland_wl_compositor_create_surface_wl_types},
+  {"create_region", "n", wayland_wl_compositor_create_region_wl_types},
+};
+static const struct wl_interface wayland_wl_compositor_wl_interface = {
+  "wl_compositor", 6, 2, wayland_wl_compositor_wl_requests, 0, NULL,
+};
+
+static const struct wl_interface *wayland_wl_shm_pool_create_buffer_wl_types[] = {
+  &wayland_wl_buffer_wl_interface, NULL, NULL, NULL, NULL, NULL,
+};
+static const struct wl_interface *wayland_wl_shm_pool_resize_wl_types[] = {
+  NULL,
+};
+static const struct wl_message wayland_wl_shm_pool_wl_requests[] = {
+  {"create_buffer", "niiiiu", wayland_wl_shm_pool_create_buffer_wl_types},
+  {"destroy", "", NULL},
+  {"resize", "i", wayland_wl_shm_pool_resize_wl_types},
+};
+static const struct wl_interface wayland_wl_shm_pool_wl_interface = {
+  "wl_shm_pool", 2, 3, wayland_wl_shm_pool_wl_requests, 0, NULL,
+};
+
+static const struct wl_interface *wayland_wl_shm_create_pool_wl_types[] = {
+  &wayland_wl_shm_pool_wl_interface, NULL, NULL,
+};
+static const struct wl_message wayland_wl_shm_wl_requests[] = {
+  {"create_pool", "nhi", wayland_wl_shm_create_pool_wl_types},
+  {"release", "2", NULL},
+};
+static const struct wl_interface *wayland_wl_shm_format_wl_types[] = {
+  NULL,
+};
+static const struct wl_message wayland_wl_shm_wl_events[] = {
+  {"format", "u", wayland_wl_shm_format_wl_types},
+};
+static const struct wl_interface wayland_wl_shm_wl_interface = {
+  "wl_shm", 2, 2, wayland_wl_shm_wl_requests, 1, wayland_wl_shm_wl_events,
+};
+
+static const struct wl_message wayland_wl_buffer_wl_requests[] = {
+  {"destroy", "", NULL},
+};
+static const struct wl_message wayland_wl_buffer_wl_events[] = {
+  {"release", "", NULL},
+};
+static const struct wl_interface wayland_wl_buffer_wl_interface = {
+  "wl_buffer", 1, 1, wayland_wl_buffer_wl_requests, 1, wayland_wl_buffer_wl_events,
+};
+
+static const struct wl_interface *wayland_wl_surface_attach_wl_types[] = {
+  &wayland_wl_buffer_wl_interface, NULL, NULL,
+};
+static const struct wl_interface *wayland_wl_surface_damage_wl_types[] = {
+  NULL, NULL, NULL, NULL,
+};
+static const struct wl_interface *wayland_wl_surface_frame_wl_types[] = {
+  &wayland_wl_callback_wl_interface,
+};
+static const struct wl_interface *wayland_wl_surface_set_opaque_region_wl_types[] = {
+  NULL,
+};
+static const struct wl_interface *wayland_wl_surface_set_input_region_wl_types[] = {
+  NULL,
+};
+static const struct wl_interface *wayland_wl_surface_set_buffer_transform_wl_types[] = {
+  NULL,
+};
+static const struct wl_interface *wayland_wl_surface_set_buffer_scale_wl_types[] = {
+  NULL,
+};
+static const struct wl_interface *wayland_wl_surface_damage_buffer_wl_types[] = {
+  NULL, NULL, NULL, NULL,
+};
+static const struct wl_interface *wayland_wl_surface_offset_wl_types[] = {
+  NULL, NULL,
+};
+static const struct wl_message wayland_wl_surface_wl_requests[] = {
+  {"destroy", "", NULL},
+  {"attach", "?oii", wayland_wl_surface_attach_wl_types},
+  {"damage", "iiii", wayland_wl_surface_damage_wl_types},
+  {"frame", "n", wayland_wl_surface_frame_wl_types},
+  {"set_opaque_region", "?o", wayland_wl_surface_set_opaque_region_wl_types},
+  {"set_input_region", "?o", wayland_wl_surface_set_input_region_wl_types},
+  {"commit", "", NULL},
+  {"set_buffer_transform", "2i", wayland_wl_surface_set_buffer_transform_wl_types},
+  {"set_buffer_scale", "3i", wayland_wl_surface_set_buffer_scale_wl_types},
+  {"damage_buffer", "4iiii", wayland_wl_surface_damage_buffer_wl_types},
+  {"offset", "5ii", wayland_wl_surface_offset_wl_types},
+};
+static const struct wl_interface *wayland_wl_surface_enter_wl_types[] = {
+  NULL,
+};
+static const struct wl_interface *wayland_wl_surface_leave_wl_types[] = {
+  NULL,
+};
+static const struct wl_interface *wayland_wl_surface_preferred_buffer_scale_wl_types[] = {
+  NULL,
+};
+static const struct wl_interface *wayland_wl_surface_preferred_buffer_transform_wl_types[] = {
+  NULL,
+};
+static const struct wl_message wayland_wl_surface_wl_events[] = {
+  {"enter", "o", wayland_wl_surface_enter_wl_types},
+  {"leave", "o", wayland_wl_surface_leave_wl_types},
+  {"preferred_buffer_scale", "6i", wayland_wl_surface_preferred_buffer_scale_wl_types},
+  {"preferred_buffer_transform", "6u", wayland_wl_surface_preferred_buffer_transform_wl_types},
+};
+static const struct wl_interface wayland_wl_surface_wl_interface = {
+  "wl_surface", 6, 11, wayland_wl_surface_wl_requests, 4, wayland_wl_surface_wl_events,
+};
+
+static const struct wl_interface *wayland_wl_seat_get_pointer_wl_types[] = {
+  &wayland_wl_pointer_wl_interface,
+};
+static const struct wl_interface *wayland_wl_seat_get_keyboard_wl_types[] = {
+  &wayland_wl_keyboard_wl_interface,
+};
+static const struct wl_interface *wayland_wl_seat_get_touch_wl_types[] = {
+  NULL,
+};
+static const struct wl_message wayland_wl_seat_wl_requests[] = {
+  {"get_pointer", "n", wayland_wl_seat_get_pointer_wl_types},
+  {"get_keyboard", "n", wayland_wl_seat_get_keyboard_wl_types},
+  {"get_touch", "n", wayland_wl_seat_get_touch_wl_types},
+  {"release", "5", NULL},
+};
+static const struct wl_interface *wayland_wl_seat_capabilities_wl_types[] = {
+  NULL,
+};
+static const struct wl_interface *wayland_wl_seat_name_wl_types[] = {
+  NULL,
+};
+static const struct wl_message wayland_wl_seat_wl_events[] = {
+  {"capabilities", "u", wayland_wl_seat_capabilities_wl_types},
+  {"name", "2s", wayland_wl_seat_name_wl_types},
+};
+static const struct wl_interface wayland_wl_seat_wl_interface = {
+  "wl_seat", 9, 4, wayland_wl_seat_wl_requests, 2, wayland_wl_seat_wl_events,
+};
+
+static const struct wl_interface *wayland_wl_pointer_set_cursor_wl_types[] = {
+  NULL, &wayland_wl_surface_wl_interface, NULL, NULL,
+};
+static const struct wl_message wayland_wl_pointer_wl_requests[] = {
+  {"set_cursor", "u?oii", wayland_wl_pointer_set_cursor_wl_types},
+  {"release", "3", NULL},
+};
+static const struct wl_interface *wayland_wl_pointer_enter_wl_types[] = {
+  NULL, &wayland_wl_surface_wl_interface, NULL, NULL,
+};
+static const struct wl_interface *wayland_wl_pointer_leave_wl_types[] = {
+  NULL, &wayland_wl_surface_wl_interface,
+};
+static const struct wl_interface *wayland_wl_pointer_motion_wl_types[] = {
+  NULL, NULL, NULL,
+};
+static const struct wl_interface *wayland_wl_pointer_button_wl_types[] = {
+  NULL, NULL, NULL, NULL,
+};
+static const struct wl_interface *wayland_wl_pointer_axis_wl_types[] = {
+  NULL, NULL, NULL,
+};
+static const struct wl_interface *wayland_wl_pointer_axis_source_wl_types[] = {
+  NULL,
+};
+static const struct wl_interface *wayland_wl_pointer_axis_stop_wl_types[] = {
+  NULL, NULL,
+};
+static const struct wl_interface *wayland_wl_pointer_axis_discrete_wl_types[] = {
+  NULL, NULL,
+};
+static const struct wl_interface *wayland_wl_pointer_axis_value120_wl_types[] = {
+  NULL, NULL,
+};
+static const struct wl_interface *wayland_wl_pointer_axis_relative_direction_wl_types[] = {
+  NULL, NULL,
+};
+static const struct wl_message wayland_wl_pointer_wl_events[] = {
+  {"enter", "uoff", wayland_wl_pointer_enter_wl_types},
+  {"leave", "uo", wayland_wl_pointer_leave_wl_types},
+  {"motion", "uff", wayland_wl_pointer_motion_wl_types},
+  {"button", "uuuu", wayland_wl_pointer_button_wl_types},
+  {"axis", "uuf", wayland_wl_pointer_axis_wl_types},
+  {"frame", "5", NULL},
+  {"axis_source", "5u", wayland_wl_pointer_axis_source_wl_types},
+  {"axis_stop", "5uu", wayland_wl_pointer_axis_stop_wl_types},
+  {"axis_discrete", "5ui", wayland_wl_pointer_axis_discrete_wl_types},
+  {"axis_value120", "8ui", wayland_wl_pointer_axis_value120_wl_types},
+  {"axis_relative_direction", "9uu", wayland_wl_pointer_axis_relative_direction_wl_types},
+};
+static const struct wl_interface wayland_wl_pointer_wl_interface = {
+  "wl_pointer", 9, 2, wayland_wl_pointer_wl_requests, 11, wayland_wl_pointer_wl_events,
+};
+
+static const struct wl_message wayland_wl_keyboard_wl_requests[] = {
+  {"release", "3", NULL},
+};
+static const struct wl_interface *wayland_wl_keyboard_keymap_wl_types[] = {
+  NULL, NULL, NULL,
+};
+static const struct wl_interface *wayland_wl_keyboard_enter_wl_types[] = {
+  NULL, &wayland_wl_surface_wl_interface, NULL,
+};
+static const struct wl_interface *wayland_wl_keyboard_leave_wl_types[] = {
+  NULL, &wayland_wl_surface_wl_interface,
+};
+static const struct wl_interface *wayland_wl_keyboard_key_wl_types[] = {
+  NULL, NULL, NULL, NULL,
+};
+static const struct wl_interface *wayland_wl_keyboard_modifiers_wl_types[] = {
+  NULL, NULL, NULL, NULL, NULL,
+};
+static const struct wl_interface *wayland_wl_keyboard_repeat_info_wl_types[] = {
+  NULL, NULL,
+};
+static const struct wl_message wayland_wl_keyboard_wl_events[] = {
+  {"keymap", "uhu", wayland_wl_keyboard_keymap_wl_types},
+  {"enter", "uoa", wayland_wl_keyboard_enter_wl_types},
+  {"leave", "uo", wayland_wl_keyboard_leave_wl_types},
+  {"key", "uuuu", wayland_wl_keyboard_key_wl_types},
+  {"modifiers", "uuuuu", wayland_wl_keyboard_modifiers_wl_types},
+  {"repeat_info", "4ii", wayland_wl_keyboard_repeat_info_wl_types},
+};
+static const struct wl_interface wayland_wl_keyboard_wl_interface = {
+  "wl_keyboard", 9, 1, wayland_wl_keyboard_wl_requests, 6, wayland_wl_keyboard_wl_events,
+};
+
+static const struct wl_interface *wayland_xdg_wm_base_create_positioner_wl_types[] = {
+  NULL,
+};
+static const struct wl_interface *wayland_xdg_wm_base_get_xdg_surface_wl_types[] = {
+  &wayland_xdg_surface_wl_interface, &wayland_wl_surface_wl_interface,
+};
+static const struct wl_interface *wayland_xdg_wm_base_pong_wl_types[] = {
+  NULL,
+};
+static const struct wl_message wayland_xdg_wm_base_wl_requests[] = {
+  {"destroy", "", NULL},
+  {"create_positioner", "n", wayland_xdg_wm_base_create_positioner_wl_types},
+  {"get_xdg_surface", "no", wayland_xdg_wm_base_get_xdg_surface_wl_types},
+  {"pong", "u", wayland_xdg_wm_base_pong_wl_types},
+};
+static const struct wl_interface *wayland_xdg_wm_base_ping_wl_types[] = {
+  NULL,
+};
+static const struct wl_message wayland_xdg_wm_base_wl_events[] = {
+  {"ping", "u", wayland_xdg_wm_base_ping_wl_types},
+};
+static const struct wl_interface wayland_xdg_wm_base_wl_interface = {
+  "xdg_wm_base", 6, 4, wayland_xdg_wm_base_wl_requests, 1, wayland_xdg_wm_base_wl_events,
+};
+
+static const struct wl_interface *wayland_xdg_surface_get_toplevel_wl_types[] = {
+  &wayland_xdg_toplevel_wl_interface,
+};
+static const struct wl_interface *wayland_xdg_surface_get_popup_wl_types[] = {
+  NULL, &wayland_xdg_surface_wl_interface, NULL,
+};
+static const struct wl_interface *wayland_xdg_surface_set_window_geometry_wl_types[] = {
+  NULL, NULL, NULL, NULL,
+};
+static const struct wl_interface *wayland_xdg_surface_ack_configure_wl_types[] = {
+  NULL,
+};
+static const struct wl_message wayland_xdg_surface_wl_requests[] = {
+  {"destroy", "", NULL},
+  {"get_toplevel", "n", wayland_xdg_surface_get_toplevel_wl_types},
+  {"get_popup", "n?oo", wayland_xdg_surface_get_popup_wl_types},
+  {"set_window_geometry", "iiii", wayland_xdg_surface_set_window_geometry_wl_types},
+  {"ack_configure", "u", wayland_xdg_surface_ack_configure_wl_types},
+};
+static const struct wl_interface *wayland_xdg_surface_configure_wl_types[] = {
+  NULL,
+};
+static const struct wl_message wayland_xdg_surface_wl_events[] = {
+  {"configure", "u", wayland_xdg_surface_configure_wl_types},
+};
+static const struct wl_interface wayland_xdg_surface_wl_interface = {
+  "xdg_surface", 6, 5, wayland_xdg_surface_wl_requests, 1, wayland_xdg_surface_wl_events,
+};
+
+static const struct wl_interface *wayland_xdg_toplevel_set_parent_wl_types[] = {
+  &wayland_xdg_toplevel_wl_interface,
+};
+static const struct wl_interface *wayland_xdg_toplevel_set_title_wl_types[] = {
+  NULL,
+};
+static const struct wl_interface *wayland_xdg_toplevel_set_app_id_wl_types[] = {
+  NULL,
+};
+static const struct wl_interface *wayland_xdg_toplevel_show_window_menu_wl_types[] = {
+  &wayland_wl_seat_wl_interface, NULL, NULL, NULL,
+};
+static const struct wl_interface *wayland_xdg_toplevel_move_wl_types[] = {
+  &wayland_wl_seat_wl_interface, NULL,
+};
+static const struct wl_interface *wayland_xdg_toplevel_resize_wl_types[] = {
+  &wayland_wl_seat_wl_interface, NULL, NULL,
+};
+static const struct wl_interface *wayland_xdg_toplevel_set_max_size_wl_types[] = {
+  NULL, NULL,
+};
+static const struct wl_interface *wayland_xdg_toplevel_set_min_size_wl_types[] = {
+  NULL, NULL,
+};
+static const struct wl_interface *wayland_xdg_toplevel_set_fullscreen_wl_types[] = {
+  NULL,
+};
+static const struct wl_message wayland_xdg_toplevel_wl_requests[] = {
+  {"destroy", "", NULL},
+  {"set_parent", "?o", wayland_xdg_toplevel_set_parent_wl_types},
+  {"set_title", "s", wayland_xdg_toplevel_set_title_wl_types},
+  {"set_app_id", "s", wayland_xdg_toplevel_set_app_id_wl_types},
+  {"show_window_menu", "ouii", wayland_xdg_toplevel_show_window_menu_wl_types},
+  {"move", "ou", wayland_xdg_toplevel_move_wl_types},
+  {"resize", "ouu", wayland_xdg_toplevel_resize_wl_types},
+  {"set_max_size", "ii", wayland_xdg_toplevel_set_max_size_wl_types},
+  {"set_min_size", "ii", wayland_xdg_toplevel_set_min_size_wl_types},
+  {"set_maximized", "", NULL},
+  {"unset_maximized", "", NULL},
+  {"set_fullscreen", "?o", wayland_xdg_toplevel_set_fullscreen_wl_types},
+  {"unset_fullscreen", "", NULL},
+  {"set_minimized", "", NULL},
+};
+static const struct wl_interface *wayland_xdg_toplevel_configure_wl_types[] = {
+  NULL, NULL, NULL,
+};
+static const struct wl_interface *wayland_xdg_toplevel_configure_bounds_wl_types[] = {
+  NULL, NULL,
+};
+static const struct wl_interface *wayland_xdg_toplevel_wm_capabilities_wl_types[] = {
+  NULL,
+};
+static const struct wl_message wayland_xdg_toplevel_wl_events[] = {
+  {"configure", "iia", wayland_xdg_toplevel_configure_wl_types},
+  {"close", "", NULL},
+  {"configure_bounds", "4ii", wayland_xdg_toplevel_configure_bounds_wl_types},
+  {"wm_capabilities", "5a", wayland_xdg_toplevel_wm_capabilities_wl_types},
+};
+static const struct wl_interface wayland_xdg_toplevel_wl_interface = {
+  "xdg_toplevel", 6, 14, wayland_xdg_toplevel_wl_requests, 4, wayland_xdg_toplevel_wl_events,
+};
+
+#endif
+
+#endif
@@ -0,0 +1,417 @@
+/* kasama_replay.c
+ *
+ * ------------------------------------------------------------
+ *
+ * Record/replay throughput benchmark for the whole output path. Each
+ * recording of PTY output (see KASAMA_RECORD in kasama_emulator.c) is
+ * written into a pipe by a child process and read back by kasama's own
+ * event loop: reactor_read_pty, the parser and grid, the renderer, the shm
+ * buffers and the commit, paced by the compositor's frame callbacks. The
+ * compositor is the mock from kasama_mock_compositor.c, forked per run, or
+ * with -c whatever $WAYLAND_DISPLAY points at.
+ *
+ * Compile / run (example):
+ *   gcc -std=c11 -O2 -o kasama_replay kasama_replay.c
+ *   ./kasama_replay                        # the built-in corpus, as fast as it goes
+ *   KASAMA_RECORD=make.rec ./kasama        # record a session...
+ *   ./kasama_replay -r make.rec            # ...and replay it at the speed it came in
+ *   ./kasama_replay -g corpus              # write the corpus out as recordings
+ *
+ * Options:
+ *   -r        replay at recorded speed instead of as fast as possible
+ *   -c        use the compositor at $WAYLAND_DISPLAY instead of the mock
+ *   -h hz     the mock's refresh rate, 0 for a frame on every commit (60)
+ *   -g dir    write dir/<kind>.rec for every corpus kind and exit
+ *
+ * Without files, the corpus is generated in memory: the ascii, compiler,
+ * utf8, tui and storm streams of kasama_bench's parser benchmark, 16 MiB
+ * each, cut into 4 KiB reads stamped at a steady rate per kind. Every run
+ * reports MB/s of PTY output, frames rendered and the p50/p99 of
+ * render_frame's time.
+ */
+
+#define KASAMA_BENCH_NO_MAIN
+#include "kasama_bench.c"
+
+#define REPLAY_CORPUS_READ 4096U        /* bytes per corpus record, a PTY read */
+#define REPLAY_CORPUS_COLS 240U         /* the corpus grid: 1080p in 8x16 cells */
+#define REPLAY_CORPUS_ROWS 67U
+#define REPLAY_DRAIN_POLL_NS 1000000ULL /* the feeder's wait for the reader */
+
+typedef struct replay_t replay_t;
+typedef struct replay_options_t replay_options_t;
+
+/* A recording in memory, header included */
+struct replay_t {
+  char name[64];
+  uint8_t *data;
+  uint64_t len;
+  uint32_t cols, rows;
+  uint64_t records;
+  uint64_t bytes;              // PTY output in the records
+};
+
+struct replay_options_t {
+  bool recorded_speed;
+  bool compositor;             // -c: a real compositor, not the mock
+  uint32_t hz;
+};
+
+/* Corpus kinds and the rate their synthetic timestamps claim, in MB/s;
+ * 0 stamps every read at once, a burst */
+static const struct {
+  const char *kind;
+  uint32_t mb_per_s;
+} replay_corpus[] = {
+  {"ascii", 16},
+  {"compiler", 8},
+  {"utf8", 8},
+  {"tui", 4},
+  {"storm", 0},
+};
+
+static bool replay_varint_get(const uint8_t **in, const uint8_t *end, uint32_t *v) {
+  uint32_t value = 0;
+  for (uint32_t shift = 0; shift <= 28; shift += 7) {
+    if (*in == end)
+      return false;
+    uint8_t b = *(*in)++;
+    value |= (uint32_t)(b & 0x7f) << shift;
+    if (b < 0x80) {
+      *v = value;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Decode the record at *in and advance past it; data points into the
+ * recording.
+ * - Returns false at the end, or on a truncated record.
+ */
+static bool replay_next(const uint8_t **in, const uint8_t *end, uint32_t *delta_us,
+                        const uint8_t **data, uint32_t *len) {
+  const uint8_t *p = *in;
+  if (!replay_varint_get(&p, end, delta_us) || !replay_varint_get(&p, end, len) ||
+      *len > (uint64_t)(end - p))
+    return false;
+  *data = p;
+  *in = p + *len;
+  return true;
+}
+
+/* Count the records and check the header.
+ * - Returns false if this is not a recording.
+ */
+static bool replay_index(replay_t *replay) {
+  recording_header_t header;
+  if (replay->len < sizeof(header))
+    return false;
+  memcpy(&header, replay->data, sizeof(header));
+  if (memcmp(header.magic, RECORDING_MAGIC, sizeof(header.magic)) != 0 || header.cols == 0 || header.rows == 0)
+    return false;
+  replay->cols = header.cols;
+  replay->rows = header.rows;
+
+  const uint8_t *in = replay->data + sizeof(header), *end = replay->data + replay->len, *data;
+  uint32_t delta_us, len;
+  replay->records = replay->bytes = 0;
+  while (replay_next(&in, end, &delta_us, &data, &len)) {
+    replay->records++;
+    replay->bytes += len;
+  }
+  if (in != end)
+    fprintf(stderr, "%s: truncated after %" PRIu64 " records\n", replay->name, replay->records);
+  return true;
+}
+
+static int replay_load(replay_t *replay, const char *path) {
+  const char *base = strrchr(path, '/');
+  snprintf(replay->name, sizeof(replay->name), "%s", base ? base + 1 : path);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    if (fd != -1)
+      close(fd);
+    return -1;
+  }
+  replay->len = (uint64_t)st.st_size;
+  replay->data = malloc(replay->len ? replay->len : 1);
+  uint64_t got = 0;
+  while (replay->data && got < replay->len) {
+    ssize_t n = read(fd, replay->data + got, replay->len - got);
+    if (n <= 0)
+      break;
+    got += (uint64_t)n;
+  }
+  close(fd);
+  if (!replay->data || got != replay->len || !replay_index(replay)) {
+    fprintf(stderr, "%s: not a kasama recording\n", path);
+    free(replay->data);
+    return -1;
+  }
+  return 0;
+}
+
+/* A recording of one corpus kind for a cols x rows grid: the generated
+ * stream in REPLAY_CORPUS_READ pieces, mb_per_s apart. */
+static int replay_corpus_build(replay_t *replay, uint32_t kind, uint32_t cols, uint32_t rows) {
+  bench_stream_t stream = {.data = malloc(BENCH_PARSER_BYTES), .cap = BENCH_PARSER_BYTES};
+  uint64_t reads = BENCH_PARSER_BYTES / REPLAY_CORPUS_READ + 1;
+  replay->data = malloc(sizeof(recording_header_t) + BENCH_PARSER_BYTES + reads * RECORDING_RECORD_MAX);
+  if (!stream.data || !replay->data) {
+    free(stream.data);
+    free(replay->data);
+    return -1;
+  }
+  bench_stream_fill(&stream, replay_corpus[kind].kind, cols, rows);
+
+  snprintf(replay->name, sizeof(replay->name), "%s", replay_corpus[kind].kind);
+  recording_header_t header = {.magic = RECORDING_MAGIC, .cols = (uint16_t)cols, .rows = (uint16_t)rows};
+  memcpy(replay->data, &header, sizeof(header));
+  uint8_t *out = replay->data + sizeof(header);
+  uint32_t delta_us = replay_corpus[kind].mb_per_s ? REPLAY_CORPUS_READ / replay_corpus[kind].mb_per_s : 0;
+  for (uint64_t at = 0; at < stream.len; at += REPLAY_CORPUS_READ) {
+    uint32_t n = stream.len - at < REPLAY_CORPUS_READ ? (uint32_t)(stream.len - at) : REPLAY_CORPUS_READ;
+    out = term_varint_put(out, at ? delta_us : 0);
+    out = term_varint_put(out, n);
+    memcpy(out, stream.data + at, n);
+    out += n;
+  }
+  replay->len = (uint64_t)(out - replay->data);
+  free(stream.data);
+  replay_index(replay);
+  return 0;
+}
+
+static int replay_write_all(int fd, const uint8_t *data, uint64_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    data += n;
+    len -= (uint64_t)n;
+  }
+  return 0;
+}
+
+/* -g: write every corpus kind to dir/<kind>.rec */
+static int replay_corpus_write(const char *dir) {
+  for (uint32_t k = 0; k < sizeof(replay_corpus) / sizeof(replay_corpus[0]); k++) {
+    replay_t replay;
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s.rec", dir, replay_corpus[k].kind);
+    if (replay_corpus_build(&replay, k, REPLAY_CORPUS_COLS, REPLAY_CORPUS_ROWS) == -1) {
+      perror("replay_corpus_build");
+      return 1;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1 || replay_write_all(fd, replay.data, replay.len) == -1) {
+      fprintf(stderr, "%s: %s\n", path, strerror(errno));
+      return 1;
+    }
+    close(fd);
+    printf("%s: %" PRIu64 " records, %.1f MB\n", path, replay.records, (double)replay.bytes / 1e6);
+    free(replay.data);
+  }
+  return 0;
+}
+
+/* The feeder process: write the records into the pipe, at their recorded
+ * times or back to back, then wait for the reader to take the last of them,
+ * since the reactor stops on our exit. */
+static void replay_feed(const replay_t *replay, int fd, bool recorded_speed) {
+  const uint8_t *in = replay->data + sizeof(recording_header_t), *end = replay->data + replay->len, *data;
+  uint32_t delta_us, len;
+  uint64_t due = monotonic_ns();
+  while (replay_next(&in, end, &delta_us, &data, &len)) {
+    if (recorded_speed) {
+      due += (uint64_t)delta_us * 1000;
+      struct timespec ts = {.tv_sec = (time_t)(due / 1000000000ULL), .tv_nsec = (long)(due % 1000000000ULL)};
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+    }
+    if (replay_write_all(fd, data, len) == -1)
+      _exit(1);
+  }
+
+  int queued;
+  struct timespec poll_interval = {.tv_nsec = (long)REPLAY_DRAIN_POLL_NS};
+  while (ioctl(fd, FIONREAD, &queued) == 0 && queued > 0)
+    nanosleep(&poll_interval, NULL);
+  _exit(0);
+}
+
+/* One recording through the event loop.
+ * - signals: SIGCHLD, blocked, for the reactor's signalfd
+ */
+static int replay_run(const replay_t *replay, const replay_options_t *options, glyph_atlas_t *atlas,
+                      const sigset_t *signals) {
+  static wayland_conn_t conn;
+  static reactor_t reactor;
+  char name[64];
+  pid_t mock = -1;
+  state_t state = {.width = replay->cols * atlas->cell_w, .height = replay->rows * atlas->cell_h,
+                   .redraw_all = true};
+  state.atlas = atlas;
+
+  if (!options->compositor) {
+    bench_mock_display(name, sizeof(name));
+    mock_config_t config = {.vsync_ns = options->hz ? 1000000000ULL / options->hz : 0,
+                            .width = state.width, .height = state.height};
+    mock = bench_mock_spawn(name, &config);
+    if (mock == -1) {
+      fprintf(stderr, "can't start the mock compositor: %s\n", strerror(errno));
+      return -1;
+    }
+  }
+
+  // a real compositor picks the window size, and the grid follows it
+  term_t term;
+  if (bench_client_startup(&conn, &state) == -1) {
+    fprintf(stderr, "startup: %s\n", strerror(errno));
+    return -1;
+  }
+  if (term_init(&term, term_cells_fit(state.width, atlas->cell_w), term_cells_fit(state.height, atlas->cell_h)) == -1) {
+    perror("term_init");
+    return -1;
+  }
+  state.term = &term;
+  frame_mark_dirty(&state);
+  frame_maybe_render(&conn, &state);
+  while (state.frame.callback) {
+    if (swapchain_wait_event(&conn, &state) == -1)
+      return -1;
+  }
+  state.frame.render_len = 0; // the empty first frame is not part of the run
+  uint64_t renders_before = state.frame.renders;
+
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) == -1 || fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1) {
+    perror("pipe");
+    return -1;
+  }
+  uint64_t start = monotonic_ns();
+  fflush(stdout);
+  pid_t feeder = fork();
+  if (feeder == -1) {
+    perror("fork");
+    return -1;
+  }
+  if (feeder == 0) {
+    close(fds[0]);
+    replay_feed(replay, fds[1], options->recorded_speed);
+  }
+  close(fds[1]);
+
+  if (reactor_init(&reactor, conn.fd, fds[0], feeder, signals) == -1) {
+    perror("reactor_init");
+    return -1;
+  }
+  int ret = reactor_run(&reactor, &conn, &state);
+  // the feeder has exited, so the last output is parsed; put it on screen
+  while (ret == 0 && (state.frame.dirty || state.frame.callback)) {
+    frame_maybe_render(&conn, &state);
+    if (state.frame.callback && swapchain_wait_event(&conn, &state) == -1)
+      ret = -1;
+  }
+  uint64_t elapsed = monotonic_ns() - start;
+  if (ret == -1)
+    fprintf(stderr, "%s: event loop: %s\n", replay->name, strerror(errno));
+
+  static const uint32_t p[] = {50, 99};
+  uint32_t us[2] = {0, 0};
+  sample_ring_percentiles(state.frame.render_us, state.frame.render_len, FRAME_TIMES_CAP, p, us, 2);
+  printf("%-12s %8.1f %8.2f %8.1f %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8uus %8uus\n", replay->name,
+         (double)reactor.stats.pty_bytes / 1e6, (double)elapsed / 1e9,
+         (double)reactor.stats.pty_bytes * 1e3 / (double)elapsed, reactor.stats.pty_reads,
+         reactor.stats.pty_budget_hits, state.frame.renders - renders_before, us[0], us[1]);
+  if (reactor.stats.pty_bytes != replay->bytes)
+    fprintf(stderr, "%s: read %" PRIu64 " of %" PRIu64 " bytes\n", replay->name, reactor.stats.pty_bytes,
+            replay->bytes);
+
+  reactor_free(&reactor);
+  client_shutdown(&conn, &state);
+  term_free(&term);
+  if (mock != -1) {
+    kill(mock, SIGTERM);
+    waitpid(mock, NULL, 0);
+    bench_mock_unlink(name);
+  }
+  return ret;
+}
+
+int main(int argc, char **argv) {
+  replay_options_t options = {.hz = 60};
+  const char *corpus_dir = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "rch:g:")) != -1) {
+    switch (opt) {
+    case 'r':
+      options.recorded_speed = true;
+      break;
+    case 'c':
+      options.compositor = true;
+      break;
+    case 'h':
+      options.hz = (uint32_t)strtoul(optarg, NULL, 10);
+      break;
+    case 'g':
+      corpus_dir = optarg;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-r] [-c] [-h hz] [recording...]\n"
+                      "       %s -g dir\n", argv[0], argv[0]);
+      return 2;
+    }
+  }
+  if (corpus_dir)
+    return replay_corpus_write(corpus_dir);
+
+  pixel_kernels_init();
+  term_scan_kernels_init();
+  log_enabled = false;
+  font_t font;
+  glyph_atlas_t atlas;
+  if (font_load_embedded(&font) == -1 || glyph_atlas_init(&atlas, &font) == -1) {
+    perror("font");
+    return 1;
+  }
+
+  // the feeder's exit ends each run, through the reactor's signalfd
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &signals, NULL);
+
+  if (options.compositor)
+    printf("compositor %s, ", getenv(WAYLAND_SOCKET_ENV) ? getenv(WAYLAND_SOCKET_ENV) : DEFAULT_WAYLAND_SOCKET);
+  else if (options.hz)
+    printf("mock compositor at %u Hz, ", options.hz);
+  else
+    printf("mock compositor, unpaced, ");
+  printf("%s\n", options.recorded_speed ? "at recorded speed" : "as fast as possible");
+  printf("%-12s %8s %8s %8s %8s %8s %8s %10s %10s\n", "recording", "MB", "seconds", "MB/s", "reads",
+         "budget", "frames", "frame p50", "frame p99");
+
+  int ret = 0;
+  uint32_t runs = optind < argc ? (uint32_t)(argc - optind) : sizeof(replay_corpus) / sizeof(replay_corpus[0]);
+  for (uint32_t i = 0; i < runs; i++) {
+    replay_t replay;
+    if (optind < argc ? replay_load(&replay, argv[optind + i]) == -1
+                      : replay_corpus_build(&replay, i, REPLAY_CORPUS_COLS, REPLAY_CORPUS_ROWS) == -1) {
+      ret = 1;
+      continue;
+    }
+    if (replay_run(&replay, &options, &atlas, &signals) == -1)
+      ret = 1;
+    free(replay.data);
+  }
+
+  glyph_atlas_free(&atlas);
+  font_free(&font);
+  return ret;
+}
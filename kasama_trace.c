@@ -0,0 +1,294 @@
+/* kasama_trace.c
+ *
+ * ------------------------------------------------------------
+ *
+ * Offline decoder for the protocol traces a -DKASAMA_TRACE build of kasama
+ * writes (on SIGUSR1, or at exit when KASAMA_TRACE_FILE is set). It prints
+ * the messages the way WAYLAND_DEBUG=1 would, then latency histograms per
+ * message:
+ *  - request -> reply: from a request that creates an object to the first
+ *    event on that object, e.g. wl_surface.frame until wl_callback.done or
+ *    xdg_wm_base.get_xdg_surface until xdg_surface.configure
+ *  - handler: time spent dispatching each event
+ *
+ * Compile / run (example):
+ *   gcc -std=c11 -O2 -o kasama_trace kasama_trace.c
+ *   ./kasama_trace kasama-1234.trace       # messages, then histograms
+ *   ./kasama_trace -s kasama-1234.trace    # histograms only
+ *
+ * Records carry only the first argument word of each message, so the text
+ * shows that and elides the rest.
+ */
+
+#define KASAMA_NO_MAIN
+#define KASAMA_PROTOCOL_NAMES
+#include "kasama_emulator.c"
+
+#define TRACE_MAX_OPCODES 16U
+#define TRACE_BUCKETS 26U          /* log2 buckets of microseconds, the last open-ended */
+
+typedef struct trace_interface_t trace_interface_t;
+typedef struct trace_latency_t trace_latency_t;
+
+/* Message names per interface, from the tables kasama_protocol.h generates
+ * out of the protocol XML */
+struct trace_interface_t {
+  const char *name;
+  const wayland_message_name_t *requests;
+  uint32_t request_count;
+  const wayland_message_name_t *events;
+  uint32_t event_count;
+};
+
+#define TRACE_INTERFACE(iface) \
+  {#iface, wayland_##iface##_request_names, wayland_##iface##_request_count, \
+   wayland_##iface##_event_names, wayland_##iface##_event_count}
+
+static const trace_interface_t trace_interfaces[] = {
+  [WAYLAND_INTERFACE_NONE] = {"?", NULL, 0, NULL, 0},
+  [WAYLAND_WL_DISPLAY] = TRACE_INTERFACE(wl_display),
+  [WAYLAND_WL_REGISTRY] = TRACE_INTERFACE(wl_registry),
+  [WAYLAND_WL_CALLBACK] = TRACE_INTERFACE(wl_callback),
+  [WAYLAND_WL_COMPOSITOR] = TRACE_INTERFACE(wl_compositor),
+  [WAYLAND_WL_SHM] = TRACE_INTERFACE(wl_shm),
+  [WAYLAND_WL_SHM_POOL] = TRACE_INTERFACE(wl_shm_pool),
+  [WAYLAND_WL_BUFFER] = TRACE_INTERFACE(wl_buffer),
+  [WAYLAND_WL_SURFACE] = TRACE_INTERFACE(wl_surface),
+  [WAYLAND_WL_SEAT] = TRACE_INTERFACE(wl_seat),
+  [WAYLAND_WL_POINTER] = TRACE_INTERFACE(wl_pointer),
+  [WAYLAND_WL_KEYBOARD] = TRACE_INTERFACE(wl_keyboard),
+  [WAYLAND_XDG_WM_BASE] = TRACE_INTERFACE(xdg_wm_base),
+  [WAYLAND_XDG_SURFACE] = TRACE_INTERFACE(xdg_surface),
+  [WAYLAND_XDG_TOPLEVEL] = TRACE_INTERFACE(xdg_toplevel),
+};
+
+#define TRACE_INTERFACES_LEN (sizeof(trace_interfaces) / sizeof(trace_interfaces[0]))
+
+/* Samples of one latency series, in nanoseconds */
+struct trace_latency_t {
+  uint64_t *samples;
+  uint64_t len;
+  uint64_t cap;
+};
+
+/* [interface][direction][opcode]: TRACE_REQUEST series are request -> reply,
+ * TRACE_EVENT series are handler times */
+static trace_latency_t trace_latencies[TRACE_INTERFACES_LEN][2][TRACE_MAX_OPCODES];
+
+static const wayland_message_name_t *trace_message(const trace_record_t *record) {
+  if (record->interface >= TRACE_INTERFACES_LEN || record->opcode >= TRACE_MAX_OPCODES)
+    return NULL;
+  const trace_interface_t *interface = &trace_interfaces[record->interface];
+  if (record->direction == TRACE_REQUEST)
+    return record->opcode < interface->request_count ? &interface->requests[record->opcode] : NULL;
+  return record->opcode < interface->event_count ? &interface->events[record->opcode] : NULL;
+}
+
+static const char *trace_interface_name(uint8_t interface) {
+  return interface < TRACE_INTERFACES_LEN ? trace_interfaces[interface].name : "?";
+}
+
+static int trace_latency_add(trace_latency_t *latency, uint64_t ns) {
+  if (latency->len == latency->cap) {
+    uint64_t cap = latency->cap ? latency->cap * 2 : 64;
+    uint64_t *samples = realloc(latency->samples, sizeof(*samples) * cap);
+    if (!samples)
+      return -1;
+    latency->samples = samples;
+    latency->cap = cap;
+  }
+  latency->samples[latency->len++] = ns;
+  return 0;
+}
+
+/* One line per message, as WAYLAND_DEBUG=1 prints them: milliseconds since
+ * the first record, "->" for requests. */
+static void trace_print(const trace_record_t *record, uint64_t start_ns) {
+  uint64_t us = (record->ns - start_ns) / 1000;
+  const wayland_message_name_t *message = trace_message(record);
+  printf("[%7" PRIu64 ".%03" PRIu64 "] %s%s#%u.", us / 1000, us % 1000,
+         record->direction == TRACE_REQUEST ? " -> " : "",
+         trace_interface_name(record->interface), record->object_id);
+  if (message)
+    printf("%s(", message->name);
+  else
+    printf("opcode %u(", record->opcode);
+
+  bool more = record->size > wayland_header_size + sizeof(uint32_t);
+  if (record->size <= wayland_header_size)
+    printf(")\n");
+  else if (message && message->creates)
+    printf("new id %s#%u%s)\n", message->creates, record->arg, more ? ", ..." : "");
+  else
+    printf("%u%s)\n", record->arg, more ? ", ..." : "");
+}
+
+/* Match requests that create an object with the first event on it. The
+ * pending table is indexed by object id, like the client's own. */
+static int trace_collect(const trace_record_t *records, uint64_t records_len) {
+  typedef struct {
+    uint64_t ns;
+    uint8_t interface;
+    uint8_t opcode;
+    bool pending;
+  } trace_pending_t;
+  uint32_t pending_cap = 0;
+  for (uint64_t i = 0; i < records_len; i++) {
+    if (records[i].direction == TRACE_REQUEST && records[i].arg >= pending_cap &&
+        records[i].arg < 0xff000000U)
+      pending_cap = records[i].arg + 1;
+  }
+  trace_pending_t *pending = calloc(pending_cap ? pending_cap : 1, sizeof(*pending));
+  if (!pending)
+    return -1;
+
+  int ret = 0;
+  for (uint64_t i = 0; i < records_len && ret == 0; i++) {
+    const trace_record_t *record = &records[i];
+    const wayland_message_name_t *message = trace_message(record);
+    if (!message)
+      continue;
+
+    if (record->direction == TRACE_REQUEST) {
+      if (message->creates && record->arg < pending_cap)
+        pending[record->arg] = (trace_pending_t){.ns = record->ns, .interface = record->interface,
+                                                 .opcode = (uint8_t)record->opcode, .pending = true};
+      continue;
+    }
+
+    ret = trace_latency_add(&trace_latencies[record->interface][TRACE_EVENT][record->opcode],
+                            record->handler_ns);
+    if (record->object_id < pending_cap && pending[record->object_id].pending) {
+      trace_pending_t *p = &pending[record->object_id];
+      p->pending = false;
+      if (ret == 0)
+        ret = trace_latency_add(&trace_latencies[p->interface][TRACE_REQUEST][p->opcode],
+                                record->ns - p->ns);
+    }
+    // a deleted id may come back for another object before anything answers
+    if (record->interface == WAYLAND_WL_DISPLAY && record->opcode == wayland_wl_display_delete_id_event &&
+        record->arg < pending_cap)
+      pending[record->arg].pending = false;
+  }
+  free(pending);
+  return ret;
+}
+
+static int trace_compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static uint32_t trace_bucket(uint64_t ns) {
+  uint64_t us = ns / 1000;
+  uint32_t bucket = 0;
+  while (us && bucket < TRACE_BUCKETS - 1) {
+    us >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+/* Format the lower edge of a bucket: 0, 1us, 2us, ... 1ms, ... 1s */
+static void trace_bucket_label(uint32_t bucket, char *label, size_t label_len) {
+  uint64_t us = bucket ? 1ULL << (bucket - 1) : 0;
+  if (us >= 1000000)
+    snprintf(label, label_len, "%.1fs", (double)us / 1e6);
+  else if (us >= 1000)
+    snprintf(label, label_len, "%.1fms", (double)us / 1e3);
+  else
+    snprintf(label, label_len, "%" PRIu64 "us", us);
+}
+
+static void trace_histogram_print(const char *title, trace_latency_t *latency) {
+  uint64_t *s = latency->samples, n = latency->len;
+  qsort(s, n, sizeof(*s), trace_compare_u64);
+  printf("%s: n=%" PRIu64 " p50=%.1fus p99=%.1fus max=%.1fus\n", title, n,
+         (double)s[(n - 1) / 2] / 1e3, (double)s[(n - 1) * 99 / 100] / 1e3, (double)s[n - 1] / 1e3);
+
+  uint64_t counts[TRACE_BUCKETS] = {0}, max_count = 0;
+  uint32_t first = TRACE_BUCKETS, last = 0;
+  for (uint64_t i = 0; i < n; i++) {
+    uint32_t bucket = trace_bucket(s[i]);
+    counts[bucket]++;
+    first = bucket < first ? bucket : first;
+    last = bucket > last ? bucket : last;
+  }
+  for (uint32_t b = first; b <= last; b++)
+    max_count = counts[b] > max_count ? counts[b] : max_count;
+  for (uint32_t b = first; b <= last; b++) {
+    char label[16];
+    trace_bucket_label(b, label, sizeof(label));
+    uint32_t bar = (uint32_t)((counts[b] * 40 + max_count - 1) / max_count);
+    printf("  >= %-8s |%-40.*s %" PRIu64 "\n", label, (int)bar,
+           "########################################", counts[b]);
+  }
+}
+
+static void trace_histograms_print(void) {
+  static const char *kinds[] = {"request -> reply", "handler"};
+  for (uint32_t direction = TRACE_REQUEST; direction <= TRACE_EVENT; direction++) {
+    printf("\n== %s ==\n", kinds[direction]);
+    for (uint32_t i = 0; i < TRACE_INTERFACES_LEN; i++) {
+      for (uint32_t op = 0; op < TRACE_MAX_OPCODES; op++) {
+        trace_latency_t *latency = &trace_latencies[i][direction][op];
+        if (latency->len == 0)
+          continue;
+        const wayland_message_name_t *message = direction == TRACE_REQUEST
+                                                  ? &trace_interfaces[i].requests[op]
+                                                  : &trace_interfaces[i].events[op];
+        char title[96];
+        snprintf(title, sizeof(title), "%s.%s", trace_interfaces[i].name, message->name);
+        trace_histogram_print(title, latency);
+        free(latency->samples);
+        *latency = (trace_latency_t){0};
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  bool summary_only = argc == 3 && strcmp(argv[1], "-s") == 0;
+  if (argc != 2 && !summary_only) {
+    fprintf(stderr, "usage: %s [-s] <trace file>\n", argv[0]);
+    return 2;
+  }
+  const char *path = argv[argc - 1];
+
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  trace_file_header_t header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != TRACE_VERSION || header.record_size != sizeof(trace_record_t) ||
+      header.records > TRACE_RING_LEN) {
+    fprintf(stderr, "%s: not a kasama trace (version %u)\n", path, TRACE_VERSION);
+    fclose(file);
+    return 1;
+  }
+  trace_record_t *records = malloc(sizeof(*records) * (header.records ? header.records : 1));
+  if (!records || fread(records, sizeof(*records), header.records, file) != header.records) {
+    fprintf(stderr, "%s: truncated\n", path);
+    fclose(file);
+    return 1;
+  }
+  fclose(file);
+
+  if (header.dropped)
+    printf("(%" PRIu64 " older records were overwritten)\n", header.dropped);
+  if (!summary_only) {
+    for (uint64_t i = 0; i < header.records; i++)
+      trace_print(&records[i], records[0].ns);
+  }
+  if (trace_collect(records, header.records) == -1) {
+    perror("trace_collect");
+    return 1;
+  }
+  printf("%" PRIu64 " records\n", header.records);
+  trace_histograms_print();
+  free(records);
+  return 0;
+}
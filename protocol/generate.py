@@ -0,0 +1,466 @@
+#!/usr/bin/env python3
+"""Generate kasama_protocol.h from Wayland protocol XML.
+
+    python3 protocol/generate.py protocol/wayland.xml protocol/xdg-shell.xml > kasama_protocol.h
+
+For every request the header gets an opcode, its size on the wire (an
+integer constant unless it carries a string or an array, then a _size()
+function of their lengths) and a _pack() that writes the header and the
+arguments into a 4-byte aligned buffer of that size. For every event: an
+opcode, a struct of its arguments and an _unpack() that fills it from the
+payload in place. Enums become integer constants. With
+KASAMA_PROTOCOL_WL_INTERFACES defined, it also carries the wl_interface
+descriptions libwayland-client needs to speak the same protocol.
+
+Constants are anonymous enums rather than `static const` variables so they
+are constant expressions (usable in switch labels and array sizes) and an
+unused one costs nothing and warns about nothing.
+"""
+
+import sys
+import xml.etree.ElementTree as ET
+
+HEADER_WORDS = 2
+
+C_TYPES = {
+    "int": "int32_t",
+    "uint": "uint32_t",
+    "fixed": "int32_t",  # 24.8 fixed point
+    "object": "uint32_t",
+    "new_id": "uint32_t",
+}
+
+
+WL_SIGNATURE = {
+    "int": "i",
+    "uint": "u",
+    "fixed": "f",
+    "string": "s",
+    "object": "o",
+    "new_id": "n",
+    "array": "a",
+    "fd": "h",
+}
+
+
+class Arg:
+    def __init__(self, node):
+        self.name = node.get("name")
+        self.type = node.get("type")
+        self.interface = node.get("interface")
+        self.allow_null = node.get("allow-null") == "true"
+
+
+class Message:
+    def __init__(self, node, interface, opcode):
+        self.name = node.get("name")
+        self.interface = interface
+        self.opcode = opcode
+        self.since = int(node.get("since", "1"))
+        self.destructor = node.get("type") == "destructor"
+        self.args = []
+        for arg in node.findall("arg"):
+            arg = Arg(arg)
+            if arg.type == "new_id" and not arg.interface:
+                # untyped new_id (wl_registry.bind): the interface name and
+                # version travel in front of the id
+                self.args.append(Arg(ET.Element("arg", name="interface", type="string")))
+                self.args.append(Arg(ET.Element("arg", name="version", type="uint")))
+            self.args.append(arg)
+
+    @property
+    def prefix(self):
+        return f"wayland_{self.interface}_{self.name}"
+
+    @property
+    def wire_args(self):
+        return [a for a in self.args if a.type != "fd"]
+
+    @property
+    def fixed_size(self):
+        """Bytes on the wire, or None if a string or array makes it vary."""
+        if any(a.type in ("string", "array") for a in self.wire_args):
+            return None
+        return 4 * (HEADER_WORDS + len(self.wire_args))
+
+    @property
+    def creates(self):
+        for arg in self.args:
+            if arg.type == "new_id":
+                return arg.interface
+        return None
+
+
+class Interface:
+    def __init__(self, node):
+        self.name = node.get("name")
+        self.version = int(node.get("version"))
+        self.requests = [Message(n, self.name, i) for i, n in enumerate(node.findall("request"))]
+        self.events = [Message(n, self.name, i) for i, n in enumerate(node.findall("event"))]
+        self.enums = []
+        for enum in node.findall("enum"):
+            entries = [(e.get("name"), e.get("value")) for e in enum.findall("entry")]
+            self.enums.append((enum.get("name"), entries))
+
+
+def signature(decl, params):
+    """`decl(params) {`, wrapped at 100 columns like the rest of the tree."""
+    line = f"{decl}("
+    lines = []
+    for i, param in enumerate(params):
+        piece = param + (", " if i + 1 < len(params) else ") {")
+        if len(line) + len(piece.rstrip()) > 100 and not line.endswith("("):
+            lines.append(line.rstrip())
+            line = " " * (len(decl) + 1) + piece
+        else:
+            line += piece
+    lines.append(line)
+    return "\n".join(lines)
+
+
+def emit_enum(out, values):
+    """Anonymous enum of (name, value) pairs, one per line if they don't fit on one."""
+    line = "enum { " + ", ".join(f"{n} = {v}" for n, v in values) + " };"
+    if len(line) <= 100:
+        out.append(line)
+        return
+    out.append("enum {")
+    out += [f"  {n} = {v}," for n, v in values]
+    out.append("};")
+
+
+def self_param(message):
+    """Name of the parameter holding the id of the object a request is sent to."""
+    names = {a.name for a in message.args}
+    name = message.interface
+    return name if name not in names else name + "_id"
+
+
+def emit_pack(out, message):
+    p = message.prefix
+    params = ["uint32_t *msg"]
+    fixed = message.fixed_size
+    if fixed is None:
+        params.append("uint32_t size")
+    params.append(f"uint32_t {self_param(message)}")
+    size_params = []
+    for arg in message.wire_args:
+        if arg.type == "string":
+            params += [f"const char *{arg.name}", f"uint32_t {arg.name}_len"]
+            size_params.append(f"uint32_t {arg.name}_len")
+        elif arg.type == "array":
+            params += [f"const void *{arg.name}", f"uint32_t {arg.name}_size"]
+            size_params.append(f"uint32_t {arg.name}_size")
+        else:
+            params.append(f"{C_TYPES[arg.type]} {arg.name}")
+
+    notes = []
+    if any(a.type == "fd" for a in message.args):
+        notes.append("the fd is not on the wire; queue it with the request")
+    if any(a.type == "string" for a in message.wire_args):
+        notes.append("string lengths exclude the terminator")
+    out.append(f"/* {message.interface}.{message.name}"
+               + (f" (since {message.since})" if message.since > 1 else "")
+               + (": " + "; ".join(notes) if notes else "") + " */")
+
+    if fixed is None:
+        base = 4 * HEADER_WORDS
+        terms = []
+        for arg in message.wire_args:
+            if arg.type == "string":
+                base += 4
+                terms.append(f"(({arg.name}_len + 4) & ~3U)")
+            elif arg.type == "array":
+                base += 4
+                terms.append(f"(({arg.name}_size + 3) & ~3U)")
+            else:
+                base += 4
+        emit_enum(out, [(f"{p}_opcode", message.opcode)])
+        out.append(f"static inline uint32_t {p}_size({', '.join(size_params)}) {{")
+        out.append(f"  return {base} + {' + '.join(terms)};")
+        out.append("}")
+    else:
+        emit_enum(out, [(f"{p}_opcode", message.opcode), (f"{p}_size", fixed)])
+
+    out.append(signature(f"static inline void {p}_pack", params))
+    out.append(f"  msg[0] = {self_param(message)};")
+    size = "size" if fixed is None else f"{fixed}U"
+    out.append(f"  msg[1] = {size} << 16 | {message.opcode}U;")
+    if fixed is not None:
+        for i, arg in enumerate(message.wire_args):
+            value = arg.name if arg.type not in ("int", "fixed") else f"(uint32_t){arg.name}"
+            out.append(f"  msg[{HEADER_WORDS + i}] = {value};")
+    else:
+        out.append(f"  uint32_t at = {HEADER_WORDS};")
+        for arg in message.wire_args:
+            if arg.type == "string":
+                out.append(f"  at += wayland_pack_bytes(msg + at, {arg.name}, {arg.name}_len + 1, {arg.name}_len);")
+            elif arg.type == "array":
+                out.append(f"  at += wayland_pack_bytes(msg + at, {arg.name}, {arg.name}_size, {arg.name}_size);")
+            else:
+                value = arg.name if arg.type not in ("int", "fixed") else f"(uint32_t){arg.name}"
+                out.append(f"  msg[at++] = {value};")
+    out.append("}")
+    out.append("")
+
+
+def emit_unpack(out, message):
+    p = message.prefix
+    header = (f"/* {message.interface}.{message.name}"
+              + (f" (since {message.since})" if message.since > 1 else ""))
+    if any(a.type == "fd" for a in message.args):
+        header += ": the fd arrives out of band, take it with wayland_conn_take_fd()"
+    out.append(header + " */")
+    fds = sum(a.type == "fd" for a in message.args)
+    if fds:
+        out.append(f"enum {{ {p}_event = {message.opcode}, {p}_fds = {fds} }};")
+    else:
+        out.append(f"enum {{ {p}_event = {message.opcode} }};")
+    args = message.wire_args
+    if not args:
+        out.append("")
+        return
+
+    out.append(f"typedef struct {p}_t {{")
+    for arg in args:
+        if arg.type == "string":
+            out.append(f"  const char *{arg.name}; // NUL-terminated, in the receive buffer")
+            out.append(f"  uint32_t {arg.name}_len; // without the terminator")
+        elif arg.type == "array":
+            out.append(f"  const void *{arg.name};")
+            out.append(f"  uint32_t {arg.name}_size;")
+        else:
+            comment = "  // 24.8 fixed point" if arg.type == "fixed" else ""
+            out.append(f"  {C_TYPES[arg.type]} {arg.name};{comment}")
+    out.append(f"}} {p}_t;")
+
+    params = ["const char *payload", "uint64_t payload_len", f"{p}_t *event"]
+    out.append(signature(f"static inline bool {p}_unpack", params))
+    out.append("  const uint32_t *p = (const uint32_t *)payload;")
+    if message.fixed_size is not None:
+        out.append(f"  if (payload_len < {4 * len(args)})")
+        out.append("    return false;")
+        for i, arg in enumerate(args):
+            value = f"p[{i}]" if arg.type not in ("int", "fixed") else f"(int32_t)p[{i}]"
+            out.append(f"  event->{arg.name} = {value};")
+    else:
+        out.append("  uint64_t words = payload_len / 4, at = 0;")
+        for arg in args:
+            if arg.type == "string":
+                out.append(f"  if (!wayland_unpack_string(p, words, &at, &event->{arg.name}, &event->{arg.name}_len))")
+                out.append("    return false;")
+                if not arg.allow_null:
+                    # a zero length is a null string, which only allow-null permits
+                    out.append(f"  if (!event->{arg.name})")
+                    out.append("    return false;")
+            elif arg.type == "array":
+                out.append(f"  if (!wayland_unpack_array(p, words, &at, &event->{arg.name}, &event->{arg.name}_size))")
+                out.append("    return false;")
+            else:
+                value = "p[at++]" if arg.type not in ("int", "fixed") else "(int32_t)p[at++]"
+                out.append("  if (at >= words)")
+                out.append("    return false;")
+                out.append(f"  event->{arg.name} = {value};")
+    out.append("  return true;")
+    out.append("}")
+    out.append("")
+
+
+def emit_event_fds(out, interface):
+    """fds carried by each event, for interfaces with any: they queue up on
+    the connection and must be taken even when an event is dropped."""
+    counts = [sum(a.type == "fd" for a in e.args) for e in interface.events]
+    if any(counts):
+        out.append(f"static const uint8_t wayland_{interface.name}_event_fds[] = "
+                   f"{{{', '.join(map(str, counts))}}};")
+        out.append("")
+
+
+def emit_names(out, interface):
+    for kind, messages in (("request", interface.requests), ("event", interface.events)):
+        entries = []
+        for m in messages:
+            creates = f'"{m.creates}"' if m.creates else "NULL"
+            entries.append(f'{{"{m.name}", {creates}}}')
+        out.append(f"enum {{ wayland_{interface.name}_{kind}_count = {len(messages)} }};")
+        out.append(f"static const wayland_message_name_t wayland_{interface.name}_{kind}_names[] = {{")
+        out += [f"  {e}," for e in entries or ["{NULL, NULL}"]]
+        out.append("};")
+
+
+def wl_signature(message):
+    """libwayland's signature string: the since version, then a letter per
+    argument, `?` in front of nullable ones."""
+    sig = str(message.since) if message.since > 1 else ""
+    for arg in message.args:
+        sig += ("?" if arg.allow_null else "") + WL_SIGNATURE[arg.type]
+    return sig
+
+
+def emit_wl_messages(out, interface, known):
+    for kind, messages in (("requests", interface.requests), ("events", interface.events)):
+        for m in messages:
+            if not m.args:
+                continue
+            types = [f"&wayland_{a.interface}_wl_interface" if a.interface in known else "NULL"
+                     for a in m.args]
+            out.append(f"static const struct wl_interface *wayland_{interface.name}_{m.name}_wl_types[] = {{")
+            out.append(f"  {', '.join(types)},")
+            out.append("};")
+        if not messages:
+            continue
+        out.append(f"static const struct wl_message wayland_{interface.name}_wl_{kind}[] = {{")
+        for m in messages:
+            types = f"wayland_{interface.name}_{m.name}_wl_types" if m.args else "NULL"
+            out.append(f'  {{"{m.name}", "{wl_signature(m)}", {types}}},')
+        out.append("};")
+    requests = f"wayland_{interface.name}_wl_requests" if interface.requests else "NULL"
+    events = f"wayland_{interface.name}_wl_events" if interface.events else "NULL"
+    out.append(f"static const struct wl_interface wayland_{interface.name}_wl_interface = {{")
+    out.append(f'  "{interface.name}", {interface.version}, {len(interface.requests)}, {requests}, '
+               f"{len(interface.events)}, {events},")
+    out.append("};")
+    out.append("")
+
+
+PRELUDE = """\
+/* kasama_protocol.h
+ *
+ * ------------------------------------------------------------
+ *
+ * GENERATED by protocol/generate.py from {sources}.
+ * Do not edit; regenerate with:
+ *   python3 protocol/generate.py {sources_args} > kasama_protocol.h
+ *
+ * Requests: wayland_<interface>_<request>_opcode, _size (a function of the
+ * string and array lengths when those vary it) and _pack(), which writes the
+ * whole message into a 4-byte aligned buffer of _size bytes. Fixed-size
+ * requests compile down to one store per word.
+ *
+ * Events: wayland_<interface>_<event>_event (the opcode), a struct of the
+ * arguments and _unpack(), which fills it from the payload in place (strings
+ * and arrays point into it) and returns false if the payload is malformed,
+ * a null string where the protocol doesn't allow one included.
+ *
+ * fd arguments have no bytes on the wire and appear in neither; an event
+ * that carries some also has wayland_<interface>_<event>_fds, and its
+ * interface a wayland_<interface>_event_fds[] table by opcode.
+ */
+#ifndef KASAMA_PROTOCOL_H
+#define KASAMA_PROTOCOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Write a length word, then `len` bytes zero-padded to 4. For strings `len`
+ * counts the terminator and `copy` doesn't, so the terminator comes from
+ * the padding. Returns the words written. */
+static inline uint32_t wayland_pack_bytes(uint32_t *msg, const void *data, uint32_t len,
+                                          uint32_t copy) {
+  uint32_t words = (len + 3) / 4;
+  msg[0] = len;
+  if (words)
+    msg[words] = 0;
+  memcpy(msg + 1, data, copy);
+  return 1 + words;
+}
+
+static inline bool wayland_unpack_string(const uint32_t *p, uint64_t words, uint64_t *at,
+                                         const char **s, uint32_t *len) {
+  if (*at >= words)
+    return false;
+  uint32_t wire_len = p[(*at)++];
+  uint64_t wire_words = ((uint64_t)wire_len + 3) / 4;
+  if (wire_words > words - *at)
+    return false;
+  const char *str = (const char *)(p + *at);
+  if (wire_len && str[wire_len - 1] != '\\0')
+    return false;
+  *s = wire_len ? str : NULL;
+  *len = wire_len ? wire_len - 1 : 0;
+  *at += wire_words;
+  return true;
+}
+
+static inline bool wayland_unpack_array(const uint32_t *p, uint64_t words, uint64_t *at,
+                                        const void **data, uint32_t *size) {
+  if (*at >= words)
+    return false;
+  uint32_t wire_size = p[(*at)++];
+  uint64_t wire_words = ((uint64_t)wire_size + 3) / 4;
+  if (wire_words > words - *at)
+    return false;
+  *data = p + *at;
+  *size = wire_size;
+  *at += wire_words;
+  return true;
+}
+"""
+
+NAMES_PRELUDE = """\
+/* Message names for decoders and debug output; only compiled in with
+ * KASAMA_PROTOCOL_NAMES. `creates` is the interface of the object a message
+ * creates through its new_id argument. */
+#ifdef KASAMA_PROTOCOL_NAMES
+typedef struct wayland_message_name_t {
+  const char *name;
+  const char *creates;
+} wayland_message_name_t;
+"""
+
+
+WL_INTERFACES_PRELUDE = """\
+/* The same protocol as libwayland's wl_interface descriptions, for the
+ * libwayland-client transport; only compiled in with
+ * KASAMA_PROTOCOL_WL_INTERFACES, after <wayland-util.h>. They are what
+ * wayland-scanner's private code would be, under kasama's names. Arguments
+ * of interfaces outside these files are typed NULL: any object. */
+#ifdef KASAMA_PROTOCOL_WL_INTERFACES"""
+
+
+def main(paths):
+    interfaces = []
+    for path in paths:
+        root = ET.parse(path).getroot()
+        interfaces += [Interface(n) for n in root.findall("interface")]
+
+    sources = " and ".join(p.split("/")[-1] for p in paths)
+    out = [PRELUDE.replace("{sources}", sources).replace("{sources_args}", " ".join(paths))]
+    for interface in interfaces:
+        out.append(f"/* ---------------- {interface.name} " + "-" * max(3, 56 - len(interface.name)) + " */")
+        out.append("")
+        out.append(f"enum {{ wayland_{interface.name}_interface_version = {interface.version} }};")
+        for name, entries in interface.enums:
+            emit_enum(out, [(f"wayland_{interface.name}_{name}_{e}", v) for e, v in entries])
+        out.append("")
+        for request in interface.requests:
+            emit_pack(out, request)
+        for event in interface.events:
+            emit_unpack(out, event)
+        emit_event_fds(out, interface)
+
+    out.append(NAMES_PRELUDE)
+    for interface in interfaces:
+        emit_names(out, interface)
+    out.append("#endif")
+    out.append("")
+
+    out.append(WL_INTERFACES_PRELUDE)
+    known = {interface.name for interface in interfaces}
+    for interface in interfaces:
+        out.append(f"static const struct wl_interface wayland_{interface.name}_wl_interface;")
+    out.append("")
+    for interface in interfaces:
+        emit_wl_messages(out, interface, known)
+    out.append("#endif")
+    out.append("")
+    out.append("#endif")
+    sys.stdout.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        sys.exit(f"usage: {sys.argv[0]} protocol.xml... > kasama_protocol.h")
+    main(sys.argv[1:])